@@ -0,0 +1,33 @@
+# Try to find lz4
+# Once done, this will define
+#
+# LZ4_FOUND        - system has lz4
+# LZ4_INCLUDE_DIRS - the lz4 include directory
+# LZ4_LIBRARIES    - the lz4 library name(s)
+#
+# LZ4_DIR may be defined as a hint for where to look
+
+find_path(LZ4_INCLUDE_DIR lz4frame.h
+  HINTS
+  ${LZ4_DIR}
+  $ENV{LZ4_DIR}
+  /usr
+  /usr/local
+  PATH_SUFFIXES include/
+  )
+
+find_library(LZ4_LIBRARY lz4
+  HINTS
+  ${LZ4_DIR}
+  $ENV{LZ4_DIR}
+  /usr
+  /usr/local
+  PATH_SUFFIXES lib lib64
+  )
+
+set(LZ4_INCLUDE_DIRS ${LZ4_INCLUDE_DIR})
+set(LZ4_LIBRARIES ${LZ4_LIBRARY})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LZ4 DEFAULT_MSG LZ4_LIBRARY LZ4_INCLUDE_DIR)
+mark_as_advanced(LZ4_INCLUDE_DIR LZ4_LIBRARY)
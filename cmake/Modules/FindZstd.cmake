@@ -0,0 +1,33 @@
+# Try to find zstd
+# Once done, this will define
+#
+# ZSTD_FOUND        - system has zstd
+# ZSTD_INCLUDE_DIRS - the zstd include directory
+# ZSTD_LIBRARIES    - the zstd library name(s)
+#
+# ZSTD_DIR may be defined as a hint for where to look
+
+find_path(ZSTD_INCLUDE_DIR zstd.h
+  HINTS
+  ${ZSTD_DIR}
+  $ENV{ZSTD_DIR}
+  /usr
+  /usr/local
+  PATH_SUFFIXES include/
+  )
+
+find_library(ZSTD_LIBRARY zstd
+  HINTS
+  ${ZSTD_DIR}
+  $ENV{ZSTD_DIR}
+  /usr
+  /usr/local
+  PATH_SUFFIXES lib lib64
+  )
+
+set(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd DEFAULT_MSG ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
@@ -28,6 +28,8 @@ option (BUILD_COVERAGE          "Compile to collect code coverage reports"
 option (BUILD_ALL               "Build client, server, lib, preload, shrinkwrap, unit tests"       OFF)
 
 option (ENABLE_ASAN             "Enable the Address Sanitizer"                                     OFF)
+option (ENABLE_ZSTD             "Support Zstandard compressed objects, requires libzstd"           OFF)
+option (ENABLE_LZ4              "Support LZ4 compressed objects, requires liblz4"                  OFF)
 
 option (INSTALL_UNITTESTS       "Install the unit test binary (mainly for packaging)"              OFF)
 option (INSTALL_UNITTESTS_DEBUG "Install the unit test debug binary"                               OFF)
@@ -29,7 +29,8 @@ typedef struct OptionsManager cvmcache_option_map;
 enum cvmcache_hash_algorithm {
   CVMCACHE_HASH_SHA1 = 1,
   CVMCACHE_HASH_RIPEMD160,
-  CVMCACHE_HASH_SHAKE128
+  CVMCACHE_HASH_SHAKE128,
+  CVMCACHE_HASH_SHAKE128TREE
 };
 
 // Mirrors cvmfs::EnumStatus protobuf definition
@@ -313,6 +313,9 @@ void CacheTransport::FillMsgHash(
     case shash::kShake128:
       msg_hash->set_algorithm(cvmfs::HASH_SHAKE128);
       break;
+    case shash::kShake128Tree:
+      msg_hash->set_algorithm(cvmfs::HASH_SHAKE128TREE);
+      break;
     default:
       PANIC(NULL);
   }
@@ -356,6 +359,9 @@ bool CacheTransport::ParseMsgHash(
     case cvmfs::HASH_SHAKE128:
       hash->algorithm = shash::kShake128;
       break;
+    case cvmfs::HASH_SHAKE128TREE:
+      hash->algorithm = shash::kShake128Tree;
+      break;
     default:
       return false;
   }
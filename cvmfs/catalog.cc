@@ -304,6 +304,7 @@ bool Catalog::LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
                           DirectoryEntry *dirent) const
 {
   assert(IsInitialized());
+  FlushPendingEntries(&md5path);
 
   MutexLockGuard m(lock_);
   sql_lookup_md5path_->BindPathHash(md5path);
@@ -347,6 +348,7 @@ bool Catalog::LookupXattrsMd5Path(
   XattrList *xattrs) const
 {
   assert(IsInitialized());
+  FlushPendingEntries(&md5path);
 
   MutexLockGuard m(lock_);
   sql_lookup_xattrs_->BindPathHash(md5path);
@@ -371,6 +373,7 @@ bool Catalog::ListingMd5PathStat(const shash::Md5 &md5path,
 {
   assert(IsInitialized());
 
+  FlushPendingEntries(NULL);
   DirectoryEntry dirent;
   StatEntry entry;
 
@@ -404,6 +407,7 @@ bool Catalog::ListingMd5Path(const shash::Md5 &md5path,
                              const bool expand_symlink) const
 {
   assert(IsInitialized());
+  FlushPendingEntries(NULL);
 
   MutexLockGuard m(lock_);
 
@@ -419,7 +423,41 @@ bool Catalog::ListingMd5Path(const shash::Md5 &md5path,
 }
 
 
+OrderedListing::OrderedListing(const Catalog *catalog, const PathString &path)
+  : catalog_(catalog)
+  , md5path_(catalog->NormalizePath(path))
+  , sql_listing_(NULL)
+{
+  assert(catalog_->IsInitialized());
+  catalog_->FlushPendingEntries(NULL);
+
+  MutexLockGuard m(catalog_->lock_);
+  sql_listing_ = new SqlListingByName(catalog_->database());
+  sql_listing_->BindPathHash(md5path_);
+}
+
+
+OrderedListing::~OrderedListing() {
+  MutexLockGuard m(catalog_->lock_);
+  delete sql_listing_;
+}
+
+
+/**
+ * Returns false after the last entry
+ */
+bool OrderedListing::Next(DirectoryEntry *dirent) {
+  MutexLockGuard m(catalog_->lock_);
+  if (!sql_listing_->FetchRow())
+    return false;
+  *dirent = sql_listing_->GetDirent(catalog_);
+  catalog_->FixTransitionPoint(md5path_, dirent);
+  return true;
+}
+
+
 bool Catalog::AllChunksBegin() {
+  FlushPendingEntries(NULL);
   return sql_all_chunks_->Open();
 }
 
@@ -445,6 +483,7 @@ bool Catalog::ListMd5PathChunks(const shash::Md5  &md5path,
                                 FileChunkList    *chunks) const
 {
   assert(IsInitialized() && chunks->IsEmpty());
+  FlushPendingEntries(&md5path);
 
   MutexLockGuard m(lock_);
 
@@ -467,6 +506,7 @@ const Catalog::HashVector& Catalog::GetReferencedObjects() const {
   }
 
   // retrieve all referenced content hashes of both files and file chunks
+  FlushPendingEntries(NULL);
   SqlListContentHashes list_content_hashes(database());
   while (list_content_hashes.FetchRow()) {
     referenced_hashes_.push_back(list_content_hashes.GetHash());
@@ -546,6 +586,7 @@ uint64_t Catalog::GetNumChunks() const {
 uint64_t Catalog::GetNumEntries() const {
   const string sql = "SELECT count(*) FROM catalog;";
 
+  FlushPendingEntries(NULL);
   MutexLockGuard m(lock_);
   SqlCatalog stmt(database(), sql);
   return (stmt.FetchRow()) ? stmt.RetrieveInt64(0) : 0;
@@ -562,6 +603,17 @@ shash::Any Catalog::GetPreviousRevision() const {
 }
 
 
+/**
+ * The reference to the delta of a nested catalog, as a string that is parsed
+ * by CatalogDeltaRef.  Empty if there is none.
+ */
+string Catalog::GetNestedCatalogDelta(const PathString &mountpoint) const {
+  MutexLockGuard m(lock_);
+  return database().GetPropertyDefault<string>(
+    "catalog_delta:" + mountpoint.ToString(), "");
+}
+
+
 string Catalog::PrintMemStatistics() const {
   sqlite::MemStatistics stats;
   {
@@ -92,6 +92,7 @@ class Catalog : SingleCopy {
   FRIEND_TEST(T_Catalog, NormalizePath);
   FRIEND_TEST(T_Catalog, PlantPath);
   friend class swissknife::CommandMigrate;  // for catalog version migration
+  friend class OrderedListing;
 
  public:
   typedef std::vector<shash::Any> HashVector;
@@ -172,6 +173,7 @@ class Catalog : SingleCopy {
   uint64_t GetNumEntries() const;
   uint64_t GetNumChunks() const;
   shash::Any GetPreviousRevision() const;
+  std::string GetNestedCatalogDelta(const PathString &mountpoint) const;
   const Counters& GetCounters() const { return counters_; }
   std::string PrintMemStatistics() const;
 
@@ -254,6 +256,13 @@ class Catalog : SingleCopy {
 
   bool LookupMd5Path(const shash::Md5 &md5path, DirectoryEntry *dirent) const;
 
+  /**
+   * Writable catalogs can hold back new entries, see
+   * WritableCatalog::BeginBulkInsert().  Called before the database is read;
+   * md5path is the looked up path or NULL if the query can return any entry.
+   */
+  virtual void FlushPendingEntries(const shash::Md5 * /* md5path */) const { }
+
  private:
   typedef std::map<PathString, Catalog*> NestedCatalogMap;
 
@@ -337,6 +346,26 @@ class Catalog : SingleCopy {
   mutable HashVector        referenced_hashes_;
 };  // class Catalog
 
+
+/**
+ * Streams the listing of a directory sorted by name (see SqlListingByName)
+ * instead of collecting it in a DirectoryEntryList.  Every instance has its
+ * own statement, so that the listings of a directory and of its subdirectories
+ * can be open at the same time.  The catalog has to stay attached while the
+ * listing is open.
+ */
+class OrderedListing : SingleCopy {
+ public:
+  OrderedListing(const Catalog *catalog, const PathString &path);
+  ~OrderedListing();
+  bool Next(DirectoryEntry *dirent);
+
+ private:
+  const Catalog *catalog_;
+  shash::Md5 md5path_;
+  SqlListingByName *sql_listing_;
+};
+
 }  // namespace catalog
 
 #endif  // CVMFS_CATALOG_H_
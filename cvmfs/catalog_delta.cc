@@ -0,0 +1,226 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "catalog_delta.h"
+
+#include <inttypes.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "cache.h"
+#include "compression.h"
+#include "logging.h"
+#include "sink.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+namespace {
+
+/**
+ * A delta starts with the magic number, the format version, the block size,
+ * the size of the new catalog, and the length-prefixed hash of the base.  It
+ * is followed by the changed blocks in ascending order, each one prefixed by
+ * its index.  Only the last block of the catalog can be shorter than the block
+ * size.  All integers are little-endian.
+ */
+const char kMagic[] = "CVMFSDLT";
+const unsigned kMagicSize = 8;
+const uint32_t kVersion = 1;
+const unsigned kHeaderSize = kMagicSize + 4 + 4 + 8 + 4;
+
+void AppendLe(const uint64_t value, const unsigned nbytes, string *buffer) {
+  for (unsigned i = 0; i < nbytes; ++i)
+    buffer->push_back(static_cast<char>(value >> (8 * i)));
+}
+
+uint64_t LoadLe(const unsigned char *p, const unsigned nbytes) {
+  uint64_t result = 0;
+  for (unsigned i = 0; i < nbytes; ++i)
+    result |= uint64_t(p[i]) << (8 * i);
+  return result;
+}
+
+}  // anonymous namespace
+
+
+string CatalogDeltaRef::ToString() const {
+  return base_hash.ToString() + " " + catalog_hash.ToString() + " " +
+         delta_hash.ToString();
+}
+
+
+bool CatalogDeltaRef::Parse(const string &str) {
+  const vector<string> parts = SplitString(str, ' ');
+  if (parts.size() != 3)
+    return false;
+  for (unsigned i = 0; i < parts.size(); ++i) {
+    if (!shash::HexPtr(parts[i]).IsValid())
+      return false;
+  }
+  base_hash = shash::MkFromHexPtr(shash::HexPtr(parts[0]),
+                                  shash::kSuffixCatalog);
+  catalog_hash = shash::MkFromHexPtr(shash::HexPtr(parts[1]),
+                                     shash::kSuffixCatalog);
+  delta_hash = shash::MkFromHexPtr(shash::HexPtr(parts[2]),
+                                   shash::kSuffixCatalogDelta);
+  return true;
+}
+
+
+shash::Any MakeCatalogDeltaId(
+  const shash::Any &base_hash,
+  const shash::Any &catalog_hash)
+{
+  shash::Any result(catalog_hash.algorithm, shash::kSuffixCatalogDelta);
+  const string pair = base_hash.ToString() + catalog_hash.ToString();
+  shash::HashMem(reinterpret_cast<const unsigned char *>(pair.data()),
+                 pair.length(), &result);
+  return result;
+}
+
+
+bool CreateCatalogDelta(
+  const string &base_path,
+  const shash::Any &base_hash,
+  const string &new_path,
+  const uint64_t max_size,
+  const string &delta_path,
+  shash::Any *delta_hash)
+{
+  const int64_t new_size = GetFileSize(new_path);
+  if (new_size < 0)
+    return false;
+  FILE *fbase = fopen(base_path.c_str(), "r");
+  if (fbase == NULL)
+    return false;
+  FILE *fnew = fopen(new_path.c_str(), "r");
+  if (fnew == NULL) {
+    fclose(fbase);
+    return false;
+  }
+
+  string delta(kMagic, kMagicSize);
+  AppendLe(kVersion, 4, &delta);
+  AppendLe(kDeltaBlockSize, 4, &delta);
+  AppendLe(new_size, 8, &delta);
+  const string base_id = base_hash.ToStringWithSuffix();
+  AppendLe(base_id.length(), 4, &delta);
+  delta += base_id;
+
+  unsigned char block_base[kDeltaBlockSize];
+  unsigned char block_new[kDeltaBlockSize];
+  uint64_t nbytes_total = 0;
+  bool result = true;
+  for (uint64_t i = 0; result; ++i) {
+    const size_t nbytes_new = fread(block_new, 1, kDeltaBlockSize, fnew);
+    if (nbytes_new == 0)
+      break;
+    nbytes_total += nbytes_new;
+    const size_t nbytes_base = fread(block_base, 1, kDeltaBlockSize, fbase);
+    if ((nbytes_base == nbytes_new) &&
+        (memcmp(block_base, block_new, nbytes_new) == 0))
+    {
+      continue;
+    }
+    AppendLe(i, 8, &delta);
+    delta.append(reinterpret_cast<char *>(block_new), nbytes_new);
+    if (delta.size() > max_size)
+      result = false;
+  }
+  if (ferror(fnew) || ferror(fbase) ||
+      (nbytes_total != static_cast<uint64_t>(new_size)))
+  {
+    result = false;
+  }
+  fclose(fnew);
+  fclose(fbase);
+  if (!result)
+    return false;
+
+  void *compressed;
+  uint64_t compressed_size;
+  if (!zlib::CompressMem2Mem(delta.data(), delta.size(),
+                             &compressed, &compressed_size))
+  {
+    return false;
+  }
+  shash::HashMem(static_cast<unsigned char *>(compressed), compressed_size,
+                 delta_hash);
+  result = CopyMem2Path(static_cast<unsigned char *>(compressed),
+                        compressed_size, delta_path);
+  free(compressed);
+  LogCvmfs(kLogCatalog, kLogVerboseMsg,
+           "catalog delta for %s: %" PRIu64 " bytes, %" PRIu64 " compressed",
+           new_path.c_str(), static_cast<uint64_t>(delta.size()),
+           compressed_size);
+  return result;
+}
+
+
+bool ApplyCatalogDelta(
+  const unsigned char *delta,
+  const uint64_t size,
+  const shash::Any &base_hash,
+  CacheManager *cache_mgr,
+  const int fd_base,
+  cvmfs::Sink *sink)
+{
+  if ((size < kHeaderSize) || (memcmp(delta, kMagic, kMagicSize) != 0))
+    return false;
+  const unsigned char *pos = delta + kMagicSize;
+  const unsigned char *end = delta + size;
+  if ((LoadLe(pos, 4) != kVersion) || (LoadLe(pos + 4, 4) != kDeltaBlockSize))
+    return false;
+  const uint64_t new_size = LoadLe(pos + 8, 8);
+  const uint64_t base_id_length = LoadLe(pos + 16, 4);
+  pos += 20;
+  if (static_cast<uint64_t>(end - pos) < base_id_length)
+    return false;
+  if (string(reinterpret_cast<const char *>(pos), base_id_length) !=
+      base_hash.ToStringWithSuffix())
+  {
+    LogCvmfs(kLogCatalog, kLogDebug, "catalog delta is not based on %s",
+             base_hash.ToString().c_str());
+    return false;
+  }
+  pos += base_id_length;
+
+  unsigned char block[kDeltaBlockSize];
+  const uint64_t nblocks = (new_size + kDeltaBlockSize - 1) / kDeltaBlockSize;
+  for (uint64_t i = 0; i < nblocks; ++i) {
+    const bool is_last = (i == nblocks - 1);
+    const uint64_t offset = i * kDeltaBlockSize;
+    const unsigned nbytes = is_last ? new_size - offset : kDeltaBlockSize;
+    const unsigned char *data = block;
+    if ((static_cast<uint64_t>(end - pos) >= 8) && (LoadLe(pos, 8) == i)) {
+      if (static_cast<uint64_t>(end - pos) < 8 + nbytes)
+        return false;
+      data = pos + 8;
+      pos += 8 + nbytes;
+    } else {
+      if (cache_mgr->Pread(fd_base, block, nbytes, offset) !=
+          static_cast<int64_t>(nbytes))
+      {
+        return false;
+      }
+    }
+    if (sink->Write(data, nbytes) != static_cast<int64_t>(nbytes))
+      return false;
+  }
+
+  // Blocks in the wrong order or beyond the end remain unused
+  return pos == end;
+}
+
+}  // namespace catalog
@@ -0,0 +1,91 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Catalog deltas let clients update a cached file catalog to a new revision
+ * without downloading the new catalog in full.  A delta lists the blocks of
+ * the uncompressed SQLite file that differ from the previous revision of the
+ * catalog (the base).  SQLite only rewrites the pages that change, so small
+ * change sets result in small deltas.
+ *
+ * A delta is stored under a name derived from the pair of the base and the
+ * resulting catalog (MakeCatalogDeltaId()), so that clients only fetch deltas
+ * that they can apply.  The publisher records the pair together with the
+ * content hash of the delta in a trusted place: in the manifest for the root
+ * catalog and in the properties of the parent catalog for nested catalogs (see
+ * CatalogDeltaRef).  Clients verify the downloaded delta against that hash.
+ * Applied to the base catalog, which is identified by its hash, a verified
+ * delta can only produce the new catalog, so the result is not compressed
+ * again on the client.
+ */
+
+#ifndef CVMFS_CATALOG_DELTA_H_
+#define CVMFS_CATALOG_DELTA_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "hash.h"
+
+class CacheManager;
+namespace cvmfs {
+class Sink;
+}
+
+namespace catalog {
+
+/**
+ * SQLite's default page size
+ */
+const unsigned kDeltaBlockSize = 4096;
+
+/**
+ * Points to the delta that produces a catalog from its previous revision.  The
+ * string form is "<base hash> <catalog hash> <delta hash>".
+ */
+struct CatalogDeltaRef {
+  std::string ToString() const;
+  /**
+   * Fails on a malformed string, e.g. an empty one
+   */
+  bool Parse(const std::string &str);
+
+  shash::Any base_hash;
+  shash::Any catalog_hash;
+  shash::Any delta_hash;  ///< content hash of the compressed delta
+};
+
+/**
+ * The object name of the delta from base_hash to catalog_hash
+ */
+shash::Any MakeCatalogDeltaId(const shash::Any &base_hash,
+                              const shash::Any &catalog_hash);
+
+/**
+ * Writes the zlib compressed delta from base_path to new_path into
+ * delta_path.  Fails if the uncompressed delta would be larger than max_size.
+ * The delta_hash has to be preset with the hash algorithm; it receives the
+ * content hash of the compressed delta.
+ */
+bool CreateCatalogDelta(const std::string &base_path,
+                        const shash::Any &base_hash,
+                        const std::string &new_path,
+                        const uint64_t max_size,
+                        const std::string &delta_path,
+                        shash::Any *delta_hash);
+
+/**
+ * Writes the catalog that results from applying the uncompressed delta to the
+ * base catalog, which is opened in the cache manager, into sink.  Fails if the
+ * delta is malformed or if it was made for another base.
+ */
+bool ApplyCatalogDelta(const unsigned char *delta,
+                       const uint64_t size,
+                       const shash::Any &base_hash,
+                       CacheManager *cache_mgr,
+                       const int fd_base,
+                       cvmfs::Sink *sink);
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_DELTA_H_
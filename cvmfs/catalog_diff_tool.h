@@ -120,6 +120,10 @@ class CatalogDiffTool {
                                    perf::Statistics* stats);
 
   void DiffRec(const PathString& path);
+  void DiffEntries(const PathString& path,
+                   const catalog::DirectoryEntry& old_entry,
+                   const catalog::DirectoryEntry& new_entry);
+  bool IsIdenticalNestedCatalog(const PathString& path);
 
   std::string repo_path_;
   shash::Any old_root_hash_;
@@ -6,6 +6,7 @@
 #define CVMFS_CATALOG_DIFF_TOOL_IMPL_H_
 
 #include <algorithm>
+#include <cstring>
 #include <string>
 
 #include "catalog.h"
@@ -15,31 +16,36 @@
 #include "util/exception.h"
 #include "util/posix.h"
 
-const uint64_t kLastInode = uint64_t(-1);
-
-inline void AppendFirstEntry(catalog::DirectoryEntryList* entry_list) {
-  catalog::DirectoryEntry empty_entry;
-  entry_list->push_back(empty_entry);
-}
-
-inline void AppendLastEntry(catalog::DirectoryEntryList* entry_list) {
-  assert(!entry_list->empty());
-  catalog::DirectoryEntry last_entry;
-  last_entry.set_inode(kLastInode);
-  entry_list->push_back(last_entry);
-}
-
+/**
+ * The order of catalog::SqlListingByName: byte by byte, a prefix comes first
+ */
 inline bool IsSmaller(const catalog::DirectoryEntry& a,
                       const catalog::DirectoryEntry& b) {
-  bool a_is_first = (a.inode() == catalog::DirectoryEntryBase::kInvalidInode);
-  bool a_is_last = (a.inode() == kLastInode);
-  bool b_is_first = (b.inode() == catalog::DirectoryEntryBase::kInvalidInode);
-  bool b_is_last = (b.inode() == kLastInode);
-
-  if (a_is_last || b_is_first) return false;
-  if (a_is_first) return !b_is_first;
-  if (b_is_last) return !a_is_last;
-  return a.name() < b.name();
+  const unsigned a_length = a.name().GetLength();
+  const unsigned b_length = b.name().GetLength();
+  const int cmp = memcmp(a.name().GetChars(), b.name().GetChars(),
+                         std::min(a_length, b_length));
+  return (cmp < 0) || ((cmp == 0) && (a_length < b_length));
+}
+
+/**
+ * Fetches the next entry of a listing, skipping the .cvmfs hidden directory.
+ * A listing that could not be opened is empty.
+ */
+inline bool NextEntry(catalog::OrderedListing* listing, const char* side,
+                      catalog::DirectoryEntry* entry) {
+  if (listing == NULL) return false;
+  do {
+    if (!listing->Next(entry)) return false;
+  } while (entry->IsHidden());
+
+  if (entry->linkcount() == 0) {
+    PANIC(kLogStderr,
+          "CatalogDiffTool - Entry %s in %s catalog has linkcount 0. "
+          "Aborting.",
+          entry->name().c_str(), side);
+  }
+  return true;
 }
 
 template <typename RoCatalogMgr>
@@ -75,11 +81,26 @@ bool CatalogDiffTool<RoCatalogMgr>::Init() {
 
 template <typename RoCatalogMgr>
 bool CatalogDiffTool<RoCatalogMgr>::Run(const PathString& path) {
+  // Catalogs are content-addressed: identical root catalogs have no changes
+  if (GetOldCatalog()->hash() == GetNewCatalog()->hash()) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "CatalogDiffTool - identical root catalogs");
+    return true;
+  }
+
   DiffRec(path);
 
   return true;
 }
 
+template <typename RoCatalogMgr>
+bool CatalogDiffTool<RoCatalogMgr>::IsIdenticalNestedCatalog(
+    const PathString& path) {
+  const shash::Any old_hash = old_catalog_mgr_->GetNestedCatalogHash(path);
+  const shash::Any new_hash = new_catalog_mgr_->GetNestedCatalogHash(path);
+  assert(!old_hash.IsNull() && !new_hash.IsNull());
+  return old_hash == new_hash;
+}
+
 template <typename RoCatalogMgr>
 RoCatalogMgr* CatalogDiffTool<RoCatalogMgr>::OpenCatalogManager(
     const std::string& repo_path, const std::string& temp_dir,
@@ -100,56 +121,26 @@ void CatalogDiffTool<RoCatalogMgr>::DiffRec(const PathString& path) {
     return;
   }
 
-  catalog::DirectoryEntryList old_listing;
-  AppendFirstEntry(&old_listing);
-  old_catalog_mgr_->Listing(path, &old_listing);
-  sort(old_listing.begin(), old_listing.end(), IsSmaller);
-  AppendLastEntry(&old_listing);
-
-  catalog::DirectoryEntryList new_listing;
-  AppendFirstEntry(&new_listing);
-  new_catalog_mgr_->Listing(path, &new_listing);
-  sort(new_listing.begin(), new_listing.end(), IsSmaller);
-  AppendLastEntry(&new_listing);
-
-  unsigned i_from = 0, size_from = old_listing.size();
-  unsigned i_to = 0, size_to = new_listing.size();
-  while ((i_from < size_from) || (i_to < size_to)) {
-    catalog::DirectoryEntry old_entry = old_listing[i_from];
-    catalog::DirectoryEntry new_entry = new_listing[i_to];
-
-    if (old_entry.linkcount() == 0) {
-      PANIC(kLogStderr,
-            "CatalogDiffTool - Entry %s in old catalog has linkcount 0. "
-            "Aborting.",
-            old_entry.name().c_str());
-    }
-    if (new_entry.linkcount() == 0) {
-      PANIC(kLogStderr,
-            "CatalogDiffTool - Entry %s in new catalog has linkcount 0. "
-            "Aborting.",
-            new_entry.name().c_str());
-    }
-
-    // Skip .cvmfs hidden directory
-    while (old_entry.IsHidden()) old_entry = old_listing[++i_from];
-    while (new_entry.IsHidden()) new_entry = new_listing[++i_to];
-
-    PathString old_path(path);
-    old_path.Append("/", 1);
-    old_path.Append(old_entry.name().GetChars(), old_entry.name().GetLength());
-    PathString new_path(path);
-    new_path.Append("/", 1);
-    new_path.Append(new_entry.name().GetChars(), new_entry.name().GetLength());
-
-    XattrList xattrs;
-    if (new_entry.HasXattrs()) {
-      new_catalog_mgr_->LookupXattrs(new_path, &xattrs);
-    }
-
-    if (IsSmaller(new_entry, old_entry)) {
-      i_to++;
+  // Both listings are sorted by the catalog databases and merged on the fly
+  UniquePtr<catalog::OrderedListing> old_listing(
+      old_catalog_mgr_->OpenOrderedListing(path));
+  UniquePtr<catalog::OrderedListing> new_listing(
+      new_catalog_mgr_->OpenOrderedListing(path));
+
+  catalog::DirectoryEntry old_entry;
+  catalog::DirectoryEntry new_entry;
+  bool has_old = NextEntry(old_listing.weak_ref(), "old", &old_entry);
+  bool has_new = NextEntry(new_listing.weak_ref(), "new", &new_entry);
+  while (has_old || has_new) {
+    if (!has_old || (has_new && IsSmaller(new_entry, old_entry))) {
+      PathString new_path(path);
+      new_path.Append("/", 1);
+      new_path.Append(new_entry.name().GetChars(),
+                      new_entry.name().GetLength());
       if (IsReportablePath(new_path)) {
+        XattrList xattrs;
+        if (new_entry.HasXattrs())
+          new_catalog_mgr_->LookupXattrs(new_path, &xattrs);
         FileChunkList chunks;
         if (new_entry.IsChunkedFile()) {
           new_catalog_mgr_->ListFileChunks(new_path, new_entry.hash_algorithm(),
@@ -160,59 +151,72 @@ void CatalogDiffTool<RoCatalogMgr>::DiffRec(const PathString& path) {
       if (new_entry.IsDirectory()) {
         DiffRec(new_path);
       }
+      has_new = NextEntry(new_listing.weak_ref(), "new", &new_entry);
       continue;
-    } else if (IsSmaller(old_entry, new_entry)) {
-      i_from++;
+    }
+
+    PathString old_path(path);
+    old_path.Append("/", 1);
+    old_path.Append(old_entry.name().GetChars(), old_entry.name().GetLength());
+    if (!has_new || IsSmaller(old_entry, new_entry)) {
       if (old_entry.IsDirectory() && !old_entry.IsNestedCatalogMountpoint()) {
         DiffRec(old_path);
       }
       if (IsReportablePath(old_path)) {
         ReportRemoval(old_path, old_entry);
       }
+      has_old = NextEntry(old_listing.weak_ref(), "old", &old_entry);
       continue;
     }
 
-    assert(old_path == new_path);
-    i_from++;
-    i_to++;
-
-    catalog::DirectoryEntryBase::Differences diff =
-        old_entry.CompareTo(new_entry);
-    if ((diff == catalog::DirectoryEntryBase::Difference::kIdentical) &&
-        old_entry.IsNestedCatalogMountpoint()) {
-      // Early recursion stop if nested catalogs are identical
-      shash::Any id_nested_from, id_nested_to;
-      id_nested_from = old_catalog_mgr_->GetNestedCatalogHash(old_path);
-      id_nested_to = new_catalog_mgr_->GetNestedCatalogHash(new_path);
-      assert(!id_nested_from.IsNull() && !id_nested_to.IsNull());
-      if (id_nested_from == id_nested_to) continue;
-    }
+    DiffEntries(old_path, old_entry, new_entry);
+    has_old = NextEntry(old_listing.weak_ref(), "old", &old_entry);
+    has_new = NextEntry(new_listing.weak_ref(), "new", &new_entry);
+  }
+}
 
-    if (IsReportablePath(old_path) &&
-        ((diff != catalog::DirectoryEntryBase::Difference::kIdentical) ||
-         old_entry.IsNestedCatalogMountpoint())) {
-      // Modified directory entry, or nested catalog with modified hash
-      FileChunkList chunks;
-      if (new_entry.IsChunkedFile()) {
-        new_catalog_mgr_->ListFileChunks(new_path, new_entry.hash_algorithm(),
-                                         &chunks);
-      }
-      bool recurse =
-        ReportModification(old_path, old_entry, new_entry, xattrs, chunks);
-      if (!recurse) continue;
-    }
+/**
+ * Compares an entry that exists on both sides and recurses if necessary
+ */
+template <typename RoCatalogMgr>
+void CatalogDiffTool<RoCatalogMgr>::DiffEntries(
+    const PathString& path, const catalog::DirectoryEntry& old_entry,
+    const catalog::DirectoryEntry& new_entry) {
+  catalog::DirectoryEntryBase::Differences diff =
+      old_entry.CompareTo(new_entry);
+  // Early recursion stop if nested catalogs are identical.  The nested
+  // catalogs are not even loaded in this case.
+  const bool is_identical_nested =
+      old_entry.IsNestedCatalogMountpoint() &&
+      new_entry.IsNestedCatalogMountpoint() &&
+      IsIdenticalNestedCatalog(path);
+  if (is_identical_nested &&
+      (diff == catalog::DirectoryEntryBase::Difference::kIdentical)) {
+    return;
+  }
 
-    if (!old_entry.IsDirectory() || !new_entry.IsDirectory()) {
-      if (old_entry.IsDirectory()) {
-        DiffRec(old_path);
-      } else if (new_entry.IsDirectory()) {
-        DiffRec(new_path);
-      }
-      continue;
+  if (IsReportablePath(path) &&
+      ((diff != catalog::DirectoryEntryBase::Difference::kIdentical) ||
+       old_entry.IsNestedCatalogMountpoint())) {
+    // Modified directory entry, or nested catalog with modified hash.
+    // Extended attributes are only looked up for reported entries.
+    XattrList xattrs;
+    if (new_entry.HasXattrs())
+      new_catalog_mgr_->LookupXattrs(path, &xattrs);
+    FileChunkList chunks;
+    if (new_entry.IsChunkedFile()) {
+      new_catalog_mgr_->ListFileChunks(path, new_entry.hash_algorithm(),
+                                       &chunks);
     }
+    bool recurse =
+      ReportModification(path, old_entry, new_entry, xattrs, chunks);
+    if (!recurse) return;
+  }
+  if (is_identical_nested) return;
 
-    // Recursion
-    DiffRec(old_path);
+  // Recursion, also if a directory replaced a file or vice versa
+  if (old_entry.IsDirectory() || new_entry.IsDirectory()) {
+    DiffRec(path);
   }
 }
 
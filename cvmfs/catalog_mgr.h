@@ -158,6 +158,7 @@ class AbstractCatalogManager : public SingleCopy {
     return Listing(p, listing);
   }
   bool ListingStat(const PathString &path, StatEntryList *listing);
+  OrderedListing *OpenOrderedListing(const PathString &path);
 
   bool ListFileChunks(const PathString &path,
                       const shash::Algorithms interpret_hashes_as,
@@ -5,10 +5,14 @@
 #include "cvmfs_config.h"
 #include "catalog_mgr_client.h"
 
+#include <alloca.h>
+
+#include <cstdlib>
 #include <string>
 #include <vector>
 
 #include "cache_posix.h"
+#include "catalog_delta.h"
 #include "download.h"
 #include "fetch.h"
 #include "manifest.h"
@@ -45,12 +49,17 @@ ClientCatalogManager::ClientCatalogManager(MountPoint *mountpoint)
   , all_inodes_(0)
   , loaded_inodes_(0)
   , fixed_alt_root_catalog_(false)
+  , catalog_deltas_(false)
 {
   LogCvmfs(kLogCatalog, kLogDebug, "constructing client catalog manager");
   n_certificate_hits_ = mountpoint->statistics()->Register(
     "cache.n_certificate_hits", "Number of certificate hits");
   n_certificate_misses_ = mountpoint->statistics()->Register(
     "cache.n_certificate_misses", "Number of certificate misses");
+  n_catalog_delta_hits_ = mountpoint->statistics()->Register(
+    "cache.n_catalog_delta_hits", "Number of catalogs updated by a delta");
+  n_catalog_delta_misses_ = mountpoint->statistics()->Register(
+    "cache.n_catalog_delta_misses", "Number of unusable catalog deltas");
 }
 
 
@@ -128,6 +137,22 @@ LoadError ClientCatalogManager::LoadCatalog(
     string alt_catalog_path = "";
     if (mountpoint.IsEmpty() && fixed_alt_root_catalog_)
       alt_catalog_path = hash.MakeAlternativePath();
+    // Only nested catalogs, the parent catalog points to the delta
+    if (catalog_deltas_ && alt_catalog_path.empty() &&
+        !mountpoint.IsEmpty() && !GetCatalogs().empty())
+    {
+      std::map<PathString, shash::Any>::const_iterator iter =
+        previous_catalogs_.find(mountpoint);
+      CatalogDeltaRef delta_ref;
+      if ((iter != previous_catalogs_.end()) && (iter->second != hash) &&
+          delta_ref.Parse(
+            FindCatalog(mountpoint)->GetNestedCatalogDelta(mountpoint)) &&
+          (delta_ref.base_hash == iter->second) &&
+          (delta_ref.catalog_hash == hash))
+      {
+        LoadCatalogDelta(delta_ref, cvmfs_path);
+      }
+    }
     LoadError load_error =
       LoadCatalogCas(hash, cvmfs_path, alt_catalog_path, catalog_path);
     if (load_error == catalog::kLoadNew)
@@ -228,6 +253,15 @@ LoadError ClientCatalogManager::LoadCatalog(
     return catalog::kLoadNew;
 
   // Load new catalog
+  CatalogDeltaRef delta_ref;
+  if (catalog_deltas_ && !cache_hash.IsNull() &&
+      !ensemble.manifest->has_alt_catalog_path() &&
+      delta_ref.Parse(ensemble.manifest->catalog_delta()) &&
+      (delta_ref.base_hash == cache_hash) &&
+      (delta_ref.catalog_hash == ensemble.manifest->catalog_hash()))
+  {
+    LoadCatalogDelta(delta_ref, cvmfs_path);
+  }
   catalog::LoadError load_retval =
     LoadCatalogCas(ensemble.manifest->catalog_hash(),
                    cvmfs_path,
@@ -269,6 +303,71 @@ LoadError ClientCatalogManager::LoadCatalogCas(
 }
 
 
+/**
+ * Reconstructs the catalog from the cached previous revision and the delta
+ * uploaded with the catalog.  The delta reference comes from the signed
+ * manifest or from the parent catalog, so the download manager verifies the
+ * delta against its content hash.  On success, LoadCatalogCas() finds the
+ * catalog in the cache, otherwise it downloads the catalog.
+ */
+bool ClientCatalogManager::LoadCatalogDelta(
+  const CatalogDeltaRef &delta_ref,
+  const string &name)
+{
+  CacheManager *cache_mgr = fetcher_->cache_mgr();
+  // Already reconstructed, e.g. for another mount point
+  const int fd = cache_mgr->Open(
+    CacheManager::Bless(delta_ref.catalog_hash, CacheManager::kTypeCatalog));
+  if (fd >= 0) {
+    cache_mgr->Close(fd);
+    return true;
+  }
+  const int fd_base = cache_mgr->Open(
+    CacheManager::Bless(delta_ref.base_hash, CacheManager::kTypeCatalog));
+  if (fd_base < 0)
+    return false;
+
+  const string url = "/data/" +
+    MakeCatalogDeltaId(delta_ref.base_hash, delta_ref.catalog_hash).MakePath();
+  download::JobInfo download_delta(&url, true, false, &delta_ref.delta_hash);
+  fetcher_->download_mgr()->Fetch(&download_delta);
+  if (download_delta.error_code != download::kFailOk) {
+    LogCvmfs(kLogCatalog, kLogDebug, "no delta for %s (%d - %s)",
+             name.c_str(), download_delta.error_code,
+             download::Code2Ascii(download_delta.error_code));
+    cache_mgr->Close(fd_base);
+    perf::Inc(n_catalog_delta_misses_);
+    return false;
+  }
+
+  bool result = false;
+  void *txn = alloca(cache_mgr->SizeOfTxn());
+  if (cache_mgr->StartTxn(delta_ref.catalog_hash, CacheManager::kSizeUnknown,
+                          txn) >= 0)
+  {
+    cache_mgr->CtrlTxn(
+      CacheManager::ObjectInfo(CacheManager::kTypeCatalog, name), 0, txn);
+    cvmfs::TransactionSink sink(cache_mgr, txn);
+    result = ApplyCatalogDelta(
+      reinterpret_cast<unsigned char *>(download_delta.destination_mem.data),
+      download_delta.destination_mem.pos, delta_ref.base_hash, cache_mgr,
+      fd_base, &sink);
+    if (result)
+      result = (cache_mgr->CommitTxn(txn) >= 0);
+    else
+      cache_mgr->AbortTxn(txn);
+  }
+  free(download_delta.destination_mem.data);
+  cache_mgr->Close(fd_base);
+
+  LogCvmfs(kLogCatalog, kLogDebug, "updating %s from %s by delta: %s",
+           name.c_str(), delta_ref.base_hash.ToString().c_str(),
+           result ? "success" : "failure");
+  perf::Inc(result ? n_catalog_delta_hits_ : n_catalog_delta_misses_);
+  return result;
+}
+
+
 void ClientCatalogManager::UnloadCatalog(const Catalog *catalog) {
   LogCvmfs(kLogCache, kLogDebug, "unloading catalog %s",
            catalog->mountpoint().c_str());
@@ -277,6 +376,8 @@ void ClientCatalogManager::UnloadCatalog(const Catalog *catalog) {
     mounted_catalogs_.find(catalog->mountpoint());
   assert(iter != mounted_catalogs_.end());
   fetcher_->cache_mgr()->quota_mgr()->Unpin(iter->second);
+  if (catalog_deltas_)
+    previous_catalogs_[catalog->mountpoint()] = iter->second;
   mounted_catalogs_.erase(iter);
   const catalog::Counters &counters = catalog->GetCounters();
   loaded_inodes_ -= counters.GetSelfEntries();
@@ -32,6 +32,8 @@ class SignatureManager;
 
 namespace catalog {
 
+struct CatalogDeltaRef;
+
 /**
  * A catalog manager that uses a Fetcher to get file catalgs in the form of
  * (virtual) file descriptors from a cache manager.  Sqlite has a path based
@@ -60,6 +62,12 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
 
   bool IsRevisionBlacklisted();
 
+  /**
+   * Try to update cached catalogs through catalog deltas before downloading
+   * them, see catalog_delta.h
+   */
+  void SetCatalogDeltas(const bool value) { catalog_deltas_ = value; }
+
   bool offline_mode() const { return offline_mode_; }
   uint64_t all_inodes() const { return all_inodes_; }
   uint64_t loaded_inodes() const { return loaded_inodes_; }
@@ -82,12 +90,18 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
                            const std::string &name,
                            const std::string &alt_catalog_path,
                            std::string *catalog_path);
+  bool LoadCatalogDelta(const CatalogDeltaRef &delta_ref,
+                        const std::string &name);
 
   /**
    * Required for unpinning
    */
   std::map<PathString, shash::Any> loaded_catalogs_;
   std::map<PathString, shash::Any> mounted_catalogs_;
+  /**
+   * The last unloaded catalog of every mount point, the base for deltas
+   */
+  std::map<PathString, shash::Any> previous_catalogs_;
 
   UniquePtr<manifest::Manifest> manifest_;
 
@@ -99,9 +113,12 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   uint64_t all_inodes_;
   uint64_t loaded_inodes_;
   bool fixed_alt_root_catalog_;  /**< fixed root hash but alternative url */
+  bool catalog_deltas_;
   BackoffThrottle backoff_throttle_;
   perf::Counter *n_certificate_hits_;
   perf::Counter *n_certificate_misses_;
+  perf::Counter *n_catalog_delta_hits_;
+  perf::Counter *n_catalog_delta_misses_;
 };
 
 
@@ -547,6 +547,41 @@ bool AbstractCatalogManager<CatalogT>::Listing(const PathString &path,
 }
 
 
+/**
+ * Opens the listing of the specified directory sorted by name, see
+ * OrderedListing.  Catalogs must not be detached while the listing is open.
+ * @param path the path of the directory to list
+ * @return the listing to be deleted by the caller, NULL on failure
+ */
+template <class CatalogT>
+OrderedListing *AbstractCatalogManager<CatalogT>::OpenOrderedListing(
+  const PathString &path)
+{
+  EnforceSqliteMemLimit();
+  ReadLock();
+
+  // Find catalog, possibly load nested
+  CatalogT *best_fit = FindCatalog(path);
+  CatalogT *catalog = best_fit;
+  if (MountSubtree(path, best_fit, true /* is_listable */, NULL)) {
+    Unlock();
+    WriteLock();
+    // Check again to avoid race
+    best_fit = FindCatalog(path);
+    if (!MountSubtree(path, best_fit, true /* is_listable */, &catalog)) {
+      Unlock();
+      return NULL;
+    }
+  }
+
+  perf::Inc(statistics_.n_listing);
+  OrderedListing *listing = new OrderedListing(catalog, path);
+
+  Unlock();
+  return listing;
+}
+
+
 /**
  * Do a listing of the specified directory, return only struct stat values.
  * @param path the path of the directory to list
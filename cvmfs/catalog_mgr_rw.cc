@@ -15,14 +15,18 @@
 #include <string>
 
 #include "catalog_balancer.h"
+#include "catalog_delta.h"
 #include "catalog_rw.h"
+#include "compression.h"
 #include "logging.h"
 #include "manifest.h"
+#include "platform.h"
 #include "smalloc.h"
 #include "statistics.h"
 #include "upload.h"
 #include "util/exception.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -45,6 +49,8 @@ WritableCatalogManager::WritableCatalogManager(
   : SimpleCatalogManager(base_hash, stratum0, dir_temp, download_manager,
       statistics)
   , spooler_(spooler)
+  , snapshot_start_(0)
+  , catalog_deltas_(false)
   , enforce_limits_(enforce_limits)
   , nested_kcatalog_limit_(nested_kcatalog_limit)
   , root_kcatalog_limit_(root_kcatalog_limit)
@@ -62,10 +68,28 @@ WritableCatalogManager::WritableCatalogManager(
     reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
   retval = pthread_mutex_init(catalog_processing_lock_, NULL);
   assert(retval == 0);
+
+  perf::StatisticsTemplate publish_statistics("publish", statistics);
+  n_catalogs_finalized_ = publish_statistics.RegisterOrLookupTemplated(
+    "n_catalogs_finalized", "Number of catalogs finalized");
+  time_catalog_commit_ns_ = publish_statistics.RegisterOrLookupTemplated(
+    "time_catalog_commit_ns",
+    "Time spent updating and committing catalogs, summed over threads");
+  time_catalog_vacuum_ns_ = publish_statistics.RegisterOrLookupTemplated(
+    "time_catalog_vacuum_ns",
+    "Time spent defragmenting catalogs, summed over threads");
+  time_catalog_snapshot_ns_ = publish_statistics.RegisterOrLookupTemplated(
+    "time_catalog_snapshot_ns",
+    "Wall clock time from the first finalized catalog to the uploaded root");
 }
 
 
 WritableCatalogManager::~WritableCatalogManager() {
+  for (std::map<std::string, CatalogBase>::const_iterator
+       i = catalog_bases_.begin(), iEnd = catalog_bases_.end(); i != iEnd; ++i)
+  {
+    unlink(i->second.path.c_str());
+  }
   pthread_mutex_destroy(sync_lock_);
   free(sync_lock_);
   pthread_mutex_destroy(catalog_processing_lock_);
@@ -73,6 +97,37 @@ WritableCatalogManager::~WritableCatalogManager() {
 }
 
 
+/**
+ * Downloads the catalog like the SimpleCatalogManager.  With catalog deltas,
+ * the catalog is copied before it is modified.
+ */
+LoadError WritableCatalogManager::LoadCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash,
+  std::string *catalog_path,
+  shash::Any *catalog_hash)
+{
+  const LoadError retval = SimpleCatalogManager::LoadCatalog(
+    mountpoint, hash, catalog_path, catalog_hash);
+  if (!catalog_deltas_ || (retval != kLoadNew))
+    return retval;
+
+  CatalogBase base;
+  base.path = *catalog_path + ".base";
+  base.hash = *catalog_hash;
+  if (!CopyPath2Path(*catalog_path, base.path)) {
+    LogCvmfs(kLogCatalog, kLogStderr,
+             "Warning: failed to copy catalog %s, no delta will be created",
+             catalog_hash->ToString().c_str());
+    unlink(base.path.c_str());
+    return retval;
+  }
+  MutexLockGuard guard(catalog_processing_lock_);
+  catalog_bases_[*catalog_path] = base;
+  return retval;
+}
+
+
 /**
  * This method is virtual in AbstractCatalogManager.  It returns a new catalog
  * structure in the form the different CatalogManagers need it.
@@ -87,9 +142,11 @@ Catalog* WritableCatalogManager::CreateCatalog(
   const shash::Any &catalog_hash,
   Catalog          *parent_catalog)
 {
-  return new WritableCatalog(mountpoint.ToString(),
-                             catalog_hash,
-                             parent_catalog);
+  WritableCatalog *catalog = new WritableCatalog(mountpoint.ToString(),
+                                                 catalog_hash,
+                                                 parent_catalog);
+  catalog->AllowBulkInsert();
+  return catalog;
 }
 
 
@@ -213,11 +270,17 @@ bool WritableCatalogManager::FindCatalog(const string     &path,
   if (NULL == dirent) {
     dirent = &dummy;
   }
-  bool found = catalog->LookupPath(ps_path, dirent);
-  if (!found || !catalog->IsWritable())
+  if (!catalog->IsWritable())
+    return false;
+  // New directories are found in the buffer of a bulk insert without writing
+  // the buffer to the database
+  WritableCatalog *writable_catalog = static_cast<WritableCatalog *>(catalog);
+  bool found = writable_catalog->LookupPendingPath(ps_path, dirent) ||
+               catalog->LookupPath(ps_path, dirent);
+  if (!found)
     return false;
 
-  *result = static_cast<WritableCatalog *>(catalog);
+  *result = writable_catalog;
   return true;
 }
 
@@ -1079,6 +1142,7 @@ bool WritableCatalogManager::Commit(const bool           stop_for_tweaks,
   manifest->set_root_path("");
   manifest->set_ttl(root_catalog_info.ttl);
   manifest->set_revision(root_catalog_info.revision);
+  manifest->set_catalog_delta(root_catalog_info.catalog_delta);
 
   return true;
 }
@@ -1086,8 +1150,9 @@ bool WritableCatalogManager::Commit(const bool           stop_for_tweaks,
 
 /**
  * Handles the snapshotting of dirty (i.e. modified) catalogs while trying to
- * parallize the compression and upload as much as possible. We use a parallel
- * depth first post order tree traversal based on 'continuations'.
+ * parallize the finalization, compression and upload as much as possible. We
+ * use a parallel depth first post order tree traversal based on
+ * 'continuations'.
  *
  * The idea is as follows:
  *  1. find all leaf-catalogs (i.e. dirty catalogs with no dirty children)
@@ -1104,19 +1169,31 @@ bool WritableCatalogManager::Commit(const bool           stop_for_tweaks,
  *     --> done through a Future<> in WritableCatalogManager::SnapshotCatalogs
  *
  * Note: The catalog finalisation (see WritableCatalogManager::FinalizeCatalog)
- *       happens in a worker thread (i.e. the callback method) for non-leaf
- *       catalogs.
- *
- * TODO(rmeusel): since all leaf catalogs are finalized in the main thread, we
- *                sacrafice some potential concurrency for simplicity.
+ *       happens in a pool of TaskFinalizeCatalog threads, for leaf and
+ *       non-leaf catalogs alike.  Every catalog is its own SQLite database, so
+ *       independent catalogs are committed and vacuumed concurrently.  The
+ *       upload callbacks only queue the parents, they don't wait for them.
  */
 WritableCatalogManager::CatalogInfo WritableCatalogManager::SnapshotCatalogs(
                                                    const bool stop_for_tweaks) {
   // prepare environment for parallel processing
   Future<CatalogInfo>  root_catalog_info_future;
+  Tube<FinalizeJob>    finalize_queue;
   CatalogUploadContext upload_context;
   upload_context.root_catalog_info = &root_catalog_info_future;
   upload_context.stop_for_tweaks   = stop_for_tweaks;
+  upload_context.finalize_queue    = &finalize_queue;
+
+  catalog_timings_.clear();
+  snapshot_start_ = platform_monotonic_time_ns();
+
+  TubeConsumerGroup<FinalizeJob> tasks_finalize;
+  const unsigned num_threads = GetNumFinalizeThreads(stop_for_tweaks);
+  for (unsigned i = 0; i < num_threads; ++i) {
+    tasks_finalize.TakeConsumer(
+      new TaskFinalizeCatalog(this, &finalize_queue, stop_for_tweaks));
+  }
+  tasks_finalize.Spawn();
 
   spooler_->RegisterListener(
     &WritableCatalogManager::CatalogUploadCallback, this, upload_context);
@@ -1126,25 +1203,83 @@ WritableCatalogManager::CatalogInfo WritableCatalogManager::SnapshotCatalogs(
   WritableCatalogList leafs_to_snapshot;
   GetModifiedCatalogLeafs(&leafs_to_snapshot);
 
-  // finalize and schedule the catalog processing
+  // schedule the finalization and processing of the leaf catalogs
         WritableCatalogList::const_iterator i    = leafs_to_snapshot.begin();
   const WritableCatalogList::const_iterator iend = leafs_to_snapshot.end();
   for (; i != iend; ++i) {
-    FinalizeCatalog(*i, stop_for_tweaks);
-    ScheduleCatalogProcessing(*i);
+    ScheduleCatalogFinalization(*i, "", &finalize_queue);
   }
 
-  LogCvmfs(kLogCatalog, kLogVerboseMsg, "waiting for upload of catalogs");
+  LogCvmfs(kLogCatalog, kLogVerboseMsg,
+           "waiting for upload of catalogs (%u finalizer threads)",
+           num_threads);
   CatalogInfo& root_catalog_info = root_catalog_info_future.Get();
+  // The root catalog is the last one to be finalized
+  tasks_finalize.Terminate();
   spooler_->WaitForUpload();
 
   spooler_->UnregisterListeners();
+  LogCriticalPath();
   return root_catalog_info;
 }
 
 
+/**
+ * By default one thread per core.  Tweaks need the terminal, one catalog
+ * after the other.
+ */
+unsigned WritableCatalogManager::GetNumFinalizeThreads(
+  const bool stop_for_tweaks)
+{
+  if (stop_for_tweaks)
+    return 1;
+  const char *num_threads = getenv("_CVMFS_SERVER_CATALOG_FINALIZE_THREADS");
+  if ((num_threads != NULL) && (String2Uint64(num_threads) > 0))
+    return String2Uint64(num_threads);
+  return GetNumberOfCpuCores();
+}
+
+
+/**
+ * Logs the catalogs whose finalization and upload determined the duration of
+ * the snapshot, from the root catalog down to a leaf catalog.
+ */
+void WritableCatalogManager::LogCriticalPath() {
+  const uint64_t duration = platform_monotonic_time_ns() - snapshot_start_;
+  time_catalog_snapshot_ns_->Xadd(duration);
+  LogCvmfs(kLogCatalog, kLogVerboseMsg,
+           "snapshot of %lu catalogs took %" PRIu64 " ms, critical path:",
+           catalog_timings_.size(), duration / (1000 * 1000));
+
+  std::string mountpoint = GetRootCatalog()->mountpoint().ToString();
+  std::map<std::string, CatalogTiming>::const_iterator i;
+  while ((i = catalog_timings_.find(mountpoint)) != catalog_timings_.end()) {
+    LogCvmfs(kLogCatalog, kLogVerboseMsg, "  %s: %s",
+             mountpoint.empty() ? "/" : mountpoint.c_str(),
+             i->second.ToString().c_str());
+    if (i->second.critical_child.empty())
+      break;
+    mountpoint = i->second.critical_child;
+  }
+}
+
+
+std::string WritableCatalogManager::CatalogTiming::ToString() const {
+  const uint64_t ms = 1000 * 1000;
+  return "ready at " + StringifyInt(t_ready / ms) + " ms, " +
+         "waited " + StringifyInt((t_finalize - t_ready) / ms) + " ms, " +
+         "committed in " + StringifyInt((t_committed - t_finalize) / ms) +
+         " ms, " +
+         "vacuumed in " + StringifyInt((t_vacuumed - t_committed) / ms) +
+         " ms, " +
+         "uploaded in " + StringifyInt((t_uploaded - t_vacuumed) / ms) + " ms";
+}
+
+
 void WritableCatalogManager::FinalizeCatalog(WritableCatalog *catalog,
-                                             const bool stop_for_tweaks) {
+                                             const bool stop_for_tweaks,
+                                             CatalogTiming *timing) {
+  const uint64_t t_start = platform_monotonic_time_ns();
   // update meta information of this catalog
   LogCvmfs(kLogCatalog, kLogVerboseMsg, "creating snapshot of catalog '%s'",
            catalog->mountpoint().c_str());
@@ -1208,7 +1343,54 @@ void WritableCatalogManager::FinalizeCatalog(WritableCatalog *catalog,
   }
 
   // compaction of bloated catalogs (usually after high database churn)
+  const uint64_t t_committed = platform_monotonic_time_ns();
   catalog->VacuumDatabaseIfNecessary();
+  const uint64_t t_vacuumed = platform_monotonic_time_ns();
+
+  n_catalogs_finalized_->Inc();
+  time_catalog_commit_ns_->Xadd(t_committed - t_start);
+  time_catalog_vacuum_ns_->Xadd(t_vacuumed - t_committed);
+  if (timing != NULL) {
+    timing->t_committed = t_committed - snapshot_start_;
+    timing->t_vacuumed = t_vacuumed - snapshot_start_;
+  }
+}
+
+
+/**
+ * Registers the catalog's timing and hands it to the finalizer threads
+ */
+void WritableCatalogManager::ScheduleCatalogFinalization(
+  WritableCatalog *catalog,
+  const std::string &critical_child,
+  Tube<FinalizeJob> *finalize_queue)
+{
+  {
+    MutexLockGuard guard(catalog_processing_lock_);
+    CatalogTiming *timing = &catalog_timings_[catalog->mountpoint().ToString()];
+    timing->t_ready = platform_monotonic_time_ns() - snapshot_start_;
+    timing->critical_child = critical_child;
+  }
+  finalize_queue->EnqueueBack(new FinalizeJob(catalog));
+}
+
+
+/**
+ * Runs in the TaskFinalizeCatalog threads
+ */
+void WritableCatalogManager::FinalizeAndProcessCatalog(
+  WritableCatalog *catalog,
+  const bool stop_for_tweaks)
+{
+  CatalogTiming *timing;
+  {
+    MutexLockGuard guard(catalog_processing_lock_);
+    // Nodes of a std::map are stable, the pointer remains valid
+    timing = &catalog_timings_[catalog->mountpoint().ToString()];
+  }
+  timing->t_finalize = platform_monotonic_time_ns() - snapshot_start_;
+  FinalizeCatalog(catalog, stop_for_tweaks, timing);
+  ScheduleCatalogProcessing(catalog);
 }
 
 
@@ -1226,6 +1408,22 @@ void WritableCatalogManager::ScheduleCatalogProcessing(
 void WritableCatalogManager::CatalogUploadCallback(
                           const upload::SpoolerResult &result,
                           const CatalogUploadContext   catalog_upload_context) {
+  // Catalog deltas are optional, they don't take part in the tree traversal
+  bool is_delta;
+  {
+    MutexLockGuard guard(catalog_processing_lock_);
+    is_delta = (pending_deltas_.erase(result.local_path) > 0);
+  }
+  if (is_delta) {
+    if (result.return_code != 0) {
+      LogCvmfs(kLogCatalog, kLogStderr,
+               "Warning: failed to upload catalog delta %s (retval: %d)",
+               result.local_path.c_str(), result.return_code);
+    }
+    unlink(result.local_path.c_str());
+    return;
+  }
+
   if (result.return_code != 0) {
     PANIC(kLogStderr, "failed to upload '%s' (retval: %d)",
           result.local_path.c_str(), result.return_code);
@@ -1245,6 +1443,22 @@ void WritableCatalogManager::CatalogUploadCallback(
   uint64_t catalog_size = GetFileSize(result.local_path);
   assert(catalog_size > 0);
 
+  const std::string mountpoint = catalog->mountpoint().ToString();
+  {
+    MutexLockGuard guard(catalog_processing_lock_);
+    CatalogTiming *timing = &catalog_timings_[mountpoint];
+    timing->t_uploaded = platform_monotonic_time_ns() - snapshot_start_;
+    LogCvmfs(kLogCatalog, kLogVerboseMsg, "catalog at %s: %s",
+             mountpoint.empty() ? "/" : mountpoint.c_str(),
+             timing->ToString().c_str());
+  }
+
+  // Scheduled before the root catalog info is handed to the main thread,
+  // which then waits for all uploads to finish
+  std::string delta_ref;
+  if (catalog_deltas_)
+    delta_ref = UploadCatalogDelta(result.local_path, result.content_hash);
+
   SyncLock();
   if (catalog->HasParent()) {
     // finalized nested catalogs will update their parent's pointer and schedule
@@ -1252,11 +1466,14 @@ void WritableCatalogManager::CatalogUploadCallback(
     LogCvmfs(kLogCatalog, kLogVerboseMsg, "updating nested catalog link");
     WritableCatalog *parent = catalog->GetWritableParent();
 
-    parent->UpdateNestedCatalog(catalog->mountpoint().ToString(),
+    parent->UpdateNestedCatalog(mountpoint,
                                 result.content_hash,
                                 catalog_size,
                                 catalog->delta_counters_);
     catalog->delta_counters_.SetZero();
+    // Also clears a stale reference if there is no delta this time
+    if (catalog_deltas_)
+      parent->SetNestedCatalogDelta(catalog->mountpoint(), delta_ref);
 
     const int remaining_dirty_children =
       catalog->GetWritableParent()->DecrementDirtyChildren();
@@ -1266,8 +1483,8 @@ void WritableCatalogManager::CatalogUploadCallback(
     // continuation of the dirty catalog tree traversal
     // see WritableCatalogManager::SnapshotCatalogs()
     if (remaining_dirty_children == 0) {
-      FinalizeCatalog(parent, catalog_upload_context.stop_for_tweaks);
-      ScheduleCatalogProcessing(parent);
+      ScheduleCatalogFinalization(parent, mountpoint,
+                                  catalog_upload_context.finalize_queue);
     }
 
   } else if (catalog->IsRoot()) {
@@ -1278,6 +1495,7 @@ void WritableCatalogManager::CatalogUploadCallback(
     root_catalog_info.ttl          = catalog->GetTTL();
     root_catalog_info.content_hash = result.content_hash;
     root_catalog_info.revision     = catalog->GetRevision();
+    root_catalog_info.catalog_delta = delta_ref;
     catalog_upload_context.root_catalog_info->Set(root_catalog_info);
     SyncUnlock();
   } else {
@@ -1286,6 +1504,56 @@ void WritableCatalogManager::CatalogUploadCallback(
 }
 
 
+/**
+ * Creates the delta from the previous revision of a catalog, if there is one,
+ * and uploads it next to the new catalog.  Returns the reference to the delta
+ * that goes into the parent catalog or into the manifest, or an empty string.
+ * Failures only cost the clients the download of the full catalog.
+ */
+std::string WritableCatalogManager::UploadCatalogDelta(
+  const std::string &catalog_path,
+  const shash::Any &catalog_hash)
+{
+  CatalogBase base;
+  {
+    MutexLockGuard guard(catalog_processing_lock_);
+    std::map<std::string, CatalogBase>::iterator i =
+      catalog_bases_.find(catalog_path);
+    if (i == catalog_bases_.end())
+      return "";
+    base = i->second;
+    catalog_bases_.erase(i);
+  }
+
+  const std::string delta_path = catalog_path + ".delta";
+  const uint64_t max_size = GetFileSize(catalog_path) / kMaxDeltaFraction;
+  CatalogDeltaRef delta_ref;
+  delta_ref.base_hash = base.hash;
+  delta_ref.catalog_hash = catalog_hash;
+  delta_ref.delta_hash =
+    shash::Any(catalog_hash.algorithm, shash::kSuffixCatalogDelta);
+  const bool retval = CreateCatalogDelta(base.path, base.hash, catalog_path,
+                                         max_size, delta_path,
+                                         &delta_ref.delta_hash);
+  unlink(base.path.c_str());
+  if (!retval) {
+    LogCvmfs(kLogCatalog, kLogVerboseMsg,
+             "no delta from catalog %s to %s", base.hash.ToString().c_str(),
+             catalog_hash.ToString().c_str());
+    unlink(delta_path.c_str());
+    return "";
+  }
+
+  {
+    MutexLockGuard guard(catalog_processing_lock_);
+    pending_deltas_.insert(delta_path);
+  }
+  spooler_->Upload(delta_path, "data/" +
+                   MakeCatalogDeltaId(base.hash, catalog_hash).MakePath());
+  return delta_ref.ToString();
+}
+
+
 /**
  * Finds dirty catalogs that can be snapshot right away and annotates all the
  * other catalogs with their number of dirty decendants.
@@ -1412,6 +1680,7 @@ WritableCatalogManager::SnapshotCatalogsSerialized(
   CatalogUploadContext unused;
   unused.root_catalog_info = NULL;
   unused.stop_for_tweaks = false;
+  unused.finalize_queue = NULL;
   spooler_->RegisterListener(
     &WritableCatalogManager::CatalogUploadSerializedCallback, this, unused);
 
@@ -39,6 +39,8 @@
 #include "catalog_mgr_ro.h"
 #include "catalog_rw.h"
 #include "file_chunk.h"
+#include "ingestion/task.h"
+#include "ingestion/tube.h"
 #include "upload_spooler_result.h"
 #include "util_concurrency.h"
 #include "xattr.h"
@@ -57,6 +59,7 @@ class Manifest;
 }
 
 namespace perf {
+class Counter;
 class Statistics;
 }
 
@@ -72,6 +75,7 @@ class WritableCatalogManager : public SimpleCatalogManager {
   // TODO(jblomer): only needed to get Spooler's hash algorithm.  Remove me
   // after refactoring of the swissknife utility.
   friend class VirtualCatalog;
+  friend class TaskFinalizeCatalog;
 
  public:
   WritableCatalogManager(const shash::Any  &base_hash,
@@ -139,6 +143,13 @@ class WritableCatalogManager : public SimpleCatalogManager {
    */
   void PrecalculateListings();
 
+  /**
+   * Keeps a copy of the catalogs as they are loaded, so that Commit() can
+   * upload catalog deltas for clients that have the previous revision.  Has
+   * to be set before Init().
+   */
+  void SetCatalogDeltas(const bool value) { catalog_deltas_ = value; }
+
   void SetTTL(const uint64_t new_ttl);
   bool SetVOMSAuthz(const std::string &voms_authz);
   bool Commit(const bool           stop_for_tweaks,
@@ -157,6 +168,10 @@ class WritableCatalogManager : public SimpleCatalogManager {
  protected:
   void EnforceSqliteMemLimit() { }
 
+  LoadError LoadCatalog(const PathString &mountpoint,
+                        const shash::Any &hash,
+                        std::string *catalog_path,
+                        shash::Any *catalog_hash);
   Catalog *CreateCatalog(const PathString &mountpoint,
                          const shash::Any &catalog_hash,
                          Catalog *parent_catalog);
@@ -182,17 +197,59 @@ class WritableCatalogManager : public SimpleCatalogManager {
     size_t       size;
     shash::Any   content_hash;
     unsigned int revision;
+    std::string  catalog_delta;  ///< see manifest::Manifest::catalog_delta()
+  };
+
+  /**
+   * A dirty catalog whose dirty children are all uploaded
+   */
+  struct FinalizeJob {
+    explicit FinalizeJob(WritableCatalog *c) : catalog(c) { }
+    static FinalizeJob *CreateQuitBeacon() { return new FinalizeJob(NULL); }
+    bool IsQuitBeacon() { return catalog == NULL; }
+    WritableCatalog *catalog;
   };
 
   struct CatalogUploadContext {
     Future<CatalogInfo>* root_catalog_info;
     bool                 stop_for_tweaks;
+    Tube<FinalizeJob>   *finalize_queue;
+  };
+
+  /**
+   * Milestones of a catalog in SnapshotCatalogs(), in nanoseconds since the
+   * start of the snapshot
+   */
+  struct CatalogTiming {
+    CatalogTiming()
+      : t_ready(0), t_finalize(0), t_committed(0), t_vacuumed(0)
+      , t_uploaded(0) { }
+    std::string ToString() const;
+
+    uint64_t t_ready;      ///< all dirty children uploaded
+    uint64_t t_finalize;   ///< taken by a finalizer thread
+    uint64_t t_committed;  ///< counters updated and committed
+    uint64_t t_vacuumed;
+    uint64_t t_uploaded;   ///< compressed and uploaded
+    /**
+     * The child that was uploaded last, empty for leaf catalogs.  Following
+     * the critical children from the root gives the critical path.
+     */
+    std::string critical_child;
   };
 
   CatalogInfo SnapshotCatalogs(const bool stop_for_tweaks);
   void FinalizeCatalog(WritableCatalog *catalog,
-                       const bool stop_for_tweaks);
+                       const bool stop_for_tweaks,
+                       CatalogTiming *timing = NULL);
   void ScheduleCatalogProcessing(WritableCatalog *catalog);
+  void ScheduleCatalogFinalization(WritableCatalog *catalog,
+                                   const std::string &critical_child,
+                                   Tube<FinalizeJob> *finalize_queue);
+  void FinalizeAndProcessCatalog(WritableCatalog *catalog,
+                                 const bool stop_for_tweaks);
+  void LogCriticalPath();
+  static unsigned GetNumFinalizeThreads(const bool stop_for_tweaks);
 
   void GetModifiedCatalogLeafs(WritableCatalogList *result) const {
     const bool dirty = GetModifiedCatalogLeafsRecursively(GetRootCatalog(),
@@ -205,6 +262,17 @@ class WritableCatalogManager : public SimpleCatalogManager {
   void CatalogUploadCallback(const upload::SpoolerResult &result,
                              const CatalogUploadContext   clg_upload_context);
 
+  /**
+   * The previous revision of a catalog, copied when it was loaded
+   */
+  struct CatalogBase {
+    std::string path;
+    shash::Any  hash;
+  };
+
+  std::string UploadCatalogDelta(const std::string &catalog_path,
+                                 const shash::Any &catalog_hash);
+
  private:
   inline void SyncLock() { pthread_mutex_lock(sync_lock_); }
   inline void SyncUnlock() { pthread_mutex_unlock(sync_lock_); }
@@ -233,6 +301,30 @@ class WritableCatalogManager : public SimpleCatalogManager {
 
   pthread_mutex_t                         *catalog_processing_lock_;
   std::map<std::string, WritableCatalog*>  catalog_processing_map_;
+  /**
+   * Keyed by mount point and protected by catalog_processing_lock_
+   */
+  std::map<std::string, CatalogTiming>     catalog_timings_;
+  uint64_t                                 snapshot_start_;
+
+  perf::Counter *n_catalogs_finalized_;
+  perf::Counter *time_catalog_commit_ns_;
+  perf::Counter *time_catalog_vacuum_ns_;
+  perf::Counter *time_catalog_snapshot_ns_;
+
+  /**
+   * Deltas are only uploaded if they are smaller than the catalog divided by
+   * this factor.  Otherwise clients are better off with the full catalog.
+   */
+  static const unsigned kMaxDeltaFraction = 4;
+  bool catalog_deltas_;
+  /**
+   * Maps the database path of the loaded catalogs to their base copy.  Like
+   * the set of deltas that are being uploaded, it is protected by
+   * catalog_processing_lock_.
+   */
+  std::map<std::string, CatalogBase> catalog_bases_;
+  std::set<std::string> pending_deltas_;
 
   // TODO(jblomer): catalog limits should become its own struct
   bool enforce_limits_;
@@ -275,6 +367,34 @@ class WritableCatalogManager : public SimpleCatalogManager {
   const unsigned balance_weight_;
 };  // class WritableCatalogManager
 
+
+/**
+ * Finalizes independent catalogs concurrently in SnapshotCatalogs().
+ */
+class TaskFinalizeCatalog
+  : public TubeConsumer<WritableCatalogManager::FinalizeJob>
+{
+ public:
+  TaskFinalizeCatalog(
+    WritableCatalogManager *catalog_mgr,
+    Tube<WritableCatalogManager::FinalizeJob> *tube,
+    const bool stop_for_tweaks)
+    : TubeConsumer<WritableCatalogManager::FinalizeJob>(tube)
+    , catalog_mgr_(catalog_mgr)
+    , stop_for_tweaks_(stop_for_tweaks)
+  { }
+
+ protected:
+  virtual void Process(WritableCatalogManager::FinalizeJob *job) {
+    catalog_mgr_->FinalizeAndProcessCatalog(job->catalog, stop_for_tweaks_);
+    delete job;
+  }
+
+ private:
+  WritableCatalogManager *catalog_mgr_;
+  bool stop_for_tweaks_;
+};
+
 }  // namespace catalog
 
 #endif  // CVMFS_CATALOG_MGR_RW_H_
@@ -32,6 +32,7 @@ WritableCatalog::WritableCatalog(const string      &path,
           parent,
           is_not_root),
   sql_insert_(NULL),
+  sql_insert_many_(NULL),
   sql_unlink_(NULL),
   sql_touch_(NULL),
   sql_update_(NULL),
@@ -40,7 +41,11 @@ WritableCatalog::WritableCatalog(const string      &path,
   sql_chunks_count_(NULL),
   sql_max_link_id_(NULL),
   sql_inc_linkcount_(NULL),
-  dirty_(false)
+  dirty_(false),
+  bulk_insert_allowed_(false),
+  bulk_insert_(false),
+  parent_index_deferred_(false),
+  num_added_(0)
 {
   atomic_init32(&dirty_children_);
 }
@@ -78,6 +83,10 @@ void WritableCatalog::Transaction() {
 
 
 void WritableCatalog::Commit() {
+  FlushPendingEntries(NULL);
+  bulk_insert_ = false;
+  num_added_ = 0;
+
   LogCvmfs(kLogCatalog, kLogVerboseMsg, "closing SQLite transaction for '%s'",
                                         mountpoint().c_str());
   const bool retval = database().CommitTransaction();
@@ -92,6 +101,7 @@ void WritableCatalog::InitPreparedStatements() {
   bool retval = SqlCatalog(database(), "PRAGMA foreign_keys = ON;").Execute();
   assert(retval);
   sql_insert_        = new SqlDirentInsert     (database());
+  sql_insert_many_   = new SqlDirentInsertMany (database());
   sql_unlink_        = new SqlDirentUnlink     (database());
   sql_touch_         = new SqlDirentTouch      (database());
   sql_update_        = new SqlDirentUpdate     (database());
@@ -107,6 +117,7 @@ void WritableCatalog::FinalizePreparedStatements() {
   // no polymorphism: no up call (see Catalog.h -
   // near the definition of this method)
   delete sql_insert_;
+  delete sql_insert_many_;
   delete sql_unlink_;
   delete sql_touch_;
   delete sql_update_;
@@ -122,6 +133,7 @@ void WritableCatalog::FinalizePreparedStatements() {
  * Find out the maximal hardlink group id in this catalog.
  */
 uint32_t WritableCatalog::GetMaxLinkId() const {
+  FlushPendingEntries(NULL);
   int result = -1;
 
   if (sql_max_link_id_->FetchRow()) {
@@ -155,6 +167,24 @@ void WritableCatalog::AddEntry(
   shash::Md5 parent_hash((shash::AsciiPtr(parent_path)));
   DirectoryEntry effective_entry(entry);
   effective_entry.set_has_xattrs(!xattrs.IsEmpty());
+  // The counters are kept in memory either way and written once on finalize
+  delta_counters_.Increment(effective_entry);
+
+  if (!bulk_insert_ && bulk_insert_allowed_ &&
+      (++num_added_ >= kBulkInsertThreshold))
+  {
+    BeginBulkInsert();
+  }
+  if (bulk_insert_) {
+    PendingEntry *pending = &pending_[MakePendingKey(path_hash)];
+    pending->entry = effective_entry;
+    pending->parent_hash = parent_hash;
+    pending->xattrs = xattrs;
+    pending->chunks.clear();
+    if (pending_.size() >= kMaxPendingEntries)
+      WritePendingEntries();
+    return;
+  }
 
   bool retval =
     sql_insert_->BindPathHash(path_hash) &&
@@ -170,8 +200,129 @@ void WritableCatalog::AddEntry(
   retval = sql_insert_->Execute();
   assert(retval);
   sql_insert_->Reset();
+}
 
-  delta_counters_.Increment(effective_entry);
+
+/**
+ * Buffers new entries from now on until the end of the transaction.  The index
+ * on the parent path hash is dropped for catalogs that are new in this
+ * transaction and restored once the catalog is listed or committed.
+ */
+void WritableCatalog::BeginBulkInsert() {
+  LogCvmfs(kLogCatalog, kLogVerboseMsg, "bulk insert into '%s'",
+           mountpoint().c_str());
+  bulk_insert_ = true;
+  if (hash().IsNull() && !parent_index_deferred_) {
+    const bool retval = SqlCatalog(database(),
+      "DROP INDEX IF EXISTS idx_catalog_parent;").Execute();
+    assert(retval);
+    parent_index_deferred_ = true;
+  }
+}
+
+
+/**
+ * Writes all buffered entries in primary key order, groups of
+ * SqlDirentInsertMany::kNumRows at a time.
+ */
+void WritableCatalog::WritePendingEntries() const {
+  if (pending_.empty())
+    return;
+  LogCvmfs(kLogCatalog, kLogVerboseMsg, "writing %u buffered entries to '%s'",
+           pending_.size(), mountpoint().c_str());
+
+  const unsigned kNumRows = SqlDirentInsertMany::kNumRows;
+  bool retval;
+  PendingMap::const_iterator i = pending_.begin();
+  const PendingMap::const_iterator iEnd = pending_.end();
+  for (unsigned remaining = pending_.size(); remaining >= kNumRows;
+       remaining -= kNumRows)
+  {
+    for (unsigned row = 0; row < kNumRows; ++row, ++i) {
+      shash::Md5 path_hash(i->first.first, i->first.second);
+      retval =
+        sql_insert_many_->BindPathHash(row, path_hash) &&
+        sql_insert_many_->BindParentPathHash(row, i->second.parent_hash) &&
+        sql_insert_many_->BindDirent(row, i->second.entry) &&
+        sql_insert_many_->BindXattr(row, i->second.xattrs);
+      assert(retval);
+    }
+    retval = sql_insert_many_->Execute();
+    assert(retval);
+    sql_insert_many_->Reset();
+  }
+  for (; i != iEnd; ++i) {
+    shash::Md5 path_hash(i->first.first, i->first.second);
+    retval =
+      sql_insert_->BindPathHash(path_hash) &&
+      sql_insert_->BindParentPathHash(i->second.parent_hash) &&
+      sql_insert_->BindDirent(i->second.entry);
+    assert(retval);
+    if (i->second.xattrs.IsEmpty()) {
+      retval = sql_insert_->BindXattrEmpty();
+    } else {
+      retval = sql_insert_->BindXattr(i->second.xattrs);
+    }
+    assert(retval);
+    retval = sql_insert_->Execute();
+    assert(retval);
+    sql_insert_->Reset();
+  }
+
+  for (i = pending_.begin(); i != iEnd; ++i) {
+    if (i->second.chunks.empty())
+      continue;
+    shash::Md5 path_hash(i->first.first, i->first.second);
+    for (unsigned j = 0; j < i->second.chunks.size(); ++j) {
+      retval =
+        sql_chunk_insert_->BindPathHash(path_hash) &&
+        sql_chunk_insert_->BindFileChunk(i->second.chunks[j]) &&
+        sql_chunk_insert_->Execute();
+      assert(retval);
+      sql_chunk_insert_->Reset();
+    }
+  }
+
+  pending_.clear();
+}
+
+
+/**
+ * Called before reading from the database.  Point lookups only write out the
+ * buffer if they hit a buffered entry.
+ */
+void WritableCatalog::FlushPendingEntries(const shash::Md5 *md5path) const {
+  if (md5path != NULL) {
+    if (pending_.empty() || (pending_.count(MakePendingKey(*md5path)) == 0))
+      return;
+    WritePendingEntries();
+    return;
+  }
+
+  WritePendingEntries();
+  if (parent_index_deferred_) {
+    const bool retval = SqlCatalog(database(),
+      "CREATE INDEX IF NOT EXISTS idx_catalog_parent "
+      "ON catalog (parent_1, parent_2);").Execute();
+    assert(retval);
+    parent_index_deferred_ = false;
+  }
+}
+
+
+bool WritableCatalog::LookupPendingPath(
+  const PathString &path,
+  DirectoryEntry *dirent) const
+{
+  if (pending_.empty())
+    return false;
+  const shash::Md5 path_hash(path.GetChars(), path.GetLength());
+  PendingMap::const_iterator i = pending_.find(MakePendingKey(path_hash));
+  if (i == pending_.end())
+    return false;
+  if (dirent != NULL)
+    *dirent = i->second.entry;
+  return true;
 }
 
 
@@ -209,6 +360,8 @@ void WritableCatalog::IncLinkcount(const string &path_within_group,
                                    const int delta)
 {
   SetDirty();
+  // The update spans the entire hardlink group
+  FlushPendingEntries(NULL);
 
   shash::Md5 path_hash = shash::Md5(shash::AsciiPtr(path_within_group));
 
@@ -253,6 +406,16 @@ void WritableCatalog::UpdateEntry(const DirectoryEntry &entry,
                                   const shash::Md5 &path_hash) {
   SetDirty();
 
+  if (!pending_.empty()) {
+    PendingMap::iterator i = pending_.find(MakePendingKey(path_hash));
+    if (i != pending_.end()) {
+      // Like SqlDirentUpdate, the extended attributes stay untouched
+      i->second.entry = entry;
+      i->second.entry.set_has_xattrs(!i->second.xattrs.IsEmpty());
+      return;
+    }
+  }
+
   bool retval =
     sql_update_->BindPathHash(path_hash) &&
     sql_update_->BindDirent(entry)       &&
@@ -275,6 +438,14 @@ void WritableCatalog::AddFileChunk(const std::string &entry_path,
 
   delta_counters_.self.file_chunks++;
 
+  if (!pending_.empty()) {
+    PendingMap::iterator i = pending_.find(MakePendingKey(path_hash));
+    if (i != pending_.end()) {
+      i->second.chunks.push_back(chunk);
+      return;
+    }
+  }
+
   bool retval =
     sql_chunk_insert_->BindPathHash(path_hash) &&
     sql_chunk_insert_->BindFileChunk(chunk) &&
@@ -290,6 +461,7 @@ void WritableCatalog::AddFileChunk(const std::string &entry_path,
  */
 void WritableCatalog::RemoveFileChunks(const std::string &entry_path) {
   shash::Md5 path_hash((shash::AsciiPtr(entry_path)));
+  FlushPendingEntries(&path_hash);
   bool retval;
 
   // subtract the number of chunks from the statistics counters
@@ -354,6 +526,18 @@ void WritableCatalog::SetPreviousRevision(const shash::Any &hash) {
 }
 
 
+/**
+ * Records where clients find the delta of a nested catalog, see
+ * Catalog::GetNestedCatalogDelta().
+ */
+void WritableCatalog::SetNestedCatalogDelta(
+  const PathString &mountpoint,
+  const std::string &delta_ref)
+{
+  database().SetProperty("catalog_delta:" + mountpoint.ToString(), delta_ref);
+}
+
+
 /**
  * Moves a subtree from this catalog into a just created nested catalog.
  */
@@ -706,6 +890,7 @@ void WritableCatalog::CopyToParent() {
   //         therefore we delete the mount point from the parent before merging
 
   WritableCatalog *parent = GetWritableParent();
+  FlushPendingEntries(NULL);
 
   // Update hardlink group IDs in this nested catalog.
   // To avoid collisions we add the maximal present hardlink group ID in parent
@@ -788,15 +973,18 @@ void WritableCatalog::VacuumDatabaseIfNecessary() {
   }
 
   if (needs_defragmentation) {
-    LogCvmfs(kLogCatalog, kLogStdout | kLogNoLinebreak,
-             "Note: Catalog at %s gets defragmented (%.2f%% %s)... ",
+    // Catalogs are defragmented concurrently, the message is logged in one
+    // piece once the work is done
+    if (!db.Vacuum()) {
+      PANIC(kLogStderr, "Catalog at %s failed to get defragmented (SQLite: %s)",
+            (IsRoot()) ? "/" : mountpoint().c_str(),
+            db.GetLastErrorMsg().c_str());
+    }
+    LogCvmfs(kLogCatalog, kLogStdout,
+             "Note: Catalog at %s gets defragmented (%.2f%% %s)... done",
              (IsRoot()) ? "/" : mountpoint().c_str(),
              ratio * 100.0,
              reason.c_str());
-    if (!db.Vacuum()) {
-      PANIC(kLogStderr, "failed (SQLite: %s)", db.GetLastErrorMsg().c_str());
-    }
-    LogCvmfs(kLogCatalog, kLogStdout, "done");
   }
 }
 
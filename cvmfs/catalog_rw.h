@@ -9,6 +9,13 @@
  *  - UpdateEntry
  *  - RemoveEntry
  *
+ * Catalogs that receive many new entries in a transaction switch to bulk
+ * insert mode (if allowed, see AllowBulkInsert()).  New entries are then
+ * buffered in memory, ordered by their path hash, and written with multi-row
+ * inserts.  Reads and writes that could observe the buffered entries write
+ * them out first.  For catalogs that are new in the transaction, the index on
+ * the parent path hash is only built after the bulk insert.
+ *
  * Catalogs not thread safe.
  */
 
@@ -17,13 +24,14 @@
 
 #include <stdint.h>
 
+#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "catalog.h"
 #include "util/posix.h"
-
-class XattrList;
+#include "xattr.h"
 
 namespace swissknife {
 class CommandMigrate;
@@ -62,6 +70,11 @@ class WritableCatalog : public Catalog {
                 const XattrList &xattr,
                 const std::string &entry_path,
                 const std::string &parent_path);
+  /**
+   * Looks up an entry that is buffered in bulk insert mode without writing
+   * out the buffer.  Returns false for entries in the database.
+   */
+  bool LookupPendingPath(const PathString &path, DirectoryEntry *dirent) const;
   void TouchEntry(const DirectoryEntryBase &entry,
                   const XattrList &xattrs,
                   const shash::Md5 &path_hash);
@@ -98,11 +111,20 @@ class WritableCatalog : public Catalog {
                            Catalog **attached_reference);
   void RemoveBindMountpoint(const std::string &mountpoint);
 
+  /**
+   * Only set by the WritableCatalogManager; other users of WritableCatalog
+   * access the database directly.
+   */
+  void AllowBulkInsert() { bulk_insert_allowed_ = true; }
+  bool IsBulkInsert() const { return bulk_insert_; }
+
   void UpdateLastModified();
   void IncrementRevision();
   void SetRevision(const uint64_t new_revision);
   void SetBranch(const std::string &branch_name);
   void SetPreviousRevision(const shash::Any &hash);
+  void SetNestedCatalogDelta(const PathString &mountpoint,
+                             const std::string &delta_ref);
   void SetTTL(const uint64_t new_ttl);
   bool SetVOMSAuthz(const std::string &voms_authz);
 
@@ -133,6 +155,8 @@ class WritableCatalog : public Catalog {
   void InitPreparedStatements();
   void FinalizePreparedStatements();
 
+  virtual void FlushPendingEntries(const shash::Md5 *md5path) const;
+
   inline WritableCatalog* GetWritableParent() const {
     Catalog *parent = this->parent();
     assert(parent->IsWritable());
@@ -148,7 +172,41 @@ class WritableCatalog : public Catalog {
   }
 
  private:
+  /**
+   * Number of added entries in a transaction that turns on bulk insert mode
+   */
+  static const unsigned kBulkInsertThreshold = 1024;
+  /**
+   * The buffer is written out when it holds that many entries
+   */
+  static const unsigned kMaxPendingEntries = 16384;
+
+  /**
+   * A new entry that is not yet written to the database
+   */
+  struct PendingEntry {
+    DirectoryEntry entry;
+    shash::Md5 parent_hash;
+    XattrList xattrs;
+    std::vector<FileChunk> chunks;
+  };
+  /**
+   * Ordered like the primary key of the catalog table
+   */
+  typedef std::pair<int64_t, int64_t> PendingKey;
+  typedef std::map<PendingKey, PendingEntry> PendingMap;
+
+  static PendingKey MakePendingKey(const shash::Md5 &path_hash) {
+    uint64_t high, low;
+    path_hash.ToIntPair(&high, &low);
+    return PendingKey(static_cast<int64_t>(high), static_cast<int64_t>(low));
+  }
+
+  void BeginBulkInsert();
+  void WritePendingEntries() const;
+
   SqlDirentInsert     *sql_insert_;
+  SqlDirentInsertMany *sql_insert_many_;
   SqlDirentUnlink     *sql_unlink_;
   SqlDirentTouch      *sql_touch_;
   SqlDirentUpdate     *sql_update_;
@@ -160,6 +218,15 @@ class WritableCatalog : public Catalog {
 
   bool dirty_;  /**< Indicates if the catalog has been changed */
 
+  bool bulk_insert_allowed_;
+  bool bulk_insert_;
+  /**
+   * Set if the parent index was dropped for the bulk insert
+   */
+  mutable bool parent_index_deferred_;
+  unsigned num_added_;  /**< Added entries in the current transaction */
+  mutable PendingMap pending_;
+
   DeltaCounters delta_counters_;
 
   // parallel commit state
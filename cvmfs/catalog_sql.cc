@@ -771,6 +771,22 @@ bool SqlListing::BindPathHash(const struct shash::Md5 &hash) {
 //------------------------------------------------------------------------------
 
 
+SqlListingByName::SqlListingByName(const CatalogDatabase &database) {
+  MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog "
+                  "WHERE (parent_1 = :p_1) AND (parent_2 = :p_2) "
+                  "ORDER BY name;");
+  DEFERRED_INITS(database);
+}
+
+
+bool SqlListingByName::BindPathHash(const struct shash::Md5 &hash) {
+  return BindMd5(1, 2, hash);
+}
+
+
+//------------------------------------------------------------------------------
+
+
 SqlLookupPathHash::SqlLookupPathHash(const CatalogDatabase &database) {
   MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog "
                   "WHERE (md5path_1 = :md5_1) AND (md5path_2 = :md5_2);");
@@ -1067,6 +1083,76 @@ bool SqlDirentInsert::BindXattrEmpty() {
 //------------------------------------------------------------------------------
 
 
+namespace {
+
+std::string MakeInsertManyStatement() {
+  std::string result =
+    "INSERT INTO catalog "
+    "(md5path_1, md5path_2, parent_1, parent_2, hash, hardlinks, size, mode,"
+    "mtime, flags, name, symlink, uid, gid, xattr) VALUES ";
+  for (unsigned i = 0; i < SqlDirentInsertMany::kNumRows; ++i) {
+    if (i > 0)
+      result += ",";
+    result += "(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)";
+  }
+  return result + ";";
+}
+
+}  // anonymous namespace
+
+
+SqlDirentInsertMany::SqlDirentInsertMany(const CatalogDatabase &database) {
+  // Built once, DeferredInit() keeps the pointer
+  static const std::string statement = MakeInsertManyStatement();
+  DeferredInit(database.sqlite_db(), statement.c_str());
+}
+
+
+bool SqlDirentInsertMany::BindPathHash(
+  const unsigned row,
+  const shash::Md5 &hash)
+{
+  return BindMd5(Idx(row, 1), Idx(row, 2), hash);
+}
+
+
+bool SqlDirentInsertMany::BindParentPathHash(
+  const unsigned row,
+  const shash::Md5 &hash)
+{
+  return BindMd5(Idx(row, 3), Idx(row, 4), hash);
+}
+
+
+bool SqlDirentInsertMany::BindDirent(
+  const unsigned row,
+  const DirectoryEntry &entry)
+{
+  return BindDirentFields(Idx(row, 5), Idx(row, 6), Idx(row, 7), Idx(row, 8),
+                          Idx(row, 9), Idx(row, 10), Idx(row, 11),
+                          Idx(row, 12), Idx(row, 13), Idx(row, 14), entry);
+}
+
+
+bool SqlDirentInsertMany::BindXattr(const unsigned row,
+                                    const XattrList &xattrs)
+{
+  if (xattrs.IsEmpty())
+    return BindNull(Idx(row, 15));
+  unsigned char *packed_xattrs;
+  unsigned size;
+  xattrs.Serialize(&packed_xattrs, &size);
+  if (packed_xattrs == NULL)
+    return BindNull(Idx(row, 15));
+  const bool retval = BindBlobTransient(Idx(row, 15), packed_xattrs, size);
+  free(packed_xattrs);
+  return retval;
+}
+
+
+//------------------------------------------------------------------------------
+
+
 SqlDirentUpdate::SqlDirentUpdate(const CatalogDatabase &database) {
   DeferredInit(database.sqlite_db(),
     "UPDATE catalog "
@@ -326,6 +326,21 @@ class SqlListing : public SqlLookup {
 //------------------------------------------------------------------------------
 
 
+/**
+ * Like SqlListing but sorted by the binary order of the entry names: byte by
+ * byte, a prefix comes first.  Used to merge two listings without sorting them
+ * in memory, see OrderedListing.
+ */
+class SqlListingByName : public SqlLookup {
+ public:
+  explicit SqlListingByName(const CatalogDatabase &database);
+  bool BindPathHash(const struct shash::Md5 &hash);
+};
+
+
+//------------------------------------------------------------------------------
+
+
 class SqlLookupPathHash : public SqlLookup {
  public:
   explicit SqlLookupPathHash(const CatalogDatabase &database);
@@ -451,6 +466,36 @@ class SqlDirentInsert : public SqlDirentWrite {
 //------------------------------------------------------------------------------
 
 
+/**
+ * Inserts kNumRows directory entries with a single statement.  Used to write
+ * the entries buffered by a WritableCatalog in bulk insert mode.  Rows are
+ * counted from 0.  The bound buffers have to stay valid until Execute().
+ */
+class SqlDirentInsertMany : public SqlDirentWrite {
+ public:
+  /**
+   * Stays below SQLite's historic limit of 999 host parameters
+   */
+  static const unsigned kNumRows = 64;
+
+  explicit SqlDirentInsertMany(const CatalogDatabase &database);
+  bool BindPathHash(const unsigned row, const shash::Md5 &hash);
+  bool BindParentPathHash(const unsigned row, const shash::Md5 &hash);
+  bool BindDirent(const unsigned row, const DirectoryEntry &entry);
+  bool BindDirent(const DirectoryEntry &entry) { return BindDirent(0, entry); }
+  bool BindXattr(const unsigned row, const XattrList &xattrs);
+
+ private:
+  static const unsigned kNumColumns = 15;
+  static int Idx(const unsigned row, const int column) {
+    return row * kNumColumns + column;
+  }
+};
+
+
+//------------------------------------------------------------------------------
+
+
 class SqlDirentUpdate : public SqlDirentWrite {
  public:
   explicit SqlDirentUpdate(const CatalogDatabase &database);
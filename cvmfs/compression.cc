@@ -3,6 +3,7 @@
  *
  * This is a wrapper around zlib.  It provides
  * a set of functions to conveniently compress and decompress stuff.
+ * The Compressor and Decompressor classes additionally wrap Zstandard and LZ4.
  * Allmost all of the functions return true on success, otherwise false.
  *
  * TODO: think about code deduplication
@@ -12,8 +13,14 @@
 #include "compression.h"
 
 #include <alloca.h>
+#ifdef HAS_LZ4
+#include <lz4frame.h>
+#endif
 #include <stdlib.h>
 #include <sys/stat.h>
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
 
 #include <algorithm>
 #include <cassert>
@@ -25,6 +32,7 @@
 #include "smalloc.h"
 #include "util/exception.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -143,15 +151,125 @@ namespace zlib {
 const unsigned kBufferSize = 32768;
 
 /**
- * Aborts if string doesn't match any of the algorithms.
+ * The zstd levels are also checked without zstd support, so that the same
+ * configuration is accepted by all builds.
  */
-Algorithms ParseCompressionAlgorithm(const std::string &algorithm_option) {
+static int MaxZstdLevel() {
+#ifdef HAS_ZSTD
+  return ZSTD_maxCLevel();
+#else
+  return 22;
+#endif
+}
+
+namespace {
+
+/**
+ * Adapters for the Decompressor interface, which writes into sinks.
+ */
+class FileSink : public cvmfs::Sink {
+ public:
+  explicit FileSink(FILE *f) : file_(f) { }
+  virtual int64_t Write(const void *buf, uint64_t sz) {
+    if ((fwrite(buf, 1, sz, file_) != sz) || ferror(file_)) {
+      LogCvmfs(kLogCompress, kLogDebug, "Inflate to file failed with %s "
+               "(errno=%d)", strerror(errno), errno);
+      return -EIO;
+    }
+    return static_cast<int64_t>(sz);
+  }
+  virtual int Reset() {
+    rewind(file_);
+    return ftruncate(fileno(file_), 0);
+  }
+
+ private:
+  FILE *file_;
+};
+
+
+class MemSink : public cvmfs::Sink {
+ public:
+  MemSink() : data_(NULL), size_(0), capacity_(0) { }
+  virtual ~MemSink() { free(data_); }
+  virtual int64_t Write(const void *buf, uint64_t sz) {
+    if (size_ + sz > capacity_) {
+      capacity_ = std::max(static_cast<uint64_t>(kZChunk),
+                           std::max(2 * capacity_, size_ + sz));
+      data_ = static_cast<unsigned char *>(srealloc(data_, capacity_));
+    }
+    memcpy(data_ + size_, buf, sz);
+    size_ += sz;
+    return static_cast<int64_t>(sz);
+  }
+  virtual int Reset() {
+    size_ = 0;
+    return 0;
+  }
+  /**
+   * Hands over the buffer to the caller.
+   */
+  void Release(void **buf, uint64_t *size) {
+    *buf = (data_ == NULL) ? smalloc(1) : data_;
+    *size = size_;
+    data_ = NULL;
+    size_ = capacity_ = 0;
+  }
+
+ private:
+  unsigned char *data_;
+  uint64_t size_;
+  uint64_t capacity_;
+};
+
+}  // anonymous namespace
+
+
+/**
+ * Aborts if string doesn't match any of the algorithms.  The level of
+ * "zstd:<level>" is stored in level, if given; zero means the default level.
+ * Algorithms that are not compiled in fall back to zlib.
+ */
+Algorithms ParseCompressionAlgorithm(const std::string &algorithm_option,
+                                     int *level)
+{
+  if (level != NULL)
+    *level = 0;
   if ((algorithm_option == "default") || (algorithm_option == "zlib"))
     return kZlibDefault;
   if (algorithm_option == "none")
     return kNoCompression;
-  PANIC(kLogStderr, "unknown compression algorithms: %s",
-        algorithm_option.c_str());
+
+  Algorithms algorithm;
+  int64_t algorithm_level = 0;
+  if (algorithm_option == "zstd") {
+    algorithm = kZstd;
+  } else if (HasPrefix(algorithm_option, "zstd:", false)) {
+    const std::string level_option = algorithm_option.substr(5);
+    algorithm_level = String2Int64(level_option);
+    if ((algorithm_level < 1) || (algorithm_level > MaxZstdLevel()) ||
+        (StringifyInt(algorithm_level) != level_option))
+    {
+      PANIC(kLogStderr, "invalid zstd compression level: %s",
+            level_option.c_str());
+    }
+    algorithm = kZstd;
+  } else if (algorithm_option == "lz4") {
+    algorithm = kLz4;
+  } else {
+    PANIC(kLogStderr, "unknown compression algorithms: %s",
+          algorithm_option.c_str());
+  }
+
+  if (!IsAlgorithmAvailable(algorithm)) {
+    LogCvmfs(kLogCompress, kLogStderr | kLogSyslogWarn,
+             "%s compression is not available in this build, using zlib",
+             AlgorithmName(algorithm).c_str());
+    return kZlibDefault;
+  }
+  if (level != NULL)
+    *level = static_cast<int>(algorithm_level);
+  return algorithm;
 }
 
 
@@ -163,6 +281,12 @@ std::string AlgorithmName(const zlib::Algorithms alg) {
     case kNoCompression:
       return "none";
       break;
+    case kZstd:
+      return "zstd";
+      break;
+    case kLz4:
+      return "lz4";
+      break;
     // Purposely did not add a 'default' statement here: this will
     // cause the compiler to generate a warning if a new algorithm
     // is added but this function is not updated.
@@ -171,6 +295,28 @@ std::string AlgorithmName(const zlib::Algorithms alg) {
 }
 
 
+bool IsAlgorithmAvailable(const zlib::Algorithms alg) {
+  switch (alg) {
+    case kZlibDefault:
+    case kNoCompression:
+      return true;
+    case kZstd:
+#ifdef HAS_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    case kLz4:
+#ifdef HAS_LZ4
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+
 void CompressInit(z_stream *strm) {
   strm->zalloc = Z_NULL;
   strm->zfree = Z_NULL;
@@ -675,6 +821,38 @@ bool DecompressPath2File(const string &src, FILE *fdest) {
 }
 
 
+/**
+ * Like DecompressPath2File but for an arbitrary (compressing) algorithm.
+ */
+bool DecompressPath2File(const string &src, FILE *fdest, const Algorithms alg)
+{
+  if (alg == kZlibDefault)
+    return DecompressPath2File(src, fdest);
+
+  FILE *fsrc = fopen(src.c_str(), "r");
+  if (!fsrc)
+    return false;
+
+  Decompressor *decompressor = Decompressor::Construct(alg);
+  if (decompressor == NULL) {
+    fclose(fsrc);
+    return false;
+  }
+  StreamStates stream_state = kStreamIOError;
+  size_t have;
+  unsigned char buf[kBufferSize];
+  while ((have = fread(buf, 1, kBufferSize, fsrc)) > 0) {
+    stream_state = decompressor->InflateToFile(buf, have, fdest);
+    if ((stream_state == kStreamDataError) || (stream_state == kStreamIOError))
+      break;
+  }
+  const bool result = (stream_state == kStreamEnd) && !ferror(fsrc);
+  delete decompressor;
+  fclose(fsrc);
+  return result;
+}
+
+
 bool CompressMem2File(const unsigned char *buf, const size_t size,
                       FILE *fdest, shash::Any *compressed_hash) {
   int z_ret = 0;
@@ -852,12 +1030,48 @@ bool DecompressMem2Mem(const void *buf, const int64_t size,
 }
 
 
+/**
+ * Like DecompressMem2Mem but for an arbitrary (compressing) algorithm.
+ * User of this function has to free out_buf.
+ */
+bool DecompressMem2Mem(const void *buf, const int64_t size,
+                       void **out_buf, uint64_t *out_size,
+                       const Algorithms alg)
+{
+  if (alg == kZlibDefault)
+    return DecompressMem2Mem(buf, size, out_buf, out_size);
+
+  Decompressor *decompressor = Decompressor::Construct(alg);
+  if (decompressor == NULL) {
+    *out_buf = NULL;
+    *out_size = 0;
+    return false;
+  }
+  MemSink sink;
+  const StreamStates stream_state = decompressor->Inflate(buf, size, &sink);
+  delete decompressor;
+  if (stream_state != kStreamEnd) {
+    *out_buf = NULL;
+    *out_size = 0;
+    return false;
+  }
+  sink.Release(out_buf, out_size);
+  return true;
+}
+
+
 //------------------------------------------------------------------------------
 
 
 void Compressor::RegisterPlugins() {
   RegisterPlugin<ZlibCompressor>();
   RegisterPlugin<EchoCompressor>();
+#ifdef HAS_ZSTD
+  RegisterPlugin<ZstdCompressor>();
+#endif
+#ifdef HAS_LZ4
+  RegisterPlugin<Lz4Compressor>();
+#endif
 }
 
 
@@ -979,4 +1193,503 @@ size_t EchoCompressor::DeflateBound(const size_t bytes) {
   return (bytes == 0) ? 1 : bytes;
 }
 
+
+//------------------------------------------------------------------------------
+
+
+#ifdef HAS_ZSTD
+
+bool ZstdCompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kZstd;
+}
+
+
+ZstdCompressor::ZstdCompressor(const Algorithms &alg)
+  : Compressor(alg)
+  , context_(ZSTD_createCCtx())
+  , level_(0)
+  , started_(false)
+{
+  assert(context_ != NULL);
+  SetLevel(kDefaultLevel);
+}
+
+
+void ZstdCompressor::SetLevel(const int level) {
+  assert(!started_);
+  level_ = (level == 0) ? kDefaultLevel : level;
+  assert((level_ >= 1) && (level_ <= ZSTD_maxCLevel()));
+  const size_t retval =
+    ZSTD_CCtx_setParameter(context_, ZSTD_c_compressionLevel, level_);
+  assert(!ZSTD_isError(retval));
+}
+
+
+ZstdCompressor::~ZstdCompressor() {
+  ZSTD_freeCCtx(context_);
+}
+
+
+Compressor* ZstdCompressor::Clone() {
+  // Unlike zlib, there is no way to copy a running zstd stream
+  assert(!started_);
+  ZstdCompressor *clone = new ZstdCompressor(kZstd);
+  clone->SetLevel(level_);
+  return clone;
+}
+
+
+bool ZstdCompressor::Deflate(
+  const bool flush,
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  started_ = true;
+  ZSTD_inBuffer input = { *inbuf, *inbufsize, 0 };
+  ZSTD_outBuffer output = { *outbuf, *outbufsize, 0 };
+  // For ZSTD_e_end, the number of bytes still to be flushed
+  const size_t remaining = ZSTD_compressStream2(
+    context_, &output, &input, flush ? ZSTD_e_end : ZSTD_e_continue);
+  assert(!ZSTD_isError(remaining));
+
+  *outbufsize = output.pos;
+  *inbuf += input.pos;
+  *inbufsize -= input.pos;
+
+  return flush ? (remaining == 0) : (*inbufsize == 0);
+}
+
+
+size_t ZstdCompressor::DeflateBound(const size_t bytes) {
+  return ZSTD_compressBound(bytes);
+}
+
+#endif  // HAS_ZSTD
+
+
+//------------------------------------------------------------------------------
+
+
+#ifdef HAS_LZ4
+
+const size_t Lz4Compressor::kBlockSize;
+
+
+static void InitLz4Preferences(LZ4F_preferences_t *preferences) {
+  memset(preferences, 0, sizeof(*preferences));
+  preferences->frameInfo.blockSizeID = LZ4F_max64KB;
+}
+
+
+bool Lz4Compressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kLz4;
+}
+
+
+Lz4Compressor::Lz4Compressor(const Algorithms &alg)
+  : Compressor(alg)
+  , context_(NULL)
+  , started_(false)
+  , finished_(false)
+  , pending_size_(0)
+  , pending_pos_(0)
+{
+  const size_t retval = LZ4F_createCompressionContext(&context_, LZ4F_VERSION);
+  assert(!LZ4F_isError(retval));
+  LZ4F_preferences_t preferences;
+  InitLz4Preferences(&preferences);
+  // Large enough for the frame header, one block update, and the frame footer
+  pending_capacity_ = std::max(
+    LZ4F_compressBound(kBlockSize, &preferences),
+    static_cast<size_t>(LZ4F_HEADER_SIZE_MAX));
+  pending_ = static_cast<unsigned char *>(smalloc(pending_capacity_));
+}
+
+
+Lz4Compressor::~Lz4Compressor() {
+  LZ4F_freeCompressionContext(context_);
+  free(pending_);
+}
+
+
+Compressor* Lz4Compressor::Clone() {
+  assert(!started_);
+  return new Lz4Compressor(kLz4);
+}
+
+
+/**
+ * Copies as much as possible of the compressed data that did not yet fit into
+ * an output buffer.  Returns the number of bytes copied.
+ */
+size_t Lz4Compressor::DrainPending(unsigned char *outbuf, size_t outbufsize) {
+  const size_t nbytes = std::min(outbufsize, pending_size_ - pending_pos_);
+  memcpy(outbuf, pending_ + pending_pos_, nbytes);
+  pending_pos_ += nbytes;
+  return nbytes;
+}
+
+
+bool Lz4Compressor::Deflate(
+  const bool flush,
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  size_t out_pos = 0;
+  while (true) {
+    out_pos += DrainPending(*outbuf + out_pos, *outbufsize - out_pos);
+    if (pending_pos_ < pending_size_)
+      break;
+
+    size_t retval;
+    if (!started_) {
+      LZ4F_preferences_t preferences;
+      InitLz4Preferences(&preferences);
+      retval = LZ4F_compressBegin(context_, pending_, pending_capacity_,
+                                  &preferences);
+      started_ = true;
+    } else if (*inbufsize > 0) {
+      const size_t nbytes = std::min(*inbufsize, kBlockSize);
+      retval = LZ4F_compressUpdate(context_, pending_, pending_capacity_,
+                                   *inbuf, nbytes, NULL);
+      *inbuf += nbytes;
+      *inbufsize -= nbytes;
+    } else if (flush && !finished_) {
+      retval = LZ4F_compressEnd(context_, pending_, pending_capacity_, NULL);
+      finished_ = true;
+    } else {
+      break;
+    }
+    assert(!LZ4F_isError(retval));
+    pending_size_ = retval;
+    pending_pos_ = 0;
+  }
+  *outbufsize = out_pos;
+
+  if (pending_pos_ < pending_size_)
+    return false;
+  return flush ? finished_ : (*inbufsize == 0);
+}
+
+
+size_t Lz4Compressor::DeflateBound(const size_t bytes) {
+  LZ4F_preferences_t preferences;
+  InitLz4Preferences(&preferences);
+  return LZ4F_compressFrameBound(bytes, &preferences);
+}
+
+#endif  // HAS_LZ4
+
+
+//------------------------------------------------------------------------------
+
+
+SegmentCompressor::SegmentCompressor(
+  const Algorithms alg,
+  const int level,
+  const bool is_first)
+  : algorithm_(alg)
+  , compressor_(NULL)
+  , header_pending_(is_first)
+  , checksum_(adler32(0L, Z_NULL, 0))
+  , size_(0)
+{
+  if (algorithm_ != kZlibDefault) {
+    compressor_ = Compressor::Construct(algorithm_);
+    assert(compressor_ != NULL);
+    compressor_->SetLevel(level);
+    return;
+  }
+  stream_.zalloc = Z_NULL;
+  stream_.zfree = Z_NULL;
+  stream_.opaque = Z_NULL;
+  stream_.next_in = Z_NULL;
+  stream_.avail_in = 0;
+  // Negative window bits: raw deflate stream without zlib header and trailer
+  int retcode = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                             -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  assert(retcode == Z_OK);
+}
+
+
+SegmentCompressor::~SegmentCompressor() {
+  if (compressor_ != NULL) {
+    delete compressor_;
+    return;
+  }
+  // Returns Z_DATA_ERROR for segments that are not the last one
+  deflateEnd(&stream_);
+}
+
+
+bool SegmentCompressor::Deflate(
+  const bool flush, const bool is_last,
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  if (compressor_ != NULL) {
+    size_ += *inbufsize;
+    bool done = compressor_->Deflate(flush, inbuf, inbufsize,
+                                     outbuf, outbufsize);
+    size_ -= *inbufsize;
+    return done;
+  }
+
+  size_t header_size = 0;
+  if (header_pending_) {
+    // Same header as written by deflateInit()
+    if (*outbufsize < 2) {
+      *outbufsize = 0;
+      return false;
+    }
+    (*outbuf)[0] = 0x78;
+    (*outbuf)[1] = 0x9c;
+    header_size = 2;
+    header_pending_ = false;
+  }
+
+  unsigned char *in = *inbuf;
+  stream_.avail_in = *inbufsize;
+  stream_.next_in = *inbuf;
+  stream_.avail_out = *outbufsize - header_size;
+  stream_.next_out = *outbuf + header_size;
+  const int flush_int =
+    flush ? (is_last ? Z_FINISH : Z_SYNC_FLUSH) : Z_NO_FLUSH;
+
+  int retcode = deflate(&stream_, flush_int);
+  // Z_BUF_ERROR: repeated Z_SYNC_FLUSH, nothing left to do
+  assert(retcode == Z_OK || retcode == Z_STREAM_END || retcode == Z_BUF_ERROR);
+
+  *outbufsize -= stream_.avail_out;
+  *inbuf = stream_.next_in;
+  *inbufsize = stream_.avail_in;
+  const size_t nbytes_in = stream_.next_in - in;
+  // adler32() returns the initial value for a NULL buffer
+  if (nbytes_in > 0) {
+    checksum_ = adler32(checksum_, in, nbytes_in);
+    size_ += nbytes_in;
+  }
+
+  switch (flush_int) {
+    case Z_NO_FLUSH:
+      return stream_.avail_in == 0;
+    case Z_SYNC_FLUSH:
+      return (stream_.avail_in == 0) && (stream_.avail_out > 0);
+    default:
+      return retcode == Z_STREAM_END;
+  }
+}
+
+
+uint32_t SegmentCompressor::CombineChecksums(
+  const Algorithms alg,
+  const uint32_t checksum1,
+  const uint32_t checksum2,
+  const uint64_t size2)
+{
+  if (alg != kZlibDefault)
+    return 0;
+  return adler32_combine(checksum1, checksum2, static_cast<z_off_t>(size2));
+}
+
+
+unsigned SegmentCompressor::WriteTrailer(
+  const Algorithms alg,
+  const uint32_t checksum,
+  unsigned char *buf)
+{
+  if (alg != kZlibDefault)
+    return 0;
+  // Adler-32 in network byte order, as in RFC 1950
+  buf[0] = (checksum >> 24) & 0xff;
+  buf[1] = (checksum >> 16) & 0xff;
+  buf[2] = (checksum >> 8) & 0xff;
+  buf[3] = checksum & 0xff;
+  return 4;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+void Decompressor::RegisterPlugins() {
+  RegisterPlugin<ZlibDecompressor>();
+#ifdef HAS_ZSTD
+  RegisterPlugin<ZstdDecompressor>();
+#endif
+#ifdef HAS_LZ4
+  RegisterPlugin<Lz4Decompressor>();
+#endif
+}
+
+
+StreamStates Decompressor::InflateToFile(
+  const void *buf,
+  const int64_t size,
+  FILE *f)
+{
+  FileSink sink(f);
+  return Inflate(buf, size, &sink);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+bool ZlibDecompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kZlibDefault;
+}
+
+
+ZlibDecompressor::ZlibDecompressor(const Algorithms &alg)
+  : Decompressor(alg)
+{
+  DecompressInit(&stream_);
+}
+
+
+ZlibDecompressor::~ZlibDecompressor() {
+  DecompressFini(&stream_);
+}
+
+
+StreamStates ZlibDecompressor::Inflate(
+  const void *buf,
+  const int64_t size,
+  cvmfs::Sink *sink)
+{
+  return DecompressZStream2Sink(buf, size, &stream_, sink);
+}
+
+
+void ZlibDecompressor::Reset() {
+  const int retval = inflateReset(&stream_);
+  assert(retval == Z_OK);
+}
+
+
+//------------------------------------------------------------------------------
+
+#ifdef HAS_ZSTD
+
+bool ZstdDecompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kZstd;
+}
+
+
+ZstdDecompressor::ZstdDecompressor(const Algorithms &alg)
+  : Decompressor(alg)
+  , context_(ZSTD_createDCtx())
+  , end_of_frame_(false)
+{
+  assert(context_ != NULL);
+}
+
+
+ZstdDecompressor::~ZstdDecompressor() {
+  ZSTD_freeDCtx(context_);
+}
+
+
+StreamStates ZstdDecompressor::Inflate(
+  const void *buf,
+  const int64_t size,
+  cvmfs::Sink *sink)
+{
+  unsigned char out[kZChunk];
+  ZSTD_inBuffer input = { buf, static_cast<size_t>(size), 0 };
+  ZSTD_outBuffer output;
+  do {
+    output.dst = out;
+    output.size = kZChunk;
+    output.pos = 0;
+    const size_t input_pos = input.pos;
+    const size_t retval = ZSTD_decompressStream(context_, &output, &input);
+    if (ZSTD_isError(retval))
+      return kStreamDataError;
+    int64_t written = sink->Write(out, output.pos);
+    if ((written < 0) || (static_cast<uint64_t>(written) != output.pos))
+      return kStreamIOError;
+    // Zero means that the frame is completely decoded and flushed.  A call
+    // without progress after the end of the frame returns the header size of
+    // a potential next frame, which must not reset the state.
+    if ((output.pos > 0) || (input.pos > input_pos))
+      end_of_frame_ = (retval == 0);
+  } while ((input.pos < input.size) || (output.pos == output.size));
+
+  return end_of_frame_ ? kStreamEnd : kStreamContinue;
+}
+
+
+void ZstdDecompressor::Reset() {
+  ZSTD_DCtx_reset(context_, ZSTD_reset_session_only);
+  end_of_frame_ = false;
+}
+
+#endif  // HAS_ZSTD
+
+
+//------------------------------------------------------------------------------
+
+#ifdef HAS_LZ4
+
+bool Lz4Decompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kLz4;
+}
+
+
+Lz4Decompressor::Lz4Decompressor(const Algorithms &alg)
+  : Decompressor(alg)
+  , context_(NULL)
+  , end_of_frame_(false)
+{
+  const size_t retval =
+    LZ4F_createDecompressionContext(&context_, LZ4F_VERSION);
+  assert(!LZ4F_isError(retval));
+}
+
+
+Lz4Decompressor::~Lz4Decompressor() {
+  LZ4F_freeDecompressionContext(context_);
+}
+
+
+StreamStates Lz4Decompressor::Inflate(
+  const void *buf,
+  const int64_t size,
+  cvmfs::Sink *sink)
+{
+  unsigned char out[kZChunk];
+  const unsigned char *in = static_cast<const unsigned char *>(buf);
+  size_t remaining = size;
+  size_t out_size;
+  do {
+    size_t in_size = remaining;
+    out_size = kZChunk;
+    // Returns a hint for the next input size, zero at the end of the frame
+    const size_t retval =
+      LZ4F_decompress(context_, out, &out_size, in, &in_size, NULL);
+    if (LZ4F_isError(retval))
+      return kStreamDataError;
+    in += in_size;
+    remaining -= in_size;
+    int64_t written = sink->Write(out, out_size);
+    if ((written < 0) || (static_cast<uint64_t>(written) != out_size))
+      return kStreamIOError;
+    if ((in_size == 0) && (out_size == 0))
+      break;
+    end_of_frame_ = (retval == 0);
+  } while ((remaining > 0) || (out_size == kZChunk));
+
+  return end_of_frame_ ? kStreamEnd : kStreamContinue;
+}
+
+
+void Lz4Decompressor::Reset() {
+  LZ4F_resetDecompressionContext(context_);
+  end_of_frame_ = false;
+}
+
+#endif  // HAS_LZ4
+
 }  // namespace zlib
@@ -14,12 +14,22 @@
 #include "duplex_zlib.h"
 #include "sink.h"
 #include "util/plugin.h"
+#include "util/single_copy.h"
 
 namespace shash {
 struct Any;
 class ContextPtr;
 }
 
+#ifdef HAS_ZSTD
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+#endif
+#ifdef HAS_LZ4
+struct LZ4F_cctx_s;
+struct LZ4F_dctx_s;
+#endif
+
 bool CopyPath2Path(const std::string &src, const std::string &dest);
 bool CopyPath2File(const std::string &src, FILE *fdest);
 bool CopyMem2Path(const unsigned char *buffer, const unsigned buffer_size,
@@ -40,10 +50,13 @@ enum StreamStates {
   kStreamEnd,
 };
 
-// Do not change order of algorithms.  Used as flags in the catalog
+// Do not change order of algorithms.  Used as flags in the catalog.  Zstd and
+// LZ4 are only available if cvmfs is built with ENABLE_ZSTD and ENABLE_LZ4.
 enum Algorithms {
   kZlibDefault = 0,
   kNoCompression,
+  kZstd,
+  kLz4,
 };
 
 /**
@@ -91,6 +104,12 @@ class Compressor: public PolymorphicConstruction<Compressor, Algorithms> {
   virtual size_t DeflateBound(const size_t bytes) = 0;
   virtual Compressor* Clone() = 0;
 
+  /**
+   * Sets an algorithm specific compression level before the first Deflate().
+   * Zero selects the default level.  Ignored by algorithms without levels.
+   */
+  virtual void SetLevel(const int /* level */) { }
+
   static void RegisterPlugins();
 };
 
@@ -125,8 +144,199 @@ class EchoCompressor: public Compressor {
 };
 
 
-Algorithms ParseCompressionAlgorithm(const std::string &algorithm_option);
+#ifdef HAS_ZSTD
+/**
+ * Zstandard streaming compression.  The compression level is set per instance,
+ * e.g. from the "zstd:<level>" algorithm option.
+ */
+class ZstdCompressor: public Compressor {
+ public:
+  static const int kDefaultLevel = 3;
+
+  explicit ZstdCompressor(const Algorithms &alg);
+  ~ZstdCompressor();
+
+  bool Deflate(const bool flush,
+               unsigned char **inbuf, size_t *inbufsize,
+               unsigned char **outbuf, size_t *outbufsize);
+  size_t DeflateBound(const size_t bytes);
+  Compressor* Clone();
+  void SetLevel(const int level);
+  int level() const { return level_; }
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  ZSTD_CCtx_s *context_;
+  int level_;
+  bool started_;
+};
+#endif  // HAS_ZSTD
+
+
+#ifdef HAS_LZ4
+/**
+ * LZ4 frame compression.  Trades compression ratio for very cheap
+ * decompression on the client.  The frame API produces output in whole blocks,
+ * so compressed data that does not fit into the caller's output buffer is kept
+ * back and handed out on the next call.
+ */
+class Lz4Compressor: public Compressor {
+ public:
+  static const size_t kBlockSize = 64 * 1024;
+
+  explicit Lz4Compressor(const Algorithms &alg);
+  ~Lz4Compressor();
+
+  bool Deflate(const bool flush,
+               unsigned char **inbuf, size_t *inbufsize,
+               unsigned char **outbuf, size_t *outbufsize);
+  size_t DeflateBound(const size_t bytes);
+  Compressor* Clone();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  size_t DrainPending(unsigned char *outbuf, size_t outbufsize);
+
+  LZ4F_cctx_s *context_;
+  bool started_;
+  bool finished_;
+  unsigned char *pending_;
+  size_t pending_capacity_;
+  size_t pending_size_;
+  size_t pending_pos_;
+};
+#endif  // HAS_LZ4
+
+
+/**
+ * Compresses one segment of a stream independently of the other segments, so
+ * that the segments of a large chunk can be compressed in parallel (see
+ * TaskChunk).  The concatenation of the compressed segments followed by the
+ * trailer is a regular stream of the algorithm.  For zstd and lz4, every
+ * segment is a frame of its own.  For zlib, the segments are raw deflate
+ * streams flushed to a byte boundary, the first segment starts with the zlib
+ * header and the trailer carries the Adler-32 checksum of all segments.  A
+ * single segment results in the same output as the Compressor.
+ */
+class SegmentCompressor : SingleCopy {
+ public:
+  static const unsigned kMaxTrailerSize = 4;
+
+  SegmentCompressor(const Algorithms alg, const int level,
+                    const bool is_first);
+  ~SegmentCompressor();
+
+  /**
+   * Like Compressor::Deflate().  A flush ends the segment; unless is_last is
+   * set, the stream remains open for the following segment.
+   */
+  bool Deflate(const bool flush, const bool is_last,
+               unsigned char **inbuf, size_t *inbufsize,
+               unsigned char **outbuf, size_t *outbufsize);
+
+  /**
+   * Checksum and size of the uncompressed input of the segment
+   */
+  uint32_t checksum() const { return checksum_; }
+  uint64_t size() const { return size_; }
+
+  static uint32_t CombineChecksums(const Algorithms alg,
+                                   const uint32_t checksum1,
+                                   const uint32_t checksum2,
+                                   const uint64_t size2);
+  /**
+   * Writes the trailer of the stream into buf, which must have space for
+   * kMaxTrailerSize bytes.  Returns the number of bytes written.
+   */
+  static unsigned WriteTrailer(const Algorithms alg, const uint32_t checksum,
+                               unsigned char *buf);
+
+ private:
+  Algorithms algorithm_;
+  /**
+   * Used for all algorithms but zlib, which needs a raw deflate stream
+   */
+  Compressor *compressor_;
+  z_stream stream_;
+  bool header_pending_;
+  uint32_t checksum_;
+  uint64_t size_;
+};
+
+
+/**
+ * Streaming decompression counterpart of the Compressor.  Used by the download
+ * manager for the algorithms that are not handled by the z_stream fast path.
+ * Inflate() can be called repeatedly with consecutive pieces of the compressed
+ * stream; it returns kStreamEnd once the end of the stream has been seen.
+ */
+class Decompressor: public PolymorphicConstruction<Decompressor, Algorithms> {
+ public:
+  explicit Decompressor(const Algorithms & /* alg */) { }
+  virtual ~Decompressor() { }
+
+  virtual StreamStates Inflate(const void *buf, const int64_t size,
+                               cvmfs::Sink *sink) = 0;
+  /**
+   * Discards the state of a partially decompressed stream, e.g. before a
+   * download is retried.
+   */
+  virtual void Reset() = 0;
+  StreamStates InflateToFile(const void *buf, const int64_t size, FILE *f);
+
+  static void RegisterPlugins();
+};
+
+
+class ZlibDecompressor: public Decompressor {
+ public:
+  explicit ZlibDecompressor(const Algorithms &alg);
+  ~ZlibDecompressor();
+  StreamStates Inflate(const void *buf, const int64_t size, cvmfs::Sink *sink);
+  void Reset();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  z_stream stream_;
+};
+
+
+#ifdef HAS_ZSTD
+class ZstdDecompressor: public Decompressor {
+ public:
+  explicit ZstdDecompressor(const Algorithms &alg);
+  ~ZstdDecompressor();
+  StreamStates Inflate(const void *buf, const int64_t size, cvmfs::Sink *sink);
+  void Reset();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  ZSTD_DCtx_s *context_;
+  bool end_of_frame_;
+};
+#endif  // HAS_ZSTD
+
+
+#ifdef HAS_LZ4
+class Lz4Decompressor: public Decompressor {
+ public:
+  explicit Lz4Decompressor(const Algorithms &alg);
+  ~Lz4Decompressor();
+  StreamStates Inflate(const void *buf, const int64_t size, cvmfs::Sink *sink);
+  void Reset();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  LZ4F_dctx_s *context_;
+  bool end_of_frame_;
+};
+#endif  // HAS_LZ4
+
+
+Algorithms ParseCompressionAlgorithm(const std::string &algorithm_option,
+                                     int *level = NULL);
 std::string AlgorithmName(const zlib::Algorithms alg);
+bool IsAlgorithmAvailable(const zlib::Algorithms alg);
 
 
 void CompressInit(z_stream *strm);
@@ -157,6 +367,8 @@ bool CompressPath2File(const std::string &src, FILE *fdest,
                        shash::Any *compressed_hash);
 bool DecompressFile2File(FILE *fsrc, FILE *fdest);
 bool DecompressPath2File(const std::string &src, FILE *fdest);
+bool DecompressPath2File(const std::string &src, FILE *fdest,
+                         const Algorithms alg);
 
 bool CompressMem2File(const unsigned char *buf, const size_t size,
                       FILE *fdest, shash::Any *compressed_hash);
@@ -166,6 +378,9 @@ bool CompressMem2Mem(const void *buf, const int64_t size,
                      void **out_buf, uint64_t *out_size);
 bool DecompressMem2Mem(const void *buf, const int64_t size,
                        void **out_buf, uint64_t *out_size);
+bool DecompressMem2Mem(const void *buf, const int64_t size,
+                       void **out_buf, uint64_t *out_size,
+                       const Algorithms alg);
 
 }  // namespace zlib
 
@@ -55,6 +55,7 @@
 #include "duplex_curl.h"
 #include "hash.h"
 #include "logging.h"
+#include "platform.h"
 #include "prng.h"
 #include "sanitizer.h"
 #include "smalloc.h"
@@ -301,9 +302,11 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
 
   if (info->destination == kDestinationSink) {
     if (info->compressed) {
-      zlib::StreamStates retval =
+      zlib::StreamStates retval = (info->decompressor == NULL) ?
         zlib::DecompressZStream2Sink(ptr, static_cast<int64_t>(num_bytes),
-                                     &info->zstream, info->destination_sink);
+                                     &info->zstream, info->destination_sink) :
+        info->decompressor->Inflate(ptr, static_cast<int64_t>(num_bytes),
+                                    info->destination_sink);
       if (retval == zlib::kStreamDataError) {
         LogCvmfs(kLogDownload, kLogSyslogErr, "failed to decompress %s",
                  info->url->c_str());
@@ -349,9 +352,11 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
     if (info->compressed) {
       // LogCvmfs(kLogDownload, kLogDebug, "REMOVE-ME: writing %d bytes for %s",
       //          num_bytes, info->url->c_str());
-      zlib::StreamStates retval =
+      zlib::StreamStates retval = (info->decompressor == NULL) ?
         zlib::DecompressZStream2File(ptr, static_cast<int64_t>(num_bytes),
-                                     &info->zstream, info->destination_file);
+                                     &info->zstream, info->destination_file) :
+        info->decompressor->InflateToFile(ptr, static_cast<int64_t>(num_bytes),
+                                          info->destination_file);
       if (retval == zlib::kStreamDataError) {
         LogCvmfs(kLogDownload, kLogSyslogErr, "failed to decompress %s",
                  info->url->c_str());
@@ -558,14 +563,8 @@ void *DownloadManager::MainDownload(void *data) {
       ReadPipe(download_mgr->pipe_jobs_[0], &info, sizeof(info));
       if (!still_running)
         gettimeofday(&timeval_start, NULL);
-      CURL *handle = download_mgr->AcquireCurlHandle();
-      download_mgr->InitializeRequest(info, handle);
-      download_mgr->SetUrlOptions(info);
-      curl_multi_add_handle(download_mgr->curl_multi_, handle);
-      curl_multi_socket_action(download_mgr->curl_multi_,
-                               CURL_SOCKET_TIMEOUT,
-                               0,
-                               &still_running);
+      download_mgr->pending_jobs_[info->priority].push_back(info);
+      download_mgr->ScheduleJobs(&still_running);
     }
 
     // Activity on curl sockets
@@ -619,6 +618,8 @@ void *DownloadManager::MainDownload(void *data) {
                                    &still_running);
         } else {
           // Return easy handle into pool and write result back
+          download_mgr->num_active_jobs_--;
+          download_mgr->UpdateConcurrency(easy_handle);
           download_mgr->ReleaseCurlHandle(easy_handle);
 
           WritePipe(info->wait_at[1], &info->error_code,
@@ -626,6 +627,9 @@ void *DownloadManager::MainDownload(void *data) {
         }
       }
     }
+
+    // Freed connections are handed to waiting jobs
+    download_mgr->ScheduleJobs(&still_running);
   }
 
   for (set<CURL *>::iterator i = download_mgr->pool_handles_inuse_->begin(),
@@ -636,6 +640,7 @@ void *DownloadManager::MainDownload(void *data) {
   }
   download_mgr->pool_handles_inuse_->clear();
   free(download_mgr->watch_fds_);
+  download_mgr->CancelPendingJobs();
 
   LogCvmfs(kLogDownload, kLogDebug, "download I/O thread terminated");
   return NULL;
@@ -788,6 +793,121 @@ string DownloadManager::ProxyInfo::Print() {
 }
 
 
+/**
+ * Takes the next waiting job in the order of the priority classes if the
+ * concurrency limit allows.  Bulk jobs cannot take the last quarter of the
+ * connections, which remains available for interactive jobs.
+ */
+JobInfo *DownloadManager::PopNextJob() {
+  if (num_active_jobs_ >= concurrency_limit_)
+    return NULL;
+  const unsigned reserved =
+    (concurrency_limit_ > 1) ? std::max(1U, concurrency_limit_ / 4) : 0;
+  for (unsigned p = 0; p < kNumPriorities; ++p) {
+    if (pending_jobs_[p].empty())
+      continue;
+    if ((p != kPriorityInteractive) &&
+        (num_active_jobs_ + reserved >= concurrency_limit_))
+    {
+      return NULL;
+    }
+    JobInfo *info = pending_jobs_[p].front();
+    pending_jobs_[p].pop_front();
+    return info;
+  }
+  return NULL;
+}
+
+
+void DownloadManager::ScheduleJobs(int *still_running) {
+  JobInfo *info;
+  while ((info = PopNextJob()) != NULL)
+    StartJob(info, still_running);
+}
+
+
+void DownloadManager::StartJob(JobInfo *info, int *still_running) {
+  const uint64_t now = platform_monotonic_time_ns();
+  if (info->timestamp_queued_ns > 0) {
+    perf::Xadd(counters_->sz_wait_time[info->priority],
+               (now - info->timestamp_queued_ns) / (1000 * 1000));
+  }
+
+  num_active_jobs_++;
+  CURL *handle = AcquireCurlHandle();
+  InitializeRequest(info, handle);
+  SetUrlOptions(info);
+  curl_multi_add_handle(curl_multi_, handle);
+  curl_multi_socket_action(curl_multi_,
+                           CURL_SOCKET_TIMEOUT,
+                           0,
+                           still_running);
+}
+
+
+/**
+ * Hill climbing on the download throughput.  Windows in which the pool was not
+ * saturated are ignored because their throughput reflects the demand rather
+ * than the capacity of the network and the servers.  The limit starts at the
+ * pool size and is only lowered once the throughput drops.  It does not fall
+ * below a quarter of the pool size.
+ */
+void DownloadManager::UpdateConcurrency(CURL *handle) {
+  double val;
+  uint64_t bytes = 0;
+  if (curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD, &val) == CURLE_OK)
+    bytes = static_cast<uint64_t>(val);
+  AdjustConcurrency(bytes, platform_monotonic_time_ns());
+}
+
+
+void DownloadManager::AdjustConcurrency(uint64_t bytes, uint64_t now_ns) {
+  window_bytes_ += bytes;
+  for (unsigned p = 0; p < kNumPriorities; ++p) {
+    if (!pending_jobs_[p].empty())
+      window_saturated_ = true;
+  }
+
+  if (now_ns - window_start_ns_ < kConcurrencyWindowNs)
+    return;
+
+  if (window_saturated_) {
+    const double throughput = static_cast<double>(window_bytes_) /
+                              static_cast<double>(now_ns - window_start_ns_);
+    if (throughput < 0.9 * last_throughput_)
+      concurrency_step_ = -concurrency_step_;
+    const unsigned min_limit = std::max(1U, pool_max_handles_ / 4);
+    const unsigned max_limit = std::max(1U, pool_max_handles_);
+    if ((concurrency_step_ > 0) && (concurrency_limit_ < max_limit))
+      concurrency_limit_++;
+    if ((concurrency_step_ < 0) && (concurrency_limit_ > min_limit))
+      concurrency_limit_--;
+    last_throughput_ = throughput;
+    counters_->n_concurrency_limit->Set(concurrency_limit_);
+  }
+  window_start_ns_ = now_ns;
+  window_bytes_ = 0;
+  window_saturated_ = false;
+}
+
+
+/**
+ * Jobs that did not get a connection before the I/O thread terminates fail
+ * instead of leaving their callers blocked.
+ */
+void DownloadManager::CancelPendingJobs() {
+  for (unsigned p = 0; p < kNumPriorities; ++p) {
+    while (!pending_jobs_[p].empty()) {
+      JobInfo *info = pending_jobs_[p].front();
+      pending_jobs_[p].pop_front();
+      info->error_code = kFailOther;
+      WritePipe(info->wait_at[1], &info->error_code,
+                sizeof(info->error_code));
+    }
+  }
+}
+
+
 /**
  * Gets an idle CURL handle from the pool. Creates a new one and adds it to
  * the pool if necessary.
@@ -853,7 +973,12 @@ void DownloadManager::InitializeRequest(JobInfo *info, CURL *handle) {
     info->nocache = false;
   }
   if (info->compressed) {
-    zlib::DecompressInit(&(info->zstream));
+    if (info->compression_alg == zlib::kZlibDefault) {
+      zlib::DecompressInit(&(info->zstream));
+    } else {
+      info->decompressor = zlib::Decompressor::Construct(info->compression_alg);
+      assert(info->decompressor != NULL);
+    }
   }
   if (info->expected_hash) {
     assert(info->hash_context.buffer != NULL);
@@ -1254,7 +1379,7 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
         bool retval = zlib::DecompressMem2Mem(
           info->destination_mem.data,
           static_cast<int64_t>(info->destination_mem.pos),
-          &buf, &size);
+          &buf, &size, info->compression_alg);
         if (retval) {
           free(info->destination_mem.data);
           info->destination_mem.data = static_cast<char *>(buf);
@@ -1423,7 +1548,9 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     }
     if (info->expected_hash)
       shash::Init(info->hash_context);
-    if (info->compressed)
+    if (info->decompressor != NULL)
+      info->decompressor->Reset();
+    else if (info->compressed)
       zlib::DecompressInit(&info->zstream);
     SetRegularCache(info);
 
@@ -1490,8 +1617,12 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     info->destination_file = NULL;
   }
 
-  if (info->compressed)
+  if (info->decompressor != NULL) {
+    delete info->decompressor;
+    info->decompressor = NULL;
+  } else if (info->compressed) {
     zlib::DecompressFini(&info->zstream);
+  }
 
   if (info->headers) {
     header_lists_->PutList(info->headers);
@@ -1513,6 +1644,13 @@ DownloadManager::DownloadManager() {
   pipe_terminate_[0] = pipe_terminate_[1] = -1;
 
   pipe_jobs_[0] = pipe_jobs_[1] = -1;
+  num_active_jobs_ = 0;
+  concurrency_limit_ = 0;
+  concurrency_step_ = 1;
+  window_start_ns_ = 0;
+  window_bytes_ = 0;
+  window_saturated_ = false;
+  last_throughput_ = 0.0;
   watch_fds_ = NULL;
   watch_fds_size_ = 0;
   watch_fds_inuse_ = 0;
@@ -1621,6 +1759,15 @@ void DownloadManager::Init(const unsigned max_pool_handles,
 
   counters_ = new Counters(statistics);
 
+  num_active_jobs_ = 0;
+  concurrency_limit_ = std::max(1U, pool_max_handles_);
+  concurrency_step_ = 1;
+  window_start_ns_ = platform_monotonic_time_ns();
+  window_bytes_ = 0;
+  window_saturated_ = false;
+  last_throughput_ = 0.0;
+  counters_->n_concurrency_limit->Set(concurrency_limit_);
+
   user_agent_ = NULL;
   InitHeaders();
 
@@ -1718,6 +1865,15 @@ Failures DownloadManager::Fetch(JobInfo *info) {
   assert(info != NULL);
   assert(info->url != NULL);
 
+  if (info->compressed && !zlib::IsAlgorithmAvailable(info->compression_alg)) {
+    LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+             "%s compression is not supported by this build (%s)",
+             zlib::AlgorithmName(info->compression_alg).c_str(),
+             info->url->c_str());
+    info->error_code = kFailBadData;
+    return kFailBadData;
+  }
+
   Failures result;
   result = PrepareDownloadDestination(info);
   if (result != kFailOk)
@@ -1751,6 +1907,7 @@ Failures DownloadManager::Fetch(JobInfo *info) {
 
     // LogCvmfs(kLogDownload, kLogDebug, "send job to thread, pipe %d %d",
     //          info->wait_at[0], info->wait_at[1]);
+    info->timestamp_queued_ns = platform_monotonic_time_ns();
     // NOLINTNEXTLINE(bugprone-sizeof-expression)
     WritePipe(pipe_jobs_[1], &info, sizeof(info));
     ReadPipe(info->wait_at[0], &result, sizeof(result));
@@ -11,6 +11,7 @@
 #include <unistd.h>
 
 #include <cstdio>
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -121,6 +122,17 @@ enum Destination {
 };  // Destination
 
 
+/**
+ * Jobs of a higher priority class are admitted first to the connection pool.
+ * Part of the pool is reserved for interactive jobs.
+ */
+enum JobPriority {
+  kPriorityInteractive = 0,  // a user waits for the result
+  kPriorityBulk,  // background transfers, e.g. replication
+  kNumPriorities
+};
+
+
 struct Counters {
   perf::Counter *sz_transferred_bytes;
   perf::Counter *sz_transfer_time;  // measured in miliseconds
@@ -128,6 +140,9 @@ struct Counters {
   perf::Counter *n_retries;
   perf::Counter *n_proxy_failover;
   perf::Counter *n_host_failover;
+  // Time jobs spend waiting for a connection (miliseconds), per priority class
+  perf::Counter *sz_wait_time[kNumPriorities];
+  perf::Counter *n_concurrency_limit;
 
   explicit Counters(perf::StatisticsTemplate statistics) {
     sz_transferred_bytes = statistics.RegisterTemplated("sz_transferred_bytes",
@@ -141,6 +156,13 @@ struct Counters {
         "Number of proxy failovers");
     n_host_failover = statistics.RegisterTemplated("n_host_failover",
         "Number of host failovers");
+    sz_wait_time[kPriorityInteractive] = statistics.RegisterTemplated(
+        "sz_wait_time_interactive",
+        "Queue wait time of interactive jobs (miliseconds)");
+    sz_wait_time[kPriorityBulk] = statistics.RegisterTemplated(
+        "sz_wait_time_bulk", "Queue wait time of bulk jobs (miliseconds)");
+    n_concurrency_limit = statistics.RegisterTemplated("n_concurrency_limit",
+        "Current limit of parallel transfers");
   }
 };  // Counters
 
@@ -170,6 +192,9 @@ struct JobInfo {
   cvmfs::Sink *destination_sink;
   const shash::Any *expected_hash;
   const std::string *extra_info;
+  JobPriority priority;
+  // Only relevant if compressed is set
+  zlib::Algorithms compression_alg;
 
   // Allow byte ranges to be specified.
   off_t range_offset;
@@ -195,10 +220,13 @@ struct JobInfo {
     destination_sink = NULL;
     expected_hash = NULL;
     extra_info = NULL;
+    priority = kPriorityInteractive;
+    compression_alg = zlib::kZlibDefault;
 
     curl_handle = NULL;
     headers = NULL;
     memset(&zstream, 0, sizeof(zstream));
+    decompressor = NULL;
     info_header = NULL;
     wait_at[0] = wait_at[1] = -1;
     nocache = false;
@@ -210,6 +238,7 @@ struct JobInfo {
     range_offset = -1;
     range_size = -1;
     http_code = -1;
+    timestamp_queued_ns = 0;
   }
 
   // One constructor per destination + head request
@@ -282,6 +311,7 @@ struct JobInfo {
   curl_slist *headers;
   char *info_header;
   z_stream zstream;
+  zlib::Decompressor *decompressor;  ///< Used for non-zlib algorithms
   shash::ContextPtr hash_context;
   int wait_at[2];  /**< Pipe used for the return value */
   std::string proxy;
@@ -293,6 +323,7 @@ struct JobInfo {
   unsigned char num_retries;
   unsigned backoff_ms;
   unsigned int current_host_chain_index;
+  uint64_t timestamp_queued_ns;
 };  // JobInfo
 
 
@@ -350,6 +381,8 @@ class CredentialsAttachment {
 class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
   FRIEND_TEST(T_Download, ValidateGeoReply);
   FRIEND_TEST(T_Download, StripDirect);
+  FRIEND_TEST(T_Download, ReservedInteractiveSlots);
+  FRIEND_TEST(T_Download, AdaptConcurrency);
 
  public:
   struct ProxyInfo {
@@ -392,6 +425,8 @@ class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
   static const unsigned kDnsDefaultRetries = 1;
   static const unsigned kDnsDefaultTimeoutMs = 3000;
   static const unsigned kProxyMapScale = 16;
+  // Throughput is compared between time windows of this length
+  static const uint64_t kConcurrencyWindowNs = 1000ULL * 1000ULL * 1000ULL;
 
   DownloadManager();
   ~DownloadManager();
@@ -479,6 +514,12 @@ class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
   void SetUrlOptions(JobInfo *info);
   bool ValidateProxyIpsUnlocked(const std::string &url, const dns::Host &host);
   void UpdateStatistics(CURL *handle);
+  JobInfo *PopNextJob();
+  void ScheduleJobs(int *still_running);
+  void StartJob(JobInfo *info, int *still_running);
+  void UpdateConcurrency(CURL *handle);
+  void AdjustConcurrency(uint64_t bytes, uint64_t now_ns);
+  void CancelPendingJobs();
   bool CanRetry(const JobInfo *info);
   void Backoff(JobInfo *info);
   void SetNocache(JobInfo *info);
@@ -507,6 +548,24 @@ class DownloadManager {  // NOLINT(clang-analyzer-optin.performance.Padding)
   int pipe_terminate_[2];
 
   int pipe_jobs_[2];
+
+  /**
+   * Jobs wait per priority class until the I/O thread admits them into the
+   * curl multi handle.  The overall number of active transfers is limited by
+   * concurrency_limit_, which is adapted to the observed throughput: as long
+   * as jobs are waiting, the limit moves by one per time window and the
+   * direction is reversed whenever the throughput drops.  Only accessed by the
+   * I/O thread.
+   */
+  std::deque<JobInfo *> pending_jobs_[kNumPriorities];
+  unsigned num_active_jobs_;
+  unsigned concurrency_limit_;
+  int concurrency_step_;
+  uint64_t window_start_ns_;
+  uint64_t window_bytes_;
+  bool window_saturated_;
+  double last_throughput_;
+
   struct pollfd *watch_fds_;
   uint32_t watch_fds_size_;
   uint32_t watch_fds_inuse_;
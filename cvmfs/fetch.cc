@@ -159,7 +159,9 @@ int Fetcher::Fetch(
              &tls->download_job.gid,
              &tls->download_job.pid);
   }
-  tls->download_job.compressed = (compression_algorithm == zlib::kZlibDefault);
+  tls->download_job.compressed =
+    (compression_algorithm != zlib::kNoCompression);
+  tls->download_job.compression_alg = compression_algorithm;
   tls->download_job.range_offset = range_offset;
   tls->download_job.range_size = size;
   download_mgr_->Fetch(&tls->download_job);
@@ -24,6 +24,14 @@
  *               hashes found in condemned catalogs and decides if they are
  *               referenced by the preserved catalog revisions or not.
  *
+ * Alternatively to the 2nd stage, the storage sweep lists the data/xx
+ * directories of the backend storage in parallel and removes all objects that
+ * are not in the HashFilterT.  It does not need to load the condemned
+ * catalogs, and it also finds objects that no catalog ever referenced, such as
+ * the leftovers of aborted publish operations.  Only data chunks, catalogs,
+ * and catalog deltas are removed.  Objects younger than a grace period might
+ * belong to a running transaction and are kept.
+ *
  * The GarbageCollector is templated with CatalogTraversalT mainly for
  * testability and with HashFilterT as an instance of the Strategy Pattern to
  * abstract from the actual hash filtering method to be used.
@@ -34,10 +42,14 @@
 
 #include <inttypes.h>
 
+#include <string>
 #include <vector>
 
+#include "atomic.h"
 #include "catalog_traversal_parallel.h"
 #include "garbage_collection/hash_filter.h"
+#include "ingestion/task.h"
+#include "ingestion/tube.h"
 #include "statistics.h"
 #include "upload_facility.h"
 
@@ -58,6 +70,7 @@ class GarbageCollector {
     static const unsigned int kNoHistory;
     static const time_t       kNoTimestamp;
     static const shash::Any   kLatestHistoryDatabase;
+    static const time_t       kDefaultGracePeriod;
 
     Configuration()
       : uploader(NULL)
@@ -70,7 +83,10 @@ class GarbageCollector {
       , deleted_objects_logfile(NULL)
       , statistics(NULL)
       , extended_stats(false)
-      , num_threads(8) {}
+      , num_threads(8)
+      , hash_filter_memory(0)
+      , sweep_storage(false)
+      , storage_grace_period(kDefaultGracePeriod) {}
 
     bool has_deletion_log() const { return deleted_objects_logfile != NULL; }
 
@@ -85,6 +101,19 @@ class GarbageCollector {
     perf::Statistics          *statistics;
     bool                       extended_stats;
     unsigned int               num_threads;
+    /**
+     * Memory limit of the preserved objects filter in bytes, 0 for no limit.
+     * Beyond the limit, the filter may spill to temp_directory.
+     */
+    uint64_t                   hash_filter_memory;
+    std::string                temp_directory;
+    /**
+     * Sweep by listing the backend storage instead of traversing the condemned
+     * catalogs.  Objects uploaded less than storage_grace_period seconds
+     * before the garbage collection started are kept.
+     */
+    bool                       sweep_storage;
+    time_t                     storage_grace_period;
   };
 
  public:
@@ -108,6 +137,8 @@ class GarbageCollector {
   bool AnalyzePreservedCatalogTree();
   bool CheckPreservedRevisions();
   bool SweepReflog();
+  bool SweepStorage();
+  void PublishStatistics();
 
   void CheckAndSweep(const shash::Any &hash);
   void Sweep(const shash::Any &hash);
@@ -118,6 +149,55 @@ class GarbageCollector {
   void LogDeletion(const shash::Any &hash) const;
 
  private:
+  /**
+   * Number of objects removed with a single request in the storage sweep
+   */
+  static const unsigned kSweepBatchSize = 1000;
+
+  /**
+   * Outcome of the storage sweep of one of the data/xx directories
+   */
+  struct SweepResult {
+    SweepResult()
+      : failed(false)
+      , num_catalogs(0)
+      , num_objects(0)
+      , num_bytes(0) { }
+    bool failed;
+    unsigned num_catalogs;
+    unsigned num_objects;
+    uint64_t num_bytes;
+  };
+
+  struct SweepJob {
+    SweepJob(int p, SweepResult *r) : prefix(p), result(r) { }
+    static SweepJob *CreateQuitBeacon() { return new SweepJob(-1, NULL); }
+    bool IsQuitBeacon() { return prefix < 0; }
+    int prefix;  ///< Between 0 and 255, the xx of the data/xx directory
+    SweepResult *result;
+  };
+
+  class TaskSweepDirectory : public TubeConsumer<SweepJob> {
+   public:
+    TaskSweepDirectory(GarbageCollector *collector, Tube<SweepJob> *tube)
+      : TubeConsumer<SweepJob>(tube)
+      , collector_(collector)
+    { }
+
+   protected:
+    virtual void Process(SweepJob *job) {
+      collector_->SweepDirectory(job->prefix, job->result);
+      delete job;
+    }
+
+   private:
+    GarbageCollector *collector_;
+  };
+
+  bool IsCondemnedInStorage(const shash::Any &hash) const;
+  void SweepDirectory(const int prefix, SweepResult *result);
+  void SweepStagedObjects(SweepResult *result);
+
   class ReflogBasedInfoShim :
     public swissknife::CatalogTraversalInfoShim<CatalogTN>
   {
@@ -175,6 +255,12 @@ class GarbageCollector {
 
   unsigned int          condemned_objects_;
   uint64_t              condemned_bytes_;
+
+  /**
+   * Objects in the storage sweep need to be older than this timestamp
+   */
+  time_t                sweep_threshold_;
+  atomic_int32          swept_directories_;
 };
 
 #include "garbage_collector_impl.h"
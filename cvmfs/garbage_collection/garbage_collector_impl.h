@@ -6,10 +6,14 @@
 #define CVMFS_GARBAGE_COLLECTION_GARBAGE_COLLECTOR_IMPL_H_
 
 #include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <ctime>
 #include <limits>
 #include <string>
 #include <vector>
 
+#include "catalog_delta.h"
 #include "logging.h"
 #include "util/string.h"
 
@@ -26,6 +30,10 @@ template<class CatalogTraversalT, class HashFilterT>
 const time_t GarbageCollector<CatalogTraversalT,
                               HashFilterT>::Configuration::kNoTimestamp = 0;
 
+template<class CatalogTraversalT, class HashFilterT>
+const time_t GarbageCollector<CatalogTraversalT,
+                       HashFilterT>::Configuration::kDefaultGracePeriod = 86400;
+
 
 template <class CatalogTraversalT, class HashFilterT>
 GarbageCollector<CatalogTraversalT, HashFilterT>::GarbageCollector(
@@ -46,8 +54,14 @@ GarbageCollector<CatalogTraversalT, HashFilterT>::GarbageCollector(
   , last_reported_status_(0.0)
   , condemned_objects_(0)
   , condemned_bytes_(0)
+  , sweep_threshold_(0)
 {
   assert(configuration_.uploader != NULL);
+  atomic_init32(&swept_directories_);
+  if (configuration_.hash_filter_memory > 0) {
+    hash_filter_.LimitMemory(configuration_.hash_filter_memory,
+                             configuration_.temp_directory);
+  }
 }
 
 
@@ -107,6 +121,12 @@ void GarbageCollector<CatalogTraversalT, HashFilterT>::PreserveDataObjects(
 
   // the hash of the actual catalog needs to preserved
   hash_filter_.Fill(data.catalog->hash());
+  // and so does the delta that produces it, see IsCondemnedInStorage()
+  const shash::Any base_hash = data.catalog->GetPreviousRevision();
+  if (!base_hash.IsNull()) {
+    hash_filter_.Fill(
+      catalog::MakeCatalogDeltaId(base_hash, data.catalog->hash()));
+  }
 
   // all the objects referenced from this catalog need to be preserved
   const HashVector &referenced_hashes = data.catalog->GetReferencedObjects();
@@ -146,8 +166,20 @@ void GarbageCollector<CatalogTraversalT, HashFilterT>::SweepDataObjects(
     CheckAndSweep(*i);
   }
 
-  // the catalog itself is also condemned and needs to be removed
-  CheckAndSweep(data.catalog->hash());
+  // the catalog itself is also condemned and needs to be removed, together
+  // with the catalog delta that might have been uploaded with it
+  const shash::Any catalog_hash = data.catalog->hash();
+  if (!hash_filter_.Contains(catalog_hash)) {
+    Sweep(catalog_hash);
+    // Deltas are optional, only the ones in the storage are condemned
+    const shash::Any base_hash = data.catalog->GetPreviousRevision();
+    if (!base_hash.IsNull()) {
+      const shash::Any delta_hash =
+        catalog::MakeCatalogDeltaId(base_hash, catalog_hash);
+      if (configuration_.uploader->Peek("data/" + delta_hash.MakePath()))
+        Sweep(delta_hash);
+    }
+  }
 
   float threshold =
     static_cast<float>(condemned_trees_) /
@@ -206,9 +238,11 @@ bool GarbageCollector<CatalogTraversalT, HashFilterT>::
 
 template <class CatalogTraversalT, class HashFilterT>
 bool GarbageCollector<CatalogTraversalT, HashFilterT>::Collect() {
+  // Objects uploaded after this point are not considered by the storage sweep
+  sweep_threshold_ = time(NULL) - configuration_.storage_grace_period;
   return AnalyzePreservedCatalogTree() &&
          CheckPreservedRevisions()     &&
-         SweepReflog();
+         (configuration_.sweep_storage ? SweepStorage() : SweepReflog());
 }
 
 
@@ -232,6 +266,8 @@ bool GarbageCollector<CatalogTraversalT, HashFilterT>::
   oldest_trunk_catalog_found_ = true;
   success = success && traversal_.TraverseNamedSnapshots();
   traversal_.UnregisterListener(callback);
+  // From here on, the preserved objects are only queried
+  hash_filter_.Freeze();
 
   return success;
 }
@@ -286,6 +322,196 @@ bool GarbageCollector<CatalogTraversalT, HashFilterT>::SweepReflog() {
     success = success && RemoveCatalogFromReflog(*i);
   }
 
+  PublishStatistics();
+
+  configuration_.uploader->WaitForUpload();
+  LogCvmfs(kLogGc, kLogStdout, "  --> done garbage collecting [%s]",
+           RfcTimestamp().c_str());
+  return success && (configuration_.uploader->GetNumberOfErrors() == 0);
+}
+
+
+template <class CatalogTraversalT, class HashFilterT>
+bool GarbageCollector<CatalogTraversalT, HashFilterT>::SweepStorage() {
+  LogCvmfs(kLogGc, kLogStdout,
+           "  --> sweeping unreferenced objects in storage [%s]",
+           RfcTimestamp().c_str());
+
+  const ReflogTN *reflog = configuration_.reflog;
+  std::vector<shash::Any> catalogs;
+  if (NULL == reflog || !reflog->List(SqlReflog::kRefCatalog, &catalogs)) {
+    LogCvmfs(kLogGc, kLogStderr, "Failed to list catalog reference log");
+    return false;
+  }
+
+  std::vector<SweepResult> results(256);
+  Tube<SweepJob> sweep_queue;
+  TubeConsumerGroup<SweepJob> tasks_sweep;
+  const unsigned num_threads = std::max(1U, configuration_.num_threads);
+  for (unsigned i = 0; i < num_threads; ++i)
+    tasks_sweep.TakeConsumer(new TaskSweepDirectory(this, &sweep_queue));
+  tasks_sweep.Spawn();
+  for (unsigned i = 0; i < results.size(); ++i)
+    sweep_queue.EnqueueBack(new SweepJob(i, &results[i]));
+  tasks_sweep.Terminate();
+  results.push_back(SweepResult());
+  SweepStagedObjects(&results.back());
+
+  bool success = true;
+  for (unsigned i = 0; i < results.size(); ++i) {
+    success = success && !results[i].failed;
+    condemned_catalogs_ += results[i].num_catalogs;
+    condemned_objects_ += results[i].num_objects;
+    condemned_bytes_ += results[i].num_bytes;
+  }
+
+  // The reflog only needs to forget the removed root catalogs if the sweep
+  // was complete
+        std::vector<shash::Any>::const_iterator i    = catalogs.begin();
+  const std::vector<shash::Any>::const_iterator iend = catalogs.end();
+  for (; success && (i != iend); ++i) {
+    if (!hash_filter_.Contains(*i)) {
+      ++unreferenced_trees_;
+      success = RemoveCatalogFromReflog(*i);
+    }
+  }
+
+  PublishStatistics();
+
+  configuration_.uploader->WaitForUpload();
+  LogCvmfs(kLogGc, kLogStdout, "  --> done garbage collecting [%s]",
+           RfcTimestamp().c_str());
+  return success && (configuration_.uploader->GetNumberOfErrors() == 0);
+}
+
+
+/**
+ * Only the objects that the catalog based sweep would remove are removed from
+ * the storage.  History databases, certificates, and meta info objects are
+ * handled by the GarbageCollectorAux.
+ */
+template <class CatalogTraversalT, class HashFilterT>
+bool GarbageCollector<CatalogTraversalT, HashFilterT>::IsCondemnedInStorage(
+  const shash::Any &hash) const
+{
+  switch (hash.suffix) {
+    case shash::kSuffixNone:
+    case shash::kSuffixPartial:
+    case shash::kSuffixCatalog:
+    case shash::kSuffixMicroCatalog:
+    // Preserved together with the catalog they produce
+    case shash::kSuffixCatalogDelta:
+      return !hash_filter_.Contains(hash);
+    default:
+      return false;
+  }
+}
+
+
+/**
+ * Called concurrently for the different data/xx directories.  Files that are
+ * no content-addressed objects are not touched.
+ */
+template <class CatalogTraversalT, class HashFilterT>
+void GarbageCollector<CatalogTraversalT, HashFilterT>::SweepDirectory(
+  const int prefix,
+  SweepResult *result)
+{
+  char hex_prefix[3];
+  snprintf(hex_prefix, sizeof(hex_prefix), "%02x", prefix);
+  const std::string directory = std::string("data/") + hex_prefix;
+  std::vector<upload::ObjectInfo> objects;
+  if (!configuration_.uploader->ListObjects(directory, &objects)) {
+    LogCvmfs(kLogGc, kLogStderr, "failed to list %s", directory.c_str());
+    result->failed = true;
+    return;
+  }
+
+  std::vector<std::string> batch;
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    const upload::ObjectInfo &object = objects[i];
+    if (object.mtime >= sweep_threshold_)
+      continue;
+
+    std::string hex_hash = hex_prefix + object.name;
+    shash::Suffix suffix = shash::kSuffixNone;
+    if (isupper(static_cast<unsigned char>(*hex_hash.rbegin()))) {
+      suffix = *hex_hash.rbegin();
+      hex_hash.resize(hex_hash.length() - 1);
+    }
+    if (!shash::HexPtr(hex_hash).IsValid())
+      continue;
+    const shash::Any hash = shash::MkFromHexPtr(shash::HexPtr(hex_hash),
+                                                suffix);
+    if (!IsCondemnedInStorage(hash))
+      continue;
+
+    if (hash.suffix == shash::kSuffixCatalog)
+      result->num_catalogs++;
+    result->num_objects++;
+    result->num_bytes += object.size;
+    LogDeletion(hash);
+    if (configuration_.dry_run)
+      continue;
+    batch.push_back(directory + "/" + object.name);
+    if (batch.size() >= kSweepBatchSize) {
+      configuration_.uploader->RemoveManyAsync(batch);
+      batch.clear();
+    }
+  }
+  configuration_.uploader->RemoveManyAsync(batch);
+
+  const int num_swept = atomic_xadd32(&swept_directories_, 1) + 1;
+  if (num_swept % 32 == 0) {
+    LogCvmfs(kLogGc, kLogStdout | kLogDebug,
+             "      - %02.0f%%    %d / 256 storage directories swept [%s]",
+             100.0 * num_swept / 256, num_swept, RfcTimestamp().c_str());
+  }
+}
+
+
+/**
+ * Removes the staged objects of streamed uploads that never made it to their
+ * final location, e.g. because the publish process was killed.  Staged objects
+ * of running transactions are younger than the grace period.
+ */
+template <class CatalogTraversalT, class HashFilterT>
+void GarbageCollector<CatalogTraversalT, HashFilterT>::SweepStagedObjects(
+  SweepResult *result)
+{
+  const std::string directory = upload::kStagingDirectory;
+  std::vector<upload::ObjectInfo> objects;
+  if (!configuration_.uploader->ListObjects(directory, &objects)) {
+    LogCvmfs(kLogGc, kLogStderr, "failed to list %s", directory.c_str());
+    result->failed = true;
+    return;
+  }
+
+  std::vector<std::string> batch;
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    const upload::ObjectInfo &object = objects[i];
+    if ((object.mtime >= sweep_threshold_) ||
+        !HasPrefix(object.name, upload::kStagingFilePrefix, false))
+    {
+      continue;
+    }
+
+    const std::string path = directory + "/" + object.name;
+    result->num_objects++;
+    result->num_bytes += object.size;
+    if (configuration_.verbose) {
+      LogCvmfs(kLogGc, kLogStdout | kLogDebug, "Sweep: %s", path.c_str());
+    }
+    if (configuration_.dry_run)
+      continue;
+    batch.push_back(path);
+  }
+  configuration_.uploader->RemoveManyAsync(batch);
+}
+
+
+template <class CatalogTraversalT, class HashFilterT>
+void GarbageCollector<CatalogTraversalT, HashFilterT>::PublishStatistics() {
   // TODO(jblomer): turn current counters into perf::Counters
   if (configuration_.statistics) {
     perf::Counter *ctr_preserved_catalogs =
@@ -305,11 +531,6 @@ bool GarbageCollector<CatalogTraversalT, HashFilterT>::SweepReflog() {
     ctr_condemned_objects->Set(condemned_objects_count());
     ctr_condemned_bytes->Set(condemned_bytes_count());
   }
-
-  configuration_.uploader->WaitForUpload();
-  LogCvmfs(kLogGc, kLogStdout, "  --> done garbage collecting [%s]",
-           RfcTimestamp().c_str());
-  return success && (configuration_.uploader->GetNumberOfErrors() == 0);
 }
 
 
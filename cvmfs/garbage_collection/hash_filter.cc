@@ -0,0 +1,325 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_FORMAT_MACROS
+
+#include "cvmfs_config.h"
+#include "garbage_collection/hash_filter.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "logging.h"
+#include "util/exception.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+CompactHashFilter::Key::Key(const shash::Any &hash) {
+  unsigned char buffer[16];
+  buffer[0] = static_cast<unsigned char>(hash.algorithm);
+  memcpy(buffer + 1, hash.digest, 15);
+  memcpy(&high, buffer, 8);
+  memcpy(&low, buffer + 8, 8);
+}
+
+
+CompactHashFilter::CompactHashFilter()
+  : sorted_(true)
+  , frozen_(false)
+  , max_keys_(0)
+  , fd_merged_(-1)
+  , num_merged_(0)
+{ }
+
+
+CompactHashFilter::~CompactHashFilter() {
+  for (unsigned i = 0; i < runs_.size(); ++i)
+    unlink(runs_[i].c_str());
+  if (fd_merged_ >= 0) {
+    close(fd_merged_);
+    unlink(path_merged_.c_str());
+  }
+}
+
+
+void CompactHashFilter::LimitMemory(
+  const uint64_t max_bytes,
+  const std::string &spill_dir)
+{
+  assert(keys_.empty() && !has_spilled());
+  max_keys_ = std::max(max_bytes / sizeof(Key), uint64_t(kKeysPerBlock));
+  spill_dir_ = spill_dir;
+}
+
+
+void CompactHashFilter::Fill(const shash::Any &hash) {
+  assert(!frozen_);
+  if ((max_keys_ > 0) && (keys_.size() == keys_.capacity())) {
+    if (keys_.size() >= max_keys_) {
+      SpillKeys();
+    } else if (keys_.capacity() * 2 > max_keys_) {
+      // Don't let the doubling of the vector overshoot the limit
+      keys_.reserve(max_keys_);
+    }
+  }
+  keys_.push_back(Key(hash));
+  sorted_ = false;
+}
+
+
+void CompactHashFilter::SortKeys() const {
+  if (sorted_)
+    return;
+  std::sort(keys_.begin(), keys_.end());
+  keys_.erase(std::unique(keys_.begin(), keys_.end()), keys_.end());
+  sorted_ = true;
+}
+
+
+/**
+ * Writes the current keys as a sorted run to the spill directory
+ */
+void CompactHashFilter::SpillKeys() {
+  SortKeys();
+  const string path = CreateTempPath(spill_dir_ + "/hashfilter", 0600);
+  if (path.empty()) {
+    PANIC(kLogStderr, "failed to create hash filter run in %s (%d)",
+          spill_dir_.c_str(), errno);
+  }
+  FILE *f = fopen(path.c_str(), "w");
+  if ((f == NULL) ||
+      (fwrite(&keys_[0], sizeof(Key), keys_.size(), f) != keys_.size()) ||
+      (fclose(f) != 0))
+  {
+    PANIC(kLogStderr, "failed to write hash filter run %s (%d)",
+          path.c_str(), errno);
+  }
+  LogCvmfs(kLogGc, kLogDebug, "spilled %" PRIu64 " preserved hashes to %s",
+           static_cast<uint64_t>(keys_.size()), path.c_str());
+  runs_.push_back(path);
+  keys_.clear();
+  if (runs_.size() >= kMaxRuns)
+    CompactRuns();
+}
+
+
+/**
+ * Merges all runs into a single one; requires an empty in-memory array
+ */
+void CompactHashFilter::CompactRuns() {
+  assert(keys_.empty());
+  const string path = CreateTempPath(spill_dir_ + "/hashfilter", 0600);
+  FILE *f = (path.empty()) ? NULL : fopen(path.c_str(), "w");
+  if (f == NULL) {
+    PANIC(kLogStderr, "failed to create hash filter run in %s (%d)",
+          spill_dir_.c_str(), errno);
+  }
+  MergeRuns(f, NULL, NULL);
+  if (fclose(f) != 0) {
+    PANIC(kLogStderr, "failed to write hash filter run %s (%d)",
+          path.c_str(), errno);
+  }
+  for (unsigned i = 0; i < runs_.size(); ++i)
+    unlink(runs_[i].c_str());
+  runs_.clear();
+  runs_.push_back(path);
+}
+
+
+void CompactHashFilter::BloomInsert(
+  const Key &key,
+  std::vector<uint64_t> *bloom) const
+{
+  // The keys are cryptographic hashes, their bits serve as hash values
+  const uint64_t num_bits = bloom->size() * 64;
+  for (unsigned i = 0; i < kBloomNumHashes; ++i) {
+    const uint64_t bit = (key.low + i * key.high) % num_bits;
+    (*bloom)[bit / 64] |= uint64_t(1) << (bit % 64);
+  }
+}
+
+
+bool CompactHashFilter::BloomContains(const Key &key) const {
+  const uint64_t num_bits = bloom_.size() * 64;
+  for (unsigned i = 0; i < kBloomNumHashes; ++i) {
+    const uint64_t bit = (key.low + i * key.high) % num_bits;
+    if ((bloom_[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+      return false;
+  }
+  return true;
+}
+
+
+/**
+ * Merges the runs and the in-memory keys, which need to be sorted.  Writes the
+ * deduplicated keys to output and into the Bloom filter and the block index,
+ * if given.  Returns the number of distinct keys.
+ */
+uint64_t CompactHashFilter::MergeRuns(
+  FILE *output,
+  std::vector<uint64_t> *bloom,
+  std::vector<Key> *index) const
+{
+  typedef std::pair<Key, unsigned> Head;  // key and index of its source
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+
+  std::vector<FILE *> inputs;
+  for (unsigned i = 0; i < runs_.size(); ++i) {
+    FILE *f = fopen(runs_[i].c_str(), "r");
+    if (f == NULL) {
+      PANIC(kLogStderr, "failed to open hash filter run %s (%d)",
+            runs_[i].c_str(), errno);
+    }
+    inputs.push_back(f);
+    Key key;
+    if (fread(&key, sizeof(key), 1, f) == 1)
+      heads.push(Head(key, i));
+  }
+  // The in-memory keys are the last source
+  const unsigned idx_memory = runs_.size();
+  uint64_t pos_memory = 0;
+  if (!keys_.empty())
+    heads.push(Head(keys_[pos_memory++], idx_memory));
+
+  uint64_t num_keys = 0;
+  Key last;
+  while (!heads.empty()) {
+    const Head head = heads.top();
+    heads.pop();
+    if ((num_keys == 0) || !(head.first == last)) {
+      if ((output != NULL) &&
+          (fwrite(&head.first, sizeof(Key), 1, output) != 1))
+      {
+        PANIC(kLogStderr, "failed to write hash filter (%d)", errno);
+      }
+      if (bloom != NULL)
+        BloomInsert(head.first, bloom);
+      if ((index != NULL) && (num_keys % kKeysPerBlock == 0))
+        index->push_back(head.first);
+      last = head.first;
+      num_keys++;
+    }
+
+    Key next;
+    if (head.second == idx_memory) {
+      if (pos_memory < keys_.size())
+        heads.push(Head(keys_[pos_memory++], idx_memory));
+    } else if (fread(&next, sizeof(next), 1, inputs[head.second]) == 1) {
+      heads.push(Head(next, head.second));
+    }
+  }
+
+  for (unsigned i = 0; i < inputs.size(); ++i) {
+    if (ferror(inputs[i])) {
+      PANIC(kLogStderr, "failed to read hash filter run %s",
+            runs_[i].c_str());
+    }
+    fclose(inputs[i]);
+  }
+  return num_keys;
+}
+
+
+void CompactHashFilter::Freeze() {
+  if (frozen_)
+    return;
+  frozen_ = true;
+  SortKeys();
+  if (runs_.empty())
+    return;
+
+  uint64_t max_num_keys = keys_.size();
+  for (unsigned i = 0; i < runs_.size(); ++i)
+    max_num_keys += GetFileSize(runs_[i]) / sizeof(Key);
+  // The Bloom filter gets at most half of the memory limit
+  const uint64_t num_words = std::max(uint64_t(1), std::min(
+    (max_num_keys * kBloomBitsPerKey + 63) / 64,
+    (max_keys_ * sizeof(Key) / 2) / sizeof(uint64_t)));
+  bloom_.assign(num_words, 0);
+
+  path_merged_ = CreateTempPath(spill_dir_ + "/hashfilter", 0600);
+  FILE *f = (path_merged_.empty()) ? NULL : fopen(path_merged_.c_str(), "w");
+  if (f == NULL) {
+    PANIC(kLogStderr, "failed to create hash filter in %s (%d)",
+          spill_dir_.c_str(), errno);
+  }
+  num_merged_ = MergeRuns(f, &bloom_, &index_);
+  if (fclose(f) != 0) {
+    PANIC(kLogStderr, "failed to write hash filter %s (%d)",
+          path_merged_.c_str(), errno);
+  }
+
+  for (unsigned i = 0; i < runs_.size(); ++i)
+    unlink(runs_[i].c_str());
+  runs_.clear();
+  std::vector<Key>().swap(keys_);
+  std::vector<Key>(index_).swap(index_);
+
+  fd_merged_ = open(path_merged_.c_str(), O_RDONLY);
+  if (fd_merged_ < 0) {
+    PANIC(kLogStderr, "failed to open hash filter %s (%d)",
+          path_merged_.c_str(), errno);
+  }
+  LogCvmfs(kLogGc, kLogDebug, "merged %" PRIu64 " preserved hashes into %s",
+           num_merged_, path_merged_.c_str());
+}
+
+
+bool CompactHashFilter::ContainsOnDisk(const Key &key) const {
+  if (!BloomContains(key))
+    return false;
+
+  std::vector<Key>::const_iterator i =
+    std::upper_bound(index_.begin(), index_.end(), key);
+  if (i == index_.begin())
+    return false;
+  const uint64_t block = (i - index_.begin()) - 1;
+  const uint64_t first = block * kKeysPerBlock;
+  const unsigned num_keys = std::min(uint64_t(kKeysPerBlock),
+                                     num_merged_ - first);
+  Key buffer[kKeysPerBlock];
+  const ssize_t nbytes = num_keys * sizeof(Key);
+  if (pread(fd_merged_, buffer, nbytes, first * sizeof(Key)) != nbytes) {
+    PANIC(kLogStderr, "failed to read hash filter %s (%d)",
+          path_merged_.c_str(), errno);
+  }
+  return std::binary_search(buffer, buffer + num_keys, key);
+}
+
+
+bool CompactHashFilter::Contains(const shash::Any &hash) const {
+  const Key key(hash);
+  if (fd_merged_ >= 0)
+    return ContainsOnDisk(key);
+  assert(runs_.empty());
+  SortKeys();
+  return std::binary_search(keys_.begin(), keys_.end(), key);
+}
+
+
+size_t CompactHashFilter::Count() const {
+  if (fd_merged_ >= 0)
+    return num_merged_;
+  SortKeys();
+  if (runs_.empty())
+    return keys_.size();
+  return MergeRuns(NULL, NULL, NULL);
+}
+
+
+uint64_t CompactHashFilter::bytes_allocated() const {
+  return (keys_.capacity() + index_.capacity()) * sizeof(Key) +
+         bloom_.capacity() * sizeof(uint64_t);
+}
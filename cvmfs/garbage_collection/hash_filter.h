@@ -9,7 +9,12 @@
 #ifndef CVMFS_GARBAGE_COLLECTION_HASH_FILTER_H_
 #define CVMFS_GARBAGE_COLLECTION_HASH_FILTER_H_
 
+#include <stdint.h>
+
+#include <cstdio>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "hash.h"
 #include "smallhash.h"
@@ -48,6 +53,14 @@ class AbstractHashFilter {
    */
   virtual void Freeze() {}
 
+  /**
+   * Asks the filter to stay within max_bytes of memory and to move data to
+   * files in spill_dir beyond that.  Implementations that keep everything in
+   * memory ignore the limit.  Has to be called before the first Fill().
+   */
+  virtual void LimitMemory(const uint64_t /* max_bytes */,
+                           const std::string & /* spill_dir */) {}
+
   /**
    * Returns the number of objects already inserted into the filter.
    * @return number of objects in the filter
@@ -118,10 +131,102 @@ class SmallhashFilter : public AbstractHashFilter {
 
   void   Freeze()      { frozen_ = true;         }
   size_t Count() const { return hashmap_.size(); }
+  uint64_t bytes_allocated() const { return hashmap_.bytes_allocated(); }
 
  private:
   SmallHashDynamic<shash::Any, bool>  hashmap_;
   bool                                frozen_;
 };
 
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * A memory bounded implementation of AbstractHashFilter for very large sets of
+ * hashes.  Every hash is stored as a 16 byte key made of the algorithm and the
+ * first 15 bytes of the digest; like in the other filters, the suffix is
+ * ignored.  Two hashes only share a key if they agree in 120 bits, which at
+ * worst preserves an object that could have been deleted.  Hence there are no
+ * false negatives.
+ *
+ * The keys are collected in a flat array.  Without a memory limit, Freeze()
+ * sorts the array and Contains() runs a binary search on it.  With a memory
+ * limit, a full array is sorted and written as a run to the spill directory.
+ * Freeze() then merges all runs into a single sorted file, which is searched
+ * through a sparse in-memory index of its blocks.  A Bloom filter in front of
+ * the file saves the disk access for most of the hashes that are not in the
+ * set.
+ *
+ * Contains() on a filter that has spilled needs Freeze() first.  Once frozen,
+ * Contains() can be called concurrently.
+ */
+class CompactHashFilter : public AbstractHashFilter {
+ public:
+  struct Key {
+    Key() : high(0), low(0) { }
+    explicit Key(const shash::Any &hash);
+    bool operator <(const Key &other) const {
+      return (high < other.high) || ((high == other.high) && (low < other.low));
+    }
+    bool operator ==(const Key &other) const {
+      return (high == other.high) && (low == other.low);
+    }
+    uint64_t high;
+    uint64_t low;
+  };
+
+  /**
+   * Number of keys in a block of the merged file, one index entry per block
+   */
+  static const unsigned kKeysPerBlock = 256;
+  static const unsigned kBloomBitsPerKey = 8;
+  static const unsigned kBloomNumHashes = 3;
+  /**
+   * Limits the number of open files when the runs are merged
+   */
+  static const unsigned kMaxRuns = 64;
+
+  CompactHashFilter();
+  virtual ~CompactHashFilter();
+
+  void Fill(const shash::Any &hash);
+  bool Contains(const shash::Any &hash) const;
+  void Freeze();
+  void LimitMemory(const uint64_t max_bytes, const std::string &spill_dir);
+  size_t Count() const;
+
+  bool has_spilled() const { return !runs_.empty() || (fd_merged_ >= 0); }
+  uint64_t bytes_allocated() const;
+
+ private:
+  void SortKeys() const;
+  void SpillKeys();
+  void CompactRuns();
+  uint64_t MergeRuns(FILE *output,
+                     std::vector<uint64_t> *bloom,
+                     std::vector<Key> *index) const;
+  void BloomInsert(const Key &key, std::vector<uint64_t> *bloom) const;
+  bool BloomContains(const Key &key) const;
+  bool ContainsOnDisk(const Key &key) const;
+
+  /**
+   * Sorted and deduplicated up to the sorted_ flag
+   */
+  mutable std::vector<Key> keys_;
+  mutable bool sorted_;
+  bool frozen_;
+
+  uint64_t max_keys_;  ///< 0 means unlimited
+  std::string spill_dir_;
+  std::vector<std::string> runs_;
+
+  std::string path_merged_;
+  int fd_merged_;
+  uint64_t num_merged_;
+  std::vector<Key> index_;  ///< First key of every block in the merged file
+  std::vector<uint64_t> bloom_;
+};
+
 #endif  // CVMFS_GARBAGE_COLLECTION_HASH_FILTER_H_
@@ -18,6 +18,8 @@
 #include <cstring>
 
 #include "duplex_ssl.h"
+#include "hash_accel.h"
+#include "hash_tree.h"
 #include "util/exception.h"
 #include "KeccakHash.h"
 
@@ -31,7 +33,7 @@ namespace CVMFS_NAMESPACE_GUARD {
 namespace shash {
 
 const char *kAlgorithmIds[] =
-  {"", "", "-rmd160", "-shake128", ""};
+  {"", "", "-rmd160", "-shake128", "-shake128tree", ""};
 
 
 bool HexPtr::IsValid() const {
@@ -76,6 +78,8 @@ Algorithms ParseHashAlgorithm(const string &algorithm_option) {
     return kRmd160;
   if (algorithm_option == "shake128")
     return kShake128;
+  if (algorithm_option == "shake128tree")
+    return kShake128Tree;
   return kAny;
 }
 
@@ -93,6 +97,11 @@ Any MkFromHexPtr(const HexPtr hex, const char suffix) {
     result = Any(kRmd160, hex);
   if ((length == 2*kDigestSizes[kShake128] + kAlgorithmIdSizes[kShake128]))
     result = Any(kShake128, hex);
+  if ((length ==
+       2*kDigestSizes[kShake128Tree] + kAlgorithmIdSizes[kShake128Tree]))
+  {
+    result = Any(kShake128Tree, hex);
+  }
 
   result.suffix = suffix;
   return result;
@@ -137,6 +146,17 @@ Any MkFromSuffixedHexPtr(const HexPtr hex) {
         : kSuffixNone;
     result = Any(kShake128, hex, suffix);
   }
+  if ((length ==
+       2*kDigestSizes[kShake128Tree] + kAlgorithmIdSizes[kShake128Tree]) ||
+      (length ==
+       2*kDigestSizes[kShake128Tree] + kAlgorithmIdSizes[kShake128Tree] + 1))
+  {
+    Suffix suffix = (length ==
+      2*kDigestSizes[kShake128Tree] + kAlgorithmIdSizes[kShake128Tree] + 1)
+        ? *(hex.str->rbegin())
+        : kSuffixNone;
+    result = Any(kShake128Tree, hex, suffix);
+  }
 
   return result;
 }
@@ -150,11 +170,13 @@ unsigned GetContextSize(const Algorithms algorithm) {
     case kMd5:
       return sizeof(MD5_CTX);
     case kSha1:
-      return sizeof(SHA_CTX);
+      return sizeof(Sha1Context);
     case kRmd160:
       return sizeof(RIPEMD160_CTX);
     case kShake128:
       return sizeof(Keccak_HashInstance);
+    case kShake128Tree:
+      return sizeof(TreeHashContext);
     default:
       PANIC(kLogDebug | kLogSyslogErr,
             "tried to generate hash context for unspecified hash. Aborting...");
@@ -169,8 +191,8 @@ void Init(ContextPtr context) {
       MD5_Init(reinterpret_cast<MD5_CTX *>(context.buffer));
       break;
     case kSha1:
-      assert(context.size == sizeof(SHA_CTX));
-      SHA1_Init(reinterpret_cast<SHA_CTX *>(context.buffer));
+      assert(context.size == sizeof(Sha1Context));
+      Sha1Init(reinterpret_cast<Sha1Context *>(context.buffer));
       break;
     case kRmd160:
       assert(context.size == sizeof(RIPEMD160_CTX));
@@ -182,6 +204,10 @@ void Init(ContextPtr context) {
         reinterpret_cast<Keccak_HashInstance *>(context.buffer));
       assert(keccak_result == SUCCESS);
       break;
+    case kShake128Tree:
+      assert(context.size == sizeof(TreeHashContext));
+      TreeHashInit(reinterpret_cast<TreeHashContext *>(context.buffer));
+      break;
     default:
       PANIC(NULL);  // Undefined hash
   }
@@ -198,9 +224,9 @@ void Update(const unsigned char *buffer, const unsigned buffer_length,
                  buffer, buffer_length);
       break;
     case kSha1:
-      assert(context.size == sizeof(SHA_CTX));
-      SHA1_Update(reinterpret_cast<SHA_CTX *>(context.buffer),
-                  buffer, buffer_length);
+      assert(context.size == sizeof(Sha1Context));
+      Sha1Update(reinterpret_cast<Sha1Context *>(context.buffer),
+                 buffer, buffer_length);
       break;
     case kRmd160:
       assert(context.size == sizeof(RIPEMD160_CTX));
@@ -213,6 +239,11 @@ void Update(const unsigned char *buffer, const unsigned buffer_length,
                         context.buffer), buffer, buffer_length * 8);
       assert(keccak_result == SUCCESS);
       break;
+    case kShake128Tree:
+      assert(context.size == sizeof(TreeHashContext));
+      TreeHashUpdate(reinterpret_cast<TreeHashContext *>(context.buffer),
+                     buffer, buffer_length);
+      break;
     default:
       PANIC(NULL);  // Undefined hash
   }
@@ -227,9 +258,9 @@ void Final(ContextPtr context, Any *any_digest) {
                 reinterpret_cast<MD5_CTX *>(context.buffer));
       break;
     case kSha1:
-      assert(context.size == sizeof(SHA_CTX));
-      SHA1_Final(any_digest->digest,
-                 reinterpret_cast<SHA_CTX *>(context.buffer));
+      assert(context.size == sizeof(Sha1Context));
+      Sha1Final(reinterpret_cast<Sha1Context *>(context.buffer),
+                any_digest->digest);
       break;
     case kRmd160:
       assert(context.size == sizeof(RIPEMD160_CTX));
@@ -245,6 +276,11 @@ void Final(ContextPtr context, Any *any_digest) {
         Keccak_HashSqueeze(reinterpret_cast<Keccak_HashInstance *>(
           context.buffer), any_digest->digest, kDigestSizes[kShake128] * 8);
       break;
+    case kShake128Tree:
+      assert(context.size == sizeof(TreeHashContext));
+      TreeHashFinal(reinterpret_cast<TreeHashContext *>(context.buffer),
+                    any_digest->digest);
+      break;
     default:
       PANIC(NULL);  // Undefined hash
   }
@@ -42,6 +42,7 @@ enum Algorithms {
   kSha1,
   kRmd160,
   kShake128,  // with 160 output bits
+  kShake128Tree,  // tree hash on top of SHAKE128, see hash_tree.h
   kAny,
 };
 
@@ -57,6 +58,7 @@ const char kSuffixPartial      = 'P';
 const char kSuffixTemporary    = 'T';
 const char kSuffixCertificate  = 'X';
 const char kSuffixMetainfo     = 'M';
+const char kSuffixCatalogDelta = 'D';  // named after base and new catalog
 
 
 /**
@@ -66,12 +68,14 @@ const char kSuffixMetainfo     = 'M';
  * PosixQuotaManager::LruCommand changes, too!
  */
 const unsigned kDigestSizes[] =
-  {16,  20,   20,     20,       20};
-// Md5  Sha1  Rmd160  Shake128  Any
+  {16,  20,   20,     20,       20,           20};
+// Md5  Sha1  Rmd160  Shake128  Shake128Tree  Any
 const unsigned kMaxDigestSize = 20;
 
 /**
- * The maximum of GetContextSize()
+ * The maximum of GetContextSize(), except for the tree hash.  Its context is
+ * much larger (see hash_tree.h), so fixed buffers of kMaxContextSize bytes need
+ * to fall back to a separate allocation for kShake128Tree.
  */
 const unsigned kMaxContextSize = 256;
 
@@ -83,17 +87,17 @@ const unsigned kMaxContextSize = 256;
  */
 extern const char *kAlgorithmIds[];
 const unsigned kAlgorithmIdSizes[] =
-  {0,   0,    7,       9,         0};
-// Md5  Sha1  -rmd160  -shake128  Any
-const unsigned kMaxAlgorithmIdentifierSize = 9;
+  {0,   0,    7,       9,         13,            0};
+// Md5  Sha1  -rmd160  -shake128  -shake128tree  Any
+const unsigned kMaxAlgorithmIdentifierSize = 13;
 
 /**
  * Corresponds to Algorithms.  There is no block size for Any.
  * Is an HMAC for SHAKE well-defined?
  */
 const unsigned kBlockSizes[] =
-  {64,  64,   64,     168};
-// Md5  Sha1  Rmd160  Shake128
+  {64,  64,   64,     168,      168};
+// Md5  Sha1  Rmd160  Shake128  Shake128Tree
 
 /**
  * Distinguishes between interpreting a string as hex hash and hashing over
@@ -0,0 +1,376 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "hash_accel.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__) && \
+    (defined(__clang__) || (__GNUC__ > 4) || \
+     ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define CVMFS_HASH_ACCEL_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Only x86 has an accelerated SHA-1 path.  Other architectures, including
+// ARMv8 with its SHA1 instructions, use OpenSSL until such a path can be built
+// and verified against the known-answer tests on the target.
+
+
+#ifdef CVMFS_NAMESPACE_GUARD
+namespace CVMFS_NAMESPACE_GUARD {
+#endif
+
+namespace shash {
+
+namespace {
+
+typedef void (*Sha1BlocksFn)(uint32_t *state,
+                             const unsigned char *data,
+                             size_t nblocks);
+
+
+#ifdef CVMFS_HASH_ACCEL_X86
+
+/**
+ * One group of four SHA-1 rounds using the message words in M[k % 4], k being
+ * the group number 0..19.  The message schedule for the groups k+1, k+2, k+3
+ * is computed on the fly in the registers not in use by the current group.
+ */
+#define CVMFS_SHA1_GROUP(k, E_CUR, E_NEXT)                                    \
+  E_CUR = _mm_sha1nexte_epu32(E_CUR, M[(k) % 4]);                             \
+  E_NEXT = abcd;                                                              \
+  if (((k) >= 3) && ((k) <= 18))                                              \
+    M[((k) + 1) % 4] = _mm_sha1msg2_epu32(M[((k) + 1) % 4], M[(k) % 4]);      \
+  abcd = _mm_sha1rnds4_epu32(abcd, E_CUR, (k) / 5);                           \
+  if (((k) >= 1) && ((k) <= 16))                                              \
+    M[((k) + 3) % 4] = _mm_sha1msg1_epu32(M[((k) + 3) % 4], M[(k) % 4]);      \
+  if (((k) >= 2) && ((k) <= 17))                                              \
+    M[((k) + 2) % 4] = _mm_xor_si128(M[((k) + 2) % 4], M[(k) % 4]);
+
+__attribute__((target("sha,sse4.1")))
+void Sha1BlocksShaNi(uint32_t *state,
+                     const unsigned char *data,
+                     size_t nblocks)
+{
+  // The SHA instructions expect big-endian message words
+  const __m128i kByteSwap =
+    _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+  __m128i abcd = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+  abcd = _mm_shuffle_epi32(abcd, 0x1B);
+  __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+  __m128i e1;
+  __m128i M[4];
+
+  for (; nblocks > 0; --nblocks, data += 64) {
+    const __m128i abcd_save = abcd;
+    const __m128i e0_save = e0;
+    for (unsigned i = 0; i < 4; ++i) {
+      M[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(data + 16 * i)), kByteSwap);
+    }
+
+    e0 = _mm_add_epi32(e0, M[0]);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+    CVMFS_SHA1_GROUP(1, e1, e0)
+    CVMFS_SHA1_GROUP(2, e0, e1)
+    CVMFS_SHA1_GROUP(3, e1, e0)
+    CVMFS_SHA1_GROUP(4, e0, e1)
+    CVMFS_SHA1_GROUP(5, e1, e0)
+    CVMFS_SHA1_GROUP(6, e0, e1)
+    CVMFS_SHA1_GROUP(7, e1, e0)
+    CVMFS_SHA1_GROUP(8, e0, e1)
+    CVMFS_SHA1_GROUP(9, e1, e0)
+    CVMFS_SHA1_GROUP(10, e0, e1)
+    CVMFS_SHA1_GROUP(11, e1, e0)
+    CVMFS_SHA1_GROUP(12, e0, e1)
+    CVMFS_SHA1_GROUP(13, e1, e0)
+    CVMFS_SHA1_GROUP(14, e0, e1)
+    CVMFS_SHA1_GROUP(15, e1, e0)
+    CVMFS_SHA1_GROUP(16, e0, e1)
+    CVMFS_SHA1_GROUP(17, e1, e0)
+    CVMFS_SHA1_GROUP(18, e0, e1)
+    CVMFS_SHA1_GROUP(19, e1, e0)
+
+    e0 = _mm_sha1nexte_epu32(e0, e0_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+
+  abcd = _mm_shuffle_epi32(abcd, 0x1B);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state), abcd);
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef CVMFS_SHA1_GROUP
+
+#endif  // CVMFS_HASH_ACCEL_X86
+
+
+unsigned DetectCpuFeatures() {
+  if (getenv("CVMFS_HASH_NO_ACCEL") != NULL)
+    return 0;
+
+  unsigned features = 0;
+#ifdef CVMFS_HASH_ACCEL_X86
+  unsigned eax, ebx, ecx, edx;
+  if ((__get_cpuid_max(0, NULL) >= 7) && __builtin_cpu_supports("sse4.1")) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (ebx & (1 << 29))
+      features |= kCpuSha1;
+  }
+  // Also checks that the operating system saves the AVX registers
+  if (__builtin_cpu_supports("avx2"))
+    features |= kCpuAvx2;
+#endif
+  return features;
+}
+
+
+Sha1BlocksFn GetSha1Blocks() {
+  if (!(GetCpuFeatures() & kCpuSha1))
+    return NULL;
+#ifdef CVMFS_HASH_ACCEL_X86
+  return Sha1BlocksShaNi;
+#else
+  return NULL;
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+
+
+/**
+ * Four 64bit lanes, one of each Keccak state.  With AVX2, a vector fits into a
+ * single register.
+ */
+typedef uint64_t Lanes __attribute__((vector_size(8 * kKeccakLanes)));
+
+const uint64_t kKeccakRoundConstants[24] = {
+  0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
+  0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
+  0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
+  0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+  0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL,
+  0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+  0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
+  0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+};
+
+#define CVMFS_KECCAK_ROL(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+/**
+ * Rho and pi step for one lane: the lane in current is rotated by N bits and
+ * moves to position TO, replacing the lane that moves on next.
+ */
+#define CVMFS_KECCAK_RHO_PI(TO, N) \
+  tmp = A[TO]; A[TO] = CVMFS_KECCAK_ROL(current, N); current = tmp;
+
+/**
+ * Theta step for column X, given the parities of the neighboring columns
+ */
+#define CVMFS_KECCAK_THETA(X, C_LEFT, C_RIGHT)                                \
+  D = C_LEFT ^ CVMFS_KECCAK_ROL(C_RIGHT, 1);                                  \
+  A[X] ^= D; A[X + 5] ^= D; A[X + 10] ^= D; A[X + 15] ^= D; A[X + 20] ^= D;
+
+/**
+ * Chi step for the row starting at lane Y
+ */
+#define CVMFS_KECCAK_CHI(Y)                                                   \
+  C0 = A[Y]; C1 = A[Y + 1]; C2 = A[Y + 2]; C3 = A[Y + 3]; C4 = A[Y + 4];      \
+  A[Y] = C0 ^ (~C1 & C2);                                                     \
+  A[Y + 1] = C1 ^ (~C2 & C3);                                                 \
+  A[Y + 2] = C2 ^ (~C3 & C4);                                                 \
+  A[Y + 3] = C3 ^ (~C4 & C0);                                                 \
+  A[Y + 4] = C4 ^ (~C0 & C1);
+
+/**
+ * Keccak-f[1600] on vectors of lanes, following the readable reference
+ * implementation of the Keccak team.  Compiled once for the baseline
+ * instruction set and once for AVX2.
+ */
+inline __attribute__((always_inline)) void KeccakRounds(Lanes *A) {
+  Lanes C0, C1, C2, C3, C4;
+  Lanes D;
+  Lanes tmp;
+  Lanes current;
+
+  for (unsigned round = 0; round < 24; ++round) {
+    // Theta
+    C0 = A[0] ^ A[5] ^ A[10] ^ A[15] ^ A[20];
+    C1 = A[1] ^ A[6] ^ A[11] ^ A[16] ^ A[21];
+    C2 = A[2] ^ A[7] ^ A[12] ^ A[17] ^ A[22];
+    C3 = A[3] ^ A[8] ^ A[13] ^ A[18] ^ A[23];
+    C4 = A[4] ^ A[9] ^ A[14] ^ A[19] ^ A[24];
+    CVMFS_KECCAK_THETA(0, C4, C1)
+    CVMFS_KECCAK_THETA(1, C0, C2)
+    CVMFS_KECCAK_THETA(2, C1, C3)
+    CVMFS_KECCAK_THETA(3, C2, C4)
+    CVMFS_KECCAK_THETA(4, C3, C0)
+
+    // Rho and pi
+    current = A[1];
+    CVMFS_KECCAK_RHO_PI(10,  1) CVMFS_KECCAK_RHO_PI(7,   3)
+    CVMFS_KECCAK_RHO_PI(11,  6) CVMFS_KECCAK_RHO_PI(17, 10)
+    CVMFS_KECCAK_RHO_PI(18, 15) CVMFS_KECCAK_RHO_PI(3,  21)
+    CVMFS_KECCAK_RHO_PI(5,  28) CVMFS_KECCAK_RHO_PI(16, 36)
+    CVMFS_KECCAK_RHO_PI(8,  45) CVMFS_KECCAK_RHO_PI(21, 55)
+    CVMFS_KECCAK_RHO_PI(24,  2) CVMFS_KECCAK_RHO_PI(4,  14)
+    CVMFS_KECCAK_RHO_PI(15, 27) CVMFS_KECCAK_RHO_PI(23, 41)
+    CVMFS_KECCAK_RHO_PI(19, 56) CVMFS_KECCAK_RHO_PI(13,  8)
+    CVMFS_KECCAK_RHO_PI(12, 25) CVMFS_KECCAK_RHO_PI(2,  43)
+    CVMFS_KECCAK_RHO_PI(20, 62) CVMFS_KECCAK_RHO_PI(14, 18)
+    CVMFS_KECCAK_RHO_PI(22, 39) CVMFS_KECCAK_RHO_PI(9,  61)
+    CVMFS_KECCAK_RHO_PI(6,  20) CVMFS_KECCAK_RHO_PI(1,  44)
+
+    // Chi
+    CVMFS_KECCAK_CHI(0)
+    CVMFS_KECCAK_CHI(5)
+    CVMFS_KECCAK_CHI(10)
+    CVMFS_KECCAK_CHI(15)
+    CVMFS_KECCAK_CHI(20)
+
+    // Iota
+    A[0] ^= kKeccakRoundConstants[round];
+  }
+}
+
+#undef CVMFS_KECCAK_CHI
+#undef CVMFS_KECCAK_THETA
+#undef CVMFS_KECCAK_RHO_PI
+#undef CVMFS_KECCAK_ROL
+
+void KeccakF1600xNGeneric(Lanes *A) {
+  KeccakRounds(A);
+}
+
+#ifdef CVMFS_HASH_ACCEL_X86
+__attribute__((target("avx2")))
+void KeccakF1600xNAvx2(Lanes *A) {
+  KeccakRounds(A);
+}
+#endif
+
+}  // anonymous namespace
+
+
+unsigned GetCpuFeatures() {
+  static unsigned features = DetectCpuFeatures();
+  return features;
+}
+
+
+void Sha1Init(Sha1Context *ctx) {
+  ctx->accelerated = (GetSha1Blocks() != NULL);
+  if (!ctx->accelerated) {
+    SHA1_Init(&ctx->fallback);
+    return;
+  }
+  ctx->state[0] = 0x67452301U;
+  ctx->state[1] = 0xEFCDAB89U;
+  ctx->state[2] = 0x98BADCFEU;
+  ctx->state[3] = 0x10325476U;
+  ctx->state[4] = 0xC3D2E1F0U;
+  ctx->num = 0;
+  ctx->length = 0;
+}
+
+
+void Sha1Update(Sha1Context *ctx, const unsigned char *buffer, size_t length) {
+  if (!ctx->accelerated) {
+    SHA1_Update(&ctx->fallback, buffer, length);
+    return;
+  }
+  Sha1BlocksFn sha1_blocks = GetSha1Blocks();
+  ctx->length += length;
+
+  // Fill up the pending partial block, if any
+  if (ctx->num > 0) {
+    const size_t nbytes = std::min(length, size_t(64 - ctx->num));
+    memcpy(ctx->block + ctx->num, buffer, nbytes);
+    ctx->num += nbytes;
+    buffer += nbytes;
+    length -= nbytes;
+    if (ctx->num < 64)
+      return;
+    sha1_blocks(ctx->state, ctx->block, 1);
+    ctx->num = 0;
+  }
+
+  const size_t nblocks = length / 64;
+  if (nblocks > 0) {
+    sha1_blocks(ctx->state, buffer, nblocks);
+    buffer += nblocks * 64;
+    length -= nblocks * 64;
+  }
+
+  memcpy(ctx->block, buffer, length);
+  ctx->num = length;
+}
+
+
+void Sha1Final(Sha1Context *ctx, unsigned char *digest) {
+  if (!ctx->accelerated) {
+    SHA1_Final(digest, &ctx->fallback);
+    return;
+  }
+  Sha1BlocksFn sha1_blocks = GetSha1Blocks();
+
+  // Padding: a single 1 bit, zeros, and the message length in bits (big endian)
+  ctx->block[ctx->num++] = 0x80;
+  if (ctx->num > 56) {
+    memset(ctx->block + ctx->num, 0, 64 - ctx->num);
+    sha1_blocks(ctx->state, ctx->block, 1);
+    ctx->num = 0;
+  }
+  memset(ctx->block + ctx->num, 0, 56 - ctx->num);
+  const uint64_t nbits = ctx->length * 8;
+  for (unsigned i = 0; i < 8; ++i)
+    ctx->block[56 + i] = (nbits >> (56 - 8 * i)) & 0xFF;
+  sha1_blocks(ctx->state, ctx->block, 1);
+
+  for (unsigned i = 0; i < 5; ++i) {
+    digest[4 * i]     = (ctx->state[i] >> 24) & 0xFF;
+    digest[4 * i + 1] = (ctx->state[i] >> 16) & 0xFF;
+    digest[4 * i + 2] = (ctx->state[i] >> 8) & 0xFF;
+    digest[4 * i + 3] = ctx->state[i] & 0xFF;
+  }
+}
+
+
+bool HasKeccakMultiBuffer() {
+  // Without wide vector registers, the multi-buffer permutation is not faster
+  // than the optimized single-state implementation of the Keccak library
+  return GetCpuFeatures() & kCpuAvx2;
+}
+
+
+void KeccakF1600xN(uint64_t *state) {
+  Lanes A[25];
+  memcpy(A, state, sizeof(A));
+#ifdef CVMFS_HASH_ACCEL_X86
+  if (GetCpuFeatures() & kCpuAvx2)
+    KeccakF1600xNAvx2(A);
+  else
+    KeccakF1600xNGeneric(A);
+#else
+  KeccakF1600xNGeneric(A);
+#endif
+  memcpy(state, A, sizeof(A));
+}
+
+}  // namespace shash
+
+#ifdef CVMFS_NAMESPACE_GUARD
+}  // namespace CVMFS_NAMESPACE_GUARD
+#endif
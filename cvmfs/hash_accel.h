@@ -0,0 +1,82 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Hardware accelerated building blocks for the hash functions in hash.h.  The
+ * implementation is selected at runtime according to the features of the CPU,
+ * so that the same binary runs on older machines.  Without support from the
+ * CPU, the functions fall back to OpenSSL and to the Keccak reference code.
+ */
+
+#ifndef CVMFS_HASH_ACCEL_H_
+#define CVMFS_HASH_ACCEL_H_
+
+#include <openssl/sha.h>
+#include <stdint.h>
+
+#include <cstddef>
+
+#ifdef CVMFS_NAMESPACE_GUARD
+namespace CVMFS_NAMESPACE_GUARD {
+#endif
+
+namespace shash {
+
+/**
+ * Bit mask returned by GetCpuFeatures()
+ */
+enum CpuFeatures {
+  kCpuSha1 = 0x01,  // x86 SHA extensions
+  kCpuAvx2 = 0x02,
+};
+
+/**
+ * Detected once on first use.  Setting CVMFS_HASH_NO_ACCEL in the environment
+ * disables all accelerated code paths, e.g. for comparison.
+ */
+unsigned GetCpuFeatures();
+
+/**
+ * SHA-1 context for Sha1Init(), Sha1Update(), and Sha1Final().  With the SHA
+ * instructions of the CPU, the hash state and the pending partial block are
+ * kept here.  Otherwise, only the OpenSSL context is used.
+ */
+struct Sha1Context {
+  bool accelerated;
+  uint32_t state[5];
+  uint32_t num;  ///< number of bytes in block
+  uint64_t length;  ///< total number of bytes hashed so far
+  unsigned char block[64];
+  SHA_CTX fallback;
+};
+
+void Sha1Init(Sha1Context *ctx);
+void Sha1Update(Sha1Context *ctx, const unsigned char *buffer, size_t length);
+/**
+ * Writes 20 bytes to digest
+ */
+void Sha1Final(Sha1Context *ctx, unsigned char *digest);
+
+/**
+ * Number of Keccak states that KeccakF1600xN() permutes at once.
+ */
+const unsigned kKeccakLanes = 4;
+
+/**
+ * True if KeccakF1600xN() is faster than permuting the states one by one.
+ */
+bool HasKeccakMultiBuffer();
+
+/**
+ * Applies the Keccak-f[1600] permutation to kKeccakLanes independent states.
+ * Lane i of state j is in state[i * kKeccakLanes + j], 25 lanes per state.
+ * Used to hash several equally long messages at once (multi-buffer hashing).
+ */
+void KeccakF1600xN(uint64_t *state);
+
+}  // namespace shash
+
+#ifdef CVMFS_NAMESPACE_GUARD
+}  // namespace CVMFS_NAMESPACE_GUARD
+#endif
+
+#endif  // CVMFS_HASH_ACCEL_H_
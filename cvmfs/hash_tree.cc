@@ -0,0 +1,227 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "hash_tree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "hash_accel.h"
+
+#ifdef CVMFS_NAMESPACE_GUARD
+namespace CVMFS_NAMESPACE_GUARD {
+#endif
+
+namespace shash {
+
+namespace {
+
+const unsigned char kNodeLeaf = 0x00;
+const unsigned char kNodeParent = 0x01;
+const unsigned char kNodeRoot = 0x02;
+
+/**
+ * SHAKE128 rate in bytes and its domain separation suffix
+ */
+const unsigned kRate = 168;
+const unsigned char kShakeSuffix = 0x1F;
+
+void FinishNode(Keccak_HashInstance *instance,
+                const unsigned char node_type,
+                unsigned char *cv)
+{
+  HashReturn keccak_result = Keccak_HashUpdate(instance, &node_type, 8);
+  assert(keccak_result == SUCCESS);
+  keccak_result = Keccak_HashFinal(instance, NULL);
+  assert(keccak_result == SUCCESS);
+  keccak_result = Keccak_HashSqueeze(instance, cv, kTreeCvSize * 8);
+  assert(keccak_result == SUCCESS);
+}
+
+/**
+ * The result may be written to one of the children
+ */
+void HashParent(const unsigned char *left,
+                const unsigned char *right,
+                unsigned char *cv)
+{
+  Keccak_HashInstance instance;
+  Keccak_HashInitialize_SHAKE128(&instance);
+  Keccak_HashUpdate(&instance, left, kTreeCvSize * 8);
+  Keccak_HashUpdate(&instance, right, kTreeCvSize * 8);
+  FinishNode(&instance, kNodeParent, cv);
+}
+
+void HashRoot(const unsigned char *cv, uint64_t size, unsigned char *digest) {
+  unsigned char size_le[8];
+  for (unsigned i = 0; i < 8; ++i)
+    size_le[i] = static_cast<unsigned char>(size >> (8 * i));
+  Keccak_HashInstance instance;
+  Keccak_HashInitialize_SHAKE128(&instance);
+  Keccak_HashUpdate(&instance, cv, kTreeCvSize * 8);
+  Keccak_HashUpdate(&instance, size_le, 8 * 8);
+  FinishNode(&instance, kNodeRoot, digest);
+}
+
+/**
+ * Adds the chaining value of the next leaf and merges all the subtrees that
+ * are complete with the new leaf.
+ */
+void PushLeaf(TreeHashContext *ctx, const unsigned char *leaf_cv) {
+  unsigned char cv[kTreeCvSize];
+  memcpy(cv, leaf_cv, kTreeCvSize);
+  ctx->nleaves++;
+  for (uint64_t n = ctx->nleaves; (n & 1) == 0; n >>= 1) {
+    assert(ctx->stack_size > 0);
+    ctx->stack_size--;
+    HashParent(ctx->stack[ctx->stack_size], cv, cv);
+  }
+  assert(ctx->stack_size < kTreeMaxDepth);
+  memcpy(ctx->stack[ctx->stack_size], cv, kTreeCvSize);
+  ctx->stack_size++;
+}
+
+inline uint64_t LoadLe64(const unsigned char *p) {
+  uint64_t result = 0;
+  for (unsigned i = 0; i < 8; ++i)
+    result |= uint64_t(p[i]) << (8 * i);
+  return result;
+}
+
+/**
+ * XORs one block of kRate bytes of every message into the interleaved states
+ * and permutes them.  The blocks of the messages are stride bytes apart.
+ */
+void AbsorbN(const unsigned char *block, unsigned stride, uint64_t *state) {
+  for (unsigned j = 0; j < kKeccakLanes; ++j) {
+    for (unsigned i = 0; i < kRate / 8; ++i)
+      state[i * kKeccakLanes + j] ^= LoadLe64(block + j * stride + i * 8);
+  }
+  KeccakF1600xN(state);
+}
+
+}  // anonymous namespace
+
+
+void TreeHashLeaf(const unsigned char *data, unsigned size, unsigned char *cv)
+{
+  assert(size <= kTreeLeafSize);
+  Keccak_HashInstance instance;
+  Keccak_HashInitialize_SHAKE128(&instance);
+  Keccak_HashUpdate(&instance, data, size * 8);
+  FinishNode(&instance, kNodeLeaf, cv);
+}
+
+
+void TreeHashLeavesN(const unsigned char *data, unsigned char *cvs) {
+  const unsigned kNumFullBlocks = kTreeLeafSize / kRate;
+  const unsigned kTailSize = kTreeLeafSize % kRate;
+  // The node type and the suffix fit into the last block
+  assert(kTailSize + 2 <= kRate);
+
+  uint64_t state[25 * kKeccakLanes];
+  memset(state, 0, sizeof(state));
+  for (unsigned b = 0; b < kNumFullBlocks; ++b)
+    AbsorbN(data + b * kRate, kTreeLeafSize, state);
+
+  // Padding according to the FIPS 202 sponge construction
+  unsigned char last_blocks[kKeccakLanes][kRate];
+  memset(last_blocks, 0, sizeof(last_blocks));
+  for (unsigned j = 0; j < kKeccakLanes; ++j) {
+    memcpy(last_blocks[j],
+           data + j * kTreeLeafSize + kNumFullBlocks * kRate, kTailSize);
+    last_blocks[j][kTailSize] = kNodeLeaf;
+    last_blocks[j][kTailSize + 1] = kShakeSuffix;
+    last_blocks[j][kRate - 1] |= 0x80;
+  }
+  AbsorbN(last_blocks[0], kRate, state);
+
+  for (unsigned j = 0; j < kKeccakLanes; ++j) {
+    for (unsigned i = 0; i < kTreeCvSize; ++i) {
+      cvs[j * kTreeCvSize + i] = static_cast<unsigned char>(
+        state[(i / 8) * kKeccakLanes + j] >> (8 * (i % 8)));
+    }
+  }
+}
+
+
+void TreeHashInit(TreeHashContext *ctx) {
+  ctx->leaf_size = 0;
+  ctx->stack_size = 0;
+  ctx->nleaves = 0;
+  ctx->size = 0;
+}
+
+
+void TreeHashUpdate(TreeHashContext *ctx,
+                    const unsigned char *buffer,
+                    size_t length)
+{
+  unsigned char cv[kKeccakLanes * kTreeCvSize];
+  ctx->size += length;
+
+  // Complete the pending leaf first
+  if (ctx->leaf_size > 0) {
+    const size_t nbytes =
+      std::min(length, size_t(kTreeLeafSize - ctx->leaf_size));
+    Keccak_HashUpdate(&ctx->leaf, buffer, nbytes * 8);
+    ctx->leaf_size += nbytes;
+    buffer += nbytes;
+    length -= nbytes;
+    if (ctx->leaf_size < kTreeLeafSize)
+      return;
+    FinishNode(&ctx->leaf, kNodeLeaf, cv);
+    PushLeaf(ctx, cv);
+    ctx->leaf_size = 0;
+  }
+
+  if (HasKeccakMultiBuffer()) {
+    while (length >= kKeccakLanes * kTreeLeafSize) {
+      TreeHashLeavesN(buffer, cv);
+      for (unsigned j = 0; j < kKeccakLanes; ++j)
+        PushLeaf(ctx, cv + j * kTreeCvSize);
+      buffer += kKeccakLanes * kTreeLeafSize;
+      length -= kKeccakLanes * kTreeLeafSize;
+    }
+  }
+  while (length >= kTreeLeafSize) {
+    TreeHashLeaf(buffer, kTreeLeafSize, cv);
+    PushLeaf(ctx, cv);
+    buffer += kTreeLeafSize;
+    length -= kTreeLeafSize;
+  }
+
+  if (length > 0) {
+    Keccak_HashInitialize_SHAKE128(&ctx->leaf);
+    Keccak_HashUpdate(&ctx->leaf, buffer, length * 8);
+    ctx->leaf_size = length;
+  }
+}
+
+
+void TreeHashFinal(TreeHashContext *ctx, unsigned char *digest) {
+  unsigned char cv[kTreeCvSize];
+  if ((ctx->leaf_size > 0) || (ctx->nleaves == 0)) {
+    if (ctx->leaf_size == 0)
+      Keccak_HashInitialize_SHAKE128(&ctx->leaf);
+    FinishNode(&ctx->leaf, kNodeLeaf, cv);
+    PushLeaf(ctx, cv);
+    ctx->leaf_size = 0;
+  }
+
+  // Merge the remaining subtrees from right to left
+  assert(ctx->stack_size > 0);
+  memcpy(cv, ctx->stack[ctx->stack_size - 1], kTreeCvSize);
+  for (unsigned i = ctx->stack_size - 1; i > 0; --i)
+    HashParent(ctx->stack[i - 1], cv, cv);
+  HashRoot(cv, ctx->size, digest);
+}
+
+}  // namespace shash
+
+#ifdef CVMFS_NAMESPACE_GUARD
+}  // namespace CVMFS_NAMESPACE_GUARD
+#endif
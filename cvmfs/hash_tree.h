@@ -0,0 +1,79 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * A tree hash on top of SHAKE128 in the spirit of BLAKE3.  The input is cut
+ * into leaves of kTreeLeafSize bytes.  The chaining values of the leaves are
+ * combined pairwise into a binary tree whose shape only depends on the input
+ * length.  Since the leaves are independent of each other, several of them are
+ * hashed at once with the multi-buffer Keccak permutation (see hash_accel.h).
+ *
+ * Node hashes, with || denoting concatenation and CV a 20 byte chaining value:
+ *   leaf   = SHAKE128(leaf data || 0x00)
+ *   parent = SHAKE128(CV left || CV right || 0x01)
+ *   root   = SHAKE128(CV of the top node || 64bit LE input length || 0x02)
+ * The empty input is a single empty leaf.
+ */
+
+#ifndef CVMFS_HASH_TREE_H_
+#define CVMFS_HASH_TREE_H_
+
+#include <stdint.h>
+
+#include <cstddef>
+
+#include "KeccakHash.h"
+
+#ifdef CVMFS_NAMESPACE_GUARD
+namespace CVMFS_NAMESPACE_GUARD {
+#endif
+
+namespace shash {
+
+const unsigned kTreeLeafSize = 1024;
+const unsigned kTreeCvSize = 20;
+/**
+ * Enough for 2^64 bytes of input
+ */
+const unsigned kTreeMaxDepth = 54;
+
+/**
+ * Hash context of the tree hash.  The stack holds the chaining values of the
+ * complete subtrees that still wait for a right sibling; subtrees are merged
+ * as soon as possible, so that there are never more than kTreeMaxDepth.
+ */
+struct TreeHashContext {
+  Keccak_HashInstance leaf;  ///< the current, incomplete leaf
+  uint32_t leaf_size;
+  uint32_t stack_size;
+  uint64_t nleaves;
+  uint64_t size;
+  unsigned char stack[kTreeMaxDepth][kTreeCvSize];
+};
+
+void TreeHashInit(TreeHashContext *ctx);
+void TreeHashUpdate(TreeHashContext *ctx,
+                    const unsigned char *buffer,
+                    size_t length);
+/**
+ * Writes kTreeCvSize bytes to digest
+ */
+void TreeHashFinal(TreeHashContext *ctx, unsigned char *digest);
+
+/**
+ * Chaining value of a single leaf of up to kTreeLeafSize bytes
+ */
+void TreeHashLeaf(const unsigned char *data, unsigned size, unsigned char *cv);
+/**
+ * Chaining values of kKeccakLanes consecutive, complete leaves, computed with
+ * the multi-buffer Keccak permutation.  Used by TreeHashUpdate() if
+ * HasKeccakMultiBuffer() is true.
+ */
+void TreeHashLeavesN(const unsigned char *data, unsigned char *cvs);
+
+}  // namespace shash
+
+#ifdef CVMFS_NAMESPACE_GUARD
+}  // namespace CVMFS_NAMESPACE_GUARD
+#endif
+
+#endif  // CVMFS_HASH_TREE_H_
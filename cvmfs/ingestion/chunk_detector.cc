@@ -8,10 +8,51 @@
 #include <algorithm>
 #include <cassert>
 #include <limits>
+#include <string>
 
 #include "ingestion/item.h"
 
 
+ChunkingAlgorithms ParseChunkingAlgorithm(const std::string &name) {
+  if ((name == "xor32") || (name == "default"))
+    return kChunkXor32;
+  if (name == "gear")
+    return kChunkGear;
+  return kChunkUnknown;
+}
+
+
+std::string ChunkingAlgorithmName(const ChunkingAlgorithms alg) {
+  switch (alg) {
+    case kChunkXor32:
+      return "xor32";
+    case kChunkGear:
+      return "gear";
+    default:
+      return "unknown";
+  }
+}
+
+
+ChunkDetector *ChunkDetector::Construct(
+  const ChunkingAlgorithms algorithm,
+  const uint64_t minimal_chunk_size,
+  const uint64_t average_chunk_size,
+  const uint64_t maximal_chunk_size)
+{
+  switch (algorithm) {
+    case kChunkXor32:
+      return new Xor32Detector(minimal_chunk_size, average_chunk_size,
+                               maximal_chunk_size);
+    case kChunkGear:
+      return new GearDetector(minimal_chunk_size, average_chunk_size,
+                              maximal_chunk_size);
+    default:
+      abort();
+  }
+}
+
+
 uint64_t ChunkDetector::FindNextCutMark(BlockItem *block) {
   uint64_t result = DoFindNextCutMark(block);
   if (result == 0)
@@ -135,3 +176,190 @@ uint64_t Xor32Detector::DoFindNextCutMark(BlockItem *buffer) {
     return NoCut(internal_offset + offset());
   }
 }
+
+
+//------------------------------------------------------------------------------
+
+
+// Random values (splitmix64 output) added to the gear hash for every input
+// byte.  As with the xor32 magic number, this table defines the cut marks and
+// must never change.
+const uint64_t GearDetector::kGearTable[256] = {
+  0x5ee3d6eed79f3e98ULL, 0xeb0652745e889e68ULL, 0x5f8eec5735eb761fULL,
+  0x49cfadc1fa16f10aULL, 0x9bb196a16a74c184ULL, 0x2416073fb223d7ffULL,
+  0xeacb3a45eaf6f6eaULL, 0xff3e0e9659755890ULL, 0x34f96324ac0bf473ULL,
+  0x83b098b61d6b5706ULL, 0xdc82d38487a43224ULL, 0xaa5e7f2252b5cee0ULL,
+  0xbd292d8db478becdULL, 0x18f24075f4c3991fULL, 0x89f8554faa527512ULL,
+  0x541ecfa820d50928ULL, 0x2a01cb15bbb8c3aaULL, 0x7a82251b36e598cbULL,
+  0x6b1c0ae80eeedce6ULL, 0x27da136c2b910cd2ULL, 0x1b63df568925259bULL,
+  0x6887f88743319d58ULL, 0x201f1cc9b8644b3eULL, 0xf45892683d37b108ULL,
+  0x52fa57e7a98630e6ULL, 0xc28fe31e0d19298aULL, 0x8bf32405623ec2a9ULL,
+  0xd3056d2dc0653cfdULL, 0x5111fa06b1ac6713ULL, 0x4e41da63a9281b71ULL,
+  0x30cafbea1c55da98ULL, 0x8b56ca9a05e54721ULL, 0x3a8d2850215bf6ceULL,
+  0x4432ab07467e02b2ULL, 0x6a84546cef0fd3afULL, 0x87b44879d034f183ULL,
+  0xfc06998a673b3c77ULL, 0x4a1f7407e9aa4a8fULL, 0x0b959887c92cf9d3ULL,
+  0x17bcdc0de92edc7bULL, 0xa0b3e4a152f1cf4cULL, 0xda052ba8de11b956ULL,
+  0x9cdd66d2f65be07bULL, 0x0415a5805c4b5cdeULL, 0x0ed6d4c336df421eULL,
+  0x86f594857c63bcb1ULL, 0xd997ff31dbdb2dc1ULL, 0x57a05bdb71b5baf6ULL,
+  0x554bdf7f68988f07ULL, 0xb2f2b7e2bb2ff7f3ULL, 0x7a3d9cb819f02a3fULL,
+  0x4efb755d44f9dedbULL, 0x9da728d8bc47ad26ULL, 0xdc7e02f30e10968eULL,
+  0xd238999493259d0fULL, 0x638cb50fc6626a95ULL, 0xd9f1b2572381b102ULL,
+  0xdc0f95e39575ff80ULL, 0x22afccec8433fbcaULL, 0xc7f38911c9693519ULL,
+  0x30a45721512d06aaULL, 0xaae691a13315056bULL, 0xc992dfc6f0cb8571ULL,
+  0x1f514d2a8ae90400ULL, 0x86bb96a6d382c689ULL, 0x72720be5ea2bdd3dULL,
+  0x46f1fb51ab4677a6ULL, 0x9d7d2a211cf0e8c1ULL, 0x35dd20cf7e146e51ULL,
+  0xcd833c07d79f5ce2ULL, 0xb5b132f30d957f78ULL, 0x1e9a9d2bde2454a3ULL,
+  0x2b76c0bf7d7ac060ULL, 0xdc820cc27d71b7aeULL, 0x428b357e77e2c9beULL,
+  0xdcf39be1dba92f1aULL, 0x43b877e026ce1393ULL, 0x21441f7a254acc38ULL,
+  0xf7682d55a17ab86dULL, 0xc8a4d5f12f8c734cULL, 0xc5cf4e706fa10334ULL,
+  0x55b0066a7610a91bULL, 0x7e5cf63fe11c3e42ULL, 0x4c5f6605c80608eaULL,
+  0x87db62f81315796eULL, 0xb95967fe2465678fULL, 0x3fe55d4d02eb8fcdULL,
+  0xca6c8968bd4cd6ecULL, 0x370594925c2127a4ULL, 0x4b53a1e782f34736ULL,
+  0xca5b67ecc6fb68d2ULL, 0x0af3ea420b1c923bULL, 0x4e3f4569fc26cd41ULL,
+  0xfff561c50981ffeaULL, 0xee5ce12de17803ddULL, 0xfb83e3d88ee564d3ULL,
+  0xde35f20174cf98caULL, 0xa687c1b6fbaef98dULL, 0x293deb17a23c33f7ULL,
+  0x92bb245f6c064cadULL, 0x68666ef4d8f242cdULL, 0x313b00a87fee1568ULL,
+  0x16bb9ed71eee1dc3ULL, 0x3a1da681ad7fd5e1ULL, 0x13b4b3a6c225b60dULL,
+  0x0e14b5600ca1f7adULL, 0xf06e6d1fad4ef9f2ULL, 0x95461092e1ba534eULL,
+  0x278c4df4fa0dd067ULL, 0xec35b790ef3fdf0fULL, 0x5050abe9c2a33930ULL,
+  0x1a9b66724d066b02ULL, 0xdf806f2a4b380841ULL, 0x85791915f31e1456ULL,
+  0x6d070252913a4f5aULL, 0xa5a6034544a14bedULL, 0x14ea45195c6e579bULL,
+  0x206bd512d3c6997aULL, 0x045f3b66bb1ba166ULL, 0x48a8baddfe84438bULL,
+  0xb574a7289b199c2aULL, 0x1fbc8510aaa1d325ULL, 0x42bb84f3ac64f444ULL,
+  0xf80fd0028a2ff832ULL, 0x0bf8e6f5d9e611d1ULL, 0x0dfc71342f7cd225ULL,
+  0xfbc2ad61a147b8baULL, 0xfa29987e1969d596ULL, 0x2e0efcc34d190fd0ULL,
+  0x4fcbaca9e629436aULL, 0x34a80a79c10621cfULL, 0xcb1558d4e2a18f50ULL,
+  0x262353e1e46a6047ULL, 0xddd4366055905962ULL, 0xfcdbe810bca1722fULL,
+  0x79e79fca780fe279ULL, 0xa2e4bc6d50a356bfULL, 0xe9ae3e39c9a48cb4ULL,
+  0x507396bccb339d9eULL, 0x464205babbfb12e9ULL, 0x348ee695a19fbaecULL,
+  0xe59aad49aee1bf2dULL, 0xb93a97b651599c58ULL, 0xb83055649d3d1601ULL,
+  0x7b3f2b6fee2426aaULL, 0xa6f15a27a53d883fULL, 0x0997b07e378ed487ULL,
+  0xbe6c9cdbb60a2f72ULL, 0x6b712ae428dd5c01ULL, 0xe357b34c9759c8c5ULL,
+  0xaed9207a507d836fULL, 0x39fc9fd677abda62ULL, 0x805dc2ff4c4d4fdcULL,
+  0xa6c4e3e422f36433ULL, 0x301b1df1f4d0989bULL, 0x3bd3c1b8ee65311eULL,
+  0xddf9b01750148445ULL, 0x29def89bc179a8adULL, 0x7dadf08adafefdf9ULL,
+  0x5987a97f46988fceULL, 0xc1f70f6fbaa73655ULL, 0x228739d611862391ULL,
+  0xcf78dfc2d3974f2dULL, 0x2190383df56b7173ULL, 0x170f58fba2f13ef6ULL,
+  0xe18c8a9d28d6ea61ULL, 0xeca3986ab406b020ULL, 0x1d1b29c0844ee22cULL,
+  0x9382d9d23c912e29ULL, 0x2d188699b5d9952cULL, 0x6a67bc734e620d19ULL,
+  0xad9226954da7b749ULL, 0xb1a1e8a08e99b370ULL, 0xc20df128ae99f3e9ULL,
+  0x8bfd9243f223ed0cULL, 0xa654e32afb85e424ULL, 0x22eb2732c8786e0dULL,
+  0x9f786b43438bfa2aULL, 0x774e81d992979f57ULL, 0x2da1fd3bdd022e90ULL,
+  0xfc7317ce72537557ULL, 0x8ce8fcc9b9c0ba9cULL, 0xed2427e36ea2bca4ULL,
+  0xe5e8c1a6c9d596f4ULL, 0x1937a5e9c26ca321ULL, 0x4c54a63583b64c79ULL,
+  0xfabb200a0758f849ULL, 0x44c7c27d7d1e08b7ULL, 0x2377134ebcde69e9ULL,
+  0x458df4d538dff0a3ULL, 0x1031846ac63ec539ULL, 0xc2cbb889909fdb6eULL,
+  0xcd59deb343ff94eeULL, 0x5f157ed9c2174d03ULL, 0xe786a56b94dd8c98ULL,
+  0x044650827ca91c37ULL, 0x8dfb136db163ef55ULL, 0x24acdb2f32b2776dULL,
+  0x1852bec63d197c5cULL, 0x4159b27766df825bULL, 0xbb34e3446a07d27eULL,
+  0x158009738a608c1fULL, 0x1bbf135abd20cac9ULL, 0x5043d68d3a2c535fULL,
+  0xf573ef52f84d6060ULL, 0xebfa4c753a5829a9ULL, 0x50e0bbe2084e1045ULL,
+  0x26651850f83be63cULL, 0x9fd4557bf38fdccaULL, 0x9f96c683e33462e0ULL,
+  0xe38c6fb79fcf3c6bULL, 0x8815ad2757c1bf49ULL, 0x00e7c2d414b7e91cULL,
+  0xa293d5ec8f171cc2ULL, 0xb9bebb9d1371e7cdULL, 0xbd448f2564c21588ULL,
+  0x7f3ec7d233c92a97ULL, 0x6b07e72f1e5c2998ULL, 0x1485e1a77b37ffecULL,
+  0x9bd7c73843d95c3eULL, 0x74e4ad78b1770dc9ULL, 0x502f8860a92b4057ULL,
+  0xeb2583678c2d074bULL, 0xa80d5dbae9297d72ULL, 0x3b48168c21b324aeULL,
+  0xac592a348c0a91b9ULL, 0x60af55f9e07a0962ULL, 0xa42ba4035d6187e7ULL,
+  0xf76d8a369f0e508dULL, 0xe1ca906220acf7feULL, 0xc13196b8c9bbf272ULL,
+  0xe56ecfdfbe62d48eULL, 0xabb2cf96101936c8ULL, 0x38d5509ca5b5ffc2ULL,
+  0x99fdbe90282fac15ULL, 0x190d5da5ae5377afULL, 0x20eda64ac0cc3020ULL,
+  0xcd2795128d8877b7ULL, 0x07fe68d859f1d87bULL, 0xed99bf969a718a3bULL,
+  0x4ce2ca2d06dc0f18ULL, 0xb614654c2865d646ULL, 0x08ad007a628c8c92ULL,
+  0xb6ecfe5c5af44ff2ULL, 0xdc3118f4a4da8290ULL, 0x9278210f3142b792ULL,
+  0x98aea22e0a848d73ULL, 0xa76752d3555caa14ULL, 0xa22b081c27972f2fULL,
+  0xc6e08adb97fed206ULL, 0xca296a434c03f8d2ULL, 0xca15c3897af1afb5ULL,
+  0x308657db817efa47ULL, 0x922155bc8cfa2fbbULL, 0x4adf19ab5279e65eULL,
+  0x01dee68a80ec3d18ULL
+};
+
+
+GearDetector::GearDetector(const uint64_t minimal_chunk_size,
+                           const uint64_t average_chunk_size,
+                           const uint64_t maximal_chunk_size)
+  : minimal_chunk_size_(minimal_chunk_size)
+  , average_chunk_size_(average_chunk_size)
+  , maximal_chunk_size_(maximal_chunk_size)
+  , mask_strict_(MakeMask(average_chunk_size, true))
+  , mask_loose_(MakeMask(average_chunk_size, false))
+  , gear_ptr_(0)
+  , gear_(0)
+{
+  assert((average_chunk_size_ == 0) || (minimal_chunk_size_ > 0));
+  if (minimal_chunk_size_ > 0) {
+    assert(minimal_chunk_size_ >= kGearWindow);
+    assert(minimal_chunk_size_ < average_chunk_size_);
+    assert(average_chunk_size_ < maximal_chunk_size_);
+  }
+}
+
+
+/**
+ * On random data, a mask with n bits matches every 2^n bytes.  The mask uses
+ * the top bits of the hash, which depend on the entire window.
+ */
+uint64_t GearDetector::MakeMask(const uint64_t average_chunk_size,
+                                const bool strict)
+{
+  if (average_chunk_size == 0)
+    return 0;
+  unsigned nbits = 0;
+  while ((uint64_t(1) << (nbits + 1)) <= average_chunk_size)
+    nbits++;
+  assert((nbits > kNormalization) && (nbits + kNormalization < 64));
+  nbits = strict ? (nbits + kNormalization) : (nbits - kNormalization);
+  return ~uint64_t(0) << (64 - nbits);
+}
+
+
+uint64_t GearDetector::DoFindNextCutMark(BlockItem *buffer) {
+  assert(minimal_chunk_size_ > 0);
+  const unsigned char *data = buffer->data();
+  const uint64_t buffer_begin = offset();
+  const uint64_t buffer_end = offset() + buffer->size();
+
+  // Cut marks are only searched beyond the minimal chunk size, the hash needs
+  // the preceding window to be filled.  Continue where the last buffer ended.
+  uint64_t pos =
+    std::max(last_cut() + minimal_chunk_size_ - kGearWindow, gear_ptr_);
+  if (pos >= buffer_end)
+    return NoCut(pos);
+  assert(pos >= buffer_begin);
+
+  // The hash is kept in a local variable: stores to the member could alias
+  // the input data and would keep the compiler from holding it in a register
+  uint64_t hash = gear_;
+  const unsigned char *p = data + (pos - buffer_begin);
+
+  const uint64_t precompute_end =
+    std::max(pos, std::min(last_cut() + minimal_chunk_size_, buffer_end));
+  for (; p < data + (precompute_end - buffer_begin); ++p)
+    hash = Roll(hash, *p);
+
+  const uint64_t normal_end =
+    std::max(pos, std::min(last_cut() + average_chunk_size_, buffer_end));
+  for (const unsigned char *end = data + (normal_end - buffer_begin);
+       p < end; ++p)
+  {
+    hash = Roll(hash, *p);
+    if ((hash & mask_strict_) == 0)
+      return DoCut(buffer_begin + (p - data));
+  }
+
+  const uint64_t max_end = last_cut() + maximal_chunk_size_;
+  const uint64_t compute_end = std::max(pos, std::min(max_end, buffer_end));
+  for (const unsigned char *end = data + (compute_end - buffer_begin);
+       p < end; ++p)
+  {
+    hash = Roll(hash, *p);
+    if ((hash & mask_loose_) == 0)
+      return DoCut(buffer_begin + (p - data));
+  }
+  gear_ = hash;
+  pos = buffer_begin + (p - data);
+
+  // Hard cut at the maximal chunk size or continue with the next buffer
+  if (pos == max_end)
+    return DoCut(pos);
+  return NoCut(pos);
+}
@@ -11,9 +11,27 @@
 #include <cstdlib>
 
 #include <algorithm>
+#include <string>
 
 class BlockItem;
 
+/**
+ * Content-defined chunking algorithms.  The algorithm of a repository must not
+ * change silently because it defines the chunk boundaries and thereby the
+ * deduplication of new revisions against existing chunks.
+ */
+enum ChunkingAlgorithms {
+  kChunkXor32 = 0,
+  kChunkGear,
+  kChunkUnknown,
+};
+
+/**
+ * Returns kChunkUnknown for unrecognized names.
+ */
+ChunkingAlgorithms ParseChunkingAlgorithm(const std::string &name);
+std::string ChunkingAlgorithmName(const ChunkingAlgorithms alg);
+
 /**
  * Abstract base class for a cutmark detector. This decides on which file
  * positions a File should be chunked.
@@ -22,6 +40,10 @@ class ChunkDetector {
  public:
   ChunkDetector() : last_cut_(0), offset_(0) {}
   virtual ~ChunkDetector() { }
+  static ChunkDetector *Construct(const ChunkingAlgorithms algorithm,
+                                  const uint64_t minimal_chunk_size,
+                                  const uint64_t average_chunk_size,
+                                  const uint64_t maximal_chunk_size);
   uint64_t FindNextCutMark(BlockItem *block);
 
   virtual bool MightFindChunks(uint64_t size) const = 0;
@@ -135,4 +157,71 @@ class Xor32Detector : public ChunkDetector {
   uint32_t xor32_;
 };
 
+
+/**
+ * Gear hash based chunking with normalized chunk sizes, as in FastCDC [1].
+ *
+ * The rolling hash is updated by a shift and an addition of a random 64-bit
+ * value per input byte, so that the top bits only depend on the last 64 bytes
+ * of the stream.  A cut mark is found when the masked top bits are zero.
+ * Before the average chunk size is reached, a mask with more bits makes cut
+ * marks less likely; afterwards, a mask with fewer bits makes them more
+ * likely.  That narrows the chunk size distribution around the average, so
+ * that fewer chunks are cut at the minimal or maximal chunk size.
+ *
+ * [1]     "FastCDC: a Fast and Efficient Content-Defined Chunking Approach
+ *          for Data Deduplication"
+ *     Wen Xia et al., USENIX ATC (2016)
+ */
+class GearDetector : public ChunkDetector {
+  FRIEND_TEST(T_ChunkDetectors, Gear);
+
+ public:
+  GearDetector(const uint64_t minimal_chunk_size,
+               const uint64_t average_chunk_size,
+               const uint64_t maximal_chunk_size);
+
+  bool MightFindChunks(const uint64_t size) const {
+    return size > minimal_chunk_size_;
+  }
+
+ protected:
+  virtual uint64_t DoFindNextCutMark(BlockItem *buffer);
+
+  virtual uint64_t DoCut(const uint64_t offset) {
+    gear_     = 0;
+    gear_ptr_ = offset;
+    return ChunkDetector::DoCut(offset);
+  }
+
+  virtual uint64_t NoCut(const uint64_t offset) {
+    gear_ptr_ = offset;
+    return ChunkDetector::NoCut(offset);
+  }
+
+  static inline uint64_t Roll(const uint64_t hash, const unsigned char byte) {
+    return (hash << 1) + kGearTable[byte];
+  }
+
+ private:
+  // The gear hash only depends on a window of the last 64 bytes
+  static const unsigned kGearWindow = 64;
+  // Normalization level: number of mask bits added / removed around the
+  // average chunk size
+  static const unsigned kNormalization = 2;
+  static const uint64_t kGearTable[256];
+
+  static uint64_t MakeMask(const uint64_t average_chunk_size,
+                           const bool strict);
+
+  const uint64_t minimal_chunk_size_;
+  const uint64_t average_chunk_size_;
+  const uint64_t maximal_chunk_size_;
+  const uint64_t mask_strict_;
+  const uint64_t mask_loose_;
+
+  uint64_t gear_ptr_;
+  uint64_t gear_;
+};
+
 #endif  // CVMFS_INGESTION_CHUNK_DETECTOR_H_
@@ -13,6 +13,8 @@
 #include <cassert>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 
 #include "duplex_libarchive.h"
@@ -217,4 +219,61 @@ class TarIngestionSource : public IngestionSource {
   Signal* read_archive_signal_;
 };
 
+
+/**
+ * Content of a tar entry that has already been read into memory.  Takes
+ * ownership of the buffer, which is released on Close() together with the
+ * read-ahead slot of the archive reader (see SyncUnionTarball).
+ */
+class TarBufferIngestionSource : public IngestionSource {
+ public:
+  TarBufferIngestionSource(const std::string &path, unsigned char *buffer,
+                           uint64_t size,
+                           SynchronizingCounter<uint32_t> *read_ahead)
+      : path_(path),
+        buffer_(buffer),
+        size_(size),
+        pos_(0),
+        read_ahead_(read_ahead) {}
+  virtual ~TarBufferIngestionSource() { Close(); }
+
+  std::string GetPath() const { return path_; }
+  virtual bool IsRealFile() const { return false; }
+
+  bool Open() {
+    assert(buffer_ != NULL);
+    return true;
+  }
+
+  ssize_t Read(void* external_buffer, size_t nbytes) {
+    assert(buffer_ != NULL);
+    size_t size = std::min(size_t(size_ - pos_), nbytes);
+    if (size > 0) memcpy(external_buffer, buffer_ + pos_, size);
+    pos_ += size;
+    return static_cast<ssize_t>(size);
+  }
+
+  bool Close() {
+    free(buffer_);
+    buffer_ = NULL;
+    if (read_ahead_ != NULL) {
+      read_ahead_->Decrement();
+      read_ahead_ = NULL;
+    }
+    return true;
+  }
+
+  bool GetSize(uint64_t* size) {
+    *size = size_;
+    return true;
+  }
+
+ private:
+  std::string path_;
+  unsigned char* buffer_;
+  uint64_t size_;
+  uint64_t pos_;
+  SynchronizingCounter<uint32_t>* read_ahead_;
+};
+
 #endif  // CVMFS_INGESTION_INGESTION_SOURCE_H_
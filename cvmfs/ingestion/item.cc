@@ -11,6 +11,7 @@
 
 #include "ingestion/ingestion_source.h"
 #include "item_mem.h"
+#include "platform.h"
 #include "smalloc.h"
 #include "util_concurrency.h"
 
@@ -23,15 +24,24 @@ FileItem::FileItem(
   shash::Algorithms hash_algorithm,
   shash::Suffix hash_suffix,
   bool may_have_chunks,
-  bool has_legacy_bulk_chunk)
+  bool has_legacy_bulk_chunk,
+  ChunkingAlgorithms chunking_algorithm,
+  uint64_t compression_segment_size,
+  int compression_level)
   : source_(source)
   , compression_algorithm_(compression_algorithm)
   , hash_algorithm_(hash_algorithm)
   , hash_suffix_(hash_suffix)
   , has_legacy_bulk_chunk_(has_legacy_bulk_chunk)
+  , compression_segment_size_(compression_segment_size)
+  , compression_level_(compression_level)
   , size_(kSizeUnknown)
   , may_have_chunks_(may_have_chunks)
-  , chunk_detector_(min_chunk_size, avg_chunk_size, max_chunk_size)
+  , creation_time_ns_(platform_monotonic_time_ns())
+  , chunk_detector_(ChunkDetector::Construct(chunking_algorithm,
+                                             min_chunk_size,
+                                             avg_chunk_size,
+                                             max_chunk_size))
   , bulk_hash_(hash_algorithm)
   , chunks_(1)
 {
@@ -72,11 +82,19 @@ ChunkItem::ChunkItem(FileItem *file_item, uint64_t offset)
   , size_(0)
   , is_bulk_chunk_(false)
   , upload_handle_(NULL)
-  , compressor_(NULL)
+  , tag_(-1)
+  , next_segment_(0)
+  , segments_checksum_(0)
 {
+  int retval = pthread_mutex_init(&segment_lock_, NULL);
+  assert(retval == 0);
   hash_ctx_.algorithm = file_item->hash_algorithm();
   hash_ctx_.size = shash::GetContextSize(hash_ctx_.algorithm);
-  hash_ctx_.buffer = hash_ctx_buffer_;
+  // Only the tree hash context does not fit into the fixed buffer
+  if (hash_ctx_.size <= sizeof(hash_ctx_buffer_))
+    hash_ctx_.buffer = hash_ctx_buffer_;
+  else
+    hash_ctx_.buffer = smalloc(hash_ctx_.size);
   shash::Init(hash_ctx_);
   hash_value_.algorithm = hash_ctx_.algorithm;
   hash_value_.suffix = shash::kSuffixPartial;
@@ -90,17 +108,37 @@ void ChunkItem::MakeBulkChunk() {
 }
 
 
-zlib::Compressor *ChunkItem::GetCompressor() {
-  if (!compressor_.IsValid()) {
-    compressor_ =
-      zlib::Compressor::Construct(file_item_->compression_algorithm());
-  }
-  return compressor_.weak_ref();
+ChunkItem::~ChunkItem() {
+  assert(pending_segments_.empty());
+  pthread_mutex_destroy(&segment_lock_);
+  if (hash_ctx_.buffer != hash_ctx_buffer_)
+    free(hash_ctx_.buffer);
+}
+
+
+void ChunkItem::PushSegment(CompressedSegment *segment) {
+  assert(segment->index >= next_segment_);
+  pending_segments_[segment->index] = segment;
 }
 
 
-void ChunkItem::ReleaseCompressor() {
-  compressor_.Destroy();
+CompressedSegment *ChunkItem::PopSegment() {
+  std::map<uint32_t, CompressedSegment *>::iterator iter =
+    pending_segments_.find(next_segment_);
+  if (iter == pending_segments_.end())
+    return NULL;
+
+  CompressedSegment *segment = iter->second;
+  pending_segments_.erase(iter);
+  if (next_segment_ == 0) {
+    segments_checksum_ = segment->checksum;
+  } else {
+    segments_checksum_ = zlib::SegmentCompressor::CombineChecksums(
+      file_item_->compression_algorithm(),
+      segments_checksum_, segment->checksum, segment->size);
+  }
+  next_segment_++;
+  return segment;
 }
 
 
@@ -113,6 +151,8 @@ BlockItem::BlockItem(ItemAllocator *allocator)
   : allocator_(allocator)
   , type_(kBlockHollow)
   , tag_(-1)
+  , segment_(0)
+  , is_segment_stop_(false)
   , file_item_(NULL)
   , chunk_item_(NULL)
   , data_(NULL)
@@ -125,6 +165,8 @@ BlockItem::BlockItem(int64_t tag, ItemAllocator *allocator)
   : allocator_(allocator)
   , type_(kBlockHollow)
   , tag_(tag)
+  , segment_(0)
+  , is_segment_stop_(false)
   , file_item_(NULL)
   , chunk_item_(NULL)
   , data_(NULL)
@@ -154,6 +196,12 @@ void BlockItem::MakeStop() {
 }
 
 
+void BlockItem::MakeSegmentStop() {
+  MakeStop();
+  is_segment_stop_ = true;
+}
+
+
 void BlockItem::MakeData(uint32_t capacity) {
   assert(type_ == kBlockHollow);
   assert(allocator_ != NULL);
@@ -167,7 +215,8 @@ void BlockItem::MakeData(uint32_t capacity) {
 
 
 /**
- * Move data from one block to another.
+ * Move data from one block to another.  The buffer keeps its capacity, which
+ * can be larger than the size for blocks that were read in place.
  */
 void BlockItem::MakeDataMove(BlockItem *other) {
   assert(type_ == kBlockHollow);
@@ -175,7 +224,8 @@ void BlockItem::MakeDataMove(BlockItem *other) {
   assert(other->size_ > 0);
 
   type_ = kBlockData;
-  capacity_ = size_ = other->size_;
+  capacity_ = other->capacity_;
+  size_ = other->size_;
   data_ = other->data_;
   allocator_ = other->allocator_;
 
@@ -9,6 +9,7 @@
 #include <stdint.h>
 
 #include <cassert>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -18,6 +19,7 @@
 #include "hash.h"
 #include "ingestion/chunk_detector.h"
 #include "ingestion/ingestion_source.h"
+#include "ingestion/tube.h"
 #include "util/pointer.h"
 #include "util/single_copy.h"
 
@@ -25,6 +27,7 @@ namespace upload {
 struct UploadStreamHandle;
 }
 
+class BlockItem;
 class ItemAllocator;
 
 /**
@@ -42,7 +45,10 @@ class FileItem : SingleCopy {
     shash::Algorithms hash_algorithm = shash::kSha1,
     shash::Suffix hash_suffix = shash::kSuffixNone,
     bool may_have_chunks = true,
-    bool has_legacy_bulk_chunk = false);
+    bool has_legacy_bulk_chunk = false,
+    ChunkingAlgorithms chunking_algorithm = kChunkXor32,
+    uint64_t compression_segment_size = 0,
+    int compression_level = 0);
   ~FileItem();
 
   static FileItem *CreateQuitBeacon() {
@@ -56,13 +62,15 @@ class FileItem : SingleCopy {
 
   std::string path() { return source_->GetPath(); }
   uint64_t size() { return size_; }
-  Xor32Detector *chunk_detector() { return &chunk_detector_; }
+  ChunkDetector *chunk_detector() { return chunk_detector_.weak_ref(); }
   shash::Any bulk_hash() { return bulk_hash_; }
   zlib::Algorithms compression_algorithm() { return compression_algorithm_; }
   shash::Algorithms hash_algorithm() { return hash_algorithm_; }
   shash::Suffix hash_suffix() { return hash_suffix_; }
   bool may_have_chunks() { return may_have_chunks_; }
   bool has_legacy_bulk_chunk() { return has_legacy_bulk_chunk_; }
+  uint64_t compression_segment_size() { return compression_segment_size_; }
+  int compression_level() { return compression_level_; }
 
   void set_size(uint64_t val) { size_ = val; }
   void set_may_have_chunks(bool val) { may_have_chunks_ = val; }
@@ -87,6 +95,18 @@ class FileItem : SingleCopy {
     return is_fully_chunked() && (atomic_read64(&nchunks_in_fly_) == 0);
   }
 
+  /**
+   * Monotonic time of the construction, to measure the pipeline latency
+   */
+  uint64_t creation_time_ns() { return creation_time_ns_; }
+
+  /**
+   * The size is unknown until the file has been opened by TaskRead
+   */
+  friend uint64_t GetItemSize(FileItem *item) {
+    return (item->size_ == kSizeUnknown) ? 0 : item->size_;
+  }
+
  private:
   static const uint64_t kSizeUnknown = uint64_t(-1);
   static const char kQuitBeaconMarker = '\0';
@@ -96,11 +116,21 @@ class FileItem : SingleCopy {
   const shash::Algorithms hash_algorithm_;
   const shash::Suffix hash_suffix_;
   const bool has_legacy_bulk_chunk_;
+  /**
+   * Chunks larger than this are compressed in parallel segments; zero
+   * disables segmentation, see TaskChunk.
+   */
+  const uint64_t compression_segment_size_;
+  /**
+   * Algorithm specific, zero selects the default level of the algorithm
+   */
+  const int compression_level_;
 
   uint64_t size_;
   bool may_have_chunks_;
+  const uint64_t creation_time_ns_;
 
-  Xor32Detector chunk_detector_;
+  UniquePtr<ChunkDetector> chunk_detector_;
   shash::Any bulk_hash_;
   FileChunkList chunks_;
   /**
@@ -122,9 +152,28 @@ class FileItem : SingleCopy {
  * the processed data of an entire file, or it can be a partial chunk of a
  * (large) input file.
  */
+/**
+ * The compressed data of a segment of a chunk.  Large chunks are split into
+ * segments that are compressed in parallel (see TaskChunk and TaskCompress).
+ */
+struct CompressedSegment {
+  CompressedSegment(uint32_t i, bool last)
+    : index(i), is_last(last), checksum(0), size(0) { }
+  uint32_t index;
+  bool is_last;
+  std::vector<BlockItem *> blocks;
+  /**
+   * Checksum and size of the uncompressed data, see zlib::SegmentCompressor
+   */
+  uint32_t checksum;
+  uint64_t size;
+};
+
+
 class ChunkItem : SingleCopy {
  public:
   ChunkItem(FileItem *file_item, uint64_t offset);
+  ~ChunkItem();
 
   void MakeBulkChunk();
   bool IsSolePiece() {
@@ -136,16 +185,26 @@ class ChunkItem : SingleCopy {
   uint64_t offset() { return offset_; }
   uint64_t size() { return size_; }
   upload::UploadStreamHandle *upload_handle() { return upload_handle_; }
-  // An active zlib compression stream requires 256kB of memory.  Therefore,
-  // we create it only for the absolutely necessary duration and free the space
-  // afterwards.
-  zlib::Compressor *GetCompressor();
-  void ReleaseCompressor();
+  int64_t tag() { return tag_; }
+
+  /**
+   * Compressed segments can arrive out of order.  PushSegment() and
+   * PopSegment() must be called with the segment lock held.  PopSegment()
+   * returns the segments in order, or NULL if the next one is still missing.
+   */
+  pthread_mutex_t *segment_lock() { return &segment_lock_; }
+  void PushSegment(CompressedSegment *segment);
+  CompressedSegment *PopSegment();
+  /**
+   * Combined checksum of the segments popped so far
+   */
+  uint32_t segments_checksum() { return segments_checksum_; }
 
   shash::ContextPtr hash_ctx() { return hash_ctx_; }
   shash::Any *hash_ptr() { return &hash_value_; }
 
   void set_size(uint64_t val) { assert(size_ == 0); size_ = val; }
+  void set_tag(int64_t val) { assert(tag_ < 0); tag_ = val; }
   void set_upload_handle(upload::UploadStreamHandle *val) {
     assert((upload_handle_ == NULL) && (val != NULL));
     upload_handle_ = val;
@@ -164,7 +223,15 @@ class ChunkItem : SingleCopy {
    * Deleted by the uploader.
    */
   upload::UploadStreamHandle *upload_handle_;
-  UniquePtr<zlib::Compressor> compressor_;
+  /**
+   * The tag of the output blocks of the chunk, set by TaskChunk.  The segments
+   * of a chunk have their own tags in the compression stage.
+   */
+  int64_t tag_;
+  pthread_mutex_t segment_lock_;
+  std::map<uint32_t, CompressedSegment *> pending_segments_;
+  uint32_t next_segment_;
+  uint32_t segments_checksum_;
   shash::ContextPtr hash_ctx_;
   shash::Any hash_value_;
   unsigned char hash_ctx_buffer_[shash::kMaxContextSize];
@@ -195,8 +262,15 @@ class BlockItem : SingleCopy {
   bool IsQuitBeacon() {
     return type_ == kBlockHollow;
   }
+  /**
+   * A stop block that ends a segment but not the chunk
+   */
+  bool IsSegmentStop() {
+    return (type_ == kBlockStop) && is_segment_stop_;
+  }
 
   void MakeStop();
+  void MakeSegmentStop();
   void MakeData(uint32_t capacity);
   void MakeDataMove(BlockItem *other);
   void MakeDataCopy(const unsigned char *data, uint32_t size);
@@ -217,10 +291,14 @@ class BlockItem : SingleCopy {
 
   BlockType type() { return type_; }
   int64_t tag() { return tag_; }
+  uint32_t segment() { return segment_; }
+  void set_segment(uint32_t val) { segment_ = val; }
   FileItem *file_item() { return file_item_; }
   ChunkItem *chunk_item() { return chunk_item_; }
   static uint64_t managed_bytes() { return atomic_read64(&managed_bytes_); }
 
+  friend uint64_t GetItemSize(BlockItem *item) { return item->size_; }
+
  private:
   /**
    * Total capacity of all BlockItem()
@@ -240,6 +318,11 @@ class BlockItem : SingleCopy {
    * Tags can (and should) be set exactly once in the life time of a block.
    */
   int64_t tag_;
+  /**
+   * Index of the segment of the chunk, see TaskChunk
+   */
+  uint32_t segment_;
+  bool is_segment_stop_;
 
   /**
    * Can be set exactly once.
@@ -255,4 +338,13 @@ class BlockItem : SingleCopy {
   uint32_t size_;
 };
 
+
+/**
+ * Blocks are passed between the pipeline stages through ring buffer tubes.
+ * Each block stage consumer exclusively reads from its own tube.
+ */
+typedef RingTube<BlockItem> BlockTube;
+typedef TubeGroup<BlockItem, BlockTube> BlockTubeGroup;
+const unsigned kBlockTubeBatchSize = 16;
+
 #endif  // CVMFS_INGESTION_ITEM_H_
@@ -4,73 +4,376 @@
 
 #include "item_mem.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 
+#include "platform.h"
 #include "util/exception.h"
 #include "util_concurrency.h"
 
 atomic_int64 ItemAllocator::total_allocated_ = 0;
 
+namespace {
 
-void ItemAllocator::Free(void *ptr) {
-  MutexLockGuard guard(lock_);
+/**
+ * The arena can hand out a block that is a little larger than requested, see
+ * MallocArena::ReserveBlock().
+ */
+const unsigned kSizeSlack = 64;
 
-  MallocArena *M = MallocArena::GetMallocArena(ptr, kArenaSize);
-  M->Free(ptr);
-  unsigned N = malloc_arenas_.size();
-  if ((N > 1) && M->IsEmpty()) {
-    for (unsigned i = 0; i < N; ++i) {
-      if (malloc_arenas_[i] == M) {
-        delete malloc_arenas_[i];
-        atomic_xadd64(&total_allocated_, -static_cast<int>(kArenaSize));
-        malloc_arenas_.erase(malloc_arenas_.begin() + i);
-        idx_last_arena_ = 0;
-        return;
-      }
+}  // anonymous namespace
+
+
+ItemAllocator::ItemAllocator()
+  : wakeup_threshold_(0)
+  , nreaders_in_file_(0)
+  , nblocked_in_file_(0)
+{
+  int retval;
+  for (unsigned i = 0; i < kMaxNodes; ++i) {
+    retval = pthread_mutex_init(&pools_[i].lock, NULL);
+    assert(retval == 0);
+  }
+  retval = pthread_mutex_init(&lock_thread_caches_, NULL);
+  assert(retval == 0);
+  retval = pthread_key_create(&thread_cache_key_, TlsDestructor);
+  assert(retval == 0);
+  retval = pthread_mutex_init(&lock_memory_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_memory_, NULL);
+  assert(retval == 0);
+  atomic_init64(&in_use_);
+  atomic_init32(&nwaiters_);
+
+  const unsigned node = GetNode();
+  pools_[node].arenas.push_back(new NodeArena(kArenaSize, node));
+  atomic_xadd64(&total_allocated_, kArenaSize);
+}
+
+
+ItemAllocator::~ItemAllocator() {
+  // Cached buffers vanish together with their arenas
+  {
+    MutexLockGuard guard(lock_thread_caches_);
+    for (unsigned i = 0; i < thread_caches_.size(); ++i)
+      delete thread_caches_[i];
+    thread_caches_.clear();
+  }
+  pthread_key_delete(thread_cache_key_);
+
+  for (unsigned i = 0; i < kMaxNodes; ++i) {
+    for (unsigned j = 0; j < pools_[i].arenas.size(); ++j) {
+      atomic_xadd64(&total_allocated_, -static_cast<int>(kArenaSize));
+      delete pools_[i].arenas[j];
     }
-    PANIC(NULL);
+    pthread_mutex_destroy(&pools_[i].lock);
   }
+  pthread_mutex_destroy(&lock_thread_caches_);
+  pthread_mutex_destroy(&lock_memory_);
+  pthread_cond_destroy(&cond_memory_);
 }
 
 
-ItemAllocator::ItemAllocator() : idx_last_arena_(0) {
-  int retval = pthread_mutex_init(&lock_, NULL);
+void ItemAllocator::TlsDestructor(void *data) {
+  ThreadCache *cache = static_cast<ThreadCache *>(data);
+  ItemAllocator *allocator = cache->allocator;
+  {
+    MutexLockGuard guard(allocator->lock_thread_caches_);
+    std::vector<ThreadCache *>::iterator i =
+      std::find(allocator->thread_caches_.begin(),
+                allocator->thread_caches_.end(), cache);
+    assert(i != allocator->thread_caches_.end());
+    allocator->thread_caches_.erase(i);
+  }
+  allocator->FlushThreadCache(cache);
+  delete cache;
+}
+
+
+unsigned ItemAllocator::GetNode() {
+  return platform_numa_node() % kMaxNodes;
+}
+
+
+/**
+ * Returns kNumSizeClasses for requests that are not pooled
+ */
+unsigned ItemAllocator::GetSizeClass(unsigned size) {
+  if ((size <= kMinPooledSize / 2) || (size > kMaxPooledSize))
+    return kNumSizeClasses;
+  unsigned size_class = 0;
+  while (GetClassSize(size_class) < size)
+    size_class++;
+  return size_class;
+}
+
+
+ItemAllocator::ThreadCache *ItemAllocator::GetThreadCache() {
+  ThreadCache *cache =
+    static_cast<ThreadCache *>(pthread_getspecific(thread_cache_key_));
+  if (cache != NULL)
+    return cache;
+
+  cache = new ThreadCache(this, GetNode());
+  int retval = pthread_setspecific(thread_cache_key_, cache);
   assert(retval == 0);
 
-  malloc_arenas_.push_back(new MallocArena(kArenaSize));
-  atomic_xadd64(&total_allocated_, kArenaSize);
+  MutexLockGuard guard(lock_thread_caches_);
+  thread_caches_.push_back(cache);
+  return cache;
 }
 
 
-ItemAllocator::~ItemAllocator() {
-  for (unsigned i = 0; i < malloc_arenas_.size(); ++i) {
-    atomic_xadd64(&total_allocated_, -static_cast<int>(kArenaSize));
-    delete malloc_arenas_[i];
+/**
+ * Used when a thread terminates or moves to another node
+ */
+void ItemAllocator::FlushThreadCache(ThreadCache *cache) {
+  for (unsigned c = 0; c < kNumSizeClasses; ++c) {
+    for (unsigned i = 0; i < cache->buffers[c].size(); ++i) {
+      void *ptr = cache->buffers[c][i];
+      FreeToPool(
+        static_cast<NodeArena *>(MallocArena::GetMallocArena(ptr, kArenaSize)),
+        c, ptr);
+    }
+    cache->buffers[c].clear();
   }
-  pthread_mutex_destroy(&lock_);
 }
 
 
-void *ItemAllocator::Malloc(unsigned size) {
-  MutexLockGuard guard(lock_);
+void *ItemAllocator::MallocFromArena(unsigned node, unsigned size) {
+  NodePool *pool = &pools_[node];
+  MutexLockGuard guard(pool->lock);
 
-  void *p = malloc_arenas_[idx_last_arena_]->Malloc(size);
+  const unsigned N = pool->arenas.size();
+  void *p = NULL;
+  if (N > 0)
+    p = pool->arenas[pool->idx_last_arena]->Malloc(size);
   if (p != NULL)
     return p;
-  unsigned N = malloc_arenas_.size();
   for (unsigned i = 0; i < N; ++i) {
-    p = malloc_arenas_[i]->Malloc(size);
+    p = pool->arenas[i]->Malloc(size);
     if (p != NULL) {
-      idx_last_arena_ = i;
+      pool->idx_last_arena = i;
       return p;
     }
   }
-  idx_last_arena_ = N;
-  MallocArena *M = new MallocArena(kArenaSize);
+  pool->idx_last_arena = N;
+  NodeArena *M = new NodeArena(kArenaSize, node);
   atomic_xadd64(&total_allocated_, kArenaSize);
-  malloc_arenas_.push_back(M);
+  pool->arenas.push_back(M);
   p = M->Malloc(size);
   assert(p != NULL);
   return p;
 }
+
+
+/**
+ * The lock of the arena's node pool must be held
+ */
+void ItemAllocator::FreeToArena(NodeArena *arena, void *ptr) {
+  NodePool *pool = &pools_[arena->node];
+  arena->Free(ptr);
+  unsigned N = pool->arenas.size();
+  if ((N > 1) && arena->IsEmpty()) {
+    for (unsigned i = 0; i < N; ++i) {
+      if (pool->arenas[i] == arena) {
+        delete pool->arenas[i];
+        atomic_xadd64(&total_allocated_, -static_cast<int>(kArenaSize));
+        pool->arenas.erase(pool->arenas.begin() + i);
+        pool->idx_last_arena = 0;
+        return;
+      }
+    }
+    PANIC(NULL);
+  }
+}
+
+
+void ItemAllocator::FreeToPool(
+  NodeArena *arena,
+  unsigned size_class,
+  void *ptr)
+{
+  NodePool *pool = &pools_[arena->node];
+  MutexLockGuard guard(pool->lock);
+  if (pool->pooled_bytes + GetClassSize(size_class) > kMaxPooledBytes) {
+    FreeToArena(arena, ptr);
+    return;
+  }
+  pool->buffers[size_class].push_back(ptr);
+  pool->pooled_bytes += GetClassSize(size_class);
+}
+
+
+void ItemAllocator::Refill(ThreadCache *cache, unsigned size_class) {
+  NodePool *pool = &pools_[cache->node];
+  MutexLockGuard guard(pool->lock);
+  std::vector<void *> *buffers = &pool->buffers[size_class];
+  const unsigned n =
+    std::min(static_cast<unsigned>(buffers->size()),
+             static_cast<unsigned>(kThreadCacheBatch));
+  cache->buffers[size_class].insert(cache->buffers[size_class].end(),
+                                    buffers->end() - n, buffers->end());
+  buffers->resize(buffers->size() - n);
+  pool->pooled_bytes -= n * GetClassSize(size_class);
+}
+
+
+void ItemAllocator::Drain(ThreadCache *cache, unsigned size_class) {
+  NodePool *pool = &pools_[cache->node];
+  std::vector<void *> *buffers = &cache->buffers[size_class];
+  assert(buffers->size() >= kThreadCacheBatch);
+
+  MutexLockGuard guard(pool->lock);
+  for (unsigned i = buffers->size() - kThreadCacheBatch;
+       i < buffers->size(); ++i)
+  {
+    void *ptr = (*buffers)[i];
+    NodeArena *arena =
+      static_cast<NodeArena *>(MallocArena::GetMallocArena(ptr, kArenaSize));
+    assert(arena->node == cache->node);
+    if (pool->pooled_bytes + GetClassSize(size_class) > kMaxPooledBytes) {
+      FreeToArena(arena, ptr);
+    } else {
+      pool->buffers[size_class].push_back(ptr);
+      pool->pooled_bytes += GetClassSize(size_class);
+    }
+  }
+  buffers->resize(buffers->size() - kThreadCacheBatch);
+}
+
+
+void ItemAllocator::Acquire(uint64_t size) {
+  atomic_xadd64(&in_use_, static_cast<int64_t>(size));
+}
+
+
+void ItemAllocator::Release(uint64_t size) {
+  const int64_t in_use =
+    atomic_xadd64(&in_use_, -static_cast<int64_t>(size)) - size;
+  // The atomic add is a full memory barrier, plain reads suffice
+  if ((nwaiters_ > 0) && (in_use <= wakeup_threshold_)) {
+    MutexLockGuard guard(lock_memory_);
+    pthread_cond_broadcast(&cond_memory_);
+  }
+}
+
+
+bool ItemAllocator::WaitForMemory(uint64_t low, uint64_t high) {
+  assert(low <= high);
+  if (in_use() <= high)
+    return false;
+
+  MutexLockGuard guard(lock_memory_);
+  if (static_cast<uint64_t>(atomic_read64(&wakeup_threshold_)) < low)
+    atomic_write64(&wakeup_threshold_, low);
+  atomic_inc32(&nwaiters_);
+  while (in_use() > low)
+    pthread_cond_wait(&cond_memory_, &lock_memory_);
+  if (atomic_xadd32(&nwaiters_, -1) == 1)
+    atomic_write64(&wakeup_threshold_, 0);
+  return true;
+}
+
+
+void ItemAllocator::BeginFile() {
+  MutexLockGuard guard(lock_memory_);
+  nreaders_in_file_++;
+}
+
+
+void ItemAllocator::EndFile() {
+  MutexLockGuard guard(lock_memory_);
+  assert(nreaders_in_file_ > 0);
+  nreaders_in_file_--;
+  // Let one of the blocked readers continue if no other reader is left
+  if ((nblocked_in_file_ > 0) && (nblocked_in_file_ == nreaders_in_file_))
+    pthread_cond_broadcast(&cond_memory_);
+}
+
+
+bool ItemAllocator::WaitForMemoryInFile(uint64_t high) {
+  if (in_use() <= high)
+    return false;
+
+  MutexLockGuard guard(lock_memory_);
+  assert(nreaders_in_file_ > 0);
+  if (nblocked_in_file_ + 1 == nreaders_in_file_)
+    return false;
+  if (static_cast<uint64_t>(atomic_read64(&wakeup_threshold_)) < high)
+    atomic_write64(&wakeup_threshold_, high);
+  atomic_inc32(&nwaiters_);
+  nblocked_in_file_++;
+  while ((in_use() > high) && (nblocked_in_file_ < nreaders_in_file_))
+    pthread_cond_wait(&cond_memory_, &lock_memory_);
+  nblocked_in_file_--;
+  if (atomic_xadd32(&nwaiters_, -1) == 1)
+    atomic_write64(&wakeup_threshold_, 0);
+  return true;
+}
+
+
+void *ItemAllocator::Malloc(unsigned size) {
+  const unsigned size_class = GetSizeClass(size);
+  if (size_class == kNumSizeClasses) {
+    // Large blocks must not be mistaken for pooled ones in Free()
+    if ((size > kMaxPooledSize) && (size < kMaxPooledSize + kSizeSlack))
+      size = kMaxPooledSize + kSizeSlack;
+    void *p = MallocFromArena(GetNode(), size);
+    Acquire(MallocArena::GetMallocArena(p, kArenaSize)->GetSize(p));
+    return p;
+  }
+
+  ThreadCache *cache = GetThreadCache();
+  if ((++cache->nallocs % kNodeRefreshInterval) == 0) {
+    const unsigned node = GetNode();
+    if (node != cache->node) {
+      FlushThreadCache(cache);
+      cache->node = node;
+    }
+  }
+
+  std::vector<void *> *buffers = &cache->buffers[size_class];
+  if (buffers->empty())
+    Refill(cache, size_class);
+  void *p;
+  if (buffers->empty()) {
+    p = MallocFromArena(cache->node, GetClassSize(size_class));
+  } else {
+    p = buffers->back();
+    buffers->pop_back();
+  }
+  Acquire(GetClassSize(size_class));
+  return p;
+}
+
+
+void ItemAllocator::Free(void *ptr) {
+  NodeArena *arena =
+    static_cast<NodeArena *>(MallocArena::GetMallocArena(ptr, kArenaSize));
+  const unsigned size = arena->GetSize(ptr);
+  if ((size < kMinPooledSize) || (size >= kMaxPooledSize + kSizeSlack)) {
+    Release(size);
+    MutexLockGuard guard(pools_[arena->node].lock);
+    FreeToArena(arena, ptr);
+    return;
+  }
+
+  unsigned size_class = 0;
+  while ((size_class + 1 < kNumSizeClasses) &&
+         (GetClassSize(size_class + 1) <= size))
+  {
+    size_class++;
+  }
+  Release(GetClassSize(size_class));
+
+  ThreadCache *cache = GetThreadCache();
+  if (cache->node != arena->node) {
+    FreeToPool(arena, size_class, ptr);
+    return;
+  }
+  cache->buffers[size_class].push_back(ptr);
+  if (cache->buffers[size_class].size() >= 2 * kThreadCacheBatch)
+    Drain(cache, size_class);
+}
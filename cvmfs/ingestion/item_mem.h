@@ -6,6 +6,7 @@
 #define CVMFS_INGESTION_ITEM_MEM_H_
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include <cassert>
 #include <vector>
@@ -16,6 +17,21 @@
 /**
  * To avoid memory fragmentation, allocate the data buffer inside the BlockItem
  * with a separate allocator.
+ *
+ * The pipeline blocks come in a few sizes (TaskRead::kBlockSize,
+ * TaskCompress::kCompressedBlockSize).  Requests between kMinPooledSize / 2
+ * and kMaxPooledSize are rounded up to a power of 2 and their buffers are
+ * recycled instead of being returned to the arena.  Every thread keeps a small
+ * cache of free buffers per size class, which it exchanges in batches with the
+ * pool of its NUMA node.  Most allocations thus need neither a lock nor a walk
+ * through the arena's free list.
+ *
+ * Arenas belong to the NUMA node of the thread that created them.  Their pages
+ * are first touched by threads of that node, so that the kernel places them
+ * on the node, too.  Freed buffers go back to the node of their arena.
+ *
+ * The allocator also provides the back-pressure of the pipeline: the reading
+ * end blocks in WaitForMemory() until enough buffers are freed.
  */
 class ItemAllocator {
  public:
@@ -25,18 +41,127 @@ class ItemAllocator {
   void *Malloc(unsigned size);
   void Free(void *ptr);
 
+  /**
+   * If more than high bytes are in use, blocks until Free() brought the usage
+   * down to low bytes.  Returns true if the caller had to wait.
+   */
+  bool WaitForMemory(uint64_t low, uint64_t high);
+  /**
+   * Readers announce the files they are in the middle of.  Blocks of such a
+   * file can be held further down the pipeline until the rest of the file
+   * arrives, e.g. the output of a compression segment.
+   */
+  void BeginFile();
+  void EndFile();
+  /**
+   * Like WaitForMemory(high, high) in the middle of a file.  The last reader
+   * in the middle of a file that is not blocked never waits, so that the held
+   * blocks are eventually freed.  A waiting reader is woken up by Free() or
+   * when it becomes the last one by EndFile().
+   */
+  bool WaitForMemoryInFile(uint64_t high);
+  /**
+   * Bytes handed out by Malloc() that have not yet been freed
+   */
+  uint64_t in_use() { return atomic_read64(&in_use_); }
+
   static int64_t total_allocated() { return atomic_read64(&total_allocated_); }
 
  private:
   static const unsigned kArenaSize = 128 * 1024 * 1024;  // 128 MB
+  static const unsigned kMinPooledSize = 4 * 1024;
+  static const unsigned kMaxPooledSize = 64 * 1024;
+  static const unsigned kNumSizeClasses = 5;  // 4 kB ... 64 kB
+  /**
+   * Number of buffers exchanged at once between a thread cache and the pool.
+   * A thread cache holds at most two batches per size class.
+   */
+  static const unsigned kThreadCacheBatch = 32;
+  /**
+   * Free buffers beyond this many bytes per node are returned to the arenas.
+   */
+  static const uint64_t kMaxPooledBytes = 64 * 1024 * 1024;
+  static const unsigned kMaxNodes = 8;
+  /**
+   * Threads can be migrated to another node, so the thread caches look up
+   * their node again after so many allocations.
+   */
+  static const unsigned kNodeRefreshInterval = 1024;
+
   static atomic_int64 total_allocated_;
 
-  std::vector<MallocArena *> malloc_arenas_;
   /**
-   * Where the last successful allocation took place.
+   * An arena with the node it belongs to.  MallocArena::GetMallocArena()
+   * returns the base class pointer of the object.
+   */
+  struct NodeArena : public MallocArena {
+    NodeArena(unsigned arena_size, unsigned n)
+      : MallocArena(arena_size), node(n) { }
+    unsigned node;
+  };
+
+  /**
+   * Arenas and free buffers of a NUMA node, protected by lock.
+   */
+  struct NodePool {
+    NodePool() : idx_last_arena(0), pooled_bytes(0) { }
+    pthread_mutex_t lock;
+    std::vector<NodeArena *> arenas;
+    /**
+     * Where the last successful allocation took place.
+     */
+    unsigned idx_last_arena;
+    std::vector<void *> buffers[kNumSizeClasses];
+    uint64_t pooled_bytes;
+  };
+
+  struct ThreadCache {
+    ThreadCache(ItemAllocator *a, unsigned n)
+      : allocator(a), node(n), nallocs(0) { }
+    ItemAllocator *allocator;
+    unsigned node;
+    unsigned nallocs;
+    std::vector<void *> buffers[kNumSizeClasses];
+  };
+
+  static void TlsDestructor(void *data);
+  static unsigned GetNode();
+  static unsigned GetSizeClass(unsigned size);
+  static unsigned GetClassSize(unsigned size_class) {
+    return kMinPooledSize << size_class;
+  }
+
+  ThreadCache *GetThreadCache();
+  void FlushThreadCache(ThreadCache *cache);
+  void *MallocFromArena(unsigned node, unsigned size);
+  void FreeToArena(NodeArena *arena, void *ptr);
+  void FreeToPool(NodeArena *arena, unsigned size_class, void *ptr);
+  void Refill(ThreadCache *cache, unsigned size_class);
+  void Drain(ThreadCache *cache, unsigned size_class);
+  void Acquire(uint64_t size);
+  void Release(uint64_t size);
+
+  NodePool pools_[kMaxNodes];
+
+  pthread_key_t thread_cache_key_;
+  std::vector<ThreadCache *> thread_caches_;
+  pthread_mutex_t lock_thread_caches_;
+
+  atomic_int64 in_use_;
+  /**
+   * Number of threads in WaitForMemory() and the highest usage at which they
+   * want to be woken up
+   */
+  atomic_int32 nwaiters_;
+  atomic_int64 wakeup_threshold_;
+  /**
+   * Readers between BeginFile() and EndFile() and how many of them are blocked
+   * in WaitForMemoryInFile(), protected by lock_memory_
    */
-  unsigned idx_last_arena_;
-  pthread_mutex_t lock_;
+  unsigned nreaders_in_file_;
+  unsigned nblocked_in_file_;
+  pthread_mutex_t lock_memory_;
+  pthread_cond_t cond_memory_;
 };  // class ItemAllocator
 
 #endif  // CVMFS_INGESTION_ITEM_MEM_H_
@@ -23,9 +23,23 @@
 
 const uint64_t IngestionPipeline::kMaxPipelineMem = 1024 * 1024 * 1024;
 
+namespace {
+
+unsigned GetNfork(const std::string &stage, unsigned nfork_default) {
+  const std::string name =
+    "_CVMFS_SERVER_PIPELINE_" + ToUpper(stage) + "_THREADS";
+  char *nfork = getenv(name.c_str());
+  if ((nfork == NULL) || (String2Uint64(nfork) == 0))
+    return nfork_default;
+  return String2Uint64(nfork);
+}
+
+}  // anonymous namespace
+
 IngestionPipeline::IngestionPipeline(
   upload::AbstractUploader *uploader,
-  const upload::SpoolerDefinition &spooler_definition)
+  const upload::SpoolerDefinition &spooler_definition,
+  perf::StatisticsTemplate *statistics)
   : compression_algorithm_(spooler_definition.compression_alg)
   , hash_algorithm_(spooler_definition.hash_algorithm)
   , generate_legacy_bulk_chunks_(spooler_definition.generate_legacy_bulk_chunks)
@@ -33,49 +47,89 @@ IngestionPipeline::IngestionPipeline(
   , minimal_chunk_size_(spooler_definition.min_file_chunk_size)
   , average_chunk_size_(spooler_definition.avg_file_chunk_size)
   , maximal_chunk_size_(spooler_definition.max_file_chunk_size)
+  , chunking_algorithm_(spooler_definition.chunking_alg)
+  , compression_segment_size_(spooler_definition.compression_segment_size)
+  , compression_level_(spooler_definition.compression_level)
   , spawned_(false)
   , uploader_(uploader)
   , tube_counter_(kMaxFilesInFlight)
 {
   unsigned nfork_base = std::max(1U, GetNumberOfCpuCores() / 8);
 
+  if (statistics != NULL) {
+    perf::StatisticsTemplate stats("pipeline", *statistics);
+    counters_read_ = new StageCounters(perf::StatisticsTemplate("read", stats));
+    counters_chunk_ =
+      new StageCounters(perf::StatisticsTemplate("chunk", stats));
+    counters_compress_ =
+      new StageCounters(perf::StatisticsTemplate("compress", stats));
+    counters_hash_ = new StageCounters(perf::StatisticsTemplate("hash", stats));
+    counters_write_ =
+      new StageCounters(perf::StatisticsTemplate("write", stats));
+    counters_register_ =
+      new StageCounters(perf::StatisticsTemplate("register", stats));
+    file_latency_ = new DurationHistogram(stats, "n_file_latency",
+      "Number of files processed within the given time");
+  }
+
   for (unsigned i = 0; i < nfork_base * kNforkRegister; ++i) {
     Tube<FileItem> *tube = new Tube<FileItem>();
     tubes_register_.TakeTube(tube);
     TaskRegister *task = new TaskRegister(tube, &tube_counter_);
     task->RegisterListener(&IngestionPipeline::OnFileProcessed, this);
+    task->SetCounters(counters_register_.weak_ref());
+    task->SetLatencyHistogram(file_latency_.weak_ref());
     tasks_register_.TakeConsumer(task);
   }
   tubes_register_.Activate();
 
-  for (unsigned i = 0; i < nfork_base * kNforkWrite; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+  const unsigned nfork_write = GetNfork("write", nfork_base * kNforkWrite);
+  for (unsigned i = 0; i < nfork_write; ++i) {
+    BlockTube *t = new BlockTube();
     tubes_write_.TakeTube(t);
-    tasks_write_.TakeConsumer(new TaskWrite(t, &tubes_register_, uploader_));
+    TaskWrite *task = new TaskWrite(t, &tubes_register_, uploader_);
+    task->SetCounters(counters_write_.weak_ref());
+    tasks_write_.TakeConsumer(task);
   }
+  if (counters_write_.IsValid())
+    tubes_register_.SetByteCounter(counters_write_->sz_out_bytes);
   tubes_write_.Activate();
 
-  for (unsigned i = 0; i < nfork_base * kNforkHash; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+  const unsigned nfork_hash = GetNfork("hash", nfork_base * kNforkHash);
+  for (unsigned i = 0; i < nfork_hash; ++i) {
+    BlockTube *t = new BlockTube();
     tubes_hash_.TakeTube(t);
-    tasks_hash_.TakeConsumer(new TaskHash(t, &tubes_write_));
+    TaskHash *task = new TaskHash(t, &tubes_write_);
+    task->SetCounters(counters_hash_.weak_ref());
+    tasks_hash_.TakeConsumer(task);
   }
+  if (counters_hash_.IsValid())
+    tubes_write_.SetByteCounter(counters_hash_->sz_out_bytes);
   tubes_hash_.Activate();
 
-  for (unsigned i = 0; i < nfork_base * kNforkCompress; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+  const unsigned nfork_compress =
+    GetNfork("compress", nfork_base * kNforkCompress);
+  for (unsigned i = 0; i < nfork_compress; ++i) {
+    BlockTube *t = new BlockTube();
     tubes_compress_.TakeTube(t);
-    tasks_compress_.TakeConsumer(
-      new TaskCompress(t, &tubes_hash_, &item_allocator_));
+    TaskCompress *task = new TaskCompress(t, &tubes_hash_, &item_allocator_);
+    task->SetCounters(counters_compress_.weak_ref());
+    tasks_compress_.TakeConsumer(task);
   }
+  if (counters_compress_.IsValid())
+    tubes_hash_.SetByteCounter(counters_compress_->sz_out_bytes);
   tubes_compress_.Activate();
 
-  for (unsigned i = 0; i < nfork_base * kNforkChunk; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+  const unsigned nfork_chunk = GetNfork("chunk", nfork_base * kNforkChunk);
+  for (unsigned i = 0; i < nfork_chunk; ++i) {
+    BlockTube *t = new BlockTube();
     tubes_chunk_.TakeTube(t);
-    tasks_chunk_.TakeConsumer(
-      new TaskChunk(t, &tubes_compress_, &item_allocator_));
+    TaskChunk *task = new TaskChunk(t, &tubes_compress_, &item_allocator_);
+    task->SetCounters(counters_chunk_.weak_ref());
+    tasks_chunk_.TakeConsumer(task);
   }
+  if (counters_chunk_.IsValid())
+    tubes_compress_.SetByteCounter(counters_chunk_->sz_out_bytes);
   tubes_chunk_.Activate();
 
   uint64_t high = kMaxPipelineMem;
@@ -88,12 +142,16 @@ IngestionPipeline::IngestionPipeline(
   LogCvmfs(kLogCvmfs, kLogDebug,
            "pipeline memory thresholds %" PRIu64 "/%" PRIu64 " M",
            low / (1024 * 1024), high / (1024 * 1024));
-  for (unsigned i = 0; i < nfork_base * kNforkRead; ++i) {
+  const unsigned nfork_read = GetNfork("read", nfork_base * kNforkRead);
+  for (unsigned i = 0; i < nfork_read; ++i) {
     TaskRead *task_read =
       new TaskRead(&tube_input_, &tubes_chunk_, &item_allocator_);
     task_read->SetWatermarks(low, high);
+    task_read->SetCounters(counters_read_.weak_ref());
     tasks_read_.TakeConsumer(task_read);
   }
+  if (counters_read_.IsValid())
+    tubes_chunk_.SetByteCounter(counters_read_->sz_out_bytes);
 }
 
 
@@ -130,7 +188,10 @@ void IngestionPipeline::Process(
     hash_algorithm_,
     hash_suffix,
     allow_chunking && chunking_enabled_,
-    generate_legacy_bulk_chunks_);
+    generate_legacy_bulk_chunks_,
+    chunking_algorithm_,
+    compression_segment_size_,
+    compression_level_);
   tube_counter_.EnqueueBack(file_item);
   tube_input_.EnqueueBack(file_item);
 }
@@ -194,7 +255,7 @@ ScrubbingPipeline::ScrubbingPipeline()
   unsigned nfork_base = std::max(1U, GetNumberOfCpuCores() / 8);
 
   for (unsigned i = 0; i < nfork_base * kNforkScrubbingCallback; ++i) {
-    Tube<BlockItem> *tube = new Tube<BlockItem>();
+    BlockTube *tube = new BlockTube();
     tubes_scrubbing_callback_.TakeTube(tube);
     TaskScrubbingCallback *task =
       new TaskScrubbingCallback(tube, &tube_counter_);
@@ -204,14 +265,14 @@ ScrubbingPipeline::ScrubbingPipeline()
   tubes_scrubbing_callback_.Activate();
 
   for (unsigned i = 0; i < nfork_base * kNforkHash; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+    BlockTube *t = new BlockTube();
     tubes_hash_.TakeTube(t);
     tasks_hash_.TakeConsumer(new TaskHash(t, &tubes_scrubbing_callback_));
   }
   tubes_hash_.Activate();
 
   for (unsigned i = 0; i < nfork_base * kNforkChunk; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+    BlockTube *t = new BlockTube();
     tubes_chunk_.TakeTube(t);
     tasks_chunk_.TakeConsumer(
       new TaskChunk(t, &tubes_hash_, &item_allocator_));
@@ -13,7 +13,9 @@
 #include "ingestion/item_mem.h"
 #include "ingestion/task.h"
 #include "ingestion/tube.h"
+#include "statistics.h"
 #include "upload_spooler_result.h"
+#include "util/pointer.h"
 #include "util_concurrency.h"
 
 namespace upload {
@@ -21,11 +23,18 @@ class AbstractUploader;
 struct SpoolerDefinition;
 }
 
+/**
+ * If statistics are given, every stage registers its StageCounters as
+ * pipeline.<stage>.* in the template, e.g. publish.pipeline.compress.n_items.
+ * The number of threads per stage can be overwritten by the
+ * _CVMFS_SERVER_PIPELINE_<STAGE>_THREADS environment variables.
+ */
 class IngestionPipeline : public Observable<upload::SpoolerResult> {
  public:
-  explicit IngestionPipeline(
+  IngestionPipeline(
     upload::AbstractUploader *uploader,
-    const upload::SpoolerDefinition &spooler_definition);
+    const upload::SpoolerDefinition &spooler_definition,
+    perf::StatisticsTemplate *statistics = NULL);
   ~IngestionPipeline();
 
   void Spawn();
@@ -42,7 +51,7 @@ class IngestionPipeline : public Observable<upload::SpoolerResult> {
   static const unsigned kNforkWrite = 1;
   static const unsigned kNforkHash = 2;
   static const unsigned kNforkCompress = 4;
-  static const unsigned kNforkChunk = 1;
+  static const unsigned kNforkChunk = 2;
   static const unsigned kNforkRead = 8;
 
   const zlib::Algorithms compression_algorithm_;
@@ -52,6 +61,9 @@ class IngestionPipeline : public Observable<upload::SpoolerResult> {
   const size_t minimal_chunk_size_;
   const size_t average_chunk_size_;
   const size_t maximal_chunk_size_;
+  const ChunkingAlgorithms chunking_algorithm_;
+  const size_t compression_segment_size_;
+  const int compression_level_;
 
   bool spawned_;
   upload::AbstractUploader *uploader_;
@@ -61,21 +73,29 @@ class IngestionPipeline : public Observable<upload::SpoolerResult> {
 
   TubeConsumerGroup<FileItem> tasks_read_;
 
-  TubeGroup<BlockItem> tubes_chunk_;
-  TubeConsumerGroup<BlockItem> tasks_chunk_;
+  BlockTubeGroup tubes_chunk_;
+  TubeConsumerGroup<BlockItem, BlockTube> tasks_chunk_;
 
-  TubeGroup<BlockItem> tubes_compress_;
-  TubeConsumerGroup<BlockItem> tasks_compress_;
+  BlockTubeGroup tubes_compress_;
+  TubeConsumerGroup<BlockItem, BlockTube> tasks_compress_;
 
-  TubeGroup<BlockItem> tubes_hash_;
-  TubeConsumerGroup<BlockItem> tasks_hash_;
+  BlockTubeGroup tubes_hash_;
+  TubeConsumerGroup<BlockItem, BlockTube> tasks_hash_;
 
-  TubeGroup<BlockItem> tubes_write_;
-  TubeConsumerGroup<BlockItem> tasks_write_;
+  BlockTubeGroup tubes_write_;
+  TubeConsumerGroup<BlockItem, BlockTube> tasks_write_;
 
   TubeGroup<FileItem> tubes_register_;
   TubeConsumerGroup<FileItem> tasks_register_;
 
+  UniquePtr<StageCounters> counters_read_;
+  UniquePtr<StageCounters> counters_chunk_;
+  UniquePtr<StageCounters> counters_compress_;
+  UniquePtr<StageCounters> counters_hash_;
+  UniquePtr<StageCounters> counters_write_;
+  UniquePtr<StageCounters> counters_register_;
+  UniquePtr<DurationHistogram> file_latency_;
+
   ItemAllocator item_allocator_;
 };  // class IngestionPipeline
 
@@ -90,13 +110,13 @@ struct ScrubbingResult {
 
 
 class TaskScrubbingCallback
-  : public TubeConsumer<BlockItem>
+  : public TubeConsumer<BlockItem, BlockTube>
   , public Observable<ScrubbingResult>
 {
  public:
-  TaskScrubbingCallback(Tube<BlockItem> *tube_in,
+  TaskScrubbingCallback(BlockTube *tube_in,
                         Tube<FileItem> *tube_counter)
-    : TubeConsumer<BlockItem>(tube_in)
+    : TubeConsumer<BlockItem, BlockTube>(tube_in, kBlockTubeBatchSize)
     , tube_counter_(tube_counter)
   { }
 
@@ -137,14 +157,14 @@ class ScrubbingPipeline : public Observable<ScrubbingResult> {
 
   TubeConsumerGroup<FileItem> tasks_read_;
 
-  TubeGroup<BlockItem> tubes_chunk_;
-  TubeConsumerGroup<BlockItem> tasks_chunk_;
+  BlockTubeGroup tubes_chunk_;
+  TubeConsumerGroup<BlockItem, BlockTube> tasks_chunk_;
 
-  TubeGroup<BlockItem> tubes_hash_;
-  TubeConsumerGroup<BlockItem> tasks_hash_;
+  BlockTubeGroup tubes_hash_;
+  TubeConsumerGroup<BlockItem, BlockTube> tasks_hash_;
 
-  TubeGroup<BlockItem> tubes_scrubbing_callback_;
-  TubeConsumerGroup<BlockItem> tasks_scrubbing_callback_;
+  BlockTubeGroup tubes_scrubbing_callback_;
+  TubeConsumerGroup<BlockItem, BlockTube> tasks_scrubbing_callback_;
 
   ItemAllocator item_allocator_;
 };
@@ -10,58 +10,199 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <string>
 #include <vector>
 
 #include "ingestion/tube.h"
+#include "platform.h"
+#include "statistics.h"
 #include "util/exception.h"
 #include "util/single_copy.h"
 
+
+/**
+ * Counts durations in decimal bins from below 10 us to 100 ms and more.  The
+ * bins are registered as <name>_lt_10us ... <name>_ge_100ms.
+ */
+class DurationHistogram : SingleCopy {
+ public:
+  static const unsigned kNumBins = 6;
+
+  DurationHistogram(perf::StatisticsTemplate statistics,
+                    const std::string &name,
+                    const std::string &desc)
+  {
+    const char *suffixes[kNumBins] =
+      {"_lt_10us", "_lt_100us", "_lt_1ms", "_lt_10ms", "_lt_100ms",
+       "_ge_100ms"};
+    for (unsigned i = 0; i < kNumBins; ++i) {
+      bins_[i] = statistics.RegisterOrLookupTemplated(
+        name + suffixes[i], desc + " (" + (suffixes[i] + 1) + ")");
+    }
+  }
+
+  void Add(uint64_t duration_ns) {
+    unsigned i = 0;
+    uint64_t limit = 10 * 1000;
+    while ((i < kNumBins - 1) && (duration_ns >= limit)) {
+      limit *= 10;
+      i++;
+    }
+    bins_[i]->Inc();
+  }
+
+ private:
+  perf::Counter *bins_[kNumBins];
+};
+
+
+/**
+ * Instrumentation of a pipeline stage, shared by all the consumers of the
+ * stage.  Pipelines that use the same statistics template add up.  The output
+ * bytes are counted by the tube group that the stage dispatches to.
+ */
+struct StageCounters : SingleCopy {
+  perf::Counter *n_items;
+  perf::Counter *n_pops;
+  perf::Counter *sum_queue_depth;
+  perf::Counter *max_queue_depth;
+  perf::Counter *sz_in_bytes;
+  perf::Counter *sz_out_bytes;
+  perf::Counter *time_busy_ns;
+  perf::Counter *time_idle_ns;
+  DurationHistogram service_time;
+
+  explicit StageCounters(perf::StatisticsTemplate statistics)
+    : service_time(statistics, "n_service",
+                   "Number of items processed within the given time")
+  {
+    n_items = statistics.RegisterOrLookupTemplated("n_items",
+      "Number of items processed");
+    n_pops = statistics.RegisterOrLookupTemplated("n_pops",
+      "Number of times consumers took items from their tube");
+    sum_queue_depth = statistics.RegisterOrLookupTemplated("sum_queue_depth",
+      "Sum of the tube sizes seen by the consumers (divide by n_pops)");
+    max_queue_depth = statistics.RegisterOrLookupTemplated("max_queue_depth",
+      "Largest tube size seen by a consumer");
+    sz_in_bytes = statistics.RegisterOrLookupTemplated("sz_in_bytes",
+      "Payload bytes taken from the tubes");
+    sz_out_bytes = statistics.RegisterOrLookupTemplated("sz_out_bytes",
+      "Payload bytes dispatched to the next stage");
+    time_busy_ns = statistics.RegisterOrLookupTemplated("time_busy_ns",
+      "Time spent processing items, summed over consumers");
+    time_idle_ns = statistics.RegisterOrLookupTemplated("time_idle_ns",
+      "Time spent waiting for items, summed over consumers");
+  }
+
+  void OnPop(uint64_t queue_depth, uint64_t idle_ns) {
+    n_pops->Inc();
+    sum_queue_depth->Xadd(queue_depth);
+    // Racy but good enough for a high-water mark
+    if (static_cast<int64_t>(queue_depth) > max_queue_depth->Get())
+      max_queue_depth->Set(queue_depth);
+    time_idle_ns->Xadd(idle_ns);
+  }
+
+  void OnProcessed(uint64_t nbytes, uint64_t service_ns) {
+    n_items->Inc();
+    sz_in_bytes->Xadd(nbytes);
+    time_busy_ns->Xadd(service_ns);
+    service_time.Add(service_ns);
+  }
+};
+
 /**
  * Forward declaration of TubeConsumerGroup so that it can be used as a friend
  * class to TubeConsumer.
  */
-template<typename ItemT>
+template<typename ItemT, typename TubeT>
 class TubeConsumerGroup;
 
 
 /**
  * Base class for threads that processes items from a tube one by one.  Concrete
  * implementations overwrite the Process() method.
+ *
+ * Consumers that are the only readers of their tube can take several items out
+ * of the tube at once (batch_size > 1).  On shared tubes, this would starve the
+ * other consumers.
  */
-template <class ItemT>
+template <class ItemT, class TubeT = Tube<ItemT> >
 class TubeConsumer : SingleCopy {
-  friend class TubeConsumerGroup<ItemT>;
+  friend class TubeConsumerGroup<ItemT, TubeT>;
 
  public:
+  static const unsigned kMaxBatchSize = 64;
+
   virtual ~TubeConsumer() { }
 
+  /**
+   * Enables the instrumentation; must be set before the consumer is spawned
+   */
+  void SetCounters(StageCounters *counters) { counters_ = counters; }
+
  protected:
-  explicit TubeConsumer(Tube<ItemT> *tube) : tube_(tube) { }
+  explicit TubeConsumer(TubeT *tube, unsigned batch_size = 1)
+    : tube_(tube)
+    , batch_size_(batch_size)
+    , counters_(NULL)
+  {
+    assert((batch_size_ > 0) && (batch_size_ <= kMaxBatchSize));
+  }
   virtual void Process(ItemT *item) = 0;
   virtual void OnTerminate() { }
 
-  Tube<ItemT> *tube_;
+  TubeT *tube_;
 
  private:
   static void *MainConsumer(void *data) {
-    TubeConsumer<ItemT> *consumer =
-      reinterpret_cast<TubeConsumer<ItemT> *>(data);
-
-    while (true) {
-      ItemT *item = consumer->tube_->PopFront();
-      if (item->IsQuitBeacon()) {
-        delete item;
-        break;
+    TubeConsumer<ItemT, TubeT> *consumer =
+      reinterpret_cast<TubeConsumer<ItemT, TubeT> *>(data);
+
+    StageCounters *counters = consumer->counters_;
+    ItemT *items[kMaxBatchSize];
+    bool quit = false;
+    uint64_t now = (counters != NULL) ? platform_monotonic_time_ns() : 0;
+    while (!quit) {
+      unsigned n = consumer->tube_->PopFrontMany(items, consumer->batch_size_);
+      if (counters != NULL) {
+        const uint64_t idle_since = now;
+        now = platform_monotonic_time_ns();
+        counters->OnPop(n + consumer->tube_->size(), now - idle_since);
+      }
+      for (unsigned i = 0; i < n; ++i) {
+        if (quit) {
+          // Only more quit beacons can follow; they belong to other consumers
+          consumer->tube_->EnqueueBack(items[i]);
+          continue;
+        }
+        if (items[i]->IsQuitBeacon()) {
+          delete items[i];
+          quit = true;
+          continue;
+        }
+        if (counters == NULL) {
+          consumer->Process(items[i]);
+          continue;
+        }
+        // The item might be gone after processing
+        const uint64_t nbytes = GetItemSize(items[i]);
+        const uint64_t start = now;
+        consumer->Process(items[i]);
+        now = platform_monotonic_time_ns();
+        counters->OnProcessed(nbytes, now - start);
       }
-      consumer->Process(item);
     }
     consumer->OnTerminate();
     return NULL;
   }
+
+  unsigned batch_size_;
+  StageCounters *counters_;
 };
 
 
-template <class ItemT>
+template <class ItemT, class TubeT = Tube<ItemT> >
 class TubeConsumerGroup : SingleCopy {
  public:
   TubeConsumerGroup() : is_active_(false) { }
@@ -71,7 +212,7 @@ class TubeConsumerGroup : SingleCopy {
       delete consumers_[i];
   }
 
-  void TakeConsumer(TubeConsumer<ItemT> *consumer) {
+  void TakeConsumer(TubeConsumer<ItemT, TubeT> *consumer) {
     assert(!is_active_);
     consumers_.push_back(consumer);
   }
@@ -82,7 +223,8 @@ class TubeConsumerGroup : SingleCopy {
     threads_.resize(N);
     for (unsigned i = 0; i < N; ++i) {
       int retval = pthread_create(
-        &threads_[i], NULL, TubeConsumer<ItemT>::MainConsumer, consumers_[i]);
+        &threads_[i], NULL, TubeConsumer<ItemT, TubeT>::MainConsumer,
+        consumers_[i]);
       if (retval != 0) {
         PANIC(kLogStderr, "failed to create new thread (error: %d, pid: %d)",
               errno, getpid());
@@ -108,7 +250,7 @@ class TubeConsumerGroup : SingleCopy {
 
  private:
   bool is_active_;
-  std::vector<TubeConsumer<ItemT> *> consumers_;
+  std::vector<TubeConsumer<ItemT, TubeT> *> consumers_;
   std::vector<pthread_t> threads_;
 };
 
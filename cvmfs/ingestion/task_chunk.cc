@@ -16,6 +16,52 @@
  */
 atomic_int64 TaskChunk::tag_seq_ = 2 << 28;
 
+void TaskChunk::StartChunk(ChunkItem *chunk_item, SegmentInfo *output) {
+  output->tag = atomic_xadd64(&tag_seq_, 1);
+  output->segment = 0;
+  output->size = 0;
+  chunk_item->set_tag(output->tag);
+}
+
+
+/**
+ * Creates the next data block for the output stream of a chunk.  Once the
+ * current segment is full, it is closed by a segment stop block and the new
+ * block starts the next segment, which can be compressed in parallel to the
+ * previous one (see TaskCompress).  Without compression, there is no point in
+ * segmenting chunks.
+ */
+BlockItem *TaskChunk::NewDataBlock(
+  ChunkItem *chunk_item,
+  SegmentInfo *output,
+  uint32_t size)
+{
+  FileItem *file_item = chunk_item->file_item();
+  const uint64_t segment_size = file_item->compression_segment_size();
+  if ((segment_size > 0) && (output->size >= segment_size) &&
+      (file_item->compression_algorithm() != zlib::kNoCompression))
+  {
+    BlockItem *block_stop = new BlockItem(output->tag, allocator_);
+    block_stop->SetFileItem(file_item);
+    block_stop->SetChunkItem(chunk_item);
+    block_stop->set_segment(output->segment);
+    block_stop->MakeSegmentStop();
+    tubes_out_->Dispatch(block_stop);
+
+    output->tag = atomic_xadd64(&tag_seq_, 1);
+    output->segment++;
+    output->size = 0;
+  }
+  output->size += size;
+
+  BlockItem *block = new BlockItem(output->tag, allocator_);
+  block->SetFileItem(file_item);
+  block->SetChunkItem(chunk_item);
+  block->set_segment(output->segment);
+  return block;
+}
+
+
 /**
  * Consumes the stream of input blocks and produces new output blocks according
  * to cut marks.  The output blocks correspond to chunks.
@@ -33,7 +79,7 @@ void TaskChunk::Process(BlockItem *input_block) {
     // This needs to be fixed up later in the pipeline by the write task.
     if (file_item->may_have_chunks()) {
       chunk_info.next_chunk = new ChunkItem(file_item, 0);
-      chunk_info.output_tag_chunk = atomic_xadd64(&tag_seq_, 1);
+      StartChunk(chunk_info.next_chunk, &chunk_info.output_chunk);
       if (file_item->has_legacy_bulk_chunk()) {
         chunk_info.bulk_chunk = new ChunkItem(file_item, 0);
       }
@@ -44,33 +90,36 @@ void TaskChunk::Process(BlockItem *input_block) {
     if (chunk_info.bulk_chunk != NULL) {
       chunk_info.bulk_chunk->MakeBulkChunk();
       chunk_info.bulk_chunk->set_size(file_item->size());
-      chunk_info.output_tag_bulk = atomic_xadd64(&tag_seq_, 1);
+      StartChunk(chunk_info.bulk_chunk, &chunk_info.output_bulk);
     }
     tag_map_.Insert(input_tag, chunk_info);
   }
   assert((chunk_info.bulk_chunk != NULL) || (chunk_info.next_chunk != NULL));
 
   BlockItem *output_block_bulk = NULL;
-  if (chunk_info.bulk_chunk != NULL) {
-    output_block_bulk = new BlockItem(chunk_info.output_tag_bulk, allocator_);
-    output_block_bulk->SetFileItem(file_item);
-    output_block_bulk->SetChunkItem(chunk_info.bulk_chunk);
-  }
 
   ChunkDetector *chunk_detector = file_item->chunk_detector();
   switch (input_block->type()) {
     case BlockItem::kBlockStop:
       // End of the file, no more new chunks
       file_item->set_is_fully_chunked();
-      if (output_block_bulk) output_block_bulk->MakeStop();
+      if (chunk_info.bulk_chunk != NULL) {
+        output_block_bulk =
+          new BlockItem(chunk_info.output_bulk.tag, allocator_);
+        output_block_bulk->SetFileItem(file_item);
+        output_block_bulk->SetChunkItem(chunk_info.bulk_chunk);
+        output_block_bulk->set_segment(chunk_info.output_bulk.segment);
+        output_block_bulk->MakeStop();
+      }
       if (chunk_info.next_chunk != NULL) {
         assert(file_item->size() >= chunk_info.next_chunk->offset());
         chunk_info.next_chunk->set_size(
           file_item->size() - chunk_info.next_chunk->offset());
         BlockItem *block_stop =
-          new BlockItem(chunk_info.output_tag_chunk, allocator_);
+          new BlockItem(chunk_info.output_chunk.tag, allocator_);
         block_stop->SetFileItem(file_item);
         block_stop->SetChunkItem(chunk_info.next_chunk);
+        block_stop->set_segment(chunk_info.output_chunk.segment);
         block_stop->MakeStop();
         tubes_out_->Dispatch(block_stop);
       }
@@ -78,7 +127,10 @@ void TaskChunk::Process(BlockItem *input_block) {
       break;
 
     case BlockItem::kBlockData:
-      if (output_block_bulk) {
+      if (chunk_info.bulk_chunk != NULL) {
+        output_block_bulk = NewDataBlock(chunk_info.bulk_chunk,
+                                         &chunk_info.output_bulk,
+                                         input_block->size());
         if (chunk_info.next_chunk != NULL) {
           // Reserve zero-copy for the regular chunk
           output_block_bulk->MakeDataCopy(input_block->data(),
@@ -100,10 +152,8 @@ void TaskChunk::Process(BlockItem *input_block) {
           unsigned tail_size = cut_mark_in_block - offset_in_block;
 
           if (tail_size > 0) {
-            BlockItem *block_tail =
-              new BlockItem(chunk_info.output_tag_chunk, allocator_);
-            block_tail->SetFileItem(file_item);
-            block_tail->SetChunkItem(chunk_info.next_chunk);
+            BlockItem *block_tail = NewDataBlock(
+              chunk_info.next_chunk, &chunk_info.output_chunk, tail_size);
             block_tail->MakeDataCopy(input_block->data() + offset_in_block,
                                      tail_size);
             tubes_out_->Dispatch(block_tail);
@@ -116,14 +166,15 @@ void TaskChunk::Process(BlockItem *input_block) {
             chunk_info.next_chunk->set_size(
               cut_mark - chunk_info.next_chunk->offset());
             BlockItem *block_stop =
-              new BlockItem(chunk_info.output_tag_chunk, allocator_);
+              new BlockItem(chunk_info.output_chunk.tag, allocator_);
             block_stop->SetFileItem(file_item);
             block_stop->SetChunkItem(chunk_info.next_chunk);
+            block_stop->set_segment(chunk_info.output_chunk.segment);
             block_stop->MakeStop();
             tubes_out_->Dispatch(block_stop);
 
             chunk_info.next_chunk = new ChunkItem(file_item, cut_mark);
-            chunk_info.output_tag_chunk = atomic_xadd64(&tag_seq_, 1);
+            StartChunk(chunk_info.next_chunk, &chunk_info.output_chunk);
           }
           offset_in_block = cut_mark_in_block;
         }
@@ -132,10 +183,8 @@ void TaskChunk::Process(BlockItem *input_block) {
         assert(input_block->size() >= offset_in_block);
         unsigned tail_size = input_block->size() - offset_in_block;
         if (tail_size > 0) {
-          BlockItem *block_tail =
-            new BlockItem(chunk_info.output_tag_chunk, allocator_);
-          block_tail->SetFileItem(file_item);
-          block_tail->SetChunkItem(chunk_info.next_chunk);
+          BlockItem *block_tail = NewDataBlock(
+            chunk_info.next_chunk, &chunk_info.output_chunk, tail_size);
           block_tail->MakeDataCopy(input_block->data() + offset_in_block,
                                    tail_size);
           tubes_out_->Dispatch(block_tail);
@@ -19,12 +19,12 @@
 
 class ItemAllocator;
 
-class TaskChunk : public TubeConsumer<BlockItem> {
+class TaskChunk : public TubeConsumer<BlockItem, BlockTube> {
  public:
-  TaskChunk(Tube<BlockItem> *tube_in,
-            TubeGroup<BlockItem> *tubes_out,
+  TaskChunk(BlockTube *tube_in,
+            BlockTubeGroup *tubes_out,
             ItemAllocator *allocator)
-    : TubeConsumer<BlockItem>(tube_in)
+    : TubeConsumer<BlockItem, BlockTube>(tube_in, kBlockTubeBatchSize)
     , tubes_out_(tubes_out)
     , allocator_(allocator)
   {
@@ -39,14 +39,25 @@ class TaskChunk : public TubeConsumer<BlockItem> {
     return MurmurHash2(&value, sizeof(value), 0x07387a4f);
   }
 
+  /**
+   * Output block stream of a chunk.  Every segment of the chunk gets a new tag.
+   */
+  struct SegmentInfo {
+    SegmentInfo() : tag(-1), segment(0), size(0) { }
+    int64_t tag;
+    uint32_t segment;
+    /**
+     * Bytes dispatched in the current segment
+     */
+    uint64_t size;
+  };
+
   /**
    * State of the chunk creation for a file
    */
   struct ChunkInfo {
     ChunkInfo()
       : offset(0)
-      , output_tag_chunk(-1)
-      , output_tag_bulk(-1)
       , next_chunk(NULL)
       , bulk_chunk(NULL)
     { }
@@ -57,11 +68,11 @@ class TaskChunk : public TubeConsumer<BlockItem> {
     /**
      * Blocks of the current regular chunk get tagged consistently
      */
-    int64_t output_tag_chunk;
+    SegmentInfo output_chunk;
     /**
      * Blocks of the corresponding bulk chunk get a unique tag
      */
-    int64_t output_tag_bulk;
+    SegmentInfo output_bulk;
     /**
      * The current regular chunk that corresponds to the output block stream;
      * may be NULL.
@@ -78,13 +89,17 @@ class TaskChunk : public TubeConsumer<BlockItem> {
    */
   typedef SmallHashDynamic<int64_t, ChunkInfo> TagMap;
 
+  void StartChunk(ChunkItem *chunk_item, SegmentInfo *output);
+  BlockItem *NewDataBlock(ChunkItem *chunk_item, SegmentInfo *output,
+                          uint32_t size);
+
   /**
    * Every new chunk increases the tag sequence counter that is used to annotate
    * BlockItems.
    */
   static atomic_int64 tag_seq_;
 
-  TubeGroup<BlockItem> *tubes_out_;
+  BlockTubeGroup *tubes_out_;
   ItemAllocator *allocator_;
   TagMap tag_map_;
 };
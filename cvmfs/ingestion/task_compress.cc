@@ -5,6 +5,8 @@
 #include "cvmfs_config.h"
 #include "task_compress.h"
 
+#include <pthread.h>
+
 #include <cstdlib>
 
 #include "compression.h"
@@ -12,65 +14,153 @@
 #include "smalloc.h"
 
 
+BlockItem *TaskCompress::NewOutputBlock(int64_t tag, BlockItem *input_block) {
+  BlockItem *output_block = new BlockItem(tag, allocator_);
+  output_block->SetFileItem(input_block->file_item());
+  output_block->SetChunkItem(input_block->chunk_item());
+  output_block->MakeData(kCompressedBlockSize);
+  return output_block;
+}
+
+
+/**
+ * Dispatches the compressed blocks of a segment.  The last segment of a chunk
+ * gets the stream trailer appended.
+ */
+void TaskCompress::PassOnSegment(
+  CompressedSegment *segment,
+  uint32_t checksum,
+  int64_t tag,
+  BlockItem *input_block)
+{
+  const unsigned nblocks = segment->blocks.size();
+  for (unsigned i = 0; i < nblocks; ++i) {
+    if ((i == nblocks - 1) && segment->is_last)
+      break;
+    tubes_out_->Dispatch(segment->blocks[i]);
+  }
+
+  if (segment->is_last) {
+    unsigned char trailer[zlib::SegmentCompressor::kMaxTrailerSize];
+    const unsigned trailer_size = zlib::SegmentCompressor::WriteTrailer(
+      input_block->file_item()->compression_algorithm(), checksum, trailer);
+    BlockItem *last_block = (nblocks > 0) ? segment->blocks[nblocks - 1] : NULL;
+    unsigned written = 0;
+    if (last_block != NULL)
+      written = last_block->Write(trailer, trailer_size);
+    if (written < trailer_size) {
+      if (last_block != NULL)
+        tubes_out_->Dispatch(last_block);
+      last_block = NewOutputBlock(tag, input_block);
+      last_block->Write(trailer + written, trailer_size - written);
+    }
+    // Without trailer, an empty chunk may have no data block at all
+    if (last_block != NULL)
+      tubes_out_->Dispatch(last_block);
+  }
+
+  delete segment;
+}
+
+
 /**
  * The data payload of the blocks is replaced by their compressed counterparts.
- * The block tags stay the same.
+ * Large chunks arrive as several segments with different tags (see TaskChunk)
+ * that are compressed independently, possibly by different compression tasks.
+ * The compressed segments are passed on in order with the tag of the chunk.
  * TODO(jblomer): avoid memory copy with EchoCompressor
  */
 void TaskCompress::Process(BlockItem *input_block) {
-  assert(input_block->chunk_item() != NULL);
+  ChunkItem *chunk_item = input_block->chunk_item();
+  assert(chunk_item != NULL);
 
-  zlib::Compressor *compressor = input_block->chunk_item()->GetCompressor();
-  const int64_t tag = input_block->tag();
+  const int64_t input_tag = input_block->tag();
+  const uint32_t segment = input_block->segment();
   const bool flush = input_block->type() == BlockItem::kBlockStop;
+  const bool is_last = !input_block->IsSegmentStop();
+  // Chunks that consist of a single segment may come without a chunk tag
+  const int64_t output_tag = (segment == 0) ? input_tag : chunk_item->tag();
+  assert(output_tag >= 0);
   unsigned char *input_data = input_block->data();
   size_t remaining_in_input = input_block->size();
 
-  BlockItem *output_block = NULL;
-  if (!tag_map_.Lookup(tag, &output_block)) {
-    // So far unseen chunk, start new stream of compressed blocks
-    output_block = new BlockItem(tag, allocator_);
-    output_block->SetFileItem(input_block->file_item());
-    output_block->SetChunkItem(input_block->chunk_item());
-    output_block->MakeData(kCompressedBlockSize);
-    tag_map_.Insert(tag, output_block);
+  SegmentState state;
+  if (!tag_map_.Lookup(input_tag, &state)) {
+    // So far unseen segment, start new stream of compressed blocks
+    state.compressor = new zlib::SegmentCompressor(
+      input_block->file_item()->compression_algorithm(),
+      input_block->file_item()->compression_level(),
+      segment == 0);
+    // The first segment is passed on right away
+    if (segment > 0)
+      state.output = new CompressedSegment(segment, false);
+    state.output_block = NewOutputBlock(output_tag, input_block);
   }
 
   bool done = false;
   do {
+    BlockItem *output_block = state.output_block;
     unsigned char *output_data = output_block->data() + output_block->size();
     assert(!output_block->IsFull());
     size_t remaining_in_output =
       output_block->capacity() - output_block->size();
 
-    done = compressor->Deflate(flush,
+    done = state.compressor->Deflate(flush, is_last,
       &input_data, &remaining_in_input, &output_data, &remaining_in_output);
     // remaining_in_output is now number of consumed bytes
     output_block->set_size(output_block->size() + remaining_in_output);
 
     if (output_block->IsFull()) {
-      tubes_out_->Dispatch(output_block);
-      output_block = new BlockItem(tag, allocator_);
-      output_block->SetFileItem(input_block->file_item());
-      output_block->SetChunkItem(input_block->chunk_item());
-      output_block->MakeData(kCompressedBlockSize);
-      tag_map_.Insert(tag, output_block);
+      if (state.output == NULL)
+        tubes_out_->Dispatch(output_block);
+      else
+        state.output->blocks.push_back(output_block);
+      state.output_block = NewOutputBlock(output_tag, input_block);
     }
   } while ((remaining_in_input > 0) || (flush && !done));
 
-  if (flush) {
-    input_block->chunk_item()->ReleaseCompressor();
+  if (!flush) {
+    tag_map_.Insert(input_tag, state);
+    delete input_block;
+    return;
+  }
+
+  tag_map_.Erase(input_tag);
+  if (state.output == NULL)
+    state.output = new CompressedSegment(segment, is_last);
+  state.output->is_last = is_last;
+  state.output->checksum = state.compressor->checksum();
+  state.output->size = state.compressor->size();
+  delete state.compressor;
+  if (state.output_block->size() > 0)
+    state.output->blocks.push_back(state.output_block);
+  else
+    delete state.output_block;
 
-    if (output_block->size() > 0)
-      tubes_out_->Dispatch(output_block);
-    else
-      delete output_block;
-    tag_map_.Erase(tag);
+  bool is_chunk_complete = false;
+  if ((segment == 0) && is_last) {
+    // Common case: the chunk consists of a single segment
+    PassOnSegment(state.output, state.output->checksum, output_tag,
+                  input_block);
+    is_chunk_complete = true;
+  } else {
+    pthread_mutex_lock(chunk_item->segment_lock());
+    chunk_item->PushSegment(state.output);
+    CompressedSegment *next_segment;
+    while ((next_segment = chunk_item->PopSegment()) != NULL) {
+      is_chunk_complete = next_segment->is_last;
+      PassOnSegment(next_segment, chunk_item->segments_checksum(),
+                    chunk_item->tag(), input_block);
+    }
+    pthread_mutex_unlock(chunk_item->segment_lock());
+  }
 
-    BlockItem *stop_block = new BlockItem(tag, allocator_);
+  // Once the stop block is dispatched, the chunk item can disappear
+  if (is_chunk_complete) {
+    BlockItem *stop_block = new BlockItem(output_tag, allocator_);
     stop_block->MakeStop();
     stop_block->SetFileItem(input_block->file_item());
-    stop_block->SetChunkItem(input_block->chunk_item());
+    stop_block->SetChunkItem(chunk_item);
     tubes_out_->Dispatch(stop_block);
   }
 
@@ -7,6 +7,7 @@
 
 #include <map>
 
+#include "compression.h"
 #include "ingestion/item.h"
 #include "ingestion/task.h"
 #include "murmur.hxx"
@@ -15,15 +16,15 @@
 
 class ItemAllocator;
 
-class TaskCompress : public TubeConsumer<BlockItem> {
+class TaskCompress : public TubeConsumer<BlockItem, BlockTube> {
  public:
   static const unsigned kCompressedBlockSize = kPageSize * 2;
 
   TaskCompress(
-    Tube<BlockItem> *tube_in,
-    TubeGroup<BlockItem> *tubes_out,
+    BlockTube *tube_in,
+    BlockTubeGroup *tubes_out,
     ItemAllocator *allocator)
-    : TubeConsumer<BlockItem>(tube_in)
+    : TubeConsumer<BlockItem, BlockTube>(tube_in, kBlockTubeBatchSize)
     , tubes_out_(tubes_out)
     , allocator_(allocator)
   {
@@ -39,12 +40,31 @@ class TaskCompress : public TubeConsumer<BlockItem> {
   }
 
   /**
-   * Maps input block tag (hence: chunk) to the output block with the compressed
-   * data.
+   * Compression state of a chunk or of a segment of a chunk.  An active zlib
+   * compression stream requires 256kB of memory.  Therefore, the compressor
+   * only exists for the duration of the segment.
    */
-  typedef SmallHashDynamic<int64_t, BlockItem *> TagMap;
+  struct SegmentState {
+    SegmentState() : compressor(NULL), output(NULL), output_block(NULL) { }
+    zlib::SegmentCompressor *compressor;
+    /**
+     * Collects the compressed blocks of segments other than the first one
+     * until the preceding segments are passed on.
+     */
+    CompressedSegment *output;
+    BlockItem *output_block;
+  };
 
-  TubeGroup<BlockItem> *tubes_out_;
+  /**
+   * Maps input block tag (hence: chunk segment) to the compression state
+   */
+  typedef SmallHashDynamic<int64_t, SegmentState> TagMap;
+
+  BlockItem *NewOutputBlock(int64_t tag, BlockItem *input_block);
+  void PassOnSegment(CompressedSegment *segment, uint32_t checksum,
+                     int64_t tag, BlockItem *input_block);
+
+  BlockTubeGroup *tubes_out_;
   ItemAllocator *allocator_;
   TagMap tag_map_;
 };
@@ -8,16 +8,18 @@
 #include "ingestion/item.h"
 #include "ingestion/task.h"
 
-class TaskHash : public TubeConsumer<BlockItem> {
+class TaskHash : public TubeConsumer<BlockItem, BlockTube> {
  public:
-  TaskHash(Tube<BlockItem> *tube_in, TubeGroup<BlockItem> *tubes_out)
-    : TubeConsumer<BlockItem>(tube_in), tubes_out_(tubes_out) { }
+  TaskHash(BlockTube *tube_in, BlockTubeGroup *tubes_out)
+    : TubeConsumer<BlockItem, BlockTube>(tube_in, kBlockTubeBatchSize)
+    , tubes_out_(tubes_out)
+  { }
 
  protected:
   virtual void Process(BlockItem *input_block);
 
  private:
-  TubeGroup<BlockItem> *tubes_out_;
+  BlockTubeGroup *tubes_out_;
 };
 
 #endif  // CVMFS_INGESTION_TASK_HASH_H_
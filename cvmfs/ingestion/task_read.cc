@@ -8,9 +8,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
 
-#include "backoff.h"
+#include "ingestion/item_mem.h"
 #include "logging.h"
 #include "platform.h"
 #include "smalloc.h"
@@ -22,12 +23,9 @@ atomic_int64 TaskRead::tag_seq_ = 0;
 
 
 void TaskRead::Process(FileItem *item) {
-  BackoffThrottle throttle(kThrottleInitMs, kThrottleMaxMs, kThrottleResetMs);
-  if ((high_watermark_ > 0) && (BlockItem::managed_bytes() > high_watermark_)) {
+  if ((high_watermark_ > 0) && (allocator_->in_use() > high_watermark_)) {
     atomic_inc64(&n_block_);
-    do {
-      throttle.Throttle();
-    } while (BlockItem::managed_bytes() > low_watermark_);
+    allocator_->WaitForMemory(low_watermark_, high_watermark_);
   }
 
   if (item->Open() == false) {
@@ -44,36 +42,54 @@ void TaskRead::Process(FileItem *item) {
       item->chunk_detector()->MightFindChunks(item->size()));
   }
 
-  unsigned char *buffer[kBlockSize];
+  // Blocks are read straight into allocator-owned buffers that travel down
+  // the pipeline, so the data is not copied before the chunk stage.  The
+  // expected file size bounds the allocation of the last block; once it is
+  // exhausted, a single byte probe detects the end of file (or a file that
+  // grew meanwhile).
   uint64_t tag = atomic_xadd64(&tag_seq_, 1);
+  if (high_watermark_ > 0)
+    allocator_->BeginFile();
+  uint64_t remaining = item->size();
   ssize_t nbytes = -1;
   unsigned cnt = 0;
   do {
-    nbytes = item->Read(buffer, kBlockSize);
+    BlockItem *block_item = new BlockItem(tag, allocator_);
+    block_item->SetFileItem(item);
+    if (remaining > 0) {
+      const uint32_t capacity =
+        static_cast<uint32_t>(std::min(remaining, uint64_t(kBlockSize)));
+      block_item->MakeData(capacity);
+      nbytes = item->Read(block_item->data(), capacity);
+    } else {
+      unsigned char probe;
+      nbytes = item->Read(&probe, 1);
+      if (nbytes > 0)
+        block_item->MakeDataCopy(&probe, 1);
+    }
     if (nbytes < 0) {
       PANIC(kLogStderr, "failed to read %s (%d)", item->path().c_str(), errno);
     }
 
-    BlockItem *block_item = new BlockItem(tag, allocator_);
-    block_item->SetFileItem(item);
     if (nbytes == 0) {
+      if (block_item->type() == BlockItem::kBlockData)
+        block_item->Reset();
       item->Close();
       block_item->MakeStop();
     } else {
-      block_item->MakeDataCopy(reinterpret_cast<unsigned char *>(buffer),
-                               nbytes);
+      block_item->set_size(nbytes);
+      remaining -= std::min(remaining, static_cast<uint64_t>(nbytes));
     }
     tubes_out_->Dispatch(block_item);
 
     cnt++;
-    if ((cnt % 32) == 0) {
-      if ((high_watermark_ > 0) &&
-          (BlockItem::managed_bytes() > high_watermark_))
-      {
-        throttle.Throttle();
-      }
+    if (((cnt % kCheckMemoryBlocks) == 0) && (high_watermark_ > 0)) {
+      if (allocator_->WaitForMemoryInFile(high_watermark_))
+        atomic_inc64(&n_block_);
     }
   } while (nbytes > 0);
+  if (high_watermark_ > 0)
+    allocator_->EndFile();
 }
 
 
@@ -17,14 +17,16 @@ class ItemAllocator;
 
 class TaskRead : public TubeConsumer<FileItem> {
  public:
-  static const unsigned kThrottleInitMs = 50;
-  static const unsigned kThrottleMaxMs = 500;
-  static const unsigned kThrottleResetMs = 2000;
+  /**
+   * While in the middle of a file, the memory is checked every so many blocks,
+   * see ItemAllocator::WaitForMemoryInFile().
+   */
+  static const unsigned kCheckMemoryBlocks = 32;
   static const unsigned kBlockSize = kPageSize * 4;
 
   TaskRead(
     Tube<FileItem> *tube_in,
-    TubeGroup<BlockItem> *tubes_out,
+    BlockTubeGroup *tubes_out,
     ItemAllocator *allocator)
     : TubeConsumer<FileItem>(tube_in)
     , tubes_out_(tubes_out)
@@ -47,16 +49,16 @@ class TaskRead : public TubeConsumer<FileItem> {
    */
   static atomic_int64 tag_seq_;
 
-  TubeGroup<BlockItem> *tubes_out_;
+  BlockTubeGroup *tubes_out_;
   ItemAllocator *allocator_;
   /**
-   * Continue reading once the amount of BlockItem managed bytes is back to
-   * the given level.
+   * Continue reading once the bytes in use by the allocator are back to the
+   * given level.
    */
   uint64_t low_watermark_;
   /**
-   * Stop reading new data into the pipeline when the amount BlockItem managed
-   * byte is higher than the given level.
+   * Stop reading new data into the pipeline when the bytes in use by the
+   * allocator are higher than the given level.
    */
   uint64_t high_watermark_;
   /**
@@ -8,6 +8,7 @@
 #include <cassert>
 
 #include "logging.h"
+#include "platform.h"
 
 void TaskRegister::Process(FileItem *file_item) {
   assert(file_item != NULL);
@@ -32,6 +33,10 @@ void TaskRegister::Process(FileItem *file_item) {
     FileChunkList(*file_item->GetChunksPtr()),
     file_item->compression_algorithm()));
 
+  if (file_latency_ != NULL) {
+    file_latency_->Add(
+      platform_monotonic_time_ns() - file_item->creation_time_ns());
+  }
   delete file_item;
   tube_counter_->PopFront();
 }
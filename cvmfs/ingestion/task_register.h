@@ -25,13 +25,22 @@ class TaskRegister
                Tube<FileItem> *tube_counter)
     : TubeConsumer<FileItem>(tube_in)
     , tube_counter_(tube_counter)
+    , file_latency_(NULL)
   { }
 
+  /**
+   * Optionally records the time from entering the pipeline to registration
+   */
+  void SetLatencyHistogram(DurationHistogram *file_latency) {
+    file_latency_ = file_latency;
+  }
+
  protected:
   virtual void Process(FileItem *file_item);
 
  private:
   Tube<FileItem> *tube_counter_;
+  DurationHistogram *file_latency_;
 };  // class TaskRegister
 
 #endif  // CVMFS_INGESTION_TASK_REGISTER_H_
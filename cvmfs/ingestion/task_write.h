@@ -10,13 +10,13 @@
 #include "upload_facility.h"
 
 
-class TaskWrite : public TubeConsumer<BlockItem> {
+class TaskWrite : public TubeConsumer<BlockItem, BlockTube> {
  public:
   TaskWrite(
-    Tube<BlockItem> *tube_in,
+    BlockTube *tube_in,
     TubeGroup<FileItem> *tubes_out,
     upload::AbstractUploader *uploader)
-    : TubeConsumer<BlockItem>(tube_in)
+    : TubeConsumer<BlockItem, BlockTube>(tube_in, kBlockTubeBatchSize)
     , tubes_out_(tubes_out)
     , uploader_(uploader) { }
 
@@ -12,10 +12,20 @@
 #include <vector>
 
 #include "atomic.h"
+#include "statistics.h"
 #include "util/pointer.h"
 #include "util/single_copy.h"
 #include "util_concurrency.h"
 
+/**
+ * Payload bytes of an item, used to count the bytes that pass through the
+ * pipeline stages.  Item types with a payload provide an overload that is
+ * found by argument-dependent lookup.
+ */
+template <class ItemT>
+inline uint64_t GetItemSize(ItemT * /* item */) { return 0; }
+
+
 /**
  * A thread-safe, doubly linked list of links containing pointers to ItemT.  The
  * ItemT elements are not owned by the Tube.  FIFO or LIFO semantics.  Using
@@ -127,6 +137,21 @@ class Tube : SingleCopy {
     return SliceUnlocked(head_->prev_);
   }
 
+  /**
+   * Remove up to max_items elements from the front of the queue.  Blocks until
+   * at least one element is available.  Returns the number of removed items.
+   */
+  unsigned PopFrontMany(ItemT **items, unsigned max_items) {
+    assert(max_items > 0);
+    MutexLockGuard lock_guard(&lock_);
+    while (size_ == 0)
+      pthread_cond_wait(&cond_populated_, &lock_);
+    unsigned n = 0;
+    while ((n < max_items) && (size_ > 0))
+      items[n++] = SliceUnlocked(head_->prev_);
+    return n;
+  }
+
   /**
    * Remove and return the last element from the queue.  Block if tube is
    * empty.
@@ -222,15 +247,254 @@ class Tube : SingleCopy {
 };
 
 
+/**
+ * A bounded FIFO for multiple producers and multiple consumers on a ring buffer
+ * of item pointers.  Unlike the Tube, it does not allocate memory per item and
+ * it does not take a lock as long as the ring is neither full nor empty.
+ * Producers and consumers claim slots with compare-and-swap on the tail and
+ * head counters.  Every slot has a sequence number that tells whether the slot
+ * is ready to be written or to be read in the current lap (D. Vyukov's bounded
+ * MPMC queue).
+ *
+ * Threads that need to block (empty or full ring, Wait()) fall back to a mutex
+ * and condition variables.  The waiter counters are incremented before the
+ * ring is checked again under the lock, so that the other side cannot miss
+ * them.
+ *
+ * Only the FIFO subset of the Tube interface is supported.
+ */
+template <class ItemT>
+class RingTube : SingleCopy {
+ public:
+  static const uint64_t kDefaultLimit = 1024;
+
+  RingTube() { Init(kDefaultLimit); }
+  explicit RingTube(uint64_t limit) { Init(limit); }
+  ~RingTube() {
+    delete[] slots_;
+    pthread_cond_destroy(&cond_populated_);
+    pthread_cond_destroy(&cond_capacious_);
+    pthread_cond_destroy(&cond_empty_);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  /**
+   * Push an item to the back of the queue.  Block if queue is currently full.
+   */
+  void EnqueueBack(ItemT *item) {
+    assert(item != NULL);
+    if (!TryEnqueue(item)) {
+      MutexLockGuard lock_guard(&lock_);
+      atomic_inc32(&num_waiting_producers_);
+      while (!TryEnqueue(item))
+        pthread_cond_wait(&cond_capacious_, &lock_);
+      atomic_dec32(&num_waiting_producers_);
+    }
+    if (Peek(&num_waiting_consumers_) > 0)
+      Notify(&cond_populated_, false);
+  }
+
+  /**
+   * Remove and return the first element from the queue.  Block if tube is
+   * empty.
+   */
+  ItemT *PopFront() {
+    ItemT *item;
+    PopFrontMany(&item, 1);
+    return item;
+  }
+
+  /**
+   * Remove up to max_items elements from the front of the queue with a single
+   * compare-and-swap.  Blocks until at least one element is available.
+   * Returns the number of removed items.
+   */
+  unsigned PopFrontMany(ItemT **items, unsigned max_items) {
+    assert(max_items > 0);
+    unsigned n = TryDequeue(items, max_items);
+    if (n == 0) {
+      MutexLockGuard lock_guard(&lock_);
+      atomic_inc32(&num_waiting_consumers_);
+      while ((n = TryDequeue(items, max_items)) == 0)
+        pthread_cond_wait(&cond_populated_, &lock_);
+      atomic_dec32(&num_waiting_consumers_);
+    }
+    if (Peek(&num_waiting_producers_) > 0)
+      Notify(&cond_capacious_, true);
+    if ((Peek(&num_waiting_empty_) > 0) && IsEmpty())
+      Notify(&cond_empty_, true);
+    return n;
+  }
+
+  /**
+   * Blocks until the tube is empty
+   */
+  void Wait() {
+    MutexLockGuard lock_guard(&lock_);
+    atomic_inc32(&num_waiting_empty_);
+    while (!IsEmpty())
+      pthread_cond_wait(&cond_empty_, &lock_);
+    atomic_dec32(&num_waiting_empty_);
+  }
+
+  bool IsEmpty() { return size() == 0; }
+
+  /**
+   * Includes items whose slot is claimed but not yet written
+   */
+  uint64_t size() {
+    // Reading the head first makes sure that head <= tail
+    const int64_t head = atomic_read64(&head_);
+    const int64_t tail = atomic_read64(&tail_);
+    return tail - head;
+  }
+
+  uint64_t capacity() const { return mask_ + 1; }
+
+ private:
+  struct Slot {
+    atomic_int64 sequence;
+    ItemT *item;
+  };
+
+  void Init(uint64_t limit) {
+    assert(limit > 0);
+    uint64_t capacity = 1;
+    while (capacity < limit)
+      capacity <<= 1;
+    mask_ = capacity - 1;
+    slots_ = new Slot[capacity];
+    for (uint64_t i = 0; i < capacity; ++i) {
+      slots_[i].sequence = i;
+      slots_[i].item = NULL;
+    }
+    atomic_init64(&head_);
+    atomic_init64(&tail_);
+    atomic_init32(&num_waiting_consumers_);
+    atomic_init32(&num_waiting_producers_);
+    atomic_init32(&num_waiting_empty_);
+
+    int retval = pthread_mutex_init(&lock_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_populated_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_capacious_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_empty_, NULL);
+    assert(retval == 0);
+  }
+
+  /**
+   * Plain read of a counter, i.e. without the bus lock of atomic_read.  Used
+   * where a stale value is either validated by a subsequent compare-and-swap,
+   * or where a preceding compare-and-swap provides the memory barrier.
+   */
+  template <typename T>
+  static inline T Peek(T *value) {
+    return *static_cast<volatile T *>(value);
+  }
+
+  /**
+   * Returns false if the ring is full
+   */
+  bool TryEnqueue(ItemT *item) {
+    int64_t pos = Peek(&tail_);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const int64_t diff = Peek(&slot->sequence) - pos;
+      if (diff == 0) {
+        if (atomic_cas64(&tail_, pos, pos + 1))
+          break;
+      } else if (diff < 0) {
+        // The slot still holds an item from the previous lap
+        return false;
+      }
+      pos = Peek(&tail_);
+    }
+    slot->item = item;
+    // Nobody else touches the slot until it is published
+    bool retval = atomic_cas64(&slot->sequence, pos, pos + 1);
+    assert(retval);
+    return true;
+  }
+
+  /**
+   * Claims a run of consecutive, readable slots.  Returns 0 if the ring is
+   * empty.
+   */
+  unsigned TryDequeue(ItemT **items, unsigned max_items) {
+    int64_t pos = Peek(&head_);
+    unsigned n;
+    while (true) {
+      const int64_t diff = Peek(&slots_[pos & mask_].sequence) - (pos + 1);
+      if (diff < 0)
+        return 0;
+      if (diff == 0) {
+        n = 1;
+        while ((n < max_items) && (n <= mask_) &&
+               (Peek(&slots_[(pos + n) & mask_].sequence) == pos + n + 1))
+        {
+          n++;
+        }
+        if (atomic_cas64(&head_, pos, pos + n))
+          break;
+      }
+      pos = Peek(&head_);
+    }
+    for (unsigned i = 0; i < n; ++i) {
+      Slot *slot = &slots_[(pos + i) & mask_];
+      items[i] = slot->item;
+      // Ready for the producer of the next lap
+      bool retval =
+        atomic_cas64(&slot->sequence, pos + i + 1, pos + i + mask_ + 1);
+      assert(retval);
+    }
+    return n;
+  }
+
+  void Notify(pthread_cond_t *cond, bool broadcast) {
+    MutexLockGuard lock_guard(&lock_);
+    int retval = broadcast ? pthread_cond_broadcast(cond)
+                           : pthread_cond_signal(cond);
+    assert(retval == 0);
+  }
+
+  /**
+   * Consumers and producers work on different cache lines
+   */
+  atomic_int64 head_;
+  char padding_head_[64 - sizeof(atomic_int64)];
+  atomic_int64 tail_;
+  char padding_tail_[64 - sizeof(atomic_int64)];
+  /**
+   * Capacity - 1, the capacity is a power of 2
+   */
+  uint64_t mask_;
+  Slot *slots_;
+
+  atomic_int32 num_waiting_consumers_;
+  atomic_int32 num_waiting_producers_;
+  atomic_int32 num_waiting_empty_;
+  /**
+   * Only used to block and to wake up blocked threads
+   */
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_populated_;
+  pthread_cond_t cond_capacious_;
+  pthread_cond_t cond_empty_;
+};
+
+
 /**
  * A tube group manages a fixed set of Tubes and dispatches items among them in
  * such a way that items with the same tag (a positive integer) are all sent
- * to the same tube.
+ * to the same tube.  TubeT is either a Tube or a RingTube.
  */
-template <class ItemT>
+template <class ItemT, class TubeT = Tube<ItemT> >
 class TubeGroup : SingleCopy {
  public:
-  TubeGroup() : is_active_(false) {
+  TubeGroup() : is_active_(false), sz_dispatched_(NULL) {
     atomic_init32(&round_robin_);
   }
 
@@ -239,7 +503,7 @@ class TubeGroup : SingleCopy {
       delete tubes_[i];
   }
 
-  void TakeTube(Tube<ItemT> *t) {
+  void TakeTube(TubeT *t) {
     assert(!is_active_);
     tubes_.push_back(t);
   }
@@ -250,30 +514,46 @@ class TubeGroup : SingleCopy {
     is_active_ = true;
   }
 
+  /**
+   * Optionally counts the payload bytes of the dispatched items.  Must be set
+   * before the producers start.
+   */
+  void SetByteCounter(perf::Counter *sz_dispatched) {
+    sz_dispatched_ = sz_dispatched;
+  }
+
   /**
    * Like Tube::EnqueueBack(), but pick a tube according to ItemT::tag()
    */
-  typename Tube<ItemT>::Link *Dispatch(ItemT *item) {
+  void Dispatch(ItemT *item) {
     assert(is_active_);
+    CountBytes(item);
     unsigned tube_idx = (tubes_.size() == 1)
                         ? 0 : (item->tag() % tubes_.size());
-    return tubes_[tube_idx]->EnqueueBack(item);
+    tubes_[tube_idx]->EnqueueBack(item);
   }
 
   /**
    * Like Tube::EnqueueBack(), use tubes one after another
    */
-  typename Tube<ItemT>::Link *DispatchAny(ItemT *item) {
+  void DispatchAny(ItemT *item) {
     assert(is_active_);
+    CountBytes(item);
     unsigned tube_idx = (tubes_.size() == 1)
                         ? 0 : (atomic_xadd32(&round_robin_, 1) % tubes_.size());
-    return tubes_[tube_idx]->EnqueueBack(item);
+    tubes_[tube_idx]->EnqueueBack(item);
   }
 
  private:
+  void CountBytes(ItemT *item) {
+    if (sz_dispatched_ != NULL)
+      sz_dispatched_->Xadd(GetItemSize(item));
+  }
+
   bool is_active_;
-  std::vector<Tube<ItemT> *> tubes_;
+  std::vector<TubeT *> tubes_;
   atomic_int32 round_robin_;
+  perf::Counter *sz_dispatched_;
 };
 
 #endif  // CVMFS_INGESTION_TUBE_H_
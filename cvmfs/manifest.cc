@@ -147,10 +147,14 @@ Manifest *Manifest::Load(const map<char, string> &content) {
     reflog_hash = MkFromHexPtr(shash::HexPtr(iter->second));
   }
 
-  return new Manifest(catalog_hash, catalog_size, root_path, ttl, revision,
-                      micro_catalog_hash, repository_name, certificate,
-                      history, publish_timestamp, garbage_collectable,
-                      has_alt_catalog_path, meta_info, reflog_hash);
+  Manifest *manifest =
+    new Manifest(catalog_hash, catalog_size, root_path, ttl, revision,
+                 micro_catalog_hash, repository_name, certificate,
+                 history, publish_timestamp, garbage_collectable,
+                 has_alt_catalog_path, meta_info, reflog_hash);
+  if ((iter = content.find('E')) != content.end())
+    manifest->set_catalog_delta(iter->second);
+  return manifest;
 }
 
 
@@ -196,6 +200,8 @@ string Manifest::ExportString() const {
   if (!reflog_hash_.IsNull()) {
     manifest += "Y" + reflog_hash_.ToString() + "\n";
   }
+  if (!catalog_delta_.empty())
+    manifest += "E" + catalog_delta_ + "\n";
   // Reserved: Z -> for identification of channel tips
 
   return manifest;
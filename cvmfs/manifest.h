@@ -117,6 +117,9 @@ class Manifest {
   void set_reflog_hash(const shash::Any& checksum) {
     reflog_hash_ = checksum;
   }
+  void set_catalog_delta(const std::string &catalog_delta) {
+    catalog_delta_ = catalog_delta;
+  }
 
   uint64_t revision() const { return revision_; }
   std::string repository_name() const { return repository_name_; }
@@ -130,6 +133,7 @@ class Manifest {
   bool has_alt_catalog_path() const { return has_alt_catalog_path_; }
   shash::Any meta_info() const { return meta_info_; }
   shash::Any reflog_hash() const { return reflog_hash_; }
+  std::string catalog_delta() const { return catalog_delta_; }
 
   std::string MakeCatalogPath() const {
     return has_alt_catalog_path_ ? catalog_hash_.MakeAlternativePath() :
@@ -172,6 +176,12 @@ class Manifest {
    * Hash of the reflog file
    */
   shash::Any reflog_hash_;
+
+  /**
+   * Points to the delta that produces the root catalog from its previous
+   * revision, see catalog::CatalogDeltaRef
+   */
+  std::string catalog_delta_;
 };  // class Manifest
 
 }  // namespace manifest
@@ -1222,6 +1222,11 @@ bool MountPoint::CreateCatalogManager() {
   string optarg;
 
   catalog_mgr_ = new catalog::ClientCatalogManager(this);
+  if (options_mgr_->GetValue("CVMFS_CATALOG_DELTAS", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    catalog_mgr_->SetCatalogDeltas(true);
+  }
 
   SetupInodeAnnotation();
   if (!SetupOwnerMaps())
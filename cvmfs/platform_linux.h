@@ -21,6 +21,7 @@
 #include <sys/prctl.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
@@ -167,6 +168,20 @@ inline void platform_spinlock_unlock(platform_spinlock *lock) {
  */
 inline pthread_t platform_gettid() { return pthread_self(); }
 
+/**
+ * NUMA node of the CPU the calling thread currently runs on, 0 if unknown.
+ * The thread may be migrated at any time, so the result is only a hint.
+ */
+inline unsigned platform_numa_node() {
+#ifdef SYS_getcpu
+  unsigned cpu;
+  unsigned node;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+    return node;
+#endif
+  return 0;
+}
+
 inline int platform_sigwait(const int signum) {
   sigset_t sigset;
   int retval = sigemptyset(&sigset);
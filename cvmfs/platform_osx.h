@@ -128,6 +128,8 @@ inline void platform_spinlock_unlock(platform_spinlock *lock) {
  */
 inline thread_port_t platform_gettid() { return mach_thread_self(); }
 
+inline unsigned platform_numa_node() { return 0; }
+
 inline int platform_sigwait(const int signum) {
   sigset_t sigset;
   int retval = sigemptyset(&sigset);
@@ -257,6 +257,7 @@ void Publisher::ConstructSpoolers() {
     settings_.storage().GetLocator(),
     settings_.transaction().hash_algorithm(),
     settings_.transaction().compression_algorithm());
+  sd.compression_level = settings_.transaction().compression_level();
   sd.session_token_file =
     settings_.transaction().spool_area().gw_session_token();
   sd.key_file = settings_.keychain().gw_key_path();
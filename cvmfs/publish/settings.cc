@@ -80,7 +80,9 @@ void SettingsTransaction::SetHashAlgorithm(const std::string &algorithm) {
 
 void SettingsTransaction::SetCompressionAlgorithm(const std::string &algorithm)
 {
-  compression_algorithm_ = zlib::ParseCompressionAlgorithm(algorithm);
+  int level;
+  compression_algorithm_ = zlib::ParseCompressionAlgorithm(algorithm, &level);
+  compression_level_ = level;
 }
 
 void SettingsTransaction::SetEnforceLimits(bool value) {
@@ -137,6 +137,7 @@ class SettingsTransaction {
     , in_enter_session_(false)
     , hash_algorithm_(shash::kShake128)
     , compression_algorithm_(zlib::kZlibDefault)
+    , compression_level_(0)
     , ttl_second_(240)
     , is_garbage_collectable_(true)
     , is_volatile_(false)
@@ -192,6 +193,7 @@ class SettingsTransaction {
   zlib::Algorithms compression_algorithm() const {
     return compression_algorithm_();
   }
+  int compression_level() const { return compression_level_(); }
   uint32_t ttl_second() const { return ttl_second_(); }
   bool is_garbage_collectable() const { return is_garbage_collectable_(); }
   bool is_volatile() const { return is_volatile_(); }
@@ -241,6 +243,7 @@ class SettingsTransaction {
   Setting<shash::Any> base_hash_;
   Setting<shash::Algorithms> hash_algorithm_;
   Setting<zlib::Algorithms> compression_algorithm_;
+  Setting<int> compression_level_;
   Setting<uint32_t> ttl_second_;
   Setting<bool> is_garbage_collectable_;
   Setting<bool> is_volatile_;
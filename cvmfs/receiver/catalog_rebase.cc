@@ -0,0 +1,141 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "catalog_rebase.h"
+
+#include "catalog_mgr_ro.h"
+#include "catalog_mgr_rw.h"
+#include "logging.h"
+#include "manifest.h"
+#include "params.h"
+#include "statistics.h"
+#include "upload.h"
+#include "util/pointer.h"
+#include "util/raii_temp_dir.h"
+
+namespace {
+
+/**
+ * Finds the nested catalog that hosts path, the mountpoint is empty for the
+ * root catalog.
+ */
+bool FindHostingCatalog(const shash::Any &root_hash,
+                        const PathString &path,
+                        const receiver::Params &params,
+                        const std::string &temp_dir_prefix,
+                        download::DownloadManager *download_manager,
+                        PathString *mountpoint,
+                        shash::Any *hash,
+                        uint64_t *size)
+{
+  UniquePtr<RaiiTempDir> temp_dir(RaiiTempDir::Create(temp_dir_prefix));
+  perf::Statistics statistics;
+  catalog::SimpleCatalogManager catalog_mgr(
+    root_hash, params.stratum0, temp_dir->dir(), download_manager,
+    &statistics, true);
+  if (!catalog_mgr.Init())
+    return false;
+  return catalog_mgr.LookupNested(path, mountpoint, hash, size);
+}
+
+}  // anonymous namespace
+
+namespace receiver {
+
+bool RebaseLease(const Params &params,
+                 const PathString &lease_path,
+                 const shash::Any &base_root_hash,
+                 const shash::Any &merged_root_hash,
+                 const std::string &temp_dir_prefix,
+                 download::DownloadManager *download_manager,
+                 manifest::Manifest *head_manifest)
+{
+  PathString path;
+  if ((lease_path.GetLength() == 0) || (lease_path.GetChars()[0] != '/'))
+    path.Append("/", 1);
+  path.Append(lease_path.GetChars(), lease_path.GetLength());
+
+  PathString mountpoint;
+  shash::Any base_hash;
+  uint64_t size;
+  if (!FindHostingCatalog(base_root_hash, path, params, temp_dir_prefix,
+                          download_manager, &mountpoint, &base_hash, &size))
+  {
+    return false;
+  }
+  if (mountpoint.IsEmpty()) {
+    LogCvmfs(kLogReceiver, kLogSyslog,
+             "CatalogRebase - lease path %s is hosted by the root catalog",
+             path.c_str());
+    return false;
+  }
+
+  PathString head_mountpoint;
+  shash::Any head_hash;
+  if (!FindHostingCatalog(head_manifest->catalog_hash(), mountpoint, params,
+                          temp_dir_prefix, download_manager, &head_mountpoint,
+                          &head_hash, &size) ||
+      (head_mountpoint != mountpoint) || (head_hash != base_hash))
+  {
+    LogCvmfs(kLogReceiver, kLogSyslog,
+             "CatalogRebase - nested catalog %s changed concurrently",
+             mountpoint.c_str());
+    return false;
+  }
+
+  PathString merged_mountpoint;
+  shash::Any merged_hash;
+  uint64_t merged_size;
+  if (!FindHostingCatalog(merged_root_hash, mountpoint, params,
+                          temp_dir_prefix, download_manager,
+                          &merged_mountpoint, &merged_hash, &merged_size) ||
+      (merged_mountpoint != mountpoint))
+  {
+    LogCvmfs(kLogReceiver, kLogSyslog,
+             "CatalogRebase - nested catalog %s removed by the lease",
+             mountpoint.c_str());
+    return false;
+  }
+
+  perf::Statistics statistics;
+  perf::StatisticsTemplate stats_tmpl("publish", &statistics);
+  upload::SpoolerDefinition definition(
+    params.spooler_configuration, params.hash_alg, params.compression_alg,
+    params.generate_legacy_bulk_chunks, params.use_file_chunking,
+    params.min_chunk_size, params.avg_chunk_size, params.max_chunk_size,
+    "dummy_token", "dummy_key");
+  UniquePtr<upload::Spooler> spooler(
+    upload::Spooler::Construct(definition, &stats_tmpl));
+  if (!spooler.IsValid())
+    return false;
+
+  UniquePtr<RaiiTempDir> temp_dir(RaiiTempDir::Create(temp_dir_prefix));
+  catalog::WritableCatalogManager output_catalog_mgr(
+    head_manifest->catalog_hash(), params.stratum0, temp_dir->dir(),
+    spooler.weak_ref(), download_manager, params.enforce_limits,
+    params.nested_kcatalog_limit, params.root_kcatalog_limit,
+    params.file_mbyte_limit, &statistics, params.use_autocatalogs,
+    params.max_weight, params.min_weight);
+  if (!output_catalog_mgr.Init())
+    return false;
+
+  LogCvmfs(kLogReceiver, kLogSyslog,
+           "CatalogRebase - swapping nested catalog %s (%s -> %s)",
+           mountpoint.c_str(), head_hash.ToString().c_str(),
+           merged_hash.ToString().c_str());
+  // The catalog manager expects the mountpoint without the leading slash.
+  // Swapping re-syncs the mountpoint entry in the parent (mtime, size) from
+  // the new nested root and carries the counter delta up to the root catalog
+  // on commit.
+  output_catalog_mgr.SwapNestedCatalog(mountpoint.ToString().substr(1),
+                                       merged_hash, merged_size);
+  if (!output_catalog_mgr.Commit(false, 0, head_manifest)) {
+    LogCvmfs(kLogReceiver, kLogSyslogErr,
+             "CatalogRebase - could not commit rebased catalogs");
+    return false;
+  }
+  return true;
+}
+
+}  // namespace receiver
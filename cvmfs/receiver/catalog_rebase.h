@@ -0,0 +1,49 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_RECEIVER_CATALOG_REBASE_H_
+#define CVMFS_RECEIVER_CATALOG_REBASE_H_
+
+#include <string>
+
+#include "hash.h"
+#include "shortstring.h"
+
+namespace download {
+class DownloadManager;
+}
+
+namespace manifest {
+class Manifest;
+}
+
+namespace receiver {
+
+struct Params;
+
+/**
+ * Commits of different leases are merged concurrently, each one onto the root
+ * catalog that was current when its merge started (the base).  If another
+ * commit got published in the meantime, the merged catalogs need to be moved
+ * onto the new root catalog (the head) before they can be published.
+ *
+ * This is cheap if the lease path is hosted by a nested catalog that is
+ * identical in the base and in the head: lease paths don't overlap, so the
+ * merged version of that nested catalog is simply swapped into the head. Only
+ * the catalogs between the nested catalog and the root catalog are rewritten.
+ *
+ * On success, the head manifest points to the new root catalog.  Returns false
+ * if the lease needs to be merged again onto the head.
+ */
+bool RebaseLease(const Params &params,
+                 const PathString &lease_path,
+                 const shash::Any &base_root_hash,
+                 const shash::Any &merged_root_hash,
+                 const std::string &temp_dir_prefix,
+                 download::DownloadManager *download_manager,
+                 manifest::Manifest *head_manifest);
+
+}  // namespace receiver
+
+#endif  // CVMFS_RECEIVER_CATALOG_REBASE_H_
@@ -12,6 +12,7 @@
 #include "catalog_merge_tool.h"
 #include "catalog_mgr_ro.h"
 #include "catalog_mgr_rw.h"
+#include "catalog_rebase.h"
 #include "compression.h"
 #include "download.h"
 #include "logging.h"
@@ -97,6 +98,11 @@ CommitProcessor::~CommitProcessor() {}
  * The resulting catalog on the gateway machine (C_GN) is then set as root
  * catalog in the repository manifest. The method also signes the updated
  * repository manifest.
+ *
+ * Lease paths don't overlap, so commits of different leases are merged
+ * concurrently.  Only the publication of C_GN is serialized by a lock file.  If
+ * another commit was published while merging, C_GN is first moved onto the new
+ * root catalog (see RebaseLease()), or the lease is merged again.
  */
 CommitProcessor::Result CommitProcessor::Process(
     const std::string& lease_path, const shash::Any& old_root_hash,
@@ -162,6 +168,7 @@ CommitProcessor::Result CommitProcessor::Process(
            "CommitProcessor - lease_path: %s, target root hash: %s",
            lease_path.c_str(),
            manifest->catalog_hash().ToString(false).c_str());
+  const shash::Any base_root_hash = manifest->catalog_hash();
 
   const std::string spooler_temp_dir =
       GetSpoolerTempDir(params.spooler_configuration);
@@ -176,50 +183,141 @@ CommitProcessor::Result CommitProcessor::Process(
            "CommitProcessor - lease_path: %s, merging catalogs",
            lease_path.c_str());
 
+  std::string new_manifest_path;
+  Result res_merge = Merge(params, old_root_hash, new_root_hash,
+                           relative_lease_path, temp_dir_root,
+                           server_tool->download_manager(), statistics_,
+                           manifest.weak_ref(), &new_manifest_path);
+  if (res_merge != kSuccess)
+    return res_merge;
+
+  // Add C_N root catalog hash to reflog through SigningTool,
+  // so garbage collector can later delete it.
+  std::vector<shash::Any> reflog_catalogs;
+  reflog_catalogs.push_back(new_root_hash);
+
+  // The lock file only serializes the publication among the receivers of this
+  // gateway host.  Several gateway hosts publishing the same repository would
+  // race on the manifest; they need to be serialized by the gateway itself.
+  const std::string commit_lock =
+      "/var/spool/cvmfs/" + repo_name + "/receiver_commit.lock";
+  const int fd_commit_lock = LockFile(commit_lock);
+  if (fd_commit_lock < 0) {
+    LogCvmfs(kLogReceiver, kLogSyslogErr,
+             "CommitProcessor - error: Could not lock %s",
+             commit_lock.c_str());
+    return kError;
+  }
+
+  UniquePtr<manifest::Manifest> head_manifest(server_tool->FetchRemoteManifest(
+      params.stratum0, repo_name, manifest_base_hash));
+  if (!head_manifest.IsValid()) {
+    LogCvmfs(kLogReceiver, kLogSyslogErr,
+             "CommitProcessor - error: Could not open repository manifest");
+    UnlockFile(fd_commit_lock);
+    return kError;
+  }
+  if (head_manifest->catalog_hash() != base_root_hash) {
+    LogCvmfs(kLogReceiver, kLogSyslog,
+             "CommitProcessor - lease_path: %s, root catalog changed to %s "
+             "while merging, rebasing",
+             lease_path.c_str(),
+             head_manifest->catalog_hash().ToString(false).c_str());
+    // The merged catalogs are not published anymore
+    reflog_catalogs.push_back(manifest->catalog_hash());
+    res_merge = kSuccess;
+    if (!RebaseLease(params, relative_lease_path, base_root_hash,
+                     manifest->catalog_hash(), temp_dir_root,
+                     server_tool->download_manager(), head_manifest.weak_ref()))
+    {
+      // Counters were already taken from the first merge
+      perf::Statistics statistics_remerge;
+      unlink(new_manifest_path.c_str());
+      res_merge = Merge(params, old_root_hash, new_root_hash,
+                        relative_lease_path, temp_dir_root,
+                        server_tool->download_manager(), &statistics_remerge,
+                        head_manifest.weak_ref(), &new_manifest_path);
+    } else if (!head_manifest->Export(new_manifest_path)) {
+      res_merge = kError;
+    }
+    if (res_merge != kSuccess) {
+      UnlockFile(fd_commit_lock);
+      return res_merge;
+    }
+    manifest = head_manifest.Release();
+  }
+  *final_revision = manifest->revision();
+
+  // We need to re-initialize the ServerTool component for signing
+  server_tool.Destroy();
+
+  const Result res_publish = Publish(
+      params, repo_name, final_tag, temp_dir_root, new_manifest_path,
+      reflog_catalogs, lease_path);
+  UnlockFile(fd_commit_lock);
+  return res_publish;
+}
+
+/**
+ * Applies the changes of the lease onto the root catalog of the given
+ * manifest.  The manifest is updated and exported to new_manifest_path.
+ */
+CommitProcessor::Result CommitProcessor::Merge(
+    const Params& params, const shash::Any& old_root_hash,
+    const shash::Any& new_root_hash, const PathString& relative_lease_path,
+    const std::string& temp_dir_root,
+    download::DownloadManager* download_manager, perf::Statistics* statistics,
+    manifest::Manifest* manifest, std::string* new_manifest_path) {
   CatalogMergeTool<catalog::WritableCatalogManager,
                    catalog::SimpleCatalogManager>
       merge_tool(params.stratum0, old_root_hash, new_root_hash,
-                 relative_lease_path, temp_dir_root,
-                 server_tool->download_manager(), manifest.weak_ref(),
-                 statistics_);
+                 relative_lease_path, temp_dir_root, download_manager,
+                 manifest, statistics);
   if (!merge_tool.Init()) {
     LogCvmfs(kLogReceiver, kLogSyslogErr,
              "Error: Could not initialize the catalog merge tool");
     return kError;
   }
 
-  std::string new_manifest_path;
-  if (!merge_tool.Run(params, &new_manifest_path, final_revision)) {
+  uint64_t final_revision;
+  if (!merge_tool.Run(params, new_manifest_path, &final_revision)) {
     LogCvmfs(kLogReceiver, kLogSyslogErr,
              "CommitProcessor - error: Catalog merge failed");
     return kMergeFailure;
   }
 
+  return kSuccess;
+}
+
+/**
+ * Creates the tag, signs the new manifest, and stores the publish statistics.
+ * The caller holds the commit lock.
+ */
+CommitProcessor::Result CommitProcessor::Publish(
+    const Params& params, const std::string& repo_name,
+    const RepositoryTag& tag, const std::string& temp_dir_root,
+    const std::string& new_manifest_path,
+    const std::vector<shash::Any>& reflog_catalogs,
+    const std::string& lease_path) {
   UniquePtr<RaiiTempDir> raii_temp_dir(RaiiTempDir::Create(temp_dir_root));
   const std::string temp_dir = raii_temp_dir->dir();
+  const std::string public_key = "/etc/cvmfs/keys/" + repo_name + ".pub";
   const std::string certificate = "/etc/cvmfs/keys/" + repo_name + ".crt";
   const std::string private_key = "/etc/cvmfs/keys/" + repo_name + ".key";
 
-  if (!CreateNewTag(final_tag, repo_name, params, temp_dir, new_manifest_path,
+  if (!CreateNewTag(tag, repo_name, params, temp_dir, new_manifest_path,
                     public_key, params.proxy)) {
     LogCvmfs(kLogReceiver, kLogSyslogErr, "Error creating tag: %s",
-             final_tag.name().c_str());
+             tag.name().c_str());
     return kError;
   }
 
-  // We need to re-initialize the ServerTool component for signing
-  server_tool.Destroy();
-  server_tool = new ServerTool();
+  UniquePtr<ServerTool> server_tool(new ServerTool());
 
   LogCvmfs(kLogReceiver, kLogSyslog,
            "CommitProcessor - lease_path: %s, signing manifest",
            lease_path.c_str());
 
-  // Add C_N root catalog hash to reflog through SigningTool,
-  // so garbage collector can later delete it.
-  std::vector<shash::Any> reflog_catalogs;
-  reflog_catalogs.push_back(new_root_hash);
-
   SigningTool signing_tool(server_tool.weak_ref());
   SigningTool::Result res = signing_tool.Run(
       new_manifest_path, params.stratum0, params.spooler_configuration,
@@ -6,9 +6,12 @@
 #define CVMFS_RECEIVER_COMMIT_PROCESSOR_H_
 
 #include <string>
+#include <vector>
 
+#include "params.h"
 #include "repository_tag.h"
 #include "server_tool.h"
+#include "shortstring.h"
 #include "util/pointer.h"
 
 namespace receiver {
@@ -22,6 +25,9 @@ namespace receiver {
  * Its responsibility is updating the repository (sub-)catalogs with the changes
  * introduced during the lease. After all the catalogs have been updated, the
  * repository manifest is also updated and resigned.
+ *
+ * Several commit processors (in different receiver processes) can work on the
+ * same repository at the same time, as long as their lease paths don't overlap.
  */
 class CommitProcessor {
  public:
@@ -39,6 +45,19 @@ class CommitProcessor {
   void SetStatistics(perf::Statistics *st, const std::string &start_time);
 
  private:
+  Result Merge(const Params& params, const shash::Any& old_root_hash,
+               const shash::Any& new_root_hash,
+               const PathString& relative_lease_path,
+               const std::string& temp_dir_root,
+               download::DownloadManager* download_manager,
+               perf::Statistics* statistics, manifest::Manifest* manifest,
+               std::string* new_manifest_path);
+  Result Publish(const Params& params, const std::string& repo_name,
+                 const RepositoryTag& tag, const std::string& temp_dir_root,
+                 const std::string& new_manifest_path,
+                 const std::vector<shash::Any>& reflog_catalogs,
+                 const std::string& lease_path);
+
   int num_errors_;
   perf::Statistics *statistics_;
   std::string start_time_;
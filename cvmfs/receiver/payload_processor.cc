@@ -6,12 +6,17 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 #include "logging.h"
 #include "params.h"
+#include "platform.h"
 #include "util/posix.h"
 #include "util/string.h"
+#include "util_concurrency.h"
 
 namespace {
 
@@ -61,13 +66,96 @@ FileInfo& FileInfo::operator=(const FileInfo& other) {
   return *this;
 }
 
+PayloadBlock::PayloadBlock(const ObjectPackBuild::Event &event,
+                           unsigned char *data)
+  : event_(event),
+    data_(data),
+    tag_(0),
+    is_quit_beacon_(false)
+{
+  // The consumer's buffer is reused for the next pieces of the payload
+  event_.buf = NULL;
+  memcpy(&tag_, event.id.digest, sizeof(tag_));
+}
+
+PayloadBlock::PayloadBlock()
+  : event_(shash::Any(), 0, 0, NULL, ObjectPack::kEmpty, ""),
+    data_(NULL),
+    tag_(0),
+    is_quit_beacon_(true)
+{}
+
+void TaskStorePayload::Process(PayloadBlock *block) {
+  const ObjectPackBuild::Event &event = block->event();
+  upload::AbstractUploader *uploader = processor_->uploader_.weak_ref();
+
+  FileIterator it = pending_files_.find(event.id);
+  if (it == pending_files_.end()) {
+    // Schedule file upload if it's not being uploaded yet.
+    // Uploaders later check if the file is already present
+    // in the upstream storage and will not upload it twice.
+    FileInfo info(event);
+    // info.handle is later deleted by FinalizeStreamedUpload
+    info.handle = uploader->InitStreamedUpload(NULL);
+    it = pending_files_.insert(std::make_pair(event.id, info)).first;
+  }
+
+  FileInfo &info = it->second;
+
+  shash::Update(block->data(), event.buf_size, info.hash_context);
+  info.current_size += event.buf_size;
+
+  upload::AbstractUploader::UploadBuffer buf(event.buf_size, block->data());
+  uploader->ScheduleUpload(info.handle, buf,
+    upload::AbstractUploader::MakeClosure(
+      &PayloadProcessor::OnUploadJobComplete, processor_,
+      static_cast<void *>(block->data())));
+
+  if (info.current_size == info.total_size) {
+    shash::Any file_hash(event.id.algorithm);
+    shash::Final(info.hash_context, &file_hash);
+
+    if (file_hash != event.id) {
+      LogCvmfs(
+          kLogReceiver, kLogSyslogErr,
+          "PayloadProcessor - error: Hash mismatch for unpacked file: event "
+          "size: %ld, file size: %ld, event hash: %s, file hash: %s",
+          event.size, info.current_size,
+          event.id.ToString(true).c_str(), file_hash.ToString(true).c_str());
+      atomic_inc32(&processor_->num_errors_);
+      pending_files_.erase(it);
+      delete block;
+      return;
+    }
+    // override final remote path if not CAS object
+    if (event.object_type == ObjectPack::kNamed) {
+      info.handle->remote_path = event.object_name;
+    }
+    uploader->ScheduleCommit(info.handle, event.id);
+
+    pending_files_.erase(it);
+  }
+
+  delete block;
+}
+
+void TaskStorePayload::OnTerminate() {
+  assert(pending_files_.empty());
+}
+
 PayloadProcessor::PayloadProcessor()
-    : pending_files_(),
+    : uploader_(),
       current_repo_(),
-      uploader_(),
       temp_dir_(),
-      num_errors_(0),
-      statistics_(NULL) {}
+      statistics_(NULL),
+      num_workers_(GetNumberOfCpuCores()),
+      sz_payload_bytes_(NULL),
+      time_payload_ns_(NULL)
+{
+  atomic_init32(&num_errors_);
+  if (num_workers_ > kMaxNumWorkers)
+    num_workers_ = kMaxNumWorkers;
+}
 
 PayloadProcessor::~PayloadProcessor() {}
 
@@ -94,11 +182,16 @@ PayloadProcessor::Result PayloadProcessor::Process(
   ObjectPackConsumer deserializer(digest, header_size);
   deserializer.RegisterListener(&PayloadProcessor::ConsumerEventCallback, this);
 
+  StartWorkers();
+
+  const uint64_t start_time = platform_monotonic_time_ns();
   int nb = 0;
   ObjectPackBuild::State consumer_state = ObjectPackBuild::kStateContinue;
   std::vector<unsigned char> buffer(kConsumerBuffer, 0);
   do {
     nb = read(fdin, &buffer[0], buffer.size());
+    if ((nb > 0) && (sz_payload_bytes_ != NULL))
+      sz_payload_bytes_->Xadd(nb);
     consumer_state = deserializer.ConsumeNext(nb, &buffer[0]);
     if (consumer_state != ObjectPackBuild::kStateContinue &&
         consumer_state != ObjectPackBuild::kStateDone) {
@@ -110,90 +203,81 @@ PayloadProcessor::Result PayloadProcessor::Process(
     }
   } while (nb > 0 && consumer_state != ObjectPackBuild::kStateDone);
 
-  assert(pending_files_.empty());
+  StopWorkers();
 
   Result res = Finalize();
+  if (time_payload_ns_ != NULL)
+    time_payload_ns_->Xadd(platform_monotonic_time_ns() - start_time);
 
   deserializer.UnregisterListeners();
 
   return res;
 }
 
+/**
+ * Copies the piece of the object and hands it over to the workers.  Runs in the
+ * thread that reads the payload.
+ */
 void PayloadProcessor::ConsumerEventCallback(
     const ObjectPackBuild::Event& event) {
-  std::string path("");
-
-  if (event.object_type == ObjectPack::kCas) {
-    path = event.id.MakePath();
-  } else if (event.object_type == ObjectPack::kNamed) {
-    path = event.object_name;
-  } else {
+  if ((event.object_type != ObjectPack::kCas) &&
+      (event.object_type != ObjectPack::kNamed))
+  {
     // kEmpty - this is an error.
     LogCvmfs(kLogReceiver, kLogSyslogErr,
              "PayloadProcessor - error: Event received with unknown object.");
-    num_errors_++;
+    atomic_inc32(&num_errors_);
     return;
   }
 
-  FileIterator it = pending_files_.find(event.id);
-  if (it == pending_files_.end()) {
-    // Schedule file upload if it's not being uploaded yet.
-    // Uploaders later check if the file is already present
-    // in the upstream storage and will not upload it twice.
-    FileInfo info(event);
-    // info.handle is later deleted by FinalizeStreamedUpload
-    info.handle = uploader_->InitStreamedUpload(NULL);
-    pending_files_[event.id] = info;
-  }
-
-  FileInfo& info = pending_files_[event.id];
-
-  void *buf_copied = smalloc(event.buf_size);
-  memcpy(buf_copied, event.buf, event.buf_size);
-  upload::AbstractUploader::UploadBuffer buf(event.buf_size, buf_copied);
-  uploader_->ScheduleUpload(info.handle, buf,
-    upload::AbstractUploader::MakeClosure(
-      &PayloadProcessor::OnUploadJobComplete, this, buf_copied));
-
-  shash::Update(static_cast<const unsigned char*>(event.buf),
-                event.buf_size,
-                info.hash_context);
-
-  info.current_size += event.buf_size;
-
-  if (info.current_size == info.total_size) {
-    shash::Any file_hash(event.id.algorithm);
-    shash::Final(info.hash_context, &file_hash);
-
-    if (file_hash != event.id) {
-      LogCvmfs(
-          kLogReceiver, kLogSyslogErr,
-          "PayloadProcessor - error: Hash mismatch for unpacked file: event "
-          "size: %ld, file size: %ld, event hash: %s, file hash: %s",
-          event.size, info.current_size,
-          event.id.ToString(true).c_str(), file_hash.ToString(true).c_str());
-      num_errors_++;
-      return;
-    }
-    // override final remote path if not CAS object
-    if (event.object_type == ObjectPack::kNamed) {
-      info.handle->remote_path = path;
-    }
-    uploader_->ScheduleCommit(info.handle, event.id);
-
-    pending_files_.erase(event.id);
-  }
+  allocator_.WaitForMemory(kMemLowWatermark, kMemHighWatermark);
+  // Empty objects are uploaded, too, so we need a valid buffer
+  unsigned char *data = static_cast<unsigned char *>(
+    allocator_.Malloc(std::max(event.buf_size, 1U)));
+  memcpy(data, event.buf, event.buf_size);
+  tubes_store_->Dispatch(new PayloadBlock(event, data));
 }
 
 void PayloadProcessor::OnUploadJobComplete(
   const upload::UploaderResults &results,
   void *buffer)
 {
-  free(buffer);
+  allocator_.Free(buffer);
 }
 
 void PayloadProcessor::SetStatistics(perf::Statistics *st) {
   statistics_ = new perf::StatisticsTemplate("publish", st);
+
+  perf::StatisticsTemplate stats_payload("payload", *statistics_);
+  counters_store_ = new StageCounters(stats_payload);
+  sz_payload_bytes_ = stats_payload.RegisterTemplated("sz_payload_bytes",
+      "Number of bytes read from the payload");
+  time_payload_ns_ = stats_payload.RegisterTemplated("time_payload_ns",
+      "Time spent receiving and storing the payload");
+}
+
+void PayloadProcessor::StartWorkers() {
+  tubes_store_ = new TubeGroup<PayloadBlock>();
+  tasks_store_ = new TubeConsumerGroup<PayloadBlock>();
+  for (unsigned i = 0; i < num_workers_; ++i) {
+    Tube<PayloadBlock> *tube = new Tube<PayloadBlock>();
+    tubes_store_->TakeTube(tube);
+    TaskStorePayload *task = new TaskStorePayload(tube, this);
+    if (counters_store_.IsValid())
+      task->SetCounters(counters_store_.weak_ref());
+    tasks_store_->TakeConsumer(task);
+  }
+  tubes_store_->Activate();
+  tasks_store_->Spawn();
+}
+
+/**
+ * Returns once all the dispatched blocks are scheduled for upload
+ */
+void PayloadProcessor::StopWorkers() {
+  tasks_store_->Terminate();
+  tasks_store_.Destroy();
+  tubes_store_.Destroy();
 }
 
 PayloadProcessor::Result PayloadProcessor::Initialize() {
@@ -217,6 +301,9 @@ PayloadProcessor::Result PayloadProcessor::Initialize() {
       params.generate_legacy_bulk_chunks, params.use_file_chunking,
       params.min_chunk_size, params.avg_chunk_size, params.max_chunk_size,
       "dummy_token", "dummy_key");
+  // Objects are streamed to the backend by as many threads as there are
+  // verify-and-store workers
+  definition.num_upload_tasks = num_workers_;
 
   uploader_.Destroy();
 
@@ -10,12 +10,19 @@
 #include <string>
 #include <vector>
 
+#include "atomic.h"
+#include "ingestion/item_mem.h"
+#include "ingestion/task.h"
+#include "ingestion/tube.h"
 #include "pack.h"
 #include "upload.h"
 #include "util/raii_temp_dir.h"
+#include "util/single_copy.h"
 
 namespace receiver {
 
+class PayloadProcessor;
+
 struct FileInfo {
   FileInfo();
   explicit FileInfo(const ObjectPackBuild::Event& event);
@@ -29,6 +36,57 @@ struct FileInfo {
   std::vector<unsigned char> hash_buffer;
 };
 
+/**
+ * A piece of an object from the object pack.  All the pieces of an object carry
+ * the same tag, so that they are verified and stored in order by the same
+ * worker.  The data buffer is released once it is written to the backend.
+ */
+class PayloadBlock : SingleCopy {
+ public:
+  PayloadBlock(const ObjectPackBuild::Event &event, unsigned char *data);
+
+  static PayloadBlock *CreateQuitBeacon() { return new PayloadBlock(); }
+  bool IsQuitBeacon() { return is_quit_beacon_; }
+
+  const ObjectPackBuild::Event &event() const { return event_; }
+  unsigned char *data() { return data_; }
+  uint32_t tag() const { return tag_; }
+
+  friend uint64_t GetItemSize(PayloadBlock *block) {
+    return block->event_.buf_size;
+  }
+
+ private:
+  PayloadBlock();
+
+  ObjectPackBuild::Event event_;
+  unsigned char *data_;
+  uint32_t tag_;
+  bool is_quit_beacon_;
+};
+
+/**
+ * Verifies the content hashes of the objects and streams them into the
+ * backend storage.  Objects that are still being received are tracked per
+ * worker.
+ */
+class TaskStorePayload : public TubeConsumer<PayloadBlock> {
+ public:
+  TaskStorePayload(Tube<PayloadBlock> *tube, PayloadProcessor *processor)
+    : TubeConsumer<PayloadBlock>(tube)
+    , processor_(processor)
+  { }
+
+ protected:
+  virtual void Process(PayloadBlock *block);
+  virtual void OnTerminate();
+
+ private:
+  typedef std::map<shash::Any, FileInfo>::iterator FileIterator;
+  PayloadProcessor *processor_;
+  std::map<shash::Any, FileInfo> pending_files_;
+};
+
 /**
  * This class is used in the `cvmfs_receiver` tool, on repository gateway
  * machines. The receiver::Reactor class, implementing the event loop of the
@@ -37,8 +95,13 @@ struct FileInfo {
  *
  * Its responsibility is reading the payload - containing a serialized
  * ObjectPack - from a file descriptor, and unpacking it into the repository.
+ * The objects are handed over to a pool of TaskStorePayload workers, so that
+ * hash verification and backend writes overlap with reading the payload.  The
+ * memory of the object buffers in flight is bounded.
  */
 class PayloadProcessor {
+  friend class TaskStorePayload;
+
  public:
   enum Result { kSuccess, kPathViolation, kUploaderError, kOtherError };
 
@@ -53,7 +116,7 @@ class PayloadProcessor {
   virtual void OnUploadJobComplete(const upload::UploaderResults &results,
                                    void *buffer);
 
-  int GetNumErrors() const { return num_errors_; }
+  int GetNumErrors() { return atomic_read32(&num_errors_); }
 
   void SetStatistics(perf::Statistics *st);
 
@@ -63,14 +126,31 @@ class PayloadProcessor {
   virtual Result Initialize();
   virtual Result Finalize();
 
+  UniquePtr<upload::AbstractUploader> uploader_;
+
  private:
-  typedef std::map<shash::Any, FileInfo>::iterator FileIterator;
-  std::map<shash::Any, FileInfo> pending_files_;
+  /**
+   * Reading the payload pauses while the object buffers in flight take more
+   * than the high watermark, until they are down to the low watermark.
+   */
+  static const uint64_t kMemHighWatermark = 256 * 1024 * 1024;
+  static const uint64_t kMemLowWatermark = 192 * 1024 * 1024;
+  static const unsigned kMaxNumWorkers = 8;
+
+  void StartWorkers();
+  void StopWorkers();
+
   std::string current_repo_;
-  UniquePtr<upload::AbstractUploader> uploader_;
   UniquePtr<RaiiTempDir> temp_dir_;
-  int num_errors_;
+  atomic_int32 num_errors_;
   UniquePtr<perf::StatisticsTemplate> statistics_;
+  unsigned num_workers_;
+  ItemAllocator allocator_;
+  UniquePtr<TubeGroup<PayloadBlock> > tubes_store_;
+  UniquePtr<TubeConsumerGroup<PayloadBlock> > tasks_store_;
+  UniquePtr<StageCounters> counters_store_;
+  perf::Counter *sz_payload_bytes_;
+  perf::Counter *time_payload_ns_;
 };
 
 }  // namespace receiver
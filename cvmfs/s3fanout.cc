@@ -32,6 +32,10 @@ const unsigned S3FanoutManager::kMax429ThrottleMs = 10000;
 const unsigned S3FanoutManager::kThrottleReportIntervalSec = 10;
 const unsigned S3FanoutManager::kDefaultHTTPPort = 80;
 const unsigned S3FanoutManager::kDefaultHTTPSPort = 443;
+const uint64_t S3FanoutManager::kLargeObjectThreshold = 1024 * 1024;
+const double S3FanoutManager::kLatencyEwmaWeight = 0.125;
+const double S3FanoutManager::kMinLatencyBaseline = 0.05;
+const double S3FanoutManager::kCongestionLatencyFactor = 3.0;
 
 
 /**
@@ -59,6 +63,146 @@ void S3FanoutManager::DetectThrottleIndicator(
 }
 
 
+/**
+ * Extracts the UploadId from the XML reply of an InitiateMultipartUpload
+ * request.  Returns the empty string if the reply does not contain one.
+ */
+std::string S3FanoutManager::ParseUploadId(const std::string &response) {
+  const std::string tag_open = "<UploadId>";
+  const std::string tag_close = "</UploadId>";
+  const std::string::size_type pos_open = response.find(tag_open);
+  if (pos_open == std::string::npos)
+    return "";
+  const std::string::size_type pos_value = pos_open + tag_open.length();
+  const std::string::size_type pos_close = response.find(tag_close, pos_value);
+  if (pos_close == std::string::npos)
+    return "";
+  return response.substr(pos_value, pos_close - pos_value);
+}
+
+
+/**
+ * The ETag of a part copy comes in the XML body instead of the header.  Quotes
+ * may be sent as XML entities.
+ */
+std::string S3FanoutManager::ParseCopyPartEtag(const std::string &response) {
+  if (response.find("<CopyPartResult") == std::string::npos)
+    return "";
+  const std::string tag_open = "<ETag>";
+  const std::string tag_close = "</ETag>";
+  const std::string::size_type pos_open = response.find(tag_open);
+  if (pos_open == std::string::npos)
+    return "";
+  const std::string::size_type pos_value = pos_open + tag_open.length();
+  const std::string::size_type pos_close = response.find(tag_close, pos_value);
+  if (pos_close == std::string::npos)
+    return "";
+  return ReplaceAll(response.substr(pos_value, pos_close - pos_value),
+                    "&quot;", "\"");
+}
+
+
+/**
+ * Finds the next <tag>value</tag> element in xml from *pos on.  On success,
+ * sets value and moves *pos behind the element.
+ */
+static bool GetXmlElement(
+  const std::string &xml,
+  const std::string &tag,
+  std::string::size_type *pos,
+  std::string *value)
+{
+  const std::string tag_open = "<" + tag + ">";
+  const std::string tag_close = "</" + tag + ">";
+  const std::string::size_type pos_open = xml.find(tag_open, *pos);
+  if (pos_open == std::string::npos)
+    return false;
+  const std::string::size_type pos_value = pos_open + tag_open.length();
+  const std::string::size_type pos_close = xml.find(tag_close, pos_value);
+  if (pos_close == std::string::npos)
+    return false;
+  *value = xml.substr(pos_value, pos_close - pos_value);
+  *pos = pos_close + tag_close.length();
+  return true;
+}
+
+
+/**
+ * Extracts the objects from the XML reply of a ListObjectsV2 request.  If the
+ * listing is truncated, next_token is set to the continuation token, otherwise
+ * it is empty.  Returns false on malformed replies.
+ */
+bool S3FanoutManager::ParseListing(
+  const std::string &response,
+  std::vector<ListEntry> *entries,
+  std::string *next_token)
+{
+  entries->clear();
+  next_token->clear();
+  if (response.find("<ListBucketResult") == std::string::npos)
+    return false;
+
+  std::string::size_type pos = 0;
+  std::string contents;
+  while (GetXmlElement(response, "Contents", &pos, &contents)) {
+    ListEntry entry;
+    std::string value;
+    std::string::size_type pos_contents = 0;
+    if (!GetXmlElement(contents, "Key", &pos_contents, &entry.key))
+      return false;
+    pos_contents = 0;
+    if (GetXmlElement(contents, "Size", &pos_contents, &value))
+      entry.size = String2Uint64(value);
+    // Of the form 2009-10-12T17:50:30.000Z, the fraction of seconds is dropped
+    pos_contents = 0;
+    if (!GetXmlElement(contents, "LastModified", &pos_contents, &value) ||
+        (value.length() < 19))
+    {
+      return false;
+    }
+    entry.mtime = IsoTimestamp2UtcTime(value.substr(0, 19) + "Z");
+    if (entry.mtime == 0)
+      return false;
+    entries->push_back(entry);
+  }
+
+  pos = 0;
+  std::string is_truncated;
+  if (GetXmlElement(response, "IsTruncated", &pos, &is_truncated) &&
+      (is_truncated == "true"))
+  {
+    pos = 0;
+    if (!GetXmlElement(response, "NextContinuationToken", &pos, next_token) ||
+        next_token->empty())
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/**
+ * Requests that send a body which needs to be covered by the payload hash of
+ * the authorization header.
+ */
+bool S3FanoutManager::HasPayload(JobInfo::RequestType request) {
+  switch (request) {
+    case JobInfo::kReqHeadOnly:
+    case JobInfo::kReqHeadPut:
+    case JobInfo::kReqDelete:
+    case JobInfo::kReqMultipartInit:
+    case JobInfo::kReqMultipartAbort:
+    case JobInfo::kReqCopy:
+    case JobInfo::kReqMultipartPartCopy:
+    case JobInfo::kReqList:
+      return false;
+    default:
+      return true;
+  }
+}
+
+
 /**
  * Called by curl for every HTTP header. Not called for file:// transfers.
  */
@@ -120,6 +264,12 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
     S3FanoutManager::DetectThrottleIndicator(header_line, info);
   }
 
+  if ((info->request == JobInfo::kReqMultipartPart) &&
+      HasPrefix(header_line, "etag:", true /* ignore_case */))
+  {
+    info->etag = Trim(header_line.substr(5), true /* trim_newline */);
+  }
+
   return num_bytes;
 }
 
@@ -147,12 +297,26 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
 
 
 /**
- * For the time being, ignore all received information in the HTTP body
+ * The HTTP body is only of interest for multipart, copy, and bulk delete
+ * requests, whose XML replies carry the upload id or an error that comes with
+ * HTTP 200, and for listings.
  */
 static size_t CallbackCurlBody(
-  char * /*ptr*/, size_t size, size_t nmemb, void * /*userdata*/)
+  char *ptr, size_t size, size_t nmemb, void *info_link)
 {
-  return size * nmemb;
+  const size_t num_bytes = size * nmemb;
+  JobInfo *info = static_cast<JobInfo *>(info_link);
+  if ((info != NULL) &&
+      ((info->request == JobInfo::kReqMultipartInit) ||
+       (info->request == JobInfo::kReqMultipartComplete) ||
+       (info->request == JobInfo::kReqCopy) ||
+       (info->request == JobInfo::kReqMultipartPartCopy) ||
+       (info->request == JobInfo::kReqList) ||
+       (info->request == JobInfo::kReqDeleteMulti)))
+  {
+    info->response.append(ptr, num_bytes);
+  }
+  return num_bytes;
 }
 
 
@@ -235,11 +399,6 @@ void *S3FanoutManager::MainUpload(void *data) {
 
   s3fanout_mgr->InitPipeWatchFds();
 
-  // Don't schedule more jobs into the multi handle than the maximum number of
-  // parallel connections.  This should prevent starvation and thus a timeout
-  // of the authorization header (CVM-1339).
-  unsigned jobs_in_flight = 0;
-
   while (true) {
     // Check events with 100ms timeout
     int timeout_ms = 100;
@@ -270,31 +429,8 @@ void *S3FanoutManager::MainUpload(void *data) {
       s3fanout_mgr->watch_fds_[1].revents = 0;
       JobInfo *info;
       ReadPipe(s3fanout_mgr->pipe_jobs_[0], &info, sizeof(info));
-      CURL *handle = s3fanout_mgr->AcquireCurlHandle();
-      if (handle == NULL) {
-        PANIC(kLogStderr, "Failed to acquire CURL handle.");
-      }
-      s3fanout::Failures init_failure =
-        s3fanout_mgr->InitializeRequest(info, handle);
-      if (init_failure != s3fanout::kFailOk) {
-        PANIC(kLogStderr,
-              "Failed to initialize CURL handle (error: %d - %s | errno: %d)",
-              init_failure, Code2Ascii(init_failure), errno);
-      }
-      s3fanout_mgr->SetUrlOptions(info);
-
-      curl_multi_add_handle(s3fanout_mgr->curl_multi_, handle);
-      s3fanout_mgr->active_requests_->insert(info);
-      jobs_in_flight++;
-      int still_running = 0, retval = 0;
-      retval = curl_multi_socket_action(s3fanout_mgr->curl_multi_,
-                                        CURL_SOCKET_TIMEOUT,
-                                        0,
-                                        &still_running);
-
-      LogCvmfs(kLogS3Fanout, kLogDebug,
-               "curl_multi_socket_action: %d - %d",
-               retval, still_running);
+      s3fanout_mgr->EnqueueJob(info);
+      s3fanout_mgr->ScheduleJobs();
     }
 
 
@@ -351,8 +487,7 @@ void *S3FanoutManager::MainUpload(void *data) {
                                  &still_running);
       } else {
         // Return easy handle into pool and write result back
-        jobs_in_flight--;
-        s3fanout_mgr->active_requests_->erase(info);
+        s3fanout_mgr->FinishJob(info);
         s3fanout_mgr->ReleaseCurlHandle(info, easy_handle);
         s3fanout_mgr->available_jobs_->Decrement();
 
@@ -360,6 +495,9 @@ void *S3FanoutManager::MainUpload(void *data) {
         s3fanout_mgr->PushCompletedJob(info);
       }
     }
+
+    // Freed slots or a raised concurrency limit admit waiting jobs
+    s3fanout_mgr->ScheduleJobs();
   }
 
   set<CURL *>::iterator i = s3fanout_mgr->pool_handles_inuse_->begin();
@@ -377,6 +515,189 @@ void *S3FanoutManager::MainUpload(void *data) {
 }
 
 
+/**
+ * Objects with a body of at least kLargeObjectThreshold bytes use the large
+ * object lane, everything else (including HEAD requests) the small one.
+ */
+UploadLane S3FanoutManager::ClassifyJob(const JobInfo &info) {
+  if (HasPayload(info.request) && info.origin.IsValid() &&
+      (info.origin->GetSize() >= kLargeObjectThreshold))
+  {
+    return kLaneLarge;
+  }
+  return kLaneSmall;
+}
+
+
+void S3FanoutManager::EnqueueJob(JobInfo *info) {
+  info->lane = ClassifyJob(*info);
+  lanes_[info->lane].pending.push_back(info);
+}
+
+
+/**
+ * Moves waiting jobs into the curl multi handle as long as the adaptive
+ * concurrency limit allows.  Small objects take precedence.  Large objects
+ * may use all but a reserve of the slots, which is kept for small objects
+ * that arrive later.  At least one large object is always admitted so that
+ * the large lane cannot starve.
+ *
+ * Don't schedule more jobs into the multi handle than the number of parallel
+ * connections.  This should prevent starvation and thus a timeout of the
+ * authorization header (CVM-1339).
+ */
+void S3FanoutManager::ScheduleJobs() {
+  LaneState *small = &lanes_[kLaneSmall];
+  LaneState *large = &lanes_[kLaneLarge];
+  while (num_active_ < concurrency_limit_) {
+    const unsigned reserve_small = std::max(1U, concurrency_limit_ / 4);
+    const unsigned max_large =
+      std::max(1U, concurrency_limit_ - std::min(concurrency_limit_,
+                                                 reserve_small));
+    JobInfo *info = NULL;
+    if (!large->pending.empty() &&
+        ((large->num_active == 0) ||
+         (small->pending.empty() && (large->num_active < max_large))))
+    {
+      info = large->pending.front();
+      large->pending.pop_front();
+    } else if (!small->pending.empty()) {
+      info = small->pending.front();
+      small->pending.pop_front();
+    } else {
+      break;
+    }
+    StartJob(info);
+  }
+}
+
+
+void S3FanoutManager::StartJob(JobInfo *info) {
+  CURL *handle = AcquireCurlHandle();
+  if (handle == NULL) {
+    PANIC(kLogStderr, "Failed to acquire CURL handle.");
+  }
+  s3fanout::Failures init_failure = InitializeRequest(info, handle);
+  if (init_failure != s3fanout::kFailOk) {
+    PANIC(kLogStderr,
+          "Failed to initialize CURL handle (error: %d - %s | errno: %d)",
+          init_failure, Code2Ascii(init_failure), errno);
+  }
+  SetUrlOptions(info);
+
+  LaneState *lane = &lanes_[info->lane];
+  if (lane->num_active == 0)
+    lane->busy_since_ns = platform_monotonic_time_ns();
+  lane->num_active++;
+  num_active_++;
+
+  curl_multi_add_handle(curl_multi_, handle);
+  active_requests_->insert(info);
+  int still_running = 0, retval = 0;
+  retval = curl_multi_socket_action(curl_multi_,
+                                    CURL_SOCKET_TIMEOUT,
+                                    0,
+                                    &still_running);
+
+  LogCvmfs(kLogS3Fanout, kLogDebug,
+           "curl_multi_socket_action: %d - %d",
+           retval, still_running);
+}
+
+
+void S3FanoutManager::FinishJob(JobInfo *info) {
+  active_requests_->erase(info);
+  LaneState *lane = &lanes_[info->lane];
+  assert(lane->num_active > 0);
+  lane->num_active--;
+  num_active_--;
+  if (lane->num_active == 0) {
+    statistics_->lanes[info->lane].busy_time +=
+      static_cast<double>(platform_monotonic_time_ns() - lane->busy_since_ns) /
+      (1000.0 * 1000.0 * 1000.0);
+  }
+}
+
+
+/**
+ * Feeds the result of a finished request into the concurrency control.  Only
+ * successful small requests provide a latency sample.
+ */
+void S3FanoutManager::UpdateConcurrency(const JobInfo &info) {
+  const bool throttled = (info.http_error == 429) || (info.http_error == 503);
+  double latency = -1.0;
+  if (!throttled && (info.lane == kLaneSmall) &&
+      ((info.error_code == kFailOk) || (info.error_code == kFailNotFound)))
+  {
+    if (curl_easy_getinfo(info.curl_handle, CURLINFO_TOTAL_TIME, &latency) !=
+        CURLE_OK)
+    {
+      latency = -1.0;
+    }
+  }
+  AdjustConcurrency(throttled, latency);
+}
+
+
+/**
+ * Adjusts the concurrency limit.  HTTP 429 and 503 replies are explicit
+ * congestion signals.  In addition, the latency of small requests is compared
+ * to the smallest latency seen so far, which is taken as the latency of an idle
+ * backend.  A latency-based decrease does not go below a quarter of
+ * pool_max_handles because slow replies can also stem from a slow network
+ * rather than from an overloaded backend.
+ *
+ * The limit is changed once per window of concurrency_limit_ requests so that
+ * the replies of a single burst are not counted multiple times.  A throttle
+ * reply anywhere in the window is remembered until the window closes, so that
+ * the window then shrinks instead of growing.  A negative latency means that
+ * the request provided no sample.
+ */
+void S3FanoutManager::AdjustConcurrency(bool throttled, double latency) {
+  const unsigned max_limit = std::max(1U, config_.pool_max_handles);
+  if (throttled)
+    throttled_in_window_ = true;
+  if (latency >= 0.0) {
+    if ((latency_min_ == 0.0) || (latency < latency_min_))
+      latency_min_ = latency;
+    if (latency_ewma_ == 0.0) {
+      latency_ewma_ = latency;
+    } else {
+      latency_ewma_ = kLatencyEwmaWeight * latency +
+                      (1.0 - kLatencyEwmaWeight) * latency_ewma_;
+    }
+  }
+
+  num_completions_since_change_++;
+  if (num_completions_since_change_ < concurrency_limit_)
+    return;
+
+  const bool slow = (latency_ewma_ > 0.0) &&
+                    (latency_ewma_ > kCongestionLatencyFactor *
+                                     std::max(latency_min_,
+                                              kMinLatencyBaseline));
+  const bool congested = throttled_in_window_ || slow;
+  const unsigned min_limit =
+    throttled_in_window_ ? 1 : std::max(1U, max_limit / 4);
+  num_completions_since_change_ = 0;
+  throttled_in_window_ = false;
+
+  if (congested) {
+    if (concurrency_limit_ <= min_limit)
+      return;
+    concurrency_limit_ = std::max(min_limit, concurrency_limit_ / 2);
+    statistics_->num_congestion_events++;
+    statistics_->min_concurrency_limit =
+      std::min(statistics_->min_concurrency_limit, concurrency_limit_);
+    LogCvmfs(kLogS3Fanout, kLogDebug, "%s, reducing concurrency to %u",
+             (min_limit == 1) ? "backend throttles" : "latency increases",
+             concurrency_limit_);
+  } else if (concurrency_limit_ < max_limit) {
+    concurrency_limit_++;
+  }
+}
+
+
 /**
  * Gets an idle CURL handle from the pool. Creates a new one and adds it to
  * the pool if necessary.
@@ -467,12 +788,25 @@ bool S3FanoutManager::MkV2Authz(const JobInfo &info, vector<string> *headers)
   string request = GetRequestString(info);
 
   string timestamp = RfcTimestamp();
+  string copy_source;
+  if ((info.request == JobInfo::kReqCopy) ||
+      (info.request == JobInfo::kReqMultipartPartCopy))
+  {
+    copy_source = "/" + config_.bucket + "/" + info.copy_source;
+  }
   string to_sign = request + "\n" +
                    payload_hash + "\n" +
                    content_type + "\n" +
                    timestamp + "\n" +
                    "x-amz-acl:public-read" + "\n" +  // default ACL
-                   "/" + config_.bucket + "/" + info.object_key;
+                   (copy_source.empty() ? "" :
+                     ("x-amz-copy-source:" + copy_source + "\n")) +
+                   (info.copy_range.empty() ? "" :
+                     ("x-amz-copy-source-range:" + info.copy_range + "\n")) +
+                   "/" + config_.bucket + "/" + info.object_key +
+                   // The listing parameters are not part of the resource
+                   ((info.request == JobInfo::kReqList) ?
+                     "" : MkQueryString(info, false));
   LogCvmfs(kLogS3Fanout, kLogDebug, "%s string to sign for: %s",
            request.c_str(), info.object_key.c_str());
 
@@ -487,6 +821,10 @@ bool S3FanoutManager::MkV2Authz(const JobInfo &info, vector<string> *headers)
                                    hmac.GetDigestSize())));
   headers->push_back("Date: " + timestamp);
   headers->push_back("X-Amz-Acl: public-read");
+  if (!copy_source.empty())
+    headers->push_back("X-Amz-Copy-Source: " + copy_source);
+  if (!info.copy_range.empty())
+    headers->push_back("X-Amz-Copy-Source-Range: " + info.copy_range);
   if (!payload_hash.empty())
     headers->push_back("Content-MD5: " + payload_hash);
   if (!content_type.empty())
@@ -572,12 +910,28 @@ bool S3FanoutManager::MkV4Authz(const JobInfo &info, vector<string> *headers)
     headers->push_back("Content-Type: " + content_type);
     canonical_headers += "content-type:" + content_type + "\n";
   }
-  signed_headers += "host;x-amz-acl;x-amz-content-sha256;x-amz-date";
+  string copy_source;
+  if ((info.request == JobInfo::kReqCopy) ||
+      (info.request == JobInfo::kReqMultipartPartCopy))
+  {
+    copy_source = GetUriEncode(
+      "/" + config_.bucket + "/" + info.copy_source, false);
+  }
+  signed_headers += "host;x-amz-acl;x-amz-content-sha256;";
+  if (!copy_source.empty())
+    signed_headers += "x-amz-copy-source;";
+  if (!info.copy_range.empty())
+    signed_headers += "x-amz-copy-source-range;";
+  signed_headers += "x-amz-date";
   canonical_headers +=
     "host:" + canonical_hostname + "\n" +
     "x-amz-acl:public-read\n"
-    "x-amz-content-sha256:" + payload_hash + "\n" +
-    "x-amz-date:" + timestamp + "\n";
+    "x-amz-content-sha256:" + payload_hash + "\n";
+  if (!copy_source.empty())
+    canonical_headers += "x-amz-copy-source:" + copy_source + "\n";
+  if (!info.copy_range.empty())
+    canonical_headers += "x-amz-copy-source-range:" + info.copy_range + "\n";
+  canonical_headers += "x-amz-date:" + timestamp + "\n";
 
   string scope = date + "/" + config_.region + "/s3/aws4_request";
   string uri = config_.dns_buckets ?
@@ -587,7 +941,7 @@ bool S3FanoutManager::MkV4Authz(const JobInfo &info, vector<string> *headers)
   string canonical_request =
     GetRequestString(info) + "\n" +
     GetUriEncode(uri, false) + "\n" +
-    "\n" +
+    MkQueryString(info, true) + "\n" +
     canonical_headers + "\n" +
     signed_headers + "\n" +
     payload_hash;
@@ -604,8 +958,14 @@ bool S3FanoutManager::MkV4Authz(const JobInfo &info, vector<string> *headers)
   string signature = shash::Hmac256(signing_key, string_to_sign);
 
   headers->push_back("X-Amz-Acl: public-read");
+  if (!copy_source.empty())
+    headers->push_back("X-Amz-Copy-Source: " + copy_source);
+  if (!info.copy_range.empty())
+    headers->push_back("X-Amz-Copy-Source-Range: " + info.copy_range);
   headers->push_back("X-Amz-Content-Sha256: " + payload_hash);
   headers->push_back("X-Amz-Date: " + timestamp);
+  if (info.request == JobInfo::kReqDeleteMulti)
+    headers->push_back("Content-MD5: " + MkContentMd5(info));
   headers->push_back(
     "Authorization: AWS4-HMAC-SHA256 "
     "Credential=" + config_.access_key + "/" + scope + ","
@@ -630,9 +990,7 @@ bool S3FanoutManager::MkAzureAuthz(const JobInfo &info, vector<string> *headers)
     "/" + config_.access_key + "/" + config_.bucket + "/" + info.object_key;
 
   string string_to_sign;
-  if ((info.request == JobInfo::kReqHeadOnly) ||
-     (info.request == JobInfo::kReqHeadPut) ||
-     (info.request == JobInfo::kReqDelete)) {
+  if (!HasPayload(info.request)) {
     string_to_sign =
       GetRequestString(info) +
       string("\n\n\n") +
@@ -755,13 +1113,72 @@ int S3FanoutManager::InitializeDnsSettings(
 }
 
 
+/**
+ * Multipart and bulk delete requests address a subresource of the object,
+ * listings take their parameters from the query string.  The parameters are
+ * returned in the lexicographical order required by the signatures.
+ */
+void S3FanoutManager::GetSubresources(
+  const JobInfo &info,
+  vector<pair<string, string> > *params) const
+{
+  params->clear();
+  switch (info.request) {
+    case JobInfo::kReqMultipartInit:
+      params->push_back(make_pair(string("uploads"), string("")));
+      break;
+    case JobInfo::kReqMultipartPart:
+    case JobInfo::kReqMultipartPartCopy:
+      params->push_back(make_pair(string("partNumber"),
+                                  StringifyInt(info.part_number)));
+      params->push_back(make_pair(string("uploadId"), info.upload_id));
+      break;
+    case JobInfo::kReqMultipartComplete:
+    case JobInfo::kReqMultipartAbort:
+      params->push_back(make_pair(string("uploadId"), info.upload_id));
+      break;
+    case JobInfo::kReqList:
+      if (!info.list_token.empty()) {
+        params->push_back(make_pair(string("continuation-token"),
+                                    info.list_token));
+      }
+      params->push_back(make_pair(string("list-type"), string("2")));
+      params->push_back(make_pair(string("prefix"), info.list_prefix));
+      break;
+    case JobInfo::kReqDeleteMulti:
+      params->push_back(make_pair(string("delete"), string("")));
+      break;
+    default:
+      break;
+  }
+}
+
+
+/**
+ * Query string of the request, starting with '?' unless canonical is set.  The
+ * canonical form is the one used in the AWS4 canonical request, i.e. with
+ * empty values spelled out and without the leading question mark.
+ */
+string S3FanoutManager::MkQueryString(const JobInfo &info, bool canonical)
+  const
+{
+  vector<pair<string, string> > params;
+  GetSubresources(info, &params);
+  string result;
+  for (unsigned i = 0; i < params.size(); ++i) {
+    result += (i == 0) ? (canonical ? "" : "?") : "&";
+    result += params[i].first;
+    if (canonical || !params[i].second.empty())
+      result += "=" + GetUriEncode(params[i].second, true);
+  }
+  return result;
+}
+
+
 bool S3FanoutManager::MkPayloadHash(const JobInfo &info, string *hex_hash)
   const
 {
-  if ((info.request == JobInfo::kReqHeadOnly) ||
-      (info.request == JobInfo::kReqHeadPut) ||
-      (info.request == JobInfo::kReqDelete))
-  {
+  if (!HasPayload(info.request)) {
     switch (config_.authz_method) {
       case kAuthzAwsV2:
         hex_hash->clear();
@@ -810,17 +1227,43 @@ bool S3FanoutManager::MkPayloadHash(const JobInfo &info, string *hex_hash)
   }
 }
 
+/**
+ * Base64 encoded MD5 sum of the request body, required by bulk deletes
+ */
+string S3FanoutManager::MkContentMd5(const JobInfo &info) const {
+  unsigned char *data;
+  unsigned int nbytes =
+    info.origin->Data(reinterpret_cast<void **>(&data),
+                      info.origin->GetSize(), 0);
+  assert(nbytes == info.origin->GetSize());
+  shash::Any md5(shash::kMd5);
+  shash::HashMem(data, nbytes, &md5);
+  return Base64(string(reinterpret_cast<char *>(md5.digest),
+                       md5.GetDigestSize()));
+}
+
+
 string S3FanoutManager::GetRequestString(const JobInfo &info) const {
   switch (info.request) {
     case JobInfo::kReqHeadOnly:
     case JobInfo::kReqHeadPut:
       return "HEAD";
+    case JobInfo::kReqList:
+      return "GET";
     case JobInfo::kReqPutCas:
     case JobInfo::kReqPutDotCvmfs:
     case JobInfo::kReqPutHtml:
     case JobInfo::kReqPutBucket:
+    case JobInfo::kReqMultipartPart:
+    case JobInfo::kReqCopy:
+    case JobInfo::kReqMultipartPartCopy:
       return "PUT";
+    case JobInfo::kReqMultipartInit:
+    case JobInfo::kReqMultipartComplete:
+    case JobInfo::kReqDeleteMulti:
+      return "POST";
     case JobInfo::kReqDelete:
+    case JobInfo::kReqMultipartAbort:
       return "DELETE";
     default:
       PANIC(NULL);
@@ -833,9 +1276,18 @@ string S3FanoutManager::GetContentType(const JobInfo &info) const {
     case JobInfo::kReqHeadOnly:
     case JobInfo::kReqHeadPut:
     case JobInfo::kReqDelete:
+    case JobInfo::kReqMultipartPart:
+    case JobInfo::kReqMultipartAbort:
+    case JobInfo::kReqCopy:
+    case JobInfo::kReqMultipartPartCopy:
+    case JobInfo::kReqList:
       return "";
     case JobInfo::kReqPutCas:
+    case JobInfo::kReqMultipartInit:
       return "application/octet-stream";
+    case JobInfo::kReqMultipartComplete:
+    case JobInfo::kReqDeleteMulti:
+      return "application/xml";
     case JobInfo::kReqPutDotCvmfs:
       return "application/x-cvmfs";
     case JobInfo::kReqPutHtml:
@@ -862,6 +1314,7 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
   info->throttle_ms = 0;
   info->throttle_timestamp = 0;
   info->http_headers = NULL;
+  info->response.clear();
   // info->payload_size is needed in S3Uploader::MainCollectResults,
   // where info->origin is already destroyed.
   info->payload_size = info->origin->GetSize();
@@ -871,14 +1324,16 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
   CURLcode retval;
   if ((info->request == JobInfo::kReqHeadOnly) ||
       (info->request == JobInfo::kReqHeadPut) ||
-      (info->request == JobInfo::kReqDelete))
+      (info->request == JobInfo::kReqDelete) ||
+      (info->request == JobInfo::kReqMultipartAbort))
   {
     retval = curl_easy_setopt(handle, CURLOPT_UPLOAD, 0);
     assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_NOBODY, 1);
     assert(retval == CURLE_OK);
 
-    if (info->request == JobInfo::kReqDelete)
+    if ((info->request == JobInfo::kReqDelete) ||
+        (info->request == JobInfo::kReqMultipartAbort))
     {
       retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST,
                                 GetRequestString(*info).c_str());
@@ -887,9 +1342,20 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
       retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL);
       assert(retval == CURLE_OK);
     }
-  } else {
+  } else if (info->request == JobInfo::kReqList) {
+    retval = curl_easy_setopt(handle, CURLOPT_UPLOAD, 0);
+    assert(retval == CURLE_OK);
+    retval = curl_easy_setopt(handle, CURLOPT_NOBODY, 0);
+    assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL);
     assert(retval == CURLE_OK);
+    retval = curl_easy_setopt(handle, CURLOPT_HTTPGET, 1);
+    assert(retval == CURLE_OK);
+  } else {
+    // POST requests of multipart uploads are sent like a PUT upload
+    retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST,
+      (GetRequestString(*info) == "POST") ? "POST" : NULL);
+    assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_UPLOAD, 1);
     assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_NOBODY, 0);
@@ -901,7 +1367,10 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
     if (info->request == JobInfo::kReqPutDotCvmfs) {
       info->http_headers =
           curl_slist_append(info->http_headers, kCacheControlDotCvmfs);
-    } else if (info->request == JobInfo::kReqPutCas) {
+    } else if ((info->request == JobInfo::kReqPutCas) ||
+               (info->request == JobInfo::kReqMultipartInit))
+    {
+      // The metadata of a multipart upload is set when it is initiated
       info->http_headers =
           curl_slist_append(info->http_headers, kCacheControlCas);
     }
@@ -951,6 +1420,9 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
   retval = curl_easy_setopt(handle, CURLOPT_READDATA,
                             static_cast<void *>(info));
   assert(retval == CURLE_OK);
+  retval = curl_easy_setopt(handle, CURLOPT_WRITEDATA,
+                            static_cast<void *>(info));
+  assert(retval == CURLE_OK);
   retval = curl_easy_setopt(handle, CURLOPT_HTTPHEADER, info->http_headers);
   assert(retval == CURLE_OK);
   if (opt_ipv4_only_) {
@@ -999,7 +1471,7 @@ void S3FanoutManager::SetUrlOptions(JobInfo *info) const {
     assert(retval == CURLE_OK);
   }
 
-  string url = MkUrl(info->object_key);
+  string url = MkUrl(info->object_key) + MkQueryString(*info, false);
   retval = curl_easy_setopt(curl_handle, CURLOPT_URL, url.c_str());
   assert(retval == CURLE_OK);
 
@@ -1011,11 +1483,16 @@ void S3FanoutManager::SetUrlOptions(JobInfo *info) const {
 /**
  * Adds transfer time and uploaded bytes to the global counters.
  */
-void S3FanoutManager::UpdateStatistics(CURL *handle) {
+void S3FanoutManager::UpdateStatistics(const JobInfo *info) {
   double val;
 
-  if (curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD, &val) == CURLE_OK)
+  statistics_->lanes[info->lane].num_requests++;
+  if (curl_easy_getinfo(info->curl_handle, CURLINFO_SIZE_UPLOAD, &val) ==
+      CURLE_OK)
+  {
     statistics_->transferred_bytes += val;
+    statistics_->lanes[info->lane].transferred_bytes += val;
+  }
 }
 
 
@@ -1087,7 +1564,8 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
            "(curl error %d, info error %d, info request %d)",
            info->object_key.c_str(),
            curl_error, info->error_code, info->request);
-  UpdateStatistics(info->curl_handle);
+  UpdateStatistics(info);
+  UpdateConcurrency(*info);
 
   // Verification and error classification
   switch (curl_error) {
@@ -1123,6 +1601,34 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
       break;
   }
 
+  // Multipart, copy, and bulk delete requests can fail with an error document
+  // in the body of an HTTP 200 reply.  These errors are transient.
+  if (info->error_code == kFailOk) {
+    if (info->request == JobInfo::kReqMultipartInit) {
+      info->upload_id = ParseUploadId(info->response);
+      if (info->upload_id.empty())
+        info->error_code = kFailOther;
+    } else if ((info->request == JobInfo::kReqMultipartComplete) ||
+               (info->request == JobInfo::kReqCopy) ||
+               (info->request == JobInfo::kReqDeleteMulti))
+    {
+      if (info->response.find("<Error>") != string::npos)
+        info->error_code = kFailServiceUnavailable;
+    } else if (info->request == JobInfo::kReqMultipartPart) {
+      if (info->etag.empty())
+        info->error_code = kFailOther;
+    } else if (info->request == JobInfo::kReqMultipartPartCopy) {
+      info->etag = ParseCopyPartEtag(info->response);
+      if (info->etag.empty()) {
+        info->error_code = (info->response.find("<Error>") != string::npos)
+                           ? kFailServiceUnavailable : kFailOther;
+      }
+    } else if (info->request == JobInfo::kReqList) {
+      if (info->response.find("<ListBucketResult") == string::npos)
+        info->error_code = kFailOther;
+    }
+  }
+
   // Transform HEAD to PUT request
   if ((info->error_code == kFailNotFound) &&
       (info->request == JobInfo::kReqHeadPut))
@@ -1155,12 +1661,17 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
   if (try_again) {
     if (info->request == JobInfo::kReqPutCas ||
         info->request == JobInfo::kReqPutDotCvmfs ||
-        info->request == JobInfo::kReqPutHtml) {
+        info->request == JobInfo::kReqPutHtml ||
+        info->request == JobInfo::kReqMultipartPart ||
+        info->request == JobInfo::kReqMultipartComplete ||
+        info->request == JobInfo::kReqDeleteMulti) {
       LogCvmfs(kLogS3Fanout, kLogDebug, "Trying again to upload %s",
                info->object_key.c_str());
       // Reset origin
       info->origin->Rewind();
     }
+    info->response.clear();
+    info->etag.clear();
     Backoff(info);
     info->error_code = kFailOk;
     info->http_error = 0;
@@ -1206,8 +1717,15 @@ S3FanoutManager::S3FanoutManager(const S3Config &config) : config_(config) {
   max_available_jobs_ = 4 * config_.pool_max_handles;
   available_jobs_ = new Semaphore(max_available_jobs_);
   assert(NULL != available_jobs_);
+  num_active_ = 0;
+  concurrency_limit_ = std::max(1U, config_.pool_max_handles);
+  num_completions_since_change_ = 0;
+  throttled_in_window_ = false;
+  latency_ewma_ = 0.0;
+  latency_min_ = 0.0;
 
   statistics_ = new Statistics();
+  statistics_->min_concurrency_limit = concurrency_limit_;
   user_agent_ = new string();
   *user_agent_ = "User-Agent: cvmfs " + string(VERSION);
   complete_hostname_ = MkCompleteHostname();
@@ -1341,6 +1859,17 @@ JobInfo *S3FanoutManager::PopCompletedJob() {
 //------------------------------------------------------------------------------
 
 
+static string PrintLane(const string &name, const LaneStatistics &lane) {
+  const double throughput = (lane.busy_time > 0.0) ?
+    (lane.transferred_bytes / lane.busy_time / (1024.0 * 1024.0)) : 0.0;
+  return
+      name + StringifyInt(lane.num_requests) + " requests, " +
+      StringifyInt(uint64_t(lane.transferred_bytes)) + " bytes in " +
+      StringifyDouble(lane.busy_time) + " s (" +
+      StringifyDouble(throughput) + " MiB/s)\n";
+}
+
+
 string Statistics::Print() const {
   return
       "Transferred Bytes:  " +
@@ -1350,7 +1879,12 @@ string Statistics::Print() const {
       "Number of requests: " +
       StringifyInt(num_requests) + "\n" +
       "Number of retries:  " +
-      StringifyInt(num_retries) + "\n";
+      StringifyInt(num_retries) + "\n" +
+      PrintLane("Small objects:      ", lanes[kLaneSmall]) +
+      PrintLane("Large objects:      ", lanes[kLaneLarge]) +
+      "Congestion events:  " +
+      StringifyInt(num_congestion_events) + " (minimum concurrency " +
+      StringifyInt(min_concurrency_limit) + ")\n";
 }
 
 }  // namespace s3fanout
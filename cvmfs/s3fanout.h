@@ -10,6 +10,8 @@
 
 #include <climits>
 #include <cstdlib>
+#include <ctime>
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -18,6 +20,7 @@
 
 #include "dns.h"
 #include "duplex_curl.h"
+#include "gtest/gtest_prod.h"
 #include "prng.h"
 #include "smalloc.h"
 #include "ssl.h"
@@ -72,12 +75,35 @@ inline const char *Code2Ascii(const Failures error) {
 
 
 
+/**
+ * Requests are scheduled in separate lanes for small and large objects so that
+ * a few large uploads cannot block the many small ones and vice versa.
+ */
+enum UploadLane {
+  kLaneSmall = 0,
+  kLaneLarge,
+  kNumLanes
+};
+
+
+struct LaneStatistics {
+  LaneStatistics() : num_requests(0), transferred_bytes(0.0), busy_time(0.0) {}
+  uint64_t num_requests;
+  double transferred_bytes;
+  double busy_time;  // Seconds during which the lane had active requests
+};
+
+
 struct Statistics {
   double transferred_bytes;
   double transfer_time;
   uint64_t num_requests;
   uint64_t num_retries;
   uint64_t ms_throttled;  // Total waiting time imposed by HTTP 429 replies
+  // Number of times the adaptive concurrency limit has been reduced
+  uint64_t num_congestion_events;
+  unsigned min_concurrency_limit;
+  LaneStatistics lanes[kNumLanes];
 
   Statistics() {
     transferred_bytes = 0.0;
@@ -85,6 +111,8 @@ struct Statistics {
     num_requests = 0;
     num_retries = 0;
     ms_throttled = 0;
+    num_congestion_events = 0;
+    min_concurrency_limit = 0;
   }
 
   std::string Print() const;
@@ -103,12 +131,33 @@ struct JobInfo : SingleCopy {
     kReqPutHtml,  // HTML file - display instead of downloading
     kReqPutBucket,  // bucket creation
     kReqDelete,
+    kReqMultipartInit,  // POST ?uploads, returns the upload id
+    kReqMultipartPart,  // PUT ?partNumber=&uploadId=, returns the ETag
+    kReqMultipartComplete,  // POST ?uploadId= with the list of parts
+    kReqMultipartAbort,  // DELETE ?uploadId=, discards uploaded parts
+    kReqCopy,  // server-side copy of copy_source to object_key
+    // PUT ?partNumber=&uploadId=, copies copy_range of copy_source
+    kReqMultipartPartCopy,
+    kReqList,  // GET ?list-type=2, one page of the keys under list_prefix
+    kReqDeleteMulti,  // POST ?delete with the list of keys to remove
   };
 
   const std::string object_key;
   void *callback;  // Callback to be called when job is finished
   UniquePtr<FileBackedBuffer> origin;
 
+  // Multipart uploads and copies
+  std::string upload_id;  // set by a completed kReqMultipartInit
+  unsigned part_number;  // 1-based, for kReqMultipartPart[Copy]
+  std::string etag;  // set by a completed kReqMultipartPart[Copy]
+  std::string copy_source;  // object key of the source of a kReqCopy
+  std::string copy_range;  // "bytes=first-last" of a kReqMultipartPartCopy
+  std::string response;  // HTTP body of multipart, copy, and list requests
+
+  // Listings
+  std::string list_prefix;  // only keys with this prefix are listed
+  std::string list_token;  // continues a truncated listing
+
   // One constructor per destination
   JobInfo(
     const std::string &object_key,
@@ -125,12 +174,14 @@ struct JobInfo : SingleCopy {
     http_headers = NULL;
     callback = NULL;
     request = kReqPutCas;
+    lane = kLaneSmall;
     error_code = kFailOk;
     http_error = 0;
     num_retries = 0;
     backoff_ms = 0;
     throttle_ms = 0;
     throttle_timestamp = 0;
+    part_number = 0;
     errorbuffer =
         reinterpret_cast<char *>(smalloc(sizeof(char) * CURL_ERROR_SIZE));
   }
@@ -143,6 +194,7 @@ struct JobInfo : SingleCopy {
   struct curl_slist *http_headers;
   uint64_t payload_size;
   RequestType request;
+  UploadLane lane;
   Failures error_code;
   int http_error;
   unsigned char num_retries;
@@ -155,6 +207,16 @@ struct JobInfo : SingleCopy {
   char *errorbuffer;
 };  // JobInfo
 
+/**
+ * An object from the reply of a kReqList request
+ */
+struct ListEntry {
+  ListEntry() : size(0), mtime(0) { }
+  std::string key;
+  uint64_t size;
+  time_t mtime;
+};
+
 struct S3FanOutDnsEntry {
   S3FanOutDnsEntry() : counter(0), dns_name(), ip(), port("80"),
      clist(NULL), sharehandle(NULL) {}
@@ -180,6 +242,8 @@ class S3FanoutManager : SingleCopy {
   static const unsigned kThrottleReportIntervalSec;
   static const unsigned kDefaultHTTPPort;
   static const unsigned kDefaultHTTPSPort;
+  // Objects from this size on are scheduled in the large object lane
+  static const uint64_t kLargeObjectThreshold;
 
   struct S3Config {
     S3Config() {
@@ -210,6 +274,13 @@ class S3FanoutManager : SingleCopy {
   };
 
   static void DetectThrottleIndicator(const std::string &header, JobInfo *info);
+  static std::string ParseUploadId(const std::string &response);
+  static std::string ParseCopyPartEtag(const std::string &response);
+  static bool ParseListing(const std::string &response,
+                           std::vector<ListEntry> *entries,
+                           std::string *next_token);
+  static bool HasPayload(JobInfo::RequestType request);
+  static UploadLane ClassifyJob(const JobInfo &info);
 
   explicit S3FanoutManager(const S3Config &config);
 
@@ -224,10 +295,28 @@ class S3FanoutManager : SingleCopy {
   const Statistics &GetStatistics();
 
  private:
+  FRIEND_TEST(T_S3Fanout, AdjustConcurrency);
+
   // Reflects the default Apache configuration of the local backend
   static const char *kCacheControlCas;  // Cache-Control: max-age=259200
   static const char *kCacheControlDotCvmfs;  // Cache-Control: max-age=61
   static const unsigned kLowSpeedLimit = 1024;  // Require at least 1kB/s
+  // Smoothing factor of the moving average of small request latencies
+  static const double kLatencyEwmaWeight;
+  // Latencies below this floor are not considered a sign of congestion
+  static const double kMinLatencyBaseline;
+  // Congestion is assumed if the average latency exceeds the baseline by this
+  static const double kCongestionLatencyFactor;
+
+  /**
+   * Per lane scheduling state, only touched by the I/O thread
+   */
+  struct LaneState {
+    LaneState() : num_active(0), busy_since_ns(0) { }
+    std::deque<JobInfo *> pending;
+    unsigned num_active;
+    uint64_t busy_since_ns;
+  };
 
   static int CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                                 void *userp, void *socketp);
@@ -245,7 +334,13 @@ class S3FanoutManager : SingleCopy {
                                  curl_slist *clist) const;
   Failures InitializeRequest(JobInfo *info, CURL *handle) const;
   void SetUrlOptions(JobInfo *info) const;
-  void UpdateStatistics(CURL *handle);
+  void UpdateStatistics(const JobInfo *info);
+  void EnqueueJob(JobInfo *info);
+  void ScheduleJobs();
+  void StartJob(JobInfo *info);
+  void FinishJob(JobInfo *info);
+  void UpdateConcurrency(const JobInfo &info);
+  void AdjustConcurrency(bool throttled, double latency);
   bool CanRetry(const JobInfo *info);
   void Backoff(JobInfo *info);
   bool VerifyAndFinalize(const int curl_error, JobInfo *info);
@@ -253,7 +348,12 @@ class S3FanoutManager : SingleCopy {
   std::string GetContentType(const JobInfo &info) const;
   std::string GetUriEncode(const std::string &val, bool encode_slash) const;
   std::string GetAwsV4SigningKey(const std::string &date) const;
+  void GetSubresources(
+    const JobInfo &info,
+    std::vector<std::pair<std::string, std::string> > *params) const;
+  std::string MkQueryString(const JobInfo &info, bool canonical) const;
   bool MkPayloadHash(const JobInfo &info, std::string *hex_hash) const;
+  std::string MkContentMd5(const JobInfo &info) const;
   bool MkV2Authz(const JobInfo &info,
                  std::vector<std::string> *headers) const;
   bool MkV4Authz(const JobInfo &info,
@@ -324,6 +424,22 @@ class S3FanoutManager : SingleCopy {
   unsigned int max_available_jobs_;
   Semaphore *available_jobs_;
 
+  /**
+   * Jobs wait in their lane until the scheduler admits them into the curl
+   * multi handle.  The number of concurrently active requests follows an
+   * additive increase / multiplicative decrease scheme: it grows by one per
+   * window of successful requests up to pool_max_handles and it is halved on
+   * HTTP 429/503 replies or when small request latencies pile up.
+   */
+  LaneState lanes_[kNumLanes];
+  unsigned num_active_;
+  unsigned concurrency_limit_;
+  unsigned num_completions_since_change_;
+  // Latched by any HTTP 429/503 reply of the current window
+  bool throttled_in_window_;
+  double latency_ewma_;
+  double latency_min_;
+
   // Writes and reads should be atomic because reading happens in a different
   // thread than writing.
   Statistics *statistics_;
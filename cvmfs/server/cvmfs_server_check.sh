@@ -57,6 +57,13 @@ __do_check() {
   [ "x$CVMFS_LOG_LEVEL" != x ] && log_level_param="-l $CVMFS_LOG_LEVEL"
   [ $check_chunks -ne 0 ]      && check_chunks_param="-c"
 
+  # catalogs verified by the last successful check are skipped; checks of a
+  # tag (-t) or a subtree (-s) add their catalogs to the checkpoint, only a
+  # check of the entire trunk replaces it
+  local checkpoint_param=""
+  [ $incremental -ne 0 ] && \
+    checkpoint_param="-C ${CVMFS_SPOOL_DIR}/check_checkpoint"
+
   local subtree_msg=""
   local subtree_param=""
   if [ "x$subtree_path" != "x" ]; then
@@ -85,6 +92,7 @@ __do_check() {
                      $check_chunks_param               \
                      $log_level_param                  \
                      $subtree_param                    \
+                     $checkpoint_param                 \
                      -r $url                           \
                      -t ${CVMFS_SPOOL_DIR}/tmp         \
                      -k ${CVMFS_PUBLIC_KEY}            \
@@ -268,10 +276,11 @@ cvmfs_server_check() {
   local subtree_path=""
   local tag=
   local repair_reflog=0
+  local incremental=0
 
   # optional parameter handling
   OPTIND=1
-  while getopts "acit:s:r" option
+  while getopts "acit:s:rI" option
   do
     case $option in
       a)
@@ -292,6 +301,9 @@ cvmfs_server_check() {
       r)
         repair_reflog=1
       ;;
+      I)
+        incremental=1
+      ;;
       ?)
         shift $(($OPTIND-2))
         usage "Command check: Unrecognized option: $1"
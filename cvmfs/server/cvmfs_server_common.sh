@@ -1370,7 +1370,9 @@ _run_catalog_migration() {
   echo "Starting catalog migration"
   local tmp_dir=${CVMFS_SPOOL_DIR}/tmp
   local manifest=${tmp_dir}/manifest
-  migration_command="${migration_command} -t $tmp_dir -o $manifest"
+  # an interrupted migration resumes from the checkpoint on the next invocation
+  local checkpoint=${CVMFS_SPOOL_DIR}/migration_checkpoint
+  migration_command="${migration_command} -t $tmp_dir -o $manifest -C $checkpoint"
   sh -c "$migration_command" || die "Fail (executed command: $migration_command)"
 
   # check if the catalog migration created a new revision
@@ -226,6 +226,20 @@ cvmfs_server_ingest() {
     ingest_command="$ingest_command -C true"
   fi
 
+  if [ "x$CVMFS_USE_FILE_CHUNKING" = "xtrue" ]; then
+    ingest_command="$ingest_command -p \
+     -l $CVMFS_MIN_CHUNK_SIZE \
+     -a $CVMFS_AVG_CHUNK_SIZE \
+     -h $CVMFS_MAX_CHUNK_SIZE"
+    if [ "x$CVMFS_CHUNKING_ALGORITHM" != "x" ]; then
+      ingest_command="$ingest_command -G $CVMFS_CHUNKING_ALGORITHM"
+    fi
+  fi
+
+  if [ "x$CVMFS_COMPRESSION_SEGMENT_SIZE" != "x" ]; then
+    ingest_command="$ingest_command -j $CVMFS_COMPRESSION_SEGMENT_SIZE"
+  fi
+
   if [ "x$CVMFS_PRINT_STATISTICS" = "xtrue" ]; then
     ingest_command="$ingest_command -+stats"
   fi
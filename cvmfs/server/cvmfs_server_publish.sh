@@ -231,6 +231,18 @@ cvmfs_server_publish() {
        -l $CVMFS_MIN_CHUNK_SIZE \
        -a $CVMFS_AVG_CHUNK_SIZE \
        -h $CVMFS_MAX_CHUNK_SIZE"
+      if [ "x$CVMFS_CHUNKING_ALGORITHM" != "x" ]; then
+        sync_command="$sync_command -G $CVMFS_CHUNKING_ALGORITHM"
+      fi
+    fi
+    if [ "x$CVMFS_COMPRESSION_SEGMENT_SIZE" != "x" ]; then
+      sync_command="$sync_command -j $CVMFS_COMPRESSION_SEGMENT_SIZE"
+    fi
+    if [ "x$CVMFS_PUBLISH_STATISTICS_JSON" != "x" ]; then
+      sync_command="$sync_command -2 $CVMFS_PUBLISH_STATISTICS_JSON"
+    fi
+    if [ "x$CVMFS_CATALOG_DELTAS" = "xtrue" ]; then
+      sync_command="$sync_command -3"
     fi
     if [ "x$CVMFS_AUTOCATALOGS" = "xtrue" ]; then
       sync_command="$sync_command -A"
@@ -244,6 +256,9 @@ cvmfs_server_publish() {
     if [ "x$CVMFS_IGNORE_XDIR_HARDLINKS" = "xtrue" ]; then
       sync_command="$sync_command -i"
     fi
+    if [ "x$CVMFS_REUSE_UNCHANGED_FILES" = "xtrue" ]; then
+      sync_command="$sync_command -1"
+    fi
     if [ "x$CVMFS_INCLUDE_XATTRS" = "xtrue" ]; then
       sync_command="$sync_command -k"
     fi
@@ -1199,6 +1199,7 @@ Supported Commands:
                   [-t tag (check given tag instead of trunk)]
                   [-s path to nested catalog subtree to check]
                   [-r repair reflog problems]
+                  [-I skip catalogs verified by the last successful check]
                   [-a check all active local repos, log to checks.log |
                     <fully qualified name> ]
                   <fully qualified name>
@@ -99,7 +99,8 @@ string Statistics::PrintList(const PrintOptions print_options) {
  *     "counter2": val2
  *   },
  *   "name_major2": {
- *     "counter3": val3
+ *     "counter3": val3,
+ *     "name_sub.counter4": val4
  *   }
  * }
  */
@@ -114,7 +115,7 @@ string Statistics::PrintJSON() {
   for (map<string, CounterInfo *>::const_iterator i = counters_.begin(),
                                                   iEnd = counters_.end();
        i != iEnd; ++i) {
-    std::vector<std::string> tokens = SplitString(i->first, '.');
+    std::vector<std::string> tokens = SplitString(i->first, '.', 2);
 
     if (tokens[0] != last_namespace) {
       if (last_namespace != "") {
@@ -134,6 +134,7 @@ struct FsCounters {
   perf::Counter *n_files_added;
   perf::Counter *n_files_removed;
   perf::Counter *n_files_changed;
+  perf::Counter *n_files_reused;
   perf::Counter *n_directories_added;
   perf::Counter *n_directories_removed;
   perf::Counter *n_directories_changed;
@@ -150,6 +151,8 @@ struct FsCounters {
         "Number of files removed");
     n_files_changed = statistics.RegisterTemplated("n_files_changed",
         "Number of files changed");
+    n_files_reused = statistics.RegisterTemplated("n_files_reused",
+        "Number of changed files with reused content");
     n_directories_added = statistics.RegisterTemplated("n_directories_added",
         "Number of directories added");
     n_directories_removed =
@@ -13,6 +13,8 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <cerrno>
+#include <cstdio>
 #include <map>
 #include <queue>
 #include <set>
@@ -20,15 +22,18 @@
 #include <vector>
 
 #include "catalog_sql.h"
+#include "catalog_traversal_parallel.h"
 #include "compression.h"
 #include "download.h"
 #include "file_chunk.h"
 #include "history_sqlite.h"
 #include "logging.h"
 #include "manifest.h"
+#include "object_fetcher.h"
 #include "reflog.h"
 #include "sanitizer.h"
 #include "shortstring.h"
+#include "sink.h"
 #include "util/exception.h"
 #include "util/pointer.h"
 #include "util/posix.h"
@@ -306,7 +311,8 @@ bool CommandCheck::InspectHistory(history::History *history) {
 
 
 /**
- * Recursive catalog walk-through
+ * Recursive catalog walk-through within a catalog.  The data objects are
+ * checked asynchronously by the verifiers.
  */
 bool CommandCheck::Find(const catalog::Catalog *catalog,
                         const PathString &path,
@@ -375,11 +381,9 @@ bool CommandCheck::Find(const catalog::Catalog *catalog,
       string chunk_path = "data/" + entries[i].checksum().MakePath();
       if (entries[i].IsDirectory())
         chunk_path += shash::kSuffixMicroCatalog;
-      if (!Exists(chunk_path)) {
-        LogCvmfs(kLogCvmfs, kLogStderr, "data chunk %s (%s) missing",
-                 entries[i].checksum().ToString().c_str(), full_path.c_str());
-        retval = false;
-      }
+      CheckObject(entries[i].checksum(), chunk_path,
+                  "data chunk " + entries[i].checksum().ToString() +
+                  " (" + full_path.ToString() + ")");
     }
 
     // Add hardlinks to counting map
@@ -567,15 +571,11 @@ bool CommandCheck::Find(const catalog::Catalog *catalog,
         if (check_chunks_ && !entries[i].IsExternalFile()) {
           const shash::Any &chunk_hash = this_chunk.content_hash();
           const string chunk_path = "data/" + chunk_hash.MakePath();
-          if (!Exists(chunk_path)) {
-            LogCvmfs(kLogCvmfs, kLogStderr, "partial data chunk %s (%s -> "
-                                            "offset: %d | size: %d) missing",
-                     this_chunk.content_hash().ToStringWithSuffix().c_str(),
-                     full_path.c_str(),
-                     this_chunk.offset(),
-                     this_chunk.size());
-            retval = false;
-          }
+          CheckObject(chunk_hash, chunk_path,
+                      "partial data chunk " + chunk_hash.ToStringWithSuffix() +
+                      " (" + full_path.ToString() + " -> offset: " +
+                      StringifyInt(this_chunk.offset()) + " | size: " +
+                      StringifyInt(this_chunk.size()) + ")");
         }
       }
 
@@ -726,85 +726,194 @@ bool CommandCheck::FindSubtreeRootCatalog(const string &subtree_path,
 
 
 /**
- * Recursion on nested catalog level.  No ownership of computed_counters.
+ * Queues a data object for the verifiers, if data chunks are checked at all
  */
-bool CommandCheck::InspectTree(const string                  &path,
-                               const shash::Any              &catalog_hash,
-                               const uint64_t                 catalog_size,
-                               const bool                     is_nested_catalog,
-                               const catalog::DirectoryEntry *transition_point,
-                               catalog::DeltaCounters        *computed_counters)
+void CommandCheck::CheckObject(
+  const shash::Any &hash,
+  const string &object_path,
+  const string &description)
 {
-  LogCvmfs(kLogCvmfs, kLogStdout | kLogInform, "[inspecting catalog] %s at %s",
-           catalog_hash.ToString().c_str(), path == "" ? "/" : path.c_str());
-
-  const catalog::Catalog *catalog = FetchCatalog(path,
-                                                 catalog_hash,
-                                                 catalog_size);
-  if (catalog == NULL) {
-    LogCvmfs(kLogCvmfs, kLogStderr, "failed to open catalog %s",
-             catalog_hash.ToString().c_str());
-    return false;
+  if (!check_chunks_)
+    return;
+  object_queue_->EnqueueBack(new ObjectJob(hash, object_path, description));
+}
+
+
+namespace {
+
+/**
+ * Discards the downloaded data; the download manager verifies the hash
+ */
+class NullSink : public cvmfs::Sink {
+ public:
+  virtual int64_t Write(const void *buf, uint64_t sz) { return sz; }
+  virtual int Reset() { return 0; }
+};
+
+}  // anonymous namespace
+
+
+/**
+ * Runs in the TaskVerifyObject threads
+ */
+void CommandCheck::VerifyObject(const ObjectJob &job) {
+  bool exists;
+  bool is_intact = true;
+  if (!verify_content_) {
+    exists = Exists(job.object_path);
+  } else if (!is_remote_) {
+    shash::Any computed_hash(job.hash.algorithm);
+    exists = shash::HashFile(job.object_path, &computed_hash);
+    is_intact = (computed_hash == job.hash);
+  } else {
+    const string url = repo_base_path_ + "/" + job.object_path;
+    NullSink sink;
+    download::JobInfo download_object(&url, false, false, &sink, &job.hash);
+    const download::Failures retval =
+      download_manager()->Fetch(&download_object);
+    exists =
+      (retval == download::kFailOk) || (retval == download::kFailBadData);
+    is_intact = (retval != download::kFailBadData);
+  }
+
+  if (!exists) {
+    LogCvmfs(kLogCvmfs, kLogStderr, "%s missing", job.description.c_str());
+    atomic_inc32(&num_errors_);
+  } else if (!is_intact) {
+    LogCvmfs(kLogCvmfs, kLogStderr, "%s has unexpected content",
+             job.description.c_str());
+    atomic_inc32(&num_errors_);
   }
+}
+
+
+bool CommandCheck::GetInspectedCatalog(
+  const shash::Any &hash,
+  InspectedCatalog *result)
+{
+  MutexLockGuard m(&lock_inspected_catalogs_);
+  std::map<shash::Any, InspectedCatalog>::const_iterator i =
+    inspected_catalogs_.find(hash);
+  if (i == inspected_catalogs_.end())
+    return false;
+  *result = i->second;
+  return true;
+}
+
+
+/**
+ * Traversal callback, called concurrently for different catalogs.  Nested
+ * catalogs are inspected before their parents.
+ */
+void CommandCheck::InspectCatalog(
+  const CatalogTraversalData<catalog::Catalog> &data)
+{
+  InspectedCatalog inspected;
+  inspected.file_size = data.file_size;
+  if (!CheckCatalog(data, &inspected))
+    atomic_inc32(&num_errors_);
 
-  int retval = true;
+  MutexLockGuard m(&lock_inspected_catalogs_);
+  inspected_catalogs_[data.catalog_hash] = inspected;
+}
 
-  if (catalog->root_prefix() != PathString(path.data(), path.length())) {
+
+/**
+ * The catalogs are attached at their mountpoints relative to the root of the
+ * check (see Catalog::PlantPath()), so that subtree checks work on the same
+ * paths as full checks.
+ */
+bool CommandCheck::CheckCatalog(
+  const CatalogTraversalData<catalog::Catalog> &data,
+  InspectedCatalog *inspected)
+{
+  const catalog::Catalog *catalog = data.catalog;
+  const PathString path = catalog->mountpoint();
+  const string root_prefix = subtree_path_ + path.ToString();
+  const bool is_verified = (checkpoint_catalogs_.count(data.catalog_hash) > 0);
+  LogCvmfs(kLogCvmfs, is_verified ? kLogDebug : (kLogStdout | kLogInform),
+           "[inspecting catalog] %s at %s%s",
+           data.catalog_hash.ToString().c_str(),
+           root_prefix.empty() ? "/" : root_prefix.c_str(),
+           is_verified ? " (verified before)" : "");
+
+  bool retval = true;
+
+  if (catalog->root_prefix() !=
+      PathString(root_prefix.data(), root_prefix.length()))
+  {
     LogCvmfs(kLogCvmfs, kLogStderr, "root prefix mismatch; "
              "expected %s, got %s",
-             path.c_str(), catalog->root_prefix().c_str());
+             root_prefix.c_str(), catalog->root_prefix().c_str());
     retval = false;
   }
 
-  // Check transition point
+  // The nested catalog sizes are checked by the parent
+  if ((data.tree_level == 0) && (root_size_ > 0) &&
+      (data.file_size != root_size_))
+  {
+    LogCvmfs(kLogCvmfs, kLogStderr, "catalog file size mismatch, "
+             "expected %" PRIu64 ", got %" PRIu64,
+             root_size_, static_cast<uint64_t>(data.file_size));
+    retval = false;
+  }
+  if (data.tree_level == 0)
+    root_revision_ = catalog->GetRevision();
+
+  // Check root entry, the parent compares it to the transition point
   catalog::DirectoryEntry root_entry;
-  if (!catalog->LookupPath(catalog->root_prefix(), &root_entry)) {
+  if (!catalog->LookupPath(path, &root_entry)) {
     LogCvmfs(kLogCvmfs, kLogStderr, "failed to lookup root entry (%s)",
-             path.c_str());
+             root_prefix.c_str());
     retval = false;
   }
+  inspected->root_entry = root_entry;
+
+  if (is_verified) {
+    // The stored counters were found to match the computed ones before
+    atomic_inc32(&num_skipped_catalogs_);
+    inspected->counters =
+      catalog::Counters::Diff(catalog::Counters(), catalog->GetCounters());
+    return retval;
+  }
+
   if (!root_entry.IsDirectory()) {
     LogCvmfs(kLogCvmfs, kLogStderr, "root entry not a directory (%s)",
-             path.c_str());
+             root_prefix.c_str());
     retval = false;
   }
+  const bool is_nested_catalog = !root_prefix.empty();
   if (is_nested_catalog) {
-    if (transition_point != NULL &&
-        !CompareEntries(*transition_point, root_entry, true, true)) {
-      LogCvmfs(kLogCvmfs, kLogStderr,
-               "transition point and root entry differ (%s)", path.c_str());
-      retval = false;
-    }
     if (!root_entry.IsNestedCatalogRoot()) {
       LogCvmfs(kLogCvmfs, kLogStderr,
-               "nested catalog root expected but not found (%s)", path.c_str());
+               "nested catalog root expected but not found (%s)",
+               root_prefix.c_str());
       retval = false;
     }
   } else {
     if (root_entry.IsNestedCatalogRoot()) {
       LogCvmfs(kLogCvmfs, kLogStderr,
-               "nested catalog root found but not expected (%s)", path.c_str());
+               "nested catalog root found but not expected (%s)",
+               root_prefix.c_str());
       retval = false;
     }
   }
 
   // Traverse the catalog
+  catalog::DeltaCounters computed_counters;
   set<PathString> bind_mountpoints;
-  if (!Find(catalog, PathString(path.data(), path.length()),
-            computed_counters, &bind_mountpoints))
-  {
+  if (!Find(catalog, path, &computed_counters, &bind_mountpoints))
     retval = false;
-  }
 
   // Check number of entries
   if (root_entry.HasXattrs())
-    computed_counters->self.xattrs++;
+    computed_counters.self.xattrs++;
   const uint64_t num_found_entries =
     1 +
-    computed_counters->self.regular_files +
-    computed_counters->self.symlinks +
-    computed_counters->self.specials +
-    computed_counters->self.directories;
+    computed_counters.self.regular_files +
+    computed_counters.self.symlinks +
+    computed_counters.self.specials +
+    computed_counters.self.directories;
   if (num_found_entries != catalog->GetNumEntries()) {
     LogCvmfs(kLogCvmfs, kLogStderr, "dangling entries in catalog, "
              "expected %" PRIu64 ", got %" PRIu64,
@@ -812,16 +921,16 @@ bool CommandCheck::InspectTree(const string                  &path,
     retval = false;
   }
 
-  // Recurse into nested catalogs
+  // Collect the results of the nested catalogs
   const catalog::Catalog::NestedCatalogList &nested_catalogs =
     catalog->ListNestedCatalogs();
   const catalog::Catalog::NestedCatalogList own_nested_catalogs =
     catalog->ListOwnNestedCatalogs();
   if (own_nested_catalogs.size() !=
-      static_cast<uint64_t>(computed_counters->self.nested_catalogs))
+      static_cast<uint64_t>(computed_counters.self.nested_catalogs))
   {
     LogCvmfs(kLogCvmfs, kLogStderr, "number of nested catalogs does not match;"
-             " expected %lu, got %lu", computed_counters->self.nested_catalogs,
+             " expected %lu, got %lu", computed_counters.self.nested_catalogs,
              own_nested_catalogs.size());
     retval = false;
   }
@@ -857,40 +966,195 @@ bool CommandCheck::InspectTree(const string                  &path,
       LogCvmfs(kLogCvmfs, kLogStderr, "failed to lookup transition point %s",
                i->mountpoint.c_str());
       retval = false;
-    } else {
-      catalog::DeltaCounters nested_counters;
-      const bool is_nested = true;
-      if (!InspectTree(i->mountpoint.ToString(), i->hash, i->size, is_nested,
-                       &nested_transition_point, &nested_counters))
-        retval = false;
-      nested_counters.PopulateToParent(computed_counters);
+      continue;
+    }
+    InspectedCatalog nested;
+    if (!GetInspectedCatalog(i->hash, &nested)) {
+      LogCvmfs(kLogCvmfs, kLogStderr, "nested catalog %s at %s not inspected",
+               i->hash.ToString().c_str(), i->mountpoint.c_str());
+      retval = false;
+      continue;
     }
+    if (!CompareEntries(nested_transition_point, nested.root_entry,
+                        true, true))
+    {
+      LogCvmfs(kLogCvmfs, kLogStderr,
+               "transition point and root entry differ (%s)",
+               i->mountpoint.c_str());
+      retval = false;
+    }
+    if ((i->size > 0) && (nested.file_size != i->size)) {
+      LogCvmfs(kLogCvmfs, kLogStderr, "catalog file size mismatch at %s, "
+               "expected %" PRIu64 ", got %" PRIu64,
+               i->mountpoint.c_str(), i->size, nested.file_size);
+      retval = false;
+    }
+    nested.counters.PopulateToParent(&computed_counters);
   }
 
   // Check statistics counters
   // Additionally account for root directory
-  computed_counters->self.directories++;
+  computed_counters.self.directories++;
   catalog::Counters compare_counters;
-  compare_counters.ApplyDelta(*computed_counters);
+  compare_counters.ApplyDelta(computed_counters);
   const catalog::Counters stored_counters = catalog->GetCounters();
   if (!CompareCounters(compare_counters, stored_counters)) {
     LogCvmfs(kLogCvmfs, kLogStderr, "statistics counter mismatch [%s]",
-             catalog_hash.ToString().c_str());
+             data.catalog_hash.ToString().c_str());
     retval = false;
   }
 
-  delete catalog;
+  inspected->counters = computed_counters;
   return retval;
 }
 
 
+bool CommandCheck::InspectTree(
+  const string &repo_name,
+  const shash::Any &root_hash)
+{
+  if (is_remote_) {
+    HttpObjectFetcher<catalog::Catalog, history::SqliteHistory>
+      fetcher(repo_name, repo_base_path_, temp_directory_,
+              download_manager(), signature_manager());
+    return InspectTree(&fetcher, root_hash);
+  }
+  LocalObjectFetcher<> fetcher(repo_base_path_, temp_directory_);
+  return InspectTree(&fetcher, root_hash);
+}
+
+
+template <class ObjectFetcherT>
+bool CommandCheck::InspectTree(
+  ObjectFetcherT *object_fetcher,
+  const shash::Any &root_hash)
+{
+  typedef CatalogTraversalParallel<ObjectFetcherT> Traversal;
+  typename Traversal::Parameters params;
+  params.object_fetcher = object_fetcher;
+  params.no_repeat_history = true;
+  params.num_threads = num_threads_;
+  params.serialize_callbacks = false;
+  Traversal traversal(params);
+  traversal.RegisterListener(&CommandCheck::InspectCatalog, this);
+
+  Tube<ObjectJob> object_queue(kMaxPendingObjects);
+  object_queue_ = &object_queue;
+  TubeConsumerGroup<ObjectJob> tasks_verify;
+  for (unsigned i = 0; i < num_threads_; ++i)
+    tasks_verify.TakeConsumer(new TaskVerifyObject(this, &object_queue));
+  tasks_verify.Spawn();
+
+  const bool retval =
+    traversal.TraverseRevision(root_hash, Traversal::kDepthFirst);
+  tasks_verify.Terminate();
+  object_queue_ = NULL;
+
+  if (!retval)
+    LogCvmfs(kLogCvmfs, kLogStderr, "failed to traverse the catalogs");
+  return retval && (atomic_read32(&num_errors_) == 0);
+}
+
+
+CommandCheck::CheckLevel CommandCheck::GetCheckLevel() const {
+  if (verify_content_)
+    return kCheckContent;
+  return check_chunks_ ? kCheckAvailability : kCheckCatalogs;
+}
+
+
+/**
+ * The checkpoint has a header line with the check level and the revision of
+ * the last successful check, followed by one catalog hash per line.  A missing
+ * or unsuitable checkpoint results in a full check.
+ */
+bool CommandCheck::ReadCheckpoint(const string &path) {
+  FILE *f = fopen(path.c_str(), "r");
+  if (f == NULL) {
+    if (errno == ENOENT)
+      return true;
+    LogCvmfs(kLogCvmfs, kLogStderr, "failed to open checkpoint %s (%d)",
+             path.c_str(), errno);
+    return false;
+  }
+
+  string line;
+  vector<string> header;
+  if (GetLineFile(f, &line))
+    header = SplitString(line, ' ');
+  if ((header.size() != 2) ||
+      (String2Uint64(header[0]) < static_cast<uint64_t>(GetCheckLevel())))
+  {
+    LogCvmfs(kLogCvmfs, kLogStdout,
+             "Checkpoint %s is from a less thorough check, checking everything",
+             path.c_str());
+    fclose(f);
+    return true;
+  }
+
+  while (GetLineFile(f, &line)) {
+    if (!shash::HexPtr(line).IsValid()) {
+      LogCvmfs(kLogCvmfs, kLogStderr, "invalid catalog hash in checkpoint %s",
+               path.c_str());
+      checkpoint_catalogs_.clear();
+      fclose(f);
+      return false;
+    }
+    checkpoint_catalogs_.insert(
+      shash::MkFromHexPtr(shash::HexPtr(line), shash::kSuffixCatalog));
+  }
+  fclose(f);
+  LogCvmfs(kLogCvmfs, kLogStdout,
+           "Using checkpoint of revision %s with %lu verified catalogs",
+           header[1].c_str(), checkpoint_catalogs_.size());
+  return true;
+}
+
+
+/**
+ * Replaces the checkpoint by the catalogs of the current check.  With merge,
+ * the catalogs of the previous checkpoint are kept, so that checking a tag or
+ * a subtree does not discard the catalogs verified by a check of the trunk.
+ */
+bool CommandCheck::WriteCheckpoint(const string &path, const bool merge) {
+  std::set<shash::Any> catalogs;
+  if (merge)
+    catalogs = checkpoint_catalogs_;
+  for (std::map<shash::Any, InspectedCatalog>::const_iterator i =
+       inspected_catalogs_.begin(), iEnd = inspected_catalogs_.end();
+       i != iEnd; ++i)
+  {
+    catalogs.insert(i->first);
+  }
+
+  string content = StringifyInt(GetCheckLevel()) + " " +
+                   StringifyInt(root_revision_) + "\n";
+  for (std::set<shash::Any>::const_iterator i = catalogs.begin(),
+       iEnd = catalogs.end(); i != iEnd; ++i)
+  {
+    content += i->ToString() + "\n";
+  }
+
+  const string tmp_path = path + ".tmp";
+  if (!SafeWriteToFile(content, tmp_path, kDefaultFileMode) ||
+      (rename(tmp_path.c_str(), path.c_str()) != 0))
+  {
+    LogCvmfs(kLogCvmfs, kLogStderr, "failed to write checkpoint %s (%d)",
+             path.c_str(), errno);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+
 int CommandCheck::Main(const swissknife::ArgumentList &args) {
   string tag_name;
-  string subtree_path = "";
   string pubkey_path = "";
   string trusted_certs = "";
   string repo_name = "";
   string reflog_chksum_path = "";
+  string checkpoint_path = "";
 
   temp_directory_ = (args.find('t') != args.end()) ? *args.find('t')->second
                                                    : "/tmp";
@@ -898,6 +1162,19 @@ int CommandCheck::Main(const swissknife::ArgumentList &args) {
     tag_name = *args.find('n')->second;
   if (args.find('c') != args.end())
     check_chunks_ = true;
+  if (args.find('V') != args.end()) {
+    check_chunks_ = true;
+    verify_content_ = true;
+  }
+  if (args.find('j') != args.end()) {
+    num_threads_ = String2Uint64(*args.find('j')->second);
+    if (num_threads_ == 0) {
+      LogCvmfs(kLogCvmfs, kLogStderr, "invalid number of threads");
+      return 1;
+    }
+  }
+  if (args.find('C') != args.end())
+    checkpoint_path = GetAbsolutePath(*args.find('C')->second);
   if (args.find('l') != args.end()) {
     unsigned log_level =
       kLogLevel0 << String2Uint64(*args.find('l')->second);
@@ -918,7 +1195,7 @@ int CommandCheck::Main(const swissknife::ArgumentList &args) {
 
   repo_base_path_ = MakeCanonicalPath(*args.find('r')->second);
   if (args.find('s') != args.end())
-    subtree_path = MakeCanonicalPath(*args.find('s')->second);
+    subtree_path_ = MakeCanonicalPath(*args.find('s')->second);
   if (args.find('R') != args.end())
     reflog_chksum_path = *args.find('R')->second;
 
@@ -1056,28 +1333,38 @@ int CommandCheck::Main(const swissknife::ArgumentList &args) {
              tag_name.c_str());
   }
 
-  const bool is_nested_catalog = (!subtree_path.empty());
-  if (is_nested_catalog && !FindSubtreeRootCatalog( subtree_path,
+  const bool is_nested_catalog = (!subtree_path_.empty());
+  if (is_nested_catalog && !FindSubtreeRootCatalog(subtree_path_,
                                                    &root_hash,
                                                    &root_size)) {
     LogCvmfs(kLogCvmfs, kLogStderr, "cannot find nested catalog at %s",
-             subtree_path.c_str());
+             subtree_path_.c_str());
     return 1;
   }
+  root_size_ = root_size;
 
-  catalog::DeltaCounters computed_counters;
-  successful = InspectTree(subtree_path,
-                           root_hash,
-                           root_size,
-                           is_nested_catalog,
-                           NULL,
-                           &computed_counters) && successful;
+  if (!checkpoint_path.empty() && !ReadCheckpoint(checkpoint_path))
+    return 1;
+
+  successful = InspectTree(repo_name, root_hash) && successful;
 
   if (!successful) {
     LogCvmfs(kLogCvmfs, kLogStderr, "CATALOG PROBLEMS OR OTHER ERRORS FOUND");
     return 1;
   }
 
+  // Only a check of the entire trunk knows all the catalogs worth keeping
+  const bool is_full_check = tag_name.empty() && !is_nested_catalog;
+  if (!checkpoint_path.empty() &&
+      !WriteCheckpoint(checkpoint_path, !is_full_check))
+  {
+    return 1;
+  }
+  if (atomic_read32(&num_skipped_catalogs_) > 0) {
+    LogCvmfs(kLogCvmfs, kLogStdout, "%d catalogs verified by a previous check",
+             atomic_read32(&num_skipped_catalogs_));
+  }
+
   LogCvmfs(kLogCvmfs, kLogStdout, "no problems found");
   return 0;
 }
@@ -1,15 +1,38 @@
 /**
  * This file is part of the CernVM File System.
+ *
+ * The catalogs are inspected by the parallel catalog traversal, nested
+ * catalogs before their parents.  Every catalog is checked on its own.  The
+ * parent checks the transition points, the catalog sizes, and the subtree
+ * counters using what its nested catalogs left behind in the table of
+ * inspected catalogs.  Data objects are checked by a pool of verifiers.
+ *
+ * A checkpoint file (-C) remembers the catalogs of the last successful check.
+ * A catalog hash covers the catalog's content including the hashes of its
+ * nested catalogs, so catalogs from the checkpoint are not inspected again,
+ * neither are their data objects.  Checks of a tag or of a subtree add their
+ * catalogs to the checkpoint, only a check of the entire trunk replaces it.
  */
 
 #ifndef CVMFS_SWISSKNIFE_CHECK_H_
 #define CVMFS_SWISSKNIFE_CHECK_H_
 
+#include <pthread.h>
+#include <stdint.h>
+
+#include <cassert>
+#include <map>
 #include <set>
 #include <string>
 
+#include "atomic.h"
 #include "catalog.h"
+#include "catalog_counters.h"
+#include "catalog_traversal.h"
+#include "directory_entry.h"
 #include "hash.h"
+#include "ingestion/task.h"
+#include "ingestion/tube.h"
 #include "swissknife.h"
 
 namespace download {
@@ -25,11 +48,24 @@ class Manifest;
 namespace swissknife {
 
 class CommandCheck : public Command {
+  friend class TaskVerifyObject;
+
  public:
   CommandCheck()
     : check_chunks_(false)
-    , is_remote_(false) {}
-  ~CommandCheck() { }
+    , verify_content_(false)
+    , is_remote_(false)
+    , num_threads_(kDefaultNumThreads)
+    , root_size_(0)
+    , root_revision_(0)
+    , object_queue_(NULL)
+  {
+    atomic_init32(&num_errors_);
+    atomic_init32(&num_skipped_catalogs_);
+    int retval = pthread_mutex_init(&lock_inspected_catalogs_, NULL);
+    assert(retval == 0);
+  }
+  ~CommandCheck() { pthread_mutex_destroy(&lock_inspected_catalogs_); }
   virtual std::string GetName() const { return "check"; }
   virtual std::string GetDescription() const {
     return "CernVM File System repository sanity checker\n"
@@ -48,19 +84,72 @@ class CommandCheck : public Command {
     r.push_back(Parameter::Optional('N', "name of the repository"));
     r.push_back(Parameter::Optional('R', "path to reflog.chksum file"));
     r.push_back(Parameter::Optional('@', "proxy url"));
+    r.push_back(Parameter::Optional('j', "number of concurrent catalog and "
+                                         "data chunk checks (default: 8)"));
+    r.push_back(Parameter::Optional('C', "checkpoint file of the verified "
+                                         "catalogs for incremental checks"));
     r.push_back(Parameter::Switch('c', "check availability of data chunks"));
+    r.push_back(Parameter::Switch('V', "verify the content hashes of data "
+                                       "chunks (implies -c)"));
     r.push_back(Parameter::Switch('L', "follow HTTP redirects"));
     return r;
   }
   int Main(const ArgumentList &args);
 
  protected:
-  bool InspectTree(const std::string               &path,
-                   const shash::Any                &catalog_hash,
-                   const uint64_t                   catalog_size,
-                   const bool                       is_nested_catalog,
-                   const catalog::DirectoryEntry  *transition_point,
-                   catalog::DeltaCounters         *computed_counters);
+  /**
+   * Thoroughness of a check; a checkpoint is only used by checks that are at
+   * most as thorough as the one that wrote it
+   */
+  enum CheckLevel {
+    kCheckCatalogs = 0,
+    kCheckAvailability,
+    kCheckContent,
+  };
+
+  /**
+   * What the parent catalog needs to know about an inspected nested catalog
+   */
+  struct InspectedCatalog {
+    InspectedCatalog() : file_size(0) { }
+    catalog::DirectoryEntry root_entry;
+    /**
+     * Computed counters including the subtree
+     */
+    catalog::DeltaCounters counters;
+    uint64_t file_size;
+  };
+
+  /**
+   * A data object referenced by a catalog entry
+   */
+  struct ObjectJob {
+    ObjectJob(const shash::Any &h, const std::string &p, const std::string &d)
+      : hash(h), object_path(p), description(d) { }
+    static ObjectJob *CreateQuitBeacon() {
+      return new ObjectJob(shash::Any(), "", "");
+    }
+    bool IsQuitBeacon() { return object_path.empty(); }
+    shash::Any hash;
+    std::string object_path;
+    std::string description;
+  };
+
+  bool InspectTree(const std::string &repo_name, const shash::Any &root_hash);
+  template <class ObjectFetcherT>
+  bool InspectTree(ObjectFetcherT *object_fetcher,
+                   const shash::Any &root_hash);
+  void InspectCatalog(const CatalogTraversalData<catalog::Catalog> &data);
+  bool CheckCatalog(const CatalogTraversalData<catalog::Catalog> &data,
+                    InspectedCatalog *inspected);
+  bool GetInspectedCatalog(const shash::Any &hash, InspectedCatalog *result);
+  void CheckObject(const shash::Any &hash,
+                   const std::string &object_path,
+                   const std::string &description);
+  void VerifyObject(const ObjectJob &job);
+  CheckLevel GetCheckLevel() const;
+  bool ReadCheckpoint(const std::string &path);
+  bool WriteCheckpoint(const std::string &path, const bool merge);
   catalog::Catalog* FetchCatalog(const std::string  &path,
                                  const shash::Any   &catalog_hash,
                                  const uint64_t      catalog_size = 0);
@@ -87,10 +176,56 @@ class CommandCheck : public Command {
                       const bool is_transition_point = false);
 
  private:
+  static const unsigned kDefaultNumThreads = 8;
+  /**
+   * The traversal blocks if the verifiers fall behind by that many objects
+   */
+  static const unsigned kMaxPendingObjects = 16384;
+
   std::string temp_directory_;
   std::string repo_base_path_;
+  std::string subtree_path_;
   bool        check_chunks_;
+  bool        verify_content_;
   bool        is_remote_;
+  unsigned    num_threads_;
+  uint64_t    root_size_;
+  uint64_t    root_revision_;
+
+  /**
+   * Filled by the catalog callbacks, which run concurrently
+   */
+  std::map<shash::Any, InspectedCatalog> inspected_catalogs_;
+  pthread_mutex_t lock_inspected_catalogs_;
+  /**
+   * Catalogs verified by a previous check, read-only during the traversal
+   */
+  std::set<shash::Any> checkpoint_catalogs_;
+  Tube<ObjectJob> *object_queue_;
+  atomic_int32 num_errors_;
+  atomic_int32 num_skipped_catalogs_;
+};
+
+
+/**
+ * Checks the data objects of the inspected catalogs concurrently.
+ */
+class TaskVerifyObject : public TubeConsumer<CommandCheck::ObjectJob> {
+ public:
+  TaskVerifyObject(CommandCheck *command,
+                   Tube<CommandCheck::ObjectJob> *tube)
+    : TubeConsumer<CommandCheck::ObjectJob>(tube)
+    , command_(command)
+  { }
+
+ protected:
+  virtual void Process(CommandCheck::ObjectJob *job) {
+    command_->VerifyObject(*job);
+    delete job;
+  }
+
+ private:
+  CommandCheck *command_;
 };
 
 }  // namespace swissknife
@@ -24,7 +24,7 @@ namespace swissknife {
 
 typedef HttpObjectFetcher<> ObjectFetcher;
 typedef CatalogTraversalParallel<ObjectFetcher> ReadonlyCatalogTraversal;
-typedef SmallhashFilter HashFilter;
+typedef CompactHashFilter HashFilter;
 typedef GarbageCollector<ReadonlyCatalogTraversal, HashFilter> GC;
 typedef GarbageCollectorAux<ReadonlyCatalogTraversal, HashFilter> GCAux;
 typedef GC::Configuration GcConfig;
@@ -42,10 +42,17 @@ ParameterList CommandGc::GetParams() const {
   r.push_back(Parameter::Optional('t', "temporary directory"));
   r.push_back(Parameter::Optional('L', "path to deletion log file"));
   r.push_back(Parameter::Optional('N', "number of threads to use"));
+  r.push_back(Parameter::Optional('M', "memory limit of the set of preserved "
+                                       "objects in MB (default: 4096)"));
+  r.push_back(Parameter::Optional('A', "keep objects younger than <A> "
+                                       "seconds in the storage sweep "
+                                       "(default: 86400)"));
   r.push_back(Parameter::Optional('@', "proxy url"));
   r.push_back(Parameter::Switch('d', "dry run"));
   r.push_back(Parameter::Switch('l', "list objects to be removed"));
   r.push_back(Parameter::Switch('I', "upload updated statistics DB file"));
+  r.push_back(Parameter::Switch('S', "sweep by listing the storage instead of "
+                                     "the condemned catalogs"));
   return r;
 }
 
@@ -81,6 +88,13 @@ int CommandGc::Main(const ArgumentList &args) {
   const bool upload_statsdb = (args.count('I') > 0);
   const unsigned int num_threads = (args.count('N') > 0) ?
     String2Uint64(*args.find('N')->second) : 8;
+  const uint64_t hash_filter_memory = (args.count('M') > 0) ?
+    String2Uint64(*args.find('M')->second) * 1024 * 1024 :
+    uint64_t(4096) * 1024 * 1024;
+  const bool sweep_storage = (args.count('S') > 0);
+  const time_t storage_grace_period = (args.count('A') > 0)
+    ? static_cast<time_t>(String2Uint64(*args.find('A')->second))
+    : GcConfig::kDefaultGracePeriod;
 
   if (revisions < 0) {
     LogCvmfs(kLogCvmfs, kLogStderr,
@@ -166,6 +180,10 @@ int CommandGc::Main(const ArgumentList &args) {
   config.statistics              = statistics();
   config.extended_stats          = extended_stats;
   config.num_threads             = num_threads;
+  config.hash_filter_memory      = hash_filter_memory;
+  config.temp_directory          = temp_directory;
+  config.sweep_storage           = sweep_storage;
+  config.storage_grace_period    = storage_grace_period;
 
   if (deletion_log_file != NULL) {
     const int bytes_written = fprintf(deletion_log_file,
@@ -204,6 +222,7 @@ int CommandGc::Main(const ArgumentList &args) {
   preserved_objects.Fill(manifest->certificate());
   preserved_objects.Fill(manifest->history());
   preserved_objects.Fill(manifest->meta_info());
+  preserved_objects.Freeze();
   GCAux collector_aux(config);
   success = collector_aux.CollectOlderThan(
     collector.oldest_trunk_catalog(), preserved_objects);
@@ -65,6 +65,7 @@ class CommandGraft : public Command {
   std::string input_file_;
   bool verbose_;
   zlib::Algorithms compression_alg_;
+  int compression_level_;
   shash::Algorithms hash_alg_;
   uint64_t chunk_size_;
   bool generate_bulk_hash_;
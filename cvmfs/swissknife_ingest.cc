@@ -65,8 +65,38 @@ int swissknife::Ingest::Main(const swissknife::ArgumentList &args) {
     }
   }
   if (args.find('Z') != args.end()) {
-    params.compression_alg =
-        zlib::ParseCompressionAlgorithm(*args.find('Z')->second);
+    params.compression_alg = zlib::ParseCompressionAlgorithm(
+      *args.find('Z')->second, &params.compression_level);
+  }
+
+  if (args.find('p') != args.end()) {
+    params.use_file_chunking = true;
+    if (args.find('l') != args.end()) {
+      params.min_file_chunk_size = String2Uint64(*args.find('l')->second);
+    }
+    if (args.find('a') != args.end()) {
+      params.avg_file_chunk_size = String2Uint64(*args.find('a')->second);
+    }
+    if (args.find('h') != args.end()) {
+      params.max_file_chunk_size = String2Uint64(*args.find('h')->second);
+    }
+    if ((params.min_file_chunk_size == 0) ||
+        (params.avg_file_chunk_size == 0) ||
+        (params.max_file_chunk_size == 0))
+    {
+      PrintError("Failed to read file chunk size values");
+      return 2;
+    }
+  }
+  if (args.find('G') != args.end()) {
+    params.chunking_alg = ParseChunkingAlgorithm(*args.find('G')->second);
+    if (params.chunking_alg == kChunkUnknown) {
+      PrintError("unknown chunking algorithm");
+      return 1;
+    }
+  }
+  if (args.find('j') != args.end()) {
+    params.compression_segment_size = String2Uint64(*args.find('j')->second);
   }
 
   bool create_catalog = args.find('C') != args.end();
@@ -100,6 +130,10 @@ int swissknife::Ingest::Main(const swissknife::ArgumentList &args) {
     spooler_definition.number_of_concurrent_uploads =
         params.max_concurrent_write_jobs;
   }
+  spooler_definition.compression_level = params.compression_level;
+  spooler_definition.chunking_alg = params.chunking_alg;
+  spooler_definition.compression_segment_size =
+    params.compression_segment_size;
 
   // Sanitize base_directory, removing any leading or trailing slashes
   // from non-root (!= "/") paths
@@ -43,6 +43,17 @@ class Ingest : public Command {
     r.push_back(Parameter::Optional('@', "proxy url"));
     r.push_back(Parameter::Switch('I', "upload updated statistics DB file"));
 
+    r.push_back(Parameter::Switch('p', "enable file chunking"));
+    r.push_back(Parameter::Optional('l', "minimal file chunk size in bytes"));
+    r.push_back(Parameter::Optional('a', "desired average chunk size (bytes)"));
+    r.push_back(Parameter::Optional('h', "maximal file chunk size in bytes"));
+    r.push_back(Parameter::Optional('G',
+                                    "chunking algorithm "
+                                    "(default: xor32)"));
+    r.push_back(Parameter::Optional('j',
+                                    "segment size for parallel compression "
+                                    "of large chunks (default: disabled)"));
+
     return r;
   }
   int Main(const ArgumentList &args);
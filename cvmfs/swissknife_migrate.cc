@@ -10,6 +10,8 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <cerrno>
+
 #include "catalog_rw.h"
 #include "catalog_sql.h"
 #include "catalog_virtual.h"
@@ -17,6 +19,8 @@
 #include "hash.h"
 #include "logging.h"
 #include "swissknife_history.h"
+#include "util/posix.h"
+#include "util/string.h"
 #include "util_concurrency.h"
 
 using namespace std;  // NOLINT
@@ -31,9 +35,19 @@ CommandMigrate::CommandMigrate() :
   has_committed_new_revision_(false),
   uid_(0),
   gid_(0),
-  root_catalog_(NULL)
+  root_catalog_(NULL),
+  checkpoint_file_(NULL)
 {
   atomic_init32(&catalogs_processed_);
+  int retval = pthread_mutex_init(&lock_checkpoint_, NULL);
+  assert(retval == 0);
+}
+
+
+CommandMigrate::~CommandMigrate() {
+  if (checkpoint_file_ != NULL)
+    fclose(checkpoint_file_);
+  pthread_mutex_destroy(&lock_checkpoint_);
 }
 
 
@@ -58,6 +72,8 @@ ParameterList CommandMigrate::GetParams() const {
   r.push_back(Parameter::Optional('i', "UID map for chown"));
   r.push_back(Parameter::Optional('j', "GID map for chown"));
   r.push_back(Parameter::Optional('@', "proxy url"));
+  r.push_back(Parameter::Optional('C',
+    "checkpoint file to resume an interrupted migration"));
   r.push_back(Parameter::Switch('f', "fix nested catalog transition points"));
   r.push_back(Parameter::Switch('l', "disable linkcount analysis of files"));
   r.push_back(Parameter::Switch('s',
@@ -122,6 +138,19 @@ int CommandMigrate::Main(const ArgumentList &args) {
     manual_root_hash = shash::MkFromHexPtr(shash::HexPtr(
       *args.find('h')->second), shash::kSuffixCatalog);
   }
+  if (args.count('C') > 0)
+    checkpoint_path_ = *args.find('C')->second;
+
+  // A checkpoint can only be resumed by the same migration
+  for (ArgumentList::const_iterator i = args.begin(); i != args.end(); ++i) {
+    if ((i->first == 'C') || (i->first == 'o') || (i->first == 't') ||
+        (i->first == '@'))
+    {
+      continue;
+    }
+    checkpoint_fingerprint_ +=
+      std::string("-") + i->first + " " + *i->second + " ";
+  }
 
   // We might need a lot of file descriptors
   if (!RaiseFileDescriptorLimit()) {
@@ -253,6 +282,8 @@ int CommandMigrate::Main(const ArgumentList &args) {
     return 5;
   }
 
+  RemoveCheckpoint();
+
   // Analyze collected statistics
   if (collect_catalog_statistics && has_committed_new_revision_) {
     LogCvmfs(kLogCatalog, kLogStdout, "\nCollected statistics results:");
@@ -399,11 +430,21 @@ bool CommandMigrate::DoMigrationAndCommit(
   concurrent_migration.RegisterListener(&CommandMigrate::MigrationCallback,
                                          this);
 
-  // Migrate catalogs recursively (starting with the deepest nested catalogs)
+  // Migrate catalogs starting with the deepest nested catalogs.  A catalog is
+  // scheduled as soon as all of its nested catalogs are uploaded.
   LogCvmfs(kLogCatalog, kLogStdout, "\nMigrating catalogs...");
   PendingCatalog *root_catalog = new PendingCatalog(root_catalog_);
+  const unsigned num_migrations = PreparePendingCatalogs<MigratorT>(
+    root_catalog, ResumeFromCheckpoint<MigratorT>(root_catalog));
+  if (num_migrations < catalog_count_) {
+    const unsigned num_finished = catalog_count_ - num_migrations;
+    LogCvmfs(kLogCatalog, kLogStdout,
+             "Resuming migration, %u catalogs already migrated", num_finished);
+    atomic_xadd32(&catalogs_processed_, num_finished);
+  }
   migration_stopwatch_.Start();
-  ConvertCatalogsRecursively(root_catalog, &concurrent_migration);
+  for (unsigned i = 0; i < num_migrations; ++i)
+    concurrent_migration.Schedule(ready_catalogs_.PopFront());
   concurrent_migration.WaitForEmptyQueue();
   spooler_->WaitForUpload();
   spooler_->UnregisterListeners();
@@ -427,9 +468,11 @@ bool CommandMigrate::DoMigrationAndCommit(
     manifest.set_catalog_hash(root_catalog->new_catalog_hash);
     manifest.set_catalog_size(root_catalog->new_catalog_size);
     manifest.set_root_path(root_catalog->root_path());
-    const catalog::Catalog* new_catalog = (root_catalog->HasNew())
-                                          ? root_catalog->new_catalog
-                                          : root_catalog->old_catalog;
+    const catalog::Catalog* new_catalog = root_catalog->old_catalog;
+    if (root_catalog->HasNew())
+      new_catalog = root_catalog->new_catalog;
+    else if (resumed_root_catalog_.IsValid())
+      new_catalog = resumed_root_catalog_.weak_ref();
     manifest.set_ttl(new_catalog->GetTTL());
     manifest.set_revision(new_catalog->GetRevision());
 
@@ -508,7 +551,7 @@ void CommandMigrate::MigrationCallback(PendingCatalog *const &data) {
 
   if (!data->HasChanges()) {
     PrintStatusMessage(data, data->GetOldContentHash(), "preserved");
-    data->was_updated.Set(false);
+    OnCatalogFinished(data);
     return;
   }
 
@@ -569,15 +612,31 @@ void CommandMigrate::UploadCallback(const upload::SpoolerResult &result) {
     PrintStatusMessage(catalog, result.content_hash, "migrated and uploaded");
 
     // The catalog is completely processed... fill the content_hash to allow the
-    // processing of parent catalogs (Notified by 'was_updated'-future)
+    // processing of parent catalogs
     // NOTE: From now on, this PendingCatalog structure could be deleted and
     //       should not be used anymore!
     catalog->new_catalog_hash = result.content_hash;
-    catalog->was_updated.Set(true);
+    OnCatalogFinished(catalog);
   }
 }
 
 
+/**
+ * Records a migrated (or unchanged) catalog and schedules its parent once the
+ * parent has no more pending nested catalogs.
+ */
+void CommandMigrate::OnCatalogFinished(PendingCatalog *catalog) {
+  const bool was_updated = !catalog->new_catalog_hash.IsNull();
+  WriteCheckpoint(catalog);
+
+  // Once was_updated is set, the root catalog can be deleted
+  PendingCatalog *parent = catalog->parent;
+  catalog->was_updated.Set(was_updated);
+  if ((parent != NULL) && (atomic_xadd32(&parent->nested_pending, -1) == 1))
+    ready_catalogs_.EnqueueBack(parent);
+}
+
+
 void CommandMigrate::PrintStatusMessage(const PendingCatalog *catalog,
                                         const shash::Any     &content_hash,
                                         const std::string    &message) {
@@ -592,10 +651,17 @@ void CommandMigrate::PrintStatusMessage(const PendingCatalog *catalog,
 }
 
 
+/**
+ * Creates the pending catalogs of the subtree and puts the catalogs without
+ * nested catalogs to migrate into the ready queue.  Subtrees that are already
+ * migrated according to the checkpoint are only kept for the cleanup.  Returns
+ * the number of catalogs that need to be migrated.
+ */
 template <class MigratorT>
-void CommandMigrate::ConvertCatalogsRecursively(PendingCatalog *catalog,
-                                                MigratorT       *migrator) {
-  // First migrate all nested catalogs (depth first traversal)
+unsigned CommandMigrate::PreparePendingCatalogs(PendingCatalog *catalog,
+                                                const bool is_finished)
+{
+  unsigned num_migrations = is_finished ? 0 : 1;
   const catalog::CatalogList nested_catalogs =
     catalog->old_catalog->GetChildren();
   catalog::CatalogList::const_iterator i    = nested_catalogs.begin();
@@ -603,12 +669,144 @@ void CommandMigrate::ConvertCatalogsRecursively(PendingCatalog *catalog,
   catalog->nested_catalogs.reserve(nested_catalogs.size());
   for (; i != iend; ++i) {
     PendingCatalog *new_nested = new PendingCatalog(*i);
+    new_nested->parent = catalog;
     catalog->nested_catalogs.push_back(new_nested);
-    ConvertCatalogsRecursively(new_nested, migrator);
+    const bool is_nested_finished =
+      is_finished || ResumeFromCheckpoint<MigratorT>(new_nested);
+    if (!is_nested_finished)
+      atomic_inc32(&catalog->nested_pending);
+    num_migrations +=
+      PreparePendingCatalogs<MigratorT>(new_nested, is_nested_finished);
   }
 
-  // Migrate this catalog referencing all its (already migrated) children
-  migrator->Schedule(catalog);
+  if (!is_finished && (atomic_read32(&catalog->nested_pending) == 0))
+    ready_catalogs_.EnqueueBack(catalog);
+  return num_migrations;
+}
+
+
+/**
+ * Reads the catalogs migrated by a previous, interrupted run with the same
+ * fingerprint and opens the checkpoint for appending.
+ */
+bool CommandMigrate::OpenCheckpoint(const std::string &fingerprint) {
+  FILE *f = fopen(checkpoint_path_.c_str(), "r");
+  if (f != NULL) {
+    std::string line;
+    if (GetLineFile(f, &line) && (line == fingerprint)) {
+      while (GetLineFile(f, &line)) {
+        const std::vector<std::string> fields = SplitString(line, ' ');
+        if (fields.size() != 3)
+          continue;
+        CheckpointEntry entry;
+        if (fields[1] != "-") {
+          entry.new_catalog_hash =
+            shash::MkFromSuffixedHexPtr(shash::HexPtr(fields[1]));
+        }
+        entry.new_catalog_size = String2Uint64(fields[2]);
+        checkpoint_[shash::MkFromSuffixedHexPtr(shash::HexPtr(fields[0]))] =
+          entry;
+      }
+    } else {
+      LogCvmfs(kLogCatalog, kLogStdout,
+               "Ignoring checkpoint of a different migration");
+    }
+    fclose(f);
+  }
+
+  checkpoint_file_ = fopen(checkpoint_path_.c_str(),
+                           checkpoint_.empty() ? "w" : "a");
+  if (checkpoint_file_ == NULL)
+    return false;
+  if (checkpoint_.empty())
+    fprintf(checkpoint_file_, "%s\n", fingerprint.c_str());
+  return fflush(checkpoint_file_) == 0;
+}
+
+
+/**
+ * Reads the counters and the root entry of a catalog migrated by a previous
+ * run.
+ */
+bool CommandMigrate::ReadMigratedCatalog(
+  const catalog::Catalog  &migrated_catalog,
+  CheckpointEntry         *entry) const
+{
+  const catalog::CatalogDatabase &database = migrated_catalog.database();
+  if (!entry->migrated_counters.ReadFromDatabase(
+        database, catalog::LegacyMode::kLegacy))
+  {
+    return false;
+  }
+
+  const std::string root_path = migrated_catalog.mountpoint().ToString();
+  catalog::SqlLookupPathHash lookup_root_entry(database);
+  if (!lookup_root_entry.BindPathHash(
+        shash::Md5(root_path.data(), root_path.size())) ||
+      !lookup_root_entry.FetchRow())
+  {
+    return false;
+  }
+  entry->root_entry = lookup_root_entry.GetDirent(&migrated_catalog);
+  return true;
+}
+
+
+/**
+ * Takes the result of a previous run if the catalog was migrated and its new
+ * version could be loaded.  The parent, if it is migrated again, gets the
+ * statistics and the root entry of the migrated catalog.
+ */
+template <class MigratorT>
+bool CommandMigrate::ResumeFromCheckpoint(PendingCatalog *catalog) {
+  std::map<shash::Any, CheckpointEntry>::const_iterator i =
+    checkpoint_.find(catalog->GetOldContentHash());
+  if (i == checkpoint_.end())
+    return false;
+
+  const CheckpointEntry &entry = i->second;
+  catalog->nested_statistics.Set(MigratorT::GetResumedStatistics(
+    catalog->old_catalog, entry.migrated_counters));
+  catalog->root_entry.Set(entry.root_entry);
+  if (entry.new_catalog_hash.IsNull()) {
+    catalog->was_updated.Set(false);
+    return true;
+  }
+  catalog->new_catalog_hash = entry.new_catalog_hash;
+  catalog->new_catalog_size = entry.new_catalog_size;
+  catalog->was_updated.Set(true);
+  return true;
+}
+
+
+void CommandMigrate::WriteCheckpoint(const PendingCatalog *catalog) {
+  if (checkpoint_file_ == NULL)
+    return;
+
+  const std::string new_hash = catalog->new_catalog_hash.IsNull()
+                               ? "-"
+                               : catalog->new_catalog_hash.ToString(true);
+  MutexLockGuard guard(&lock_checkpoint_);
+  fprintf(checkpoint_file_, "%s %s %lu\n",
+          catalog->GetOldContentHash().ToString(true).c_str(),
+          new_hash.c_str(),
+          static_cast<unsigned long>(catalog->new_catalog_size));  // NOLINT
+  fflush(checkpoint_file_);
+}
+
+
+/**
+ * The checkpoint is not needed anymore after a successful migration
+ */
+void CommandMigrate::RemoveCheckpoint() {
+  if (checkpoint_file_ == NULL)
+    return;
+  fclose(checkpoint_file_);
+  checkpoint_file_ = NULL;
+  if ((unlink(checkpoint_path_.c_str()) != 0) && (errno != ENOENT)) {
+    LogCvmfs(kLogCatalog, kLogStderr, "failed to remove checkpoint %s",
+             checkpoint_path_.c_str());
+  }
 }
 
 
@@ -637,6 +835,9 @@ bool CommandMigrate::ConfigureSQLite() const {
 
 void CommandMigrate::AnalyzeCatalogStatistics() const {
   const unsigned int number_of_catalogs = catalog_statistics_list_.size();
+  // Resumed migrations have no statistics of the catalogs migrated before
+  if (number_of_catalogs == 0)
+    return;
   unsigned int       aggregated_entry_count = 0;
   unsigned int       aggregated_max_row_id = 0;
   unsigned int       aggregated_hardlink_count = 0;
@@ -690,6 +891,11 @@ void CommandMigrate::AnalyzeCatalogStatistics() const {
 
 
 CommandMigrate::PendingCatalog::~PendingCatalog() {
+  // Only resumed catalogs still have their nested catalogs here
+  for (unsigned i = 0; i < nested_catalogs.size(); ++i)
+    delete nested_catalogs[i];
+  nested_catalogs.clear();
+
   delete old_catalog;
   old_catalog = NULL;
 
@@ -750,7 +956,8 @@ bool CommandMigrate::AbstractMigrationWorker<DerivedT>::
 
   // go through all nested catalogs and update their references (we are curently
   // in their parent catalog)
-  // Note: we might need to wait for the nested catalog to be fully processed.
+  // Note: the catalog is only scheduled once its nested catalogs are fully
+  //       processed.
   PendingCatalogList::const_iterator i    = data->nested_catalogs.begin();
   PendingCatalogList::const_iterator iend = data->nested_catalogs.end();
   for (; i != iend; ++i) {
@@ -1697,6 +1904,21 @@ CommandMigrate::MigrationWorker_217::MigrationWorker_217(
 { }
 
 
+/**
+ * The migration only adds counters to the legacy ones of the old catalog
+ */
+catalog::DeltaCounters
+CommandMigrate::MigrationWorker_217::GetResumedStatistics(
+  const catalog::Catalog   *old_catalog,
+  const catalog::Counters  &migrated_counters)
+{
+  catalog::Counters legacy_counters;
+  legacy_counters.ReadFromDatabase(old_catalog->database(),
+                                   catalog::LegacyMode::kLegacy);
+  return catalog::Counters::Diff(legacy_counters, migrated_counters);
+}
+
+
 bool CommandMigrate::MigrationWorker_217::RunMigration(PendingCatalog *data)
   const
 {
@@ -7,6 +7,9 @@
 
 #include "swissknife.h"
 
+#include <pthread.h>
+
+#include <cstdio>
 #include <map>
 #include <string>
 #include <vector>
@@ -16,6 +19,7 @@
 #include "catalog_traversal.h"
 #include "hash.h"
 #include "history_sqlite.h"
+#include "ingestion/tube.h"
 #include "logging.h"
 #include "manifest.h"
 #include "uid_map.h"
@@ -69,7 +73,11 @@ class CommandMigrate : public Command {
       : success(false)
       , old_catalog(old_catalog)
       , new_catalog(NULL)
-      , new_catalog_size(0) { }
+      , parent(NULL)
+      , new_catalog_size(0)
+    {
+      atomic_init32(&nested_pending);
+    }
     virtual ~PendingCatalog();
 
     inline const std::string root_path() const {
@@ -93,6 +101,10 @@ class CommandMigrate : public Command {
     catalog::WritableCatalog         *new_catalog;
 
     PendingCatalogList                nested_catalogs;
+    PendingCatalog                   *parent;
+    // Number of nested catalogs that still need to be migrated and uploaded.
+    // The catalog is scheduled for migration once it drops to zero.
+    atomic_int32                      nested_pending;
     Future<catalog::DirectoryEntry>   root_entry;
     Future<catalog::DeltaCounters>    nested_statistics;
 
@@ -109,6 +121,19 @@ class CommandMigrate : public Command {
   class PendingCatalogMap : public std::map<std::string, const PendingCatalog*>,
                             public Lockable {};
 
+  /**
+   * A catalog that was migrated by a previous run.  The counters and the root
+   * entry are read from the migrated catalog for the parents that are migrated
+   * again.
+   */
+  struct CheckpointEntry {
+    CheckpointEntry() : new_catalog_size(0) { }
+    shash::Any               new_catalog_hash;
+    size_t                   new_catalog_size;
+    catalog::Counters        migrated_counters;
+    catalog::DirectoryEntry  root_entry;
+  };
+
   template<class DerivedT>
   class AbstractMigrationWorker : public ConcurrentWorker<DerivedT> {
    public:
@@ -130,6 +155,17 @@ class CommandMigrate : public Command {
 
     void operator()(const expected_data &data);
 
+    /**
+     * The statistics that a catalog migrated by a previous run passes on to
+     * its parent, given the counters of its migrated version
+     */
+    static catalog::DeltaCounters GetResumedStatistics(
+      const catalog::Catalog   *old_catalog,
+      const catalog::Counters  &migrated_counters)
+    {
+      return catalog::Counters::Diff(catalog::Counters(), migrated_counters);
+    }
+
    protected:
     bool RunMigration(PendingCatalog *data) const { return false; }
 
@@ -213,6 +249,10 @@ class CommandMigrate : public Command {
    public:
     explicit MigrationWorker_217(const worker_context *context);
 
+    static catalog::DeltaCounters GetResumedStatistics(
+      const catalog::Catalog   *old_catalog,
+      const catalog::Counters  &migrated_counters);
+
    protected:
     bool RunMigration(PendingCatalog *data) const;
 
@@ -312,7 +352,7 @@ class CommandMigrate : public Command {
 
  public:
   CommandMigrate();
-  ~CommandMigrate() { }
+  ~CommandMigrate();
   virtual std::string GetName() const { return "migrate"; }
   virtual std::string GetDescription() const {
     return "CernVM-FS catalog repository migration \n"
@@ -355,9 +395,81 @@ class CommandMigrate : public Command {
     CatalogTraversal<ObjectFetcherT> traversal(params);
     traversal.RegisterListener(&CommandMigrate::CatalogCallback, this);
 
-    if (manual_root_hash.IsNull())
-      return traversal.Traverse();
-    return traversal.Traverse(manual_root_hash);
+    const bool retval_traversal = manual_root_hash.IsNull()
+                                  ? traversal.Traverse()
+                                  : traversal.Traverse(manual_root_hash);
+    if (!retval_traversal)
+      return false;
+
+    if (checkpoint_path_.empty())
+      return true;
+    if (!OpenCheckpoint(checkpoint_fingerprint_ +
+                        root_catalog_->hash().ToString(true)))
+    {
+      LogCvmfs(kLogCvmfs, kLogStderr, "could not open checkpoint %s",
+               checkpoint_path_.c_str());
+      return false;
+    }
+    LoadMigratedCatalogs(root_catalog_, false, object_fetcher);
+    return true;
+  }
+
+  /**
+   * Loads the migrated versions of the topmost catalogs in the checkpoint.
+   * Their parents are migrated again and need the statistics and the root
+   * entries of the migrated nested catalogs.  Catalogs whose migrated version
+   * cannot be loaded anymore are removed from the checkpoint.
+   */
+  template <class ObjectFetcherT>
+  void LoadMigratedCatalogs(const catalog::Catalog  *catalog,
+                            const bool               is_parent_finished,
+                            ObjectFetcherT          *object_fetcher)
+  {
+    bool is_finished = is_parent_finished;
+    std::map<shash::Any, CheckpointEntry>::iterator i =
+      checkpoint_.find(catalog->hash());
+    if (!is_finished && (i != checkpoint_.end())) {
+      is_finished = LoadMigratedCatalog(catalog, object_fetcher, &i->second);
+      if (!is_finished)
+        checkpoint_.erase(i);
+    }
+
+    const catalog::CatalogList nested_catalogs = catalog->GetChildren();
+    catalog::CatalogList::const_iterator j    = nested_catalogs.begin();
+    catalog::CatalogList::const_iterator jend = nested_catalogs.end();
+    for (; j != jend; ++j)
+      LoadMigratedCatalogs(*j, is_finished, object_fetcher);
+  }
+
+  template <class ObjectFetcherT>
+  bool LoadMigratedCatalog(const catalog::Catalog  *catalog,
+                           ObjectFetcherT          *object_fetcher,
+                           CheckpointEntry         *entry)
+  {
+    // Unchanged catalogs are their own migrated version
+    if (entry->new_catalog_hash.IsNull())
+      return ReadMigratedCatalog(*catalog, entry);
+
+    UniquePtr<typename ObjectFetcherT::CatalogTN> migrated_catalog;
+    const ObjectFetcherFailures::Failures retval =
+      object_fetcher->FetchCatalog(entry->new_catalog_hash,
+                                   catalog->mountpoint().ToString(),
+                                   &migrated_catalog,
+                                   !catalog->IsRoot());
+    if ((retval != ObjectFetcherFailures::kFailOk) ||
+        !ReadMigratedCatalog(*migrated_catalog.weak_ref(), entry))
+    {
+      LogCvmfs(kLogCatalog, kLogStdout,
+               "migrated catalog %s is not available, migrating %s again",
+               entry->new_catalog_hash.ToString().c_str(),
+               catalog->hash().ToString().c_str());
+      return false;
+    }
+
+    // The manifest of a resumed root catalog is taken from its migrated version
+    if (catalog->IsRoot())
+      resumed_root_catalog_ = migrated_catalog.Release();
+    return true;
   }
 
   void CatalogCallback(
@@ -374,7 +486,17 @@ class CommandMigrate : public Command {
                             typename MigratorT::worker_context  *context);
 
   template <class MigratorT>
-  void ConvertCatalogsRecursively(PendingCatalog *catalog, MigratorT *migrator);
+  unsigned PreparePendingCatalogs(PendingCatalog *catalog,
+                                  const bool is_finished);
+  void OnCatalogFinished(PendingCatalog *catalog);
+
+  bool OpenCheckpoint(const std::string &fingerprint);
+  bool ReadMigratedCatalog(const catalog::Catalog  &migrated_catalog,
+                           CheckpointEntry         *entry) const;
+  template <class MigratorT>
+  bool ResumeFromCheckpoint(PendingCatalog *catalog);
+  void WriteCheckpoint(const PendingCatalog *catalog);
+  void RemoveCheckpoint();
   bool RaiseFileDescriptorLimit() const;
   bool ConfigureSQLite() const;
   void AnalyzeCatalogStatistics() const;
@@ -413,6 +535,24 @@ class CommandMigrate : public Command {
   catalog::Catalog const*     root_catalog_;
   UniquePtr<upload::Spooler>  spooler_;
   PendingCatalogMap           pending_catalogs_;
+  /**
+   * Catalogs whose nested catalogs are all migrated, in the order in which
+   * they become ready.  Independent subtrees are thus migrated in parallel.
+   */
+  Tube<PendingCatalog>        ready_catalogs_;
+
+  /**
+   * The checkpoint records the migrated catalogs, so that an interrupted
+   * migration resumes with the remaining ones.  Its first line identifies the
+   * migration parameters and the root catalog; the other lines are
+   * <old catalog hash> <new catalog hash or '-'> <new catalog size>
+   */
+  std::string                            checkpoint_path_;
+  std::string                            checkpoint_fingerprint_;
+  FILE                                  *checkpoint_file_;
+  pthread_mutex_t                        lock_checkpoint_;
+  std::map<shash::Any, CheckpointEntry>  checkpoint_;
+  UniquePtr<catalog::WritableCatalog>    resumed_root_catalog_;
 
   StopWatch  catalog_loading_stopwatch_;
   StopWatch  migration_stopwatch_;
@@ -18,8 +18,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -41,6 +44,7 @@
 #include "util/exception.h"
 #include "util/posix.h"
 #include "util/shared_ptr.h"
+#include "util/single_copy.h"
 #include "util/string.h"
 #include "util_concurrency.h"
 
@@ -88,13 +92,76 @@ class ChunkJob {
   unsigned char            digest[shash::kMaxDigestSize];
 };
 
-static void SpoolerOnUpload(const upload::SpoolerResult &result) {
-  unlink(result.local_path.c_str());
-  if (result.return_code != 0) {
-    PANIC(kLogStderr, "spooler failure %d (%s, hash: %s)", result.return_code,
-          result.local_path.c_str(), result.content_hash.ToString().c_str());
+
+/**
+ * Limits the volume of downloaded objects that wait in the temporary directory
+ * for the spooler.  Download workers block once the budget is exhausted until
+ * enough uploads have been completed.  An object larger than the budget is
+ * admitted only if nothing else is in flight.
+ */
+class StorageBudget : SingleCopy {
+ public:
+  explicit StorageBudget(const uint64_t limit) : limit_(limit), used_(0) {
+    int retval = pthread_mutex_init(&lock_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_, NULL);
+    assert(retval == 0);
   }
-}
+
+  ~StorageBudget() {
+    pthread_cond_destroy(&cond_);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  void Acquire(const string &path, const uint64_t size) {
+    MutexLockGuard m(&lock_);
+    while ((used_ > 0) && (used_ + size > limit_))
+      pthread_cond_wait(&cond_, &lock_);
+    used_ += size;
+    in_flight_[path] = size;
+  }
+
+  void Release(const string &path) {
+    MutexLockGuard m(&lock_);
+    map<string, uint64_t>::iterator i = in_flight_.find(path);
+    if (i == in_flight_.end())
+      return;
+    used_ -= i->second;
+    in_flight_.erase(i);
+    pthread_cond_broadcast(&cond_);
+  }
+
+ private:
+  const uint64_t limit_;
+  uint64_t used_;
+  map<string, uint64_t> in_flight_;
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+};
+
+
+/**
+ * A pulled catalog whose upload is deferred to the next checkpoint.  Nesting
+ * level increases with the recursion, so stores are ordered by depth.
+ */
+struct PendingCatalog {
+  PendingCatalog(const string &p, const shash::Any &h, const unsigned d)
+    : local_path(p), hash(h), depth(d) { }
+  bool operator <(const PendingCatalog &other) const {
+    return depth > other.depth;
+  }
+  string local_path;
+  shash::Any hash;
+  unsigned depth;
+};
+
+// Existence of chunks is checked in batches of this size
+const unsigned kPeekBatchSize = 512;
+// Pulled catalogs are stored at the latest after this many catalogs
+const unsigned kCatalogCheckpoint = 64;
+// Default for the volume of fetched objects awaiting upload (in MB)
+const uint64_t kDefaultStorageBudgetMb = 1024;
+
 
 SharedPtr<string>    stratum0_url;
 SharedPtr<string>    stratum1_url;
@@ -118,10 +185,28 @@ bool                 preload_cache = false;
 string              *preload_cachedir = NULL;
 bool                 inspect_existing_catalogs = false;
 manifest::Reflog    *reflog = NULL;
+StorageBudget       *storage_budget = NULL;
+// Only accessed by the catalog traversal
+vector<PendingCatalog> pending_catalogs;
+set<shash::Any>      pending_catalog_hashes;
+// Chunks handed to the workers since the last checkpoint
+set<shash::Any>      scheduled_chunks;
+unsigned             catalog_depth = 0;
 
 }  // anonymous namespace
 
 
+static void SpoolerOnUpload(const upload::SpoolerResult &result) {
+  if (storage_budget != NULL)
+    storage_budget->Release(result.local_path);
+  unlink(result.local_path.c_str());
+  if (result.return_code != 0) {
+    PANIC(kLogStderr, "spooler failure %d (%s, hash: %s)", result.return_code,
+          result.local_path.c_str(), result.content_hash.ToString().c_str());
+  }
+}
+
+
 static std::string MakePath(const shash::Any &hash) {
   return (preload_cache)
     ? *preload_cachedir + "/" + hash.MakePathWithoutSuffix()
@@ -138,6 +223,72 @@ static bool Peek(const shash::Any &remote_hash) {
   return Peek(MakePath(remote_hash));
 }
 
+
+/**
+ * Catalogs pulled in this run are present even before their deferred upload.
+ */
+static bool PeekCatalog(const shash::Any &catalog_hash) {
+  return (pending_catalog_hashes.count(catalog_hash) > 0) ||
+         Peek(catalog_hash);
+}
+
+
+static void CountChunk() {
+  if (atomic_xadd64(&overall_chunks, 1) % 1000 == 0)
+    LogCvmfs(kLogCvmfs, kLogStdout | kLogNoLinebreak, ".");
+}
+
+
+/**
+ * Checks the existence of a batch of chunks in one go and hands the missing
+ * ones over to the download workers.
+ *
+ * @return the number of chunks scheduled for download
+ */
+static unsigned ScheduleChunks(const vector<ChunkJob> &chunks) {
+  // Chunks shared with a catalog processed shortly before might still be in
+  // flight; they must not be fetched twice
+  vector<const ChunkJob *> candidates;
+  vector<string> paths;
+  for (unsigned i = 0; i < chunks.size(); ++i) {
+    const shash::Any hash = chunks[i].hash();
+    if (scheduled_chunks.count(hash) > 0) {
+      CountChunk();
+      continue;
+    }
+    candidates.push_back(&chunks[i]);
+    paths.push_back(MakePath(hash));
+  }
+
+  vector<bool> found(paths.size(), false);
+  if (preload_cache) {
+    for (unsigned i = 0; i < paths.size(); ++i)
+      found[i] = FileExists(paths[i]);
+  } else {
+    spooler->PeekMany(paths, &found);
+  }
+
+  unsigned num_scheduled = 0;
+  for (unsigned i = 0; i < candidates.size(); ++i) {
+    if (found[i]) {
+      CountChunk();
+      continue;
+    }
+    scheduled_chunks.insert(candidates[i]->hash());
+    atomic_inc64(&chunk_queue);
+    WritePipe(pipe_chunks[1], candidates[i], sizeof(ChunkJob));
+    num_scheduled++;
+  }
+  return num_scheduled;
+}
+
+
+static void WaitForChunks() {
+  while (atomic_read64(&chunk_queue) != 0) {
+    SafeSleepMs(100);
+  }
+}
+
 static void ReportDownloadError(const download::JobInfo &download_job) {
   const download::Failures error_code = download_job.error_code;
   const int http_code = download_job.http_code;
@@ -179,10 +330,10 @@ static void ReportDownloadError(const download::JobInfo &download_job) {
 static void Store(
   const string &local_path,
   const string &remote_path,
-  const bool compressed_src)
+  const zlib::Algorithms compression_alg)
 {
   if (preload_cache) {
-    if (!compressed_src) {
+    if (compression_alg == zlib::kNoCompression) {
       int retval = rename(local_path.c_str(), remote_path.c_str());
       if (retval != 0) {
         PANIC(kLogStderr, "Failed to move '%s' to '%s'", local_path.c_str(),
@@ -196,7 +347,8 @@ static void Store(
         PANIC(kLogStderr, "Failed to create temporary file '%s'",
               remote_path.c_str());
       }
-      int retval = zlib::DecompressPath2File(local_path, fdest);
+      int retval =
+        zlib::DecompressPath2File(local_path, fdest, compression_alg);
       if (!retval) {
         PANIC(kLogStderr, "Failed to preload %s to %s", local_path.c_str(),
               remote_path.c_str());
@@ -214,9 +366,9 @@ static void Store(
 static void Store(
   const string &local_path,
   const shash::Any &remote_hash,
-  const bool compressed_src = true)
+  const zlib::Algorithms compression_alg = zlib::kZlibDefault)
 {
-  Store(local_path, MakePath(remote_hash), compressed_src);
+  Store(local_path, MakePath(remote_hash), compression_alg);
 }
 
 
@@ -234,7 +386,7 @@ static void StoreBuffer(const unsigned char *buffer, const unsigned size,
   }
   assert(retval);
   fclose(ftmp);
-  Store(tmp_file, dest_path, true);
+  Store(tmp_file, dest_path, zlib::kZlibDefault);
 }
 
 static void StoreBuffer(const unsigned char *buffer, const unsigned size,
@@ -248,6 +400,43 @@ static void WaitForStorage() {
 }
 
 
+/**
+ * Stores the catalogs pulled since the last checkpoint.  A catalog must only
+ * become visible once all of its chunks and all of its nested catalogs are
+ * stored, otherwise an interrupted replication would later skip the missing
+ * parts.  Therefore the checkpoint waits for all outstanding chunks and then
+ * stores the catalogs level by level, deepest first.
+ */
+static void FlushCatalogs() {
+  if (pending_catalogs.empty())
+    return;
+
+  WaitForChunks();
+  WaitForStorage();
+  std::stable_sort(pending_catalogs.begin(), pending_catalogs.end());
+  for (unsigned i = 0; i < pending_catalogs.size(); ++i) {
+    if ((i > 0) && (pending_catalogs[i].depth != pending_catalogs[i-1].depth))
+      WaitForStorage();
+    Store(pending_catalogs[i].local_path, pending_catalogs[i].hash);
+  }
+  WaitForStorage();
+  pending_catalogs.clear();
+  pending_catalog_hashes.clear();
+  scheduled_chunks.clear();
+}
+
+
+static void DeferCatalog(const string &local_path,
+                         const shash::Any &catalog_hash)
+{
+  pending_catalogs.push_back(
+    PendingCatalog(local_path, catalog_hash, catalog_depth));
+  pending_catalog_hashes.insert(catalog_hash);
+  if (pending_catalogs.size() >= kCatalogCheckpoint)
+    FlushCatalogs();
+}
+
+
 struct MainWorkerContext {
   download::DownloadManager *download_manager;
 };
@@ -270,28 +459,29 @@ static void *MainWorker(void *data) {
     LogCvmfs(kLogCvmfs, kLogVerboseMsg, "processing chunk %s",
              chunk_hash.ToString().c_str());
 
-    if (!Peek(chunk_hash)) {
-      string tmp_file;
-      FILE *fchunk = CreateTempFile(*temp_dir + "/cvmfs", 0600, "w",
-                                    &tmp_file);
-      assert(fchunk);
-      string url_chunk = *stratum0_url + "/data/" + chunk_hash.MakePath();
-      download::JobInfo download_chunk(&url_chunk, false, false, fchunk,
-                                       &chunk_hash);
-
-      const download::Failures download_result =
-                                       download_manager->Fetch(&download_chunk);
-      if (download_result != download::kFailOk) {
-        ReportDownloadError(download_chunk);
-        PANIC(kLogStderr, "Download error");
-      }
-      fclose(fchunk);
-      Store(tmp_file, chunk_hash,
-            (compression_alg == zlib::kZlibDefault) ? true : false);
-      atomic_inc64(&overall_new);
+    // Existence has been checked by the catalog traversal
+    string tmp_file;
+    FILE *fchunk = CreateTempFile(*temp_dir + "/cvmfs", 0600, "w",
+                                  &tmp_file);
+    assert(fchunk);
+    string url_chunk = *stratum0_url + "/data/" + chunk_hash.MakePath();
+    download::JobInfo download_chunk(&url_chunk, false, false, fchunk,
+                                     &chunk_hash);
+    // Catalog downloads of the traversal take precedence
+    download_chunk.priority = download::kPriorityBulk;
+
+    const download::Failures download_result =
+                                     download_manager->Fetch(&download_chunk);
+    if (download_result != download::kFailOk) {
+      ReportDownloadError(download_chunk);
+      PANIC(kLogStderr, "Download error");
     }
-    if (atomic_xadd64(&overall_chunks, 1) % 1000 == 0)
-      LogCvmfs(kLogCvmfs, kLogStdout | kLogNoLinebreak, ".");
+    fclose(fchunk);
+    if (storage_budget != NULL)
+      storage_budget->Acquire(tmp_file, GetFileSize(tmp_file));
+    Store(tmp_file, chunk_hash, compression_alg);
+    atomic_inc64(&overall_new);
+    CountChunk();
     atomic_dec64(&chunk_queue);
   }
   return NULL;
@@ -310,7 +500,9 @@ bool CommandPull::PullRecursion(catalog::Catalog   *catalog,
     } else {
       LogCvmfs(kLogCvmfs, kLogStdout, "Replicating from historic catalog %s",
                previous_catalog.ToString().c_str());
+      catalog_depth++;
       bool retval = Pull(previous_catalog, path);
+      catalog_depth--;
       if (!retval)
         return false;
     }
@@ -326,7 +518,9 @@ bool CommandPull::PullRecursion(catalog::Catalog   *catalog,
     {
       LogCvmfs(kLogCvmfs, kLogStdout, "Replicating from catalog at %s",
                i->mountpoint.c_str());
+      catalog_depth++;
       bool retval = Pull(i->hash, i->mountpoint.ToString());
+      catalog_depth--;
       if (!retval)
         return false;
     }
@@ -342,9 +536,11 @@ bool CommandPull::Pull(const shash::Any   &catalog_hash,
   assert(shash::kSuffixCatalog == catalog_hash.suffix);
 
   // Check if the catalog already exists
-  if (Peek(catalog_hash)) {
-    // Preload: dirtab changed
-    if (inspect_existing_catalogs) {
+  if (PeekCatalog(catalog_hash)) {
+    // Preload: dirtab changed.  Catalogs pulled in this run are complete.
+    if (inspect_existing_catalogs &&
+        (pending_catalog_hashes.count(catalog_hash) == 0))
+    {
       if (!preload_cache) {
         PANIC(kLogStderr, "to be implemented: -t without -c");
       }
@@ -373,9 +569,6 @@ bool CommandPull::Pull(const shash::Any   &catalog_hash,
     return true;
   }
 
-  int64_t gauge_chunks = atomic_read64(&overall_chunks);
-  int64_t gauge_new = atomic_read64(&overall_new);
-
   // Download and uncompress catalog
   shash::Any chunk_hash;
   zlib::Algorithms compression_alg;
@@ -445,7 +638,8 @@ bool CommandPull::Pull(const shash::Any   &catalog_hash,
   }
   apply_timestamp_threshold = true;
 
-  // Traverse the chunks
+  // Traverse the chunks.  Missing chunks are fetched and stored by the
+  // workers while the traversal continues with the nested catalogs.
   LogCvmfs(kLogCvmfs, kLogStdout | kLogNoLinebreak,
            "  Processing chunks [%" PRIu64 " registered chunks]: ",
            catalog->GetNumChunks());
@@ -454,28 +648,32 @@ bool CommandPull::Pull(const shash::Any   &catalog_hash,
     LogCvmfs(kLogCvmfs, kLogStderr, "failed to gather chunks");
     goto pull_cleanup;
   }
-  while (catalog->AllChunksNext(&chunk_hash, &compression_alg)) {
-    ChunkJob next_chunk(chunk_hash, compression_alg);
-    WritePipe(pipe_chunks[1], &next_chunk, sizeof(next_chunk));
-    atomic_inc64(&chunk_queue);
-  }
-  catalog->AllChunksEnd();
-  while (atomic_read64(&chunk_queue) != 0) {
-    SafeSleepMs(100);
+  {
+    uint64_t num_chunks = 0;
+    uint64_t num_scheduled = 0;
+    vector<ChunkJob> batch;
+    while (catalog->AllChunksNext(&chunk_hash, &compression_alg)) {
+      batch.push_back(ChunkJob(chunk_hash, compression_alg));
+      if (batch.size() == kPeekBatchSize) {
+        num_scheduled += ScheduleChunks(batch);
+        num_chunks += batch.size();
+        batch.clear();
+      }
+    }
+    num_scheduled += ScheduleChunks(batch);
+    num_chunks += batch.size();
+    catalog->AllChunksEnd();
+    LogCvmfs(kLogCvmfs, kLogStdout, " fetching %" PRIu64 " new chunks out of "
+             "%" PRIu64 " unique chunks", num_scheduled, num_chunks);
   }
-  LogCvmfs(kLogCvmfs, kLogStdout, " fetched %" PRId64 " new chunks out of "
-           "%" PRId64 " unique chunks",
-           atomic_read64(&overall_new)-gauge_new,
-           atomic_read64(&overall_chunks)-gauge_chunks);
 
   retval = PullRecursion(catalog, path);
 
   delete catalog;
   unlink(file_catalog.c_str());
-  WaitForStorage();
   if (!retval)
     return false;
-  Store(file_catalog_vanilla, catalog_hash);
+  DeferCatalog(file_catalog_vanilla, catalog_hash);
   return true;
 
  pull_cleanup:
@@ -530,6 +728,9 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
     trusted_certs = *args.find('y')->second;
   if (args.find('n') != args.end())
     num_parallel = String2Uint64(*args.find('n')->second);
+  uint64_t storage_budget_mb = kDefaultStorageBudgetMb;
+  if (args.find('b') != args.end())
+    storage_budget_mb = String2Uint64(*args.find('b')->second);
   if (args.find('t') != args.end())
     timeout = String2Uint64(*args.find('t')->second);
   if (args.find('a') != args.end())
@@ -686,6 +887,7 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
     spooler = upload::Spooler::Construct(spooler_definition);
     assert(spooler);
     spooler->RegisterListener(&SpoolerOnUpload);
+    storage_budget = new StorageBudget(storage_budget_mb * 1024 * 1024);
   }
 
   // Open the reflog for modification
@@ -797,7 +999,7 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
                                  iend = historic_tags.end();
        i != iend; ++i)
   {
-    if (Peek(i->root_hash))
+    if (PeekCatalog(i->root_hash))
       continue;
     LogCvmfs(kLogCvmfs, kLogStdout, "Replicating from %s repository tag",
              i->name.c_str());
@@ -805,6 +1007,9 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
     bool retval2 = Pull(i->root_hash, "");
     retval = retval && retval2;
   }
+  // Catalogs whose subtree has been pulled completely are stored even if
+  // other parts of the replication failed
+  FlushCatalogs();
 
   // Stopping threads
   LogCvmfs(kLogCvmfs, kLogStdout, "Stopping %u workers", num_parallel);
@@ -915,6 +1120,8 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
     UnlockFile(fd_lockfile);
   free(workers);
   delete spooler;
+  delete storage_budget;
+  storage_budget = NULL;
   delete pathfilter;
   return result;
 }
@@ -83,6 +83,10 @@ void CommandScrub::FileCallback(
   if (hash_string.empty()) {
     return;
   }
+  // Catalog deltas are named after their base and the catalog they produce
+  if (*(file_name.end() - 1) == shash::kSuffixCatalogDelta) {
+    return;
+  }
 
   if (!shash::HexPtr(hash_string).IsValid()) {
     PrintAlert(Alerts::kMalformedHash, full_path, hash_string);
@@ -166,7 +170,8 @@ std::string CommandScrub::CheckPathAndExtractHash(
       last_character != shash::kSuffixPartial &&
       last_character != shash::kSuffixCertificate &&
       last_character != shash::kSuffixMicroCatalog &&
-      last_character != shash::kSuffixMetainfo) {
+      last_character != shash::kSuffixMetainfo &&
+      last_character != shash::kSuffixCatalogDelta) {
     PrintAlert(Alerts::kUnexpectedModifier, full_path);
     return "";
   }
@@ -54,6 +54,7 @@
 #include "sync_union.h"
 #include "sync_union_aufs.h"
 #include "sync_union_overlayfs.h"
+#include "util/posix.h"
 #include "util/string.h"
 
 using namespace std;  // NOLINT
@@ -655,8 +656,18 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
     }
   }
   if (args.find('Z') != args.end()) {
-    params.compression_alg =
-        zlib::ParseCompressionAlgorithm(*args.find('Z')->second);
+    params.compression_alg = zlib::ParseCompressionAlgorithm(
+      *args.find('Z')->second, &params.compression_level);
+  }
+  if (args.find('G') != args.end()) {
+    params.chunking_alg = ParseChunkingAlgorithm(*args.find('G')->second);
+    if (params.chunking_alg == kChunkUnknown) {
+      PrintError("unknown chunking algorithm");
+      return 1;
+    }
+  }
+  if (args.find('j') != args.end()) {
+    params.compression_segment_size = String2Uint64(*args.find('j')->second);
   }
 
   if (args.find('C') != args.end()) {
@@ -707,6 +718,14 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
     params.ignore_special_files = true;
   }
 
+  if (args.find('1') != args.end()) {
+    params.reuse_unchanged_files = true;
+  }
+
+  if (args.find('3') != args.end()) {
+    params.catalog_deltas = true;
+  }
+
   if (args.find('P') != args.end()) {
     params.session_token_file = *args.find('P')->second;
   }
@@ -724,6 +743,8 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
   }
 
   const bool upload_statsdb = (args.count('I') > 0);
+  const std::string statistics_json_path =
+    (args.count('2') > 0) ? *args.find('2')->second : "";
 
   if (!CheckParams(params)) return 2;
   // This may fail, in which case a warning is printed and the process continues
@@ -742,6 +763,10 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
         params.max_concurrent_write_jobs;
   }
   spooler_definition.num_upload_tasks = params.num_upload_tasks;
+  spooler_definition.chunking_alg = params.chunking_alg;
+  spooler_definition.compression_segment_size =
+    params.compression_segment_size;
+  spooler_definition.compression_level = params.compression_level;
 
   upload::SpoolerDefinition spooler_definition_catalogs(
       spooler_definition.Dup2DefaultCompression());
@@ -800,6 +825,7 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
       download_manager(), params.enforce_limits, params.nested_kcatalog_limit,
       params.root_kcatalog_limit, params.file_mbyte_limit, statistics(),
       params.is_balanced, params.max_weight, params.min_weight);
+  catalog_manager.SetCatalogDeltas(params.catalog_deltas);
   catalog_manager.Init();
 
   publish::SyncMediator mediator(&catalog_manager, &params, publish_statistics);
@@ -921,6 +947,15 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
     }
   }
 
+  if (!statistics_json_path.empty()) {
+    if (!SafeWriteToFile(this->statistics()->PrintJSON(), statistics_json_path,
+                         kDefaultFileMode))
+    {
+      LogCvmfs(kLogCvmfs, kLogStderr, "Warning: failed to write %s",
+               statistics_json_path.c_str());
+    }
+  }
+
   delete params.spooler;
 
   if (!manifest->Export(params.manifest_path)) {
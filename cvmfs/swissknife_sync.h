@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "compression.h"
+#include "ingestion/chunk_detector.h"
 #include "repository_tag.h"
 #include "swissknife.h"
 #include "upload.h"
@@ -40,8 +41,13 @@ struct SyncParameters {
         voms_authz(false),
         virtual_dir_actions(0),
         ignore_special_files(false),
+        reuse_unchanged_files(false),
+        catalog_deltas(false),
         branched_catalog(false),
         compression_alg(zlib::kZlibDefault),
+        compression_level(0),
+        chunking_alg(kChunkXor32),
+        compression_segment_size(0),
         enforce_limits(false),
         nested_kcatalog_limit(0),
         root_kcatalog_limit(0),
@@ -90,8 +96,13 @@ struct SyncParameters {
   bool voms_authz;
   int virtual_dir_actions;  // bit field
   bool ignore_special_files;
+  bool reuse_unchanged_files;
+  bool catalog_deltas;
   bool branched_catalog;
   zlib::Algorithms compression_alg;
+  int compression_level;
+  ChunkingAlgorithms chunking_alg;
+  size_t compression_segment_size;
   bool enforce_limits;
   unsigned nested_kcatalog_limit;
   unsigned root_kcatalog_limit;
@@ -285,6 +296,15 @@ class CommandSync : public Command {
     r.push_back(Parameter::Optional('Z',
                                     "compression algorithm "
                                     "(default: zlib)"));
+    r.push_back(Parameter::Optional('G',
+                                    "chunking algorithm "
+                                    "(default: xor32)"));
+    r.push_back(Parameter::Optional('j',
+                                    "segment size for parallel compression "
+                                    "of large chunks (default: disabled)"));
+    r.push_back(Parameter::Optional('2',
+                                    "write the publish statistics including "
+                                    "the ingestion pipeline as JSON to file"));
     r.push_back(Parameter::Optional('S',
                                     "virtual directory options "
                                     "[snapshots, remove]"));
@@ -294,6 +314,12 @@ class CommandSync : public Command {
                                   "tweaks"));
     r.push_back(Parameter::Switch('i', "ignore x-directory hardlinks"));
     r.push_back(Parameter::Switch('g', "ignore special files"));
+    r.push_back(Parameter::Switch('1',
+                                  "reuse the content of files with unchanged "
+                                  "size and mtime"));
+    r.push_back(Parameter::Switch('3',
+                                  "upload deltas of the changed catalogs "
+                                  "for clients"));
     r.push_back(Parameter::Switch('k', "include extended attributes"));
     r.push_back(Parameter::Switch('m', "create micro catalogs"));
     r.push_back(Parameter::Switch('n', "create new repository"));
@@ -187,6 +187,11 @@ uint64_t SyncItem::GetRdOnlySize() const {
   return rdonly_stat_.stat.st_size;
 }
 
+time_t SyncItem::GetUnionMtime() const {
+  StatUnion();
+  return union_stat_.stat.st_mtime;
+}
+
 IngestionSource *SyncItemNative::CreateIngestionSource() const {
   return new FileIngestionSource(GetUnionPath());
 }
@@ -170,6 +170,7 @@ class SyncItem {
   uint64_t GetUnionInode() const;
   uint64_t GetScratchSize() const;
   uint64_t GetRdOnlySize() const;
+  time_t GetUnionMtime() const;
 
   inline std::string filename() const { return filename_; }
   inline std::string relative_parent_path() const {
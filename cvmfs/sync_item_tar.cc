@@ -4,6 +4,7 @@
 
 #include "sync_item_tar.h"
 
+#include <cstdlib>
 #include <string>
 
 #include "directory_entry.h"
@@ -24,10 +25,27 @@ SyncItemTar::SyncItemTar(const std::string &relative_parent_path,
       archive_(archive),
       archive_entry_(entry),
       obtained_tar_stat_(false),
-      read_archive_signal_(read_archive_signal) {
+      read_archive_signal_(read_archive_signal),
+      payload_(NULL),
+      read_ahead_(NULL) {
   GetStatFromTar();
 }
 
+SyncItemTar::~SyncItemTar() {
+  // The item has been dropped without ever being processed by the pipeline
+  if (payload_ != NULL) {
+    free(payload_);
+    read_ahead_->Decrement();
+  }
+}
+
+void SyncItemTar::SetPayload(unsigned char *buffer,
+                             SynchronizingCounter<uint32_t> *read_ahead) {
+  assert(payload_ == NULL);
+  payload_ = buffer;
+  read_ahead_ = read_ahead;
+}
+
 void SyncItemTar::StatScratch(const bool refresh) const {
   if (scratch_stat_.obtained && !refresh) return;
   scratch_stat_.stat = GetStatFromTar();
@@ -143,6 +161,13 @@ catalog::DirectoryEntryBase SyncItemTar::CreateBasicCatalogDirent() const {
 }
 
 IngestionSource *SyncItemTar::CreateIngestionSource() const {
+  if (payload_ != NULL) {
+    IngestionSource *source = new TarBufferIngestionSource(
+      GetUnionPath(), payload_, tar_stat_.st_size, read_ahead_);
+    payload_ = NULL;
+    read_ahead_ = NULL;
+    return source;
+  }
   return new TarIngestionSource(GetUnionPath(), archive_, archive_entry_,
                                 read_archive_signal_);
 }
@@ -22,6 +22,7 @@ class SyncItemTar : public SyncItem {
   friend class SyncUnionTarball;
 
  public:
+  virtual ~SyncItemTar();
   virtual catalog::DirectoryEntryBase CreateBasicCatalogDirent() const;
   virtual IngestionSource *CreateIngestionSource() const;
   virtual void MakePlaceholderDirectory() const { rdonly_type_ = kItemDir; }
@@ -34,6 +35,14 @@ class SyncItemTar : public SyncItem {
               const std::string &filename, struct archive *archive,
               struct archive_entry *entry, Signal *read_archive_signal,
               const SyncUnion *union_engine);
+  /**
+   * Hands the content of the entry, read ahead by SyncUnionTarball, over to
+   * the item.  The ingestion source created for the item takes ownership of
+   * the buffer and returns the read-ahead slot once the pipeline has consumed
+   * the data.
+   */
+  void SetPayload(unsigned char *buffer,
+                  SynchronizingCounter<uint32_t> *read_ahead);
 
  private:
   struct archive *archive_;
@@ -42,6 +51,8 @@ class SyncItemTar : public SyncItem {
   mutable platform_stat64 tar_stat_;
   mutable bool obtained_tar_stat_;
   Signal *read_archive_signal_;
+  mutable unsigned char *payload_;
+  mutable SynchronizingCounter<uint32_t> *read_ahead_;
 };
 
 }  // namespace publish
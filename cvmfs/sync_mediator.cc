@@ -176,6 +176,9 @@ void SyncMediator::Touch(SharedPtr<SyncItem> entry) {
     return;
   }
 
+  if (params_->reuse_unchanged_files && ReuseUnchangedFile(entry))
+    return;
+
   if (entry->IsRegularFile() || entry->IsSymlink() || entry->IsSpecialFile()) {
     Replace(entry);  // This way, hardlink processing is correct
     // Replace calls Remove; cancel Remove's actions:
@@ -224,6 +227,81 @@ void SyncMediator::Touch(SharedPtr<SyncItem> entry) {
 }
 
 
+/**
+ * The union file system copies up a file on any change, including pure
+ * meta-data changes such as chmod or chown.  If the size and the mtime of a
+ * touched regular file match its catalog entry, the file is assumed to be
+ * unchanged (cf. rsync's quick check).  The new catalog entry then takes the
+ * content hash and the chunk list from the old one, so that the file does not
+ * go through the ingestion pipeline again.
+ * Returns false if the file needs to be processed.
+ */
+bool SyncMediator::ReuseUnchangedFile(SharedPtr<SyncItem> entry) {
+  if (params_->dry_run || !entry->IsRegularFile() || !entry->WasRegularFile() ||
+      entry->IsBundleSpec() || entry->HasGraftMarker() ||
+      entry->HasHardlinks() || (entry->GetRdOnlyLinkcount() > 1))
+  {
+    return false;
+  }
+  if (entry->GetScratchSize() != entry->GetRdOnlySize())
+    return false;
+
+  const std::string path = "/" + entry->GetRelativePath();
+  catalog::DirectoryEntry dirent;
+  if (!catalog_manager_->LookupPath(path, catalog::kLookupSole, &dirent))
+    return false;
+  // Only reuse what the current settings would produce for the same content
+  if (!dirent.IsRegular() ||
+      (dirent.size() != entry->GetScratchSize()) ||
+      (dirent.mtime() != entry->GetUnionMtime()) ||
+      (dirent.hash_algorithm() != params_->spooler->GetHashAlgorithm()) ||
+      (dirent.compression_algorithm() != params_->compression_alg) ||
+      (dirent.IsExternalFile() != entry->IsExternalData()))
+  {
+    return false;
+  }
+  FileChunkList chunks;
+  if (dirent.IsChunkedFile()) {
+    const bool retval = catalog_manager_->ListFileChunks(
+      PathString(path), dirent.hash_algorithm(), &chunks);
+    if (!retval || chunks.IsEmpty())
+      return false;
+  }
+
+  LogCvmfs(kLogPublish, kLogVerboseMsg, "reusing content %s of %s",
+           dirent.checksum().ToString().c_str(), path.c_str());
+  RemoveFile(entry);
+  // RemoveFile counts a removed file; cancel it as Touch() does after Replace()
+  perf::Dec(counters_->n_files_removed);
+  perf::Xadd(counters_->sz_removed_bytes, -entry->GetRdOnlySize());
+  reporter_->OnAdd(entry->GetUnionPath(), catalog::DirectoryEntry());
+  entry->SetContentHash(dirent.checksum());
+  entry->SetCompressionAlgorithm(dirent.compression_algorithm());
+
+  XattrList *xattrs = &default_xattrs_;
+  if (params_->include_xattrs) {
+    xattrs = XattrList::CreateFromFile(entry->GetUnionPath());
+    assert(xattrs != NULL);
+  }
+  if (dirent.IsChunkedFile()) {
+    catalog_manager_->AddChunkedFile(entry->CreateBasicCatalogDirent(),
+                                     *xattrs,
+                                     entry->relative_parent_path(),
+                                     chunks);
+  } else {
+    catalog_manager_->AddFile(entry->CreateBasicCatalogDirent(),
+                              *xattrs,
+                              entry->relative_parent_path());
+  }
+  if (xattrs != &default_xattrs_)
+    free(xattrs);
+
+  perf::Inc(counters_->n_files_changed);
+  perf::Inc(counters_->n_files_reused);
+  return true;
+}
+
+
 /**
  * Remove an entry from the repository. Directories will be recursively removed.
  */
@@ -186,6 +186,7 @@ class SyncMediator : public virtual AbstractSyncMediator {
   // Called after figuring out the type of a path (file, symlink, dir)
   void AddFile(SharedPtr<SyncItem> entry);
   void RemoveFile(SharedPtr<SyncItem> entry);
+  bool ReuseUnchangedFile(SharedPtr<SyncItem> entry);
 
   void AddDirectory(SharedPtr<SyncItem> entry);
   void RemoveDirectory(SharedPtr<SyncItem> entry);
@@ -9,6 +9,7 @@
 #include <pthread.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <list>
@@ -42,7 +43,8 @@ SyncUnionTarball::SyncUnionTarball(AbstractSyncMediator *mediator,
       base_directory_(base_directory),
       to_delete_(to_delete),
       create_catalog_on_root_(create_catalog_on_root),
-      read_archive_signal_(new Signal) {}
+      read_archive_signal_(new Signal),
+      read_ahead_files_(kMaxReadAheadFiles) {}
 
 SyncUnionTarball::~SyncUnionTarball() { delete read_archive_signal_; }
 
@@ -58,6 +60,7 @@ bool SyncUnionTarball::Initialize() {
   src = archive_read_new();
   assert(ARCHIVE_OK == archive_read_support_format_tar(src));
   assert(ARCHIVE_OK == archive_read_support_format_empty(src));
+  SupportCompressedArchives();
 
   if (tarball_path_ == "-") {
     result = archive_read_open_filename(src, NULL, kBlockSize);
@@ -75,6 +78,29 @@ bool SyncUnionTarball::Initialize() {
   return SyncUnion::Initialize();
 }
 
+/**
+ * The libarchive shipped with cvmfs is built without compression libraries.
+ * Compressed tarballs are recognized by their magic number and piped through
+ * an external decompressor instead.  The decompressor runs as a separate
+ * process concurrently to the archive reader and to the ingestion pipeline.
+ * Neither gzip nor zstd streams can be split for decompression, so the
+ * decompression itself remains sequential; pigz at least moves reading,
+ * writing, and check summing of the stream into separate threads.
+ */
+void SyncUnionTarball::SupportCompressedArchives() {
+  static const unsigned char kMagicGzip[] = {0x1f, 0x8b};
+  static const unsigned char kMagicZstd[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+  const std::string gzip =
+      FindExecutable("pigz").empty() ? "gzip -dc" : "pigz -dc";
+  int retval = archive_read_support_filter_program_signature(
+      src, gzip.c_str(), kMagicGzip, sizeof(kMagicGzip));
+  assert(retval == ARCHIVE_OK);
+  retval = archive_read_support_filter_program_signature(
+      src, "zstd -dc", kMagicZstd, sizeof(kMagicZstd));
+  assert(retval == ARCHIVE_OK);
+}
+
 /*
  * Libarchive is not thread aware, so we need to make sure that before
  * to read/"open" the next header in the archive the content of the
@@ -89,6 +115,10 @@ bool SyncUnionTarball::Initialize() {
  * not reading data anymore from there.
  * This whole process is not necessary for directories since we don't
  * actually need to read data from them.
+ * Nor is it necessary for small regular files: their content is read ahead
+ * into memory right away (see ReadAhead()), so that the traversal continues
+ * while the pipeline processes many small files concurrently.  Only large
+ * files are streamed from the archive by the pipeline in lockstep.
  *
  * It may be needed to add a catalog as a root of the archive.
  * A possible way to do it is by creating an virtual `.cvmfscatalog` file and
@@ -202,8 +232,9 @@ void SyncUnionTarball::ProcessArchiveEntry(struct archive_entry *entry) {
 
   CreateDirectories(parent_path);
 
-  SharedPtr<SyncItem> sync_entry = SharedPtr<SyncItem>(new SyncItemTar(
-      parent_path, filename, src, entry, read_archive_signal_, this));
+  SyncItemTar *tar_entry = new SyncItemTar(
+      parent_path, filename, src, entry, read_archive_signal_, this);
+  SharedPtr<SyncItem> sync_entry = SharedPtr<SyncItem>(tar_entry);
 
   if (NULL != archive_entry_hardlink(entry)) {
     const std::string hardlink_name(
@@ -239,11 +270,14 @@ void SyncUnionTarball::ProcessArchiveEntry(struct archive_entry *entry) {
                                      // can read the next header
 
   } else if (sync_entry->IsRegularFile()) {
-    // inside the process pipeline we will wake up the signal
+    const bool is_read_ahead = ReadAhead(tar_entry);
+    // unless read ahead, the signal is woken up inside the process pipeline
     ProcessFile(sync_entry);
     if (filename == ".cvmfscatalog") {
       to_create_catalog_dirs_.insert(parent_path);
     }
+    if (is_read_ahead)
+      read_archive_signal_->Wakeup();
 
   } else if (sync_entry->IsSymlink() || sync_entry->IsFifo() ||
              sync_entry->IsSocket() || sync_entry->IsCharacterDevice() ||
@@ -273,6 +307,36 @@ void SyncUnionTarball::ProcessArchiveEntry(struct archive_entry *entry) {
   }
 }
 
+/**
+ * Reads the content of small regular files into memory.  Blocks while
+ * kMaxReadAheadFiles buffers are waiting for the pipeline.  Returns false if
+ * the file is too large and should be streamed by the pipeline instead.
+ */
+bool SyncUnionTarball::ReadAhead(SyncItemTar *entry) {
+  const uint64_t size = entry->GetScratchSize();
+  if (size > kMaxReadAheadSize)
+    return false;
+
+  read_ahead_files_.Increment();
+  unsigned char *buffer =
+      static_cast<unsigned char *>(smalloc(std::max(size, uint64_t(1))));
+  uint64_t pos = 0;
+  while (pos < size) {
+    const ssize_t nbytes = archive_read_data(src, buffer + pos, size - pos);
+    if (nbytes < 0) {
+      PANIC(kLogStderr, "failed to read data from the tar entry: %s\n%s",
+            entry->GetUnionPath().c_str(), archive_error_string(src));
+    }
+    if (nbytes == 0) {
+      PANIC(kLogStderr, "truncated tar entry: %s",
+            entry->GetUnionPath().c_str());
+    }
+    pos += nbytes;
+  }
+  entry->SetPayload(buffer, &read_ahead_files_);
+  return true;
+}
+
 std::string SyncUnionTarball::SanitizePath(const std::string &path) {
   if (path.length() >= 2) {
     if (path[0] == '.' && path[1] == '/') {
@@ -12,6 +12,7 @@
 #include "sync_union.h"
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include <list>
 #include <map>
@@ -24,6 +25,7 @@
 namespace publish {
 
 class AbstractSyncMediator;
+class SyncItemTar;
 
 class SyncUnionTarball : public SyncUnion {
  public:
@@ -91,7 +93,21 @@ class SyncUnionTarball : public SyncUnion {
    */
   Signal *read_archive_signal_;
 
+  /**
+   * Number of regular files whose content has been read ahead into memory but
+   * not yet been consumed by the ingestion pipeline.  Bounds the memory used
+   * for read-ahead to kMaxReadAheadFiles * kMaxReadAheadSize.
+   */
+  SynchronizingCounter<uint32_t> read_ahead_files_;
+
   static const size_t kBlockSize = 4096 * 4;
+  /**
+   * Regular files up to this size are read into memory by the traversal
+   * thread so that it can continue with the next entry immediately.  Larger
+   * files are streamed by the pipeline directly from the archive.
+   */
+  static const uint64_t kMaxReadAheadSize = 1024 * 1024;
+  static const uint32_t kMaxReadAheadFiles = 128;
 
   /**
    * create missing directory and all the ancestors
@@ -106,6 +122,8 @@ class SyncUnionTarball : public SyncUnion {
    */
   void CreateDirectories(const std::string &target);
   void ProcessArchiveEntry(struct archive_entry *entry);
+  bool ReadAhead(SyncItemTar *entry);
+  void SupportCompressedArchives();
   std::string SanitizePath(const std::string &path);
 };  // class SyncUnionTarball
 
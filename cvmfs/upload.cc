@@ -50,7 +50,8 @@ bool Spooler::Initialize(perf::StatisticsTemplate *statistics) {
 
   // configure the file processor context
   ingestion_pipeline_ =
-      new IngestionPipeline(uploader_.weak_ref(), spooler_definition_);
+      new IngestionPipeline(uploader_.weak_ref(), spooler_definition_,
+                            statistics);
   ingestion_pipeline_->RegisterListener(&Spooler::ProcessingCallback, this);
   ingestion_pipeline_->Spawn();
 
@@ -125,6 +126,12 @@ bool Spooler::Peek(const std::string &path) const {
   return uploader_->Peek(path);
 }
 
+void Spooler::PeekMany(const std::vector<std::string> &paths,
+                       std::vector<bool> *found) const
+{
+  uploader_->PeekMany(paths, found);
+}
+
 bool Spooler::Mkdir(const std::string &path) {
   return uploader_->Mkdir(path);
 }
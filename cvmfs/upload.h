@@ -264,6 +264,16 @@ class Spooler : public Observable<SpoolerResult> {
    */
   bool Peek(const std::string &path) const;
 
+  /**
+   * Checks for a batch of files if they are present in the backend storage.
+   * Backends can overlap the checks, e.g. S3 pipelines the HEAD requests.
+   *
+   * @param paths  the paths of the files to be peeked
+   * @param found  receives for each path if it was found in the backend
+   */
+  void PeekMany(const std::vector<std::string> &paths,
+                std::vector<bool> *found) const;
+
   /**
    * Make directory in upstream storage. Noop if directory already present.
    * NOTE: currently only used to create the 'stats/' subdirectory
@@ -37,6 +37,81 @@ AbstractUploader::UploadJob::UploadJob(
   , content_hash(content_hash)
 { }
 
+ObjectPresenceCache::ObjectPresenceCache() : generation_(0) {
+  entries_.Init(1024, shash::Md5(shash::AsciiPtr("!")), HashMd5);
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+}
+
+
+ObjectPresenceCache::~ObjectPresenceCache() {
+  pthread_mutex_destroy(&lock_);
+}
+
+
+ObjectPresence ObjectPresenceCache::Lookup(const std::string &path) {
+  const shash::Md5 key(path.data(), path.length());
+  ObjectPresence presence = kPresenceUnknown;
+  MutexLockGuard guard(&lock_);
+  entries_.Lookup(key, &presence);
+  return presence;
+}
+
+
+void ObjectPresenceCache::Insert(
+  const std::string &path,
+  ObjectPresence presence)
+{
+  if (presence == kPresenceUnknown) {
+    Forget(path);
+    return;
+  }
+  const shash::Md5 key(path.data(), path.length());
+  MutexLockGuard guard(&lock_);
+  if (entries_.size() >= kMaxEntries)
+    entries_.Clear();
+  entries_.Insert(key, presence);
+}
+
+
+void ObjectPresenceCache::Forget(const std::string &path) {
+  const shash::Md5 key(path.data(), path.length());
+  MutexLockGuard guard(&lock_);
+  entries_.Erase(key);
+  ++generation_;
+}
+
+
+uint64_t ObjectPresenceCache::generation() {
+  MutexLockGuard guard(&lock_);
+  return generation_;
+}
+
+
+/**
+ * Like Insert() but drops the answer if an object was forgotten in the
+ * meantime.  The removal might have overtaken the backend request.
+ */
+void ObjectPresenceCache::InsertAnswer(
+  const std::string &path,
+  ObjectPresence presence,
+  uint64_t generation)
+{
+  if (presence == kPresenceUnknown)
+    return;
+  const shash::Md5 key(path.data(), path.length());
+  MutexLockGuard guard(&lock_);
+  if (generation != generation_)
+    return;
+  if (entries_.size() >= kMaxEntries)
+    entries_.Clear();
+  entries_.Insert(key, presence);
+}
+
+
+//------------------------------------------------------------------------------
+
+
 void AbstractUploader::RegisterPlugins() {
   RegisterPlugin<LocalUploader>();
   RegisterPlugin<S3Uploader>();
@@ -61,6 +136,80 @@ bool AbstractUploader::Initialize() {
   return true;
 }
 
+bool AbstractUploader::Peek(const std::string &path) {
+  ObjectPresence presence = presence_cache_.Lookup(path);
+  if (presence == kPresenceUnknown) {
+    const uint64_t generation = presence_cache_.generation();
+    presence = DoPeek(path);
+    presence_cache_.InsertAnswer(path, presence, generation);
+  }
+  return presence == kPresent;
+}
+
+
+void AbstractUploader::PeekMany(
+  const std::vector<std::string> &paths,
+  std::vector<bool> *found)
+{
+  found->assign(paths.size(), false);
+
+  std::vector<std::string> unknown_paths;
+  std::vector<unsigned> unknown_idx;
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    const ObjectPresence presence = presence_cache_.Lookup(paths[i]);
+    if (presence == kPresenceUnknown) {
+      unknown_paths.push_back(paths[i]);
+      unknown_idx.push_back(i);
+    } else {
+      (*found)[i] = (presence == kPresent);
+    }
+  }
+  if (unknown_paths.empty())
+    return;
+
+  const uint64_t generation = presence_cache_.generation();
+  std::vector<ObjectPresence> presence;
+  DoPeekMany(unknown_paths, &presence);
+  assert(presence.size() == unknown_paths.size());
+  for (unsigned i = 0; i < unknown_paths.size(); ++i) {
+    presence_cache_.InsertAnswer(unknown_paths[i], presence[i], generation);
+    (*found)[unknown_idx[i]] = (presence[i] == kPresent);
+  }
+}
+
+
+void AbstractUploader::DoPeekMany(
+  const std::vector<std::string> &paths,
+  std::vector<ObjectPresence> *presence)
+{
+  presence->clear();
+  presence->reserve(paths.size());
+  for (unsigned i = 0; i < paths.size(); ++i)
+    presence->push_back(DoPeek(paths[i]));
+}
+
+
+void AbstractUploader::RemoveManyAsync(
+  const std::vector<std::string> &files_to_delete)
+{
+  if (files_to_delete.empty())
+    return;
+  for (unsigned i = 0; i < files_to_delete.size(); ++i)
+    presence_cache_.Forget(files_to_delete[i]);
+  DoRemoveManyAsync(files_to_delete);
+}
+
+
+void AbstractUploader::DoRemoveManyAsync(
+  const std::vector<std::string> &files)
+{
+  for (unsigned i = 0; i < files.size(); ++i) {
+    ++jobs_in_flight_;
+    DoRemoveAsync(files[i]);
+  }
+}
+
+
 bool AbstractUploader::FinalizeSession(bool /*commit*/,
                                        const std::string & /*old_root_hash*/,
                                        const std::string & /*new_root_hash*/,
@@ -6,15 +6,20 @@
 #define CVMFS_UPLOAD_FACILITY_H_
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 
+#include <ctime>
 #include <string>
+#include <vector>
 
 #include "atomic.h"
+#include "hash.h"
 #include "ingestion/ingestion_source.h"
 #include "ingestion/task.h"
 #include "ingestion/tube.h"
 #include "repository_tag.h"
+#include "smallhash.h"
 #include "statistics.h"
 #include "upload_spooler_definition.h"
 #include "util/posix.h"
@@ -68,6 +73,85 @@ struct UploaderResults {
 
 struct UploadStreamHandle;
 
+/**
+ * Result of an existence check in the backend storage.  Backends that cannot
+ * tell (e.g. the gateway) or that failed to answer report kPresenceUnknown.
+ */
+enum ObjectPresence {
+  kPresenceUnknown = 0,
+  kPresent,
+  kAbsent,
+};
+
+
+/**
+ * Streamed objects that are assembled in the storage before they are moved to
+ * their content-addressed location, e.g. S3 multipart uploads, are staged as
+ * <kStagingDirectory>/<kStagingFilePrefix>...  Leftovers of aborted publish
+ * runs are removed by the storage sweep of the garbage collector.
+ */
+const char kStagingDirectory[] = "data/txn";
+const char kStagingFilePrefix[] = "multipart.";
+
+
+/**
+ * A file in a directory of the backend storage, as returned by
+ * AbstractUploader::ListObjects()
+ */
+struct ObjectInfo {
+  ObjectInfo() : size(0), mtime(0) { }
+  std::string name;  ///< relative to the listed directory
+  uint64_t size;
+  time_t mtime;
+};
+
+
+/**
+ * Remembers for the lifetime of an uploader which objects are known to exist
+ * or to be missing in the backend storage.  Within a publish operation, the
+ * uploader is the only writer that removes objects.  Other writers, such as the
+ * receivers of concurrent gateway leases, only add objects, and the garbage
+ * collection is kept out by the gc lock.  Hence a stale kAbsent costs at most
+ * a redundant upload, and kPresent stays valid as long as removals keep the
+ * cache up to date.  When the cache is full, it is simply cleared.
+ *
+ * Thread-safe: the upload threads, the S3 callbacks, and the callers of
+ * Peek()/PeekMany() use the cache concurrently.  A backend answer that was
+ * requested before a concurrent Forget() is dropped by InsertAnswer(), so that
+ * a removed object is not remembered as present.
+ */
+class ObjectPresenceCache : SingleCopy {
+ public:
+  static const unsigned kMaxEntries = 1 << 19;
+
+  ObjectPresenceCache();
+  ~ObjectPresenceCache();
+
+  ObjectPresence Lookup(const std::string &path);
+  void Insert(const std::string &path, ObjectPresence presence);
+  void Forget(const std::string &path);
+
+  /**
+   * Changes on every Forget().  Taken before asking the backend and passed
+   * to InsertAnswer().
+   */
+  uint64_t generation();
+  void InsertAnswer(const std::string &path,
+                    ObjectPresence presence,
+                    uint64_t generation);
+
+ private:
+  static uint32_t HashMd5(const shash::Md5 &key) {
+    return static_cast<uint32_t>(
+      *(reinterpret_cast<const uint32_t *>(key.digest) + 1));
+  }
+
+  SmallHashDynamic<shash::Md5, ObjectPresence> entries_;
+  uint64_t generation_;
+  pthread_mutex_t lock_;
+};
+
+
 /**
  * Abstract base class for all backend upload facilities
  * This class defines an interface and constructs the concrete Uploaders,
@@ -269,6 +353,7 @@ class AbstractUploader
    */
   void RemoveAsync(const std::string &file_to_delete) {
     ++jobs_in_flight_;
+    presence_cache_.Forget(file_to_delete);
     DoRemoveAsync(file_to_delete);
   }
 
@@ -281,6 +366,29 @@ class AbstractUploader
     RemoveAsync("data/" + hash_to_delete.MakePath());
   }
 
+  /**
+   * Bulk version of RemoveAsync().  Backends that support it remove the files
+   * with a single request per batch.
+   *
+   * @param files_to_delete  paths to the files to be removed
+   */
+  void RemoveManyAsync(const std::vector<std::string> &files_to_delete);
+
+  /**
+   * Lists the files of a directory in the backend storage, such as "data/ab".
+   * This is a synchronous operation that can run concurrently for different
+   * directories.  Used by the garbage collection to find unreferenced objects.
+   *
+   * @param directory  relative directory path in the backend storage
+   * @param objects    the files in the directory, in no particular order
+   * @return           false on I/O errors or if the backend cannot list files
+   */
+  virtual bool ListObjects(const std::string &directory,
+                           std::vector<ObjectInfo> *objects)
+  {
+    return false;
+  }
+
   /**
    * Get object size based on its content hash
    *
@@ -292,12 +400,22 @@ class AbstractUploader
 
   /**
    * Checks if a file is already present in the backend storage. This might be a
-   * synchronous operation.
+   * synchronous operation.  Answers are remembered in the presence cache.
    *
    * @param path  the path of the file to be checked
    * @return      true if the file was found in the backend storage
    */
-  virtual bool Peek(const std::string &path) = 0;
+  bool Peek(const std::string &path);
+
+  /**
+   * Bulk version of Peek().  Only the paths unknown to the presence cache are
+   * checked, in one batch, which allows backends to overlap the round-trips.
+   *
+   * @param paths  the paths of the files to be checked
+   * @param found  set to the existence of each of the paths, in order
+   */
+  void PeekMany(const std::vector<std::string> &paths,
+                std::vector<bool> *found);
 
   /**
    * Make directory in upstream storage. Noop if directory already present.
@@ -372,6 +490,27 @@ class AbstractUploader
 
   virtual void DoRemoveAsync(const std::string &file_to_delete) = 0;
 
+  /**
+   * Removes a batch of files.  The default implementation removes them one by
+   * one.  Every request needs to be accounted for in jobs_in_flight_.
+   * Public interface: AbstractUploader::RemoveManyAsync()
+   */
+  virtual void DoRemoveManyAsync(const std::vector<std::string> &files);
+
+  /**
+   * Implementation of the existence check, bypassing the presence cache.
+   * Public interface: AbstractUploader::Peek()
+   */
+  virtual ObjectPresence DoPeek(const std::string &path) = 0;
+
+  /**
+   * Checks a batch of paths.  The default implementation checks them one by
+   * one; backends with high latency should overlap the checks.
+   * Public interface: AbstractUploader::PeekMany()
+   */
+  virtual void DoPeekMany(const std::vector<std::string> &paths,
+                          std::vector<ObjectPresence> *presence);
+
   virtual int64_t DoGetObjectSize(const std::string &file_name) = 0;
 
   /**
@@ -415,6 +554,20 @@ class AbstractUploader
   void CountUploadedCatalogs() const;
   void CountUploadedCatalogBytes(int64_t bytes_written) const;
 
+  /**
+   * Concrete uploaders report successfully written objects so that later
+   * duplicates of the same object can be skipped without asking the backend.
+   */
+  void MarkPresent(const std::string &path) {
+    presence_cache_.Insert(path, kPresent);
+  }
+  ObjectPresence LookupPresence(const std::string &path) {
+    return presence_cache_.Lookup(path);
+  }
+  void ForgetPresence(const std::string &path) {
+    presence_cache_.Forget(path);
+  }
+
  protected:
   /**
    * Used by concrete implementations when they use callbacks where it's not
@@ -436,6 +589,7 @@ class AbstractUploader
   TubeGroup<UploadJob> tubes_upload_;
   TubeConsumerGroup<UploadJob> tasks_upload_;
   mutable UniquePtr<UploadCounters> counters_;
+  ObjectPresenceCache presence_cache_;
 };  // class AbstractUploader
 
 
@@ -4,6 +4,8 @@
 
 #include "upload_gateway.h"
 
+#include <alloca.h>
+
 #include <limits>
 #include <vector>
 
@@ -116,7 +118,10 @@ void GatewayUploader::DoRemoveAsync(const std::string& /*file_to_delete*/) {
   Respond(NULL, UploaderResults());
 }
 
-bool GatewayUploader::Peek(const std::string& /*path*/) { return false; }
+// The gateway does not offer existence checks
+ObjectPresence GatewayUploader::DoPeek(const std::string& /*path*/) {
+  return kPresenceUnknown;
+}
 
 // TODO(jpriessn): implement Mkdir on gateway server-side
 bool GatewayUploader::Mkdir(const std::string &path) {
@@ -146,8 +151,8 @@ void GatewayUploader::DoUpload(const std::string& remote_path,
     return;
   }
 
-  unsigned char hash_ctx[shash::kMaxContextSize];
-  shash::ContextPtr hash_ctx_ptr(spooler_definition().hash_algorithm, hash_ctx);
+  shash::ContextPtr hash_ctx_ptr(spooler_definition().hash_algorithm);
+  hash_ctx_ptr.buffer = alloca(hash_ctx_ptr.size);
   shash::Init(hash_ctx_ptr);
   std::vector<char> buf(1024);
   ssize_t read_bytes = 0;
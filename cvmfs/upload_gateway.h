@@ -59,8 +59,6 @@ class GatewayUploader : public AbstractUploader {
 
   virtual std::string name() const;
 
-  virtual bool Peek(const std::string& path);
-
   virtual bool Mkdir(const std::string &path);
 
   virtual bool PlaceBootstrappingShortcut(const shash::Any& object);
@@ -83,6 +81,8 @@ class GatewayUploader : public AbstractUploader {
 
   virtual void DoRemoveAsync(const std::string& file_to_delete);
 
+  virtual ObjectPresence DoPeek(const std::string& path);
+
  protected:
   virtual bool ReadSessionTokenFile(const std::string& token_file_name,
                                     std::string* token);
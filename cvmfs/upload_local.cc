@@ -5,9 +5,13 @@
 #include "upload_local.h"
 #include "cvmfs_config.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <string>
+#include <vector>
 
 #include "compression.h"
 #include "logging.h"
@@ -103,6 +107,7 @@ void LocalUploader::DoUpload(const std::string &remote_path,
     return;
   }
 
+  MarkPresent(remote_path);
   Respond(callback, UploaderResults(rvi, source->GetPath()));
 }
 
@@ -179,6 +184,7 @@ void LocalUploader::FinalizeStreamedUpload(UploadStreamHandle *handle,
               UploaderResults(UploaderResults::kChunkCommit, cpy_errno));
       return;
     }
+    MarkPresent(final_path);
     if (!content_hash.HasSuffix()
         || content_hash.suffix == shash::kSuffixPartial) {
       CountUploadedChunks();
@@ -214,9 +220,44 @@ void LocalUploader::DoRemoveAsync(const std::string &file_to_delete) {
   Respond(NULL, UploaderResults());
 }
 
-bool LocalUploader::Peek(const std::string &path) {
+ObjectPresence LocalUploader::DoPeek(const std::string &path) {
   bool retval = FileExists(upstream_path_ + "/" + path);
-  return retval;
+  return retval ? kPresent : kAbsent;
+}
+
+bool LocalUploader::ListObjects(
+  const std::string &directory,
+  std::vector<ObjectInfo> *objects)
+{
+  objects->clear();
+  const std::string path = upstream_path_ + "/" + directory;
+  DIR *dirp = opendir(path.c_str());
+  if (dirp == NULL)
+    return errno == ENOENT;
+
+  platform_dirent64 *dirent;
+  while ((dirent = platform_readdir(dirp)) != NULL) {
+    const std::string name = dirent->d_name;
+    if ((name == ".") || (name == ".."))
+      continue;
+    struct stat info;
+    if (fstatat(dirfd(dirp), name.c_str(), &info, AT_SYMLINK_NOFOLLOW) != 0) {
+      // Removed in the meantime
+      if (errno == ENOENT)
+        continue;
+      closedir(dirp);
+      return false;
+    }
+    if (!S_ISREG(info.st_mode))
+      continue;
+    ObjectInfo object;
+    object.name = name;
+    object.size = info.st_size;
+    object.mtime = info.st_mtime;
+    objects->push_back(object);
+  }
+  closedir(dirp);
+  return true;
 }
 
 bool LocalUploader::Mkdir(const std::string &path) {
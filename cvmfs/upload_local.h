@@ -9,6 +9,7 @@
 #include <unistd.h>
 
 #include <string>
+#include <vector>
 
 #include "atomic.h"
 #include "upload_facility.h"
@@ -67,7 +68,9 @@ class LocalUploader : public AbstractUploader {
 
   void DoRemoveAsync(const std::string &file_to_delete);
 
-  bool Peek(const std::string &path);
+  ObjectPresence DoPeek(const std::string &path);
+  bool ListObjects(const std::string &directory,
+                   std::vector<ObjectInfo> *objects);
 
   bool Mkdir(const std::string &path);
 
@@ -9,6 +9,7 @@
 #include <inttypes.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -30,6 +31,39 @@ void S3Uploader::RequestCtrl::WaitFor() {
 }
 
 
+S3MultipartUpload::S3MultipartUpload(const std::string &object_key)
+  : object_key(object_key)
+  , copying(false)
+  , size(0)
+  , synchronous(false)
+  , commit_callback(NULL)
+  , parts_in_flight(0)
+  , init_done(false)
+  , committed(false)
+  , done(false)
+  , failed(false)
+{
+  int retval = pthread_mutex_init(&lock, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond, NULL);
+  assert(retval == 0);
+}
+
+
+S3MultipartUpload::~S3MultipartUpload() {
+  assert(pending_parts.empty());
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&lock);
+}
+
+
+void S3MultipartUpload::WaitForDone() {
+  MutexLockGuard guard(&lock);
+  while (!done)
+    pthread_cond_wait(&cond, &lock);
+}
+
+
 S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
   : AbstractUploader(spooler_definition)
   , dns_buckets_(true)
@@ -40,6 +74,10 @@ S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
   , peek_before_put_(true)
   , use_https_(false)
   , proxy_("")
+  , multipart_threshold_(kDefaultMultipartThreshold)
+  , multipart_part_size_(kDefaultMultipartPartSize)
+  , max_single_copy_size_(kMaxSingleCopySize)
+  , copy_part_size_(kDefaultCopyPartSize)
   , temporary_path_(spooler_definition.temporary_path)
 {
   assert(spooler_definition.IsValid() &&
@@ -75,6 +113,8 @@ S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
   s3fanout_mgr_ = new s3fanout::S3FanoutManager(s3config);
   s3fanout_mgr_->Spawn();
 
+  parts_in_flight_ = new SynchronizingCounter<uint32_t>(num_parallel_uploads_);
+
   int retval = pthread_create(
     &thread_collect_results_, NULL, MainCollectResults, this);
   assert(retval == 0);
@@ -85,6 +125,8 @@ S3Uploader::~S3Uploader() {
   // Signal termination to our own worker thread
   s3fanout_mgr_->PushCompletedJob(NULL);
   pthread_join(thread_collect_results_, NULL);
+  LogCvmfs(kLogUploadS3, kLogDebug, "S3 transfer statistics:\n%s",
+           s3fanout_mgr_->GetStatistics().Print().c_str());
 }
 
 
@@ -191,6 +233,34 @@ bool S3Uploader::ParseSpoolerDefinition(
     options_manager.GetValue("CVMFS_S3_PROXY", &proxy_);
   }
 
+  // The first part of a streamed object is everything up to the threshold
+  if (options_manager.GetValue("CVMFS_S3_MULTIPART_THRESHOLD", &parameter)) {
+    multipart_threshold_ = String2Uint64(parameter);
+    if ((multipart_threshold_ > 0) &&
+        (multipart_threshold_ < kMinMultipartPartSize))
+    {
+      LogCvmfs(kLogUploadS3, kLogStderr,
+               "Invalid CVMFS_S3_MULTIPART_THRESHOLD in '%s', "
+               "must be 0 or at least %" PRIu64 " bytes", config_path.c_str(),
+               kMinMultipartPartSize);
+      return false;
+    }
+  }
+  if (options_manager.GetValue("CVMFS_S3_MULTIPART_PART_SIZE", &parameter)) {
+    multipart_part_size_ = String2Uint64(parameter);
+    if (multipart_part_size_ < kMinMultipartPartSize) {
+      LogCvmfs(kLogUploadS3, kLogStderr,
+               "Invalid CVMFS_S3_MULTIPART_PART_SIZE in '%s', "
+               "must be at least %" PRIu64 " bytes", config_path.c_str(),
+               kMinMultipartPartSize);
+      return false;
+    }
+  }
+  if (authz_method_ == s3fanout::kAuthzAzure) {
+    // Azure blob storage uses block lists instead of multipart uploads
+    multipart_threshold_ = 0;
+  }
+
   return true;
 }
 
@@ -260,7 +330,21 @@ void *S3Uploader::MainCollectResults(void *data) {
         atomic_inc32(&uploader->io_errors_);
       }
     }
-    if (info->request == s3fanout::JobInfo::kReqDelete) {
+    if ((info->request == s3fanout::JobInfo::kReqMultipartInit) ||
+        (info->request == s3fanout::JobInfo::kReqMultipartPart) ||
+        (info->request == s3fanout::JobInfo::kReqMultipartComplete) ||
+        (info->request == s3fanout::JobInfo::kReqMultipartAbort) ||
+        (info->request == s3fanout::JobInfo::kReqCopy) ||
+        (info->request == s3fanout::JobInfo::kReqMultipartPartCopy))
+    {
+      uploader->OnMultipartJobComplete(info, reply_code);
+    } else if (info->request == s3fanout::JobInfo::kReqList) {
+      uploader->OnListComplete(info, reply_code);
+    } else if (info->request == s3fanout::JobInfo::kReqDelete) {
+      uploader->ForgetPresence(uploader->GetRemotePath(info->object_key));
+      uploader->Respond(NULL, UploaderResults());
+    } else if (info->request == s3fanout::JobInfo::kReqDeleteMulti) {
+      // The presence cache has been updated by RemoveManyAsync()
       uploader->Respond(NULL, UploaderResults());
     } else if (info->request == s3fanout::JobInfo::kReqHeadOnly) {
       if (info->error_code == s3fanout::kFailNotFound) reply_code = 1;
@@ -277,6 +361,8 @@ void *S3Uploader::MainCollectResults(void *data) {
         uploader->DecUploadedChunks();
         uploader->CountUploadedBytes(-(info->payload_size));
       }
+      if (reply_code == 0)
+        uploader->MarkPresent(uploader->GetRemotePath(info->object_key));
       uploader->Respond(static_cast<CallbackTN*>(info->callback),
                         UploaderResults(UploaderResults::kChunkCommit,
                                         reply_code));
@@ -305,6 +391,17 @@ void S3Uploader::DoUpload(
   rvb = source->GetSize(&size);
   assert(rvb);
 
+  if ((multipart_threshold_ > 0) && (size >= multipart_threshold_)) {
+    rvb = DoUploadMultipart(repository_alias_ + "/" + remote_path, source);
+    source->Close();
+    if (rvb)
+      MarkPresent(remote_path);
+    Respond(callback, UploaderResults(rvb ? 0 : 99, source->GetPath()));
+    LogCvmfs(kLogUploadS3, kLogDebug, "Uploading from source finished: %s",
+             source->GetPath().c_str());
+    return;
+  }
+
   FileBackedBuffer *origin =
     FileBackedBuffer::Create(kInMemoryObjectThreshold,
                              spooler_definition().temporary_path);
@@ -335,7 +432,7 @@ void S3Uploader::DoUpload(
   } else if (HasSuffix(remote_path, ".html", false)) {
     info->request = s3fanout::JobInfo::kReqPutHtml;
   } else {
-    if (peek_before_put_)
+    if (peek_before_put_ && (LookupPresence(remote_path) != kAbsent))
       info->request = s3fanout::JobInfo::kReqHeadPut;
   }
 
@@ -353,6 +450,404 @@ void S3Uploader::DoUpload(
 }
 
 
+/**
+ * Uploads a source of known size in parts straight to its final location.
+ * The parts are read while earlier parts are still in flight.
+ */
+bool S3Uploader::DoUploadMultipart(
+  const std::string &object_key,
+  IngestionSource *source)
+{
+  S3MultipartUpload *multipart = new S3MultipartUpload(object_key);
+  multipart->synchronous = true;
+  StartMultipart(multipart);
+
+  unsigned char buffer[kPageSize];
+  FileBackedBuffer *part = NULL;
+  ssize_t nbytes;
+  do {
+    nbytes = source->Read(buffer, kPageSize);
+    if (nbytes < 0) {
+      MutexLockGuard guard(&multipart->lock);
+      multipart->failed = true;
+      break;
+    }
+    if (nbytes > 0) {
+      if (part == NULL) {
+        part = FileBackedBuffer::Create(multipart_part_size_,
+                                        spooler_definition().temporary_path);
+      }
+      part->Append(buffer, nbytes);
+      if (part->GetSize() >= multipart_part_size_) {
+        UploadPart(multipart, part);
+        part = NULL;
+      }
+    }
+  } while (nbytes == kPageSize);
+  if (part != NULL) {
+    if (part->GetSize() > 0)
+      UploadPart(multipart, part);
+    else
+      delete part;
+  }
+
+  CommitMultipart(multipart);
+  multipart->WaitForDone();
+  const bool result = !multipart->failed;
+  delete multipart;
+  return result;
+}
+
+
+/**
+ * Initiates a multipart upload without waiting for the upload id.  If the
+ * backend refuses to start the upload, the parts are dropped and the upload
+ * fails on commit.
+ */
+void S3Uploader::StartMultipart(S3MultipartUpload *multipart) {
+  s3fanout::JobInfo *info = CreateJobInfo(multipart->object_key);
+  info->origin->Commit();
+  info->request = s3fanout::JobInfo::kReqMultipartInit;
+  info->callback = multipart;
+
+  IncJobsInFlight();
+  UploadJobInfo(info);
+}
+
+
+/**
+ * Takes ownership of the part buffer.  Blocks while too many parts are in
+ * flight.  Parts are held back until the upload id is known.
+ */
+void S3Uploader::UploadPart(
+  S3MultipartUpload *multipart,
+  FileBackedBuffer *part)
+{
+  part->Commit();
+  multipart->size += part->GetSize();
+
+  s3fanout::JobInfo *info =
+    new s3fanout::JobInfo(multipart->object_key, multipart, part);
+  info->request = s3fanout::JobInfo::kReqMultipartPart;
+
+  // May block; the collector thread needs the multipart lock to make progress
+  parts_in_flight_->Increment();
+  IncJobsInFlight();
+  bool dropped = false;
+  {
+    MutexLockGuard guard(&multipart->lock);
+    if (multipart->init_done && multipart->failed) {
+      // The upload could not be started
+      dropped = true;
+    } else {
+      multipart->etags.push_back("");
+      info->part_number = multipart->etags.size();
+      multipart->parts_in_flight++;
+      if (!multipart->init_done) {
+        multipart->pending_parts.push_back(info);
+        return;
+      }
+      info->upload_id = multipart->upload_id;
+    }
+  }
+  if (dropped) {
+    delete info;
+    parts_in_flight_->Decrement();
+    Respond(NULL, UploaderResults());
+    return;
+  }
+  UploadJobInfo(info);
+}
+
+
+/**
+ * Marks the multipart upload as complete from the producer side.  Either
+ * finishes the upload right away or leaves it to the initiation or the last
+ * part in flight.
+ */
+void S3Uploader::CommitMultipart(S3MultipartUpload *multipart) {
+  bool last = false;
+  {
+    MutexLockGuard guard(&multipart->lock);
+    multipart->committed = true;
+    last = multipart->init_done && (multipart->parts_in_flight == 0);
+  }
+  if (last)
+    CompleteMultipart(multipart);
+}
+
+
+/**
+ * Called once all parts are in.  Sends the part list or, if any of the parts
+ * failed, aborts the upload so that no partial object becomes visible.
+ */
+void S3Uploader::CompleteMultipart(S3MultipartUpload *multipart) {
+  if (multipart->upload_id.empty()) {
+    // The upload never started, there is nothing to abort
+    FinishMultipart(multipart, 99);
+    return;
+  }
+
+  FileBackedBuffer *request_body =
+    FileBackedBuffer::Create(kInMemoryObjectThreshold,
+                             spooler_definition().temporary_path);
+  s3fanout::JobInfo *info = new s3fanout::JobInfo(
+    multipart->copying ? multipart->final_key : multipart->object_key,
+    multipart, request_body);
+  info->upload_id = multipart->upload_id;
+
+  if (multipart->failed) {
+    info->request = s3fanout::JobInfo::kReqMultipartAbort;
+  } else {
+    info->request = s3fanout::JobInfo::kReqMultipartComplete;
+    std::string xml = "<CompleteMultipartUpload>";
+    for (unsigned i = 0; i < multipart->etags.size(); ++i) {
+      xml += "<Part><PartNumber>" + StringifyInt(i + 1) + "</PartNumber>"
+             "<ETag>" + multipart->etags[i] + "</ETag></Part>";
+    }
+    xml += "</CompleteMultipartUpload>";
+    request_body->Append(xml.data(), xml.length());
+  }
+  request_body->Commit();
+
+  IncJobsInFlight();
+  UploadJobInfo(info);
+}
+
+
+/**
+ * Starts the multipart upload that copies a staged object too large for a
+ * single copy request to its final key.  Runs in the results collector thread.
+ */
+void S3Uploader::StartMultipartCopy(S3MultipartUpload *multipart) {
+  multipart->copying = true;
+  multipart->upload_id.clear();
+  multipart->etags.clear();
+  s3fanout::JobInfo *info = CreateJobInfo(multipart->final_key);
+  info->origin->Commit();
+  info->request = s3fanout::JobInfo::kReqMultipartInit;
+  info->callback = multipart;
+  IncJobsInFlight();
+  UploadJobInfo(info);
+}
+
+
+/**
+ * Sends all the part copies at once.  They do not go through parts_in_flight_
+ * because they carry no data and the collector thread must not block.
+ */
+void S3Uploader::UploadCopyParts(S3MultipartUpload *multipart) {
+  const unsigned num_parts = static_cast<unsigned>(
+    (multipart->size + copy_part_size_ - 1) / copy_part_size_);
+  {
+    MutexLockGuard guard(&multipart->lock);
+    multipart->etags.resize(num_parts);
+    multipart->parts_in_flight = num_parts;
+  }
+  for (unsigned i = 0; i < num_parts; ++i) {
+    const uint64_t first = i * copy_part_size_;
+    const uint64_t last =
+      std::min(multipart->size, first + copy_part_size_) - 1;
+    s3fanout::JobInfo *info = CreateJobInfo(multipart->final_key);
+    info->origin->Commit();
+    info->request = s3fanout::JobInfo::kReqMultipartPartCopy;
+    info->callback = multipart;
+    info->upload_id = multipart->upload_id;
+    info->part_number = i + 1;
+    info->copy_source = multipart->object_key;
+    info->copy_range = "bytes=" + StringifyUint(first) + "-" +
+                       StringifyUint(last);
+    IncJobsInFlight();
+    UploadJobInfo(info);
+  }
+}
+
+
+/**
+ * Last step of a multipart upload; wakes up a synchronous uploader or
+ * notifies the owner of the streamed upload.
+ */
+void S3Uploader::FinishMultipart(
+  S3MultipartUpload *multipart,
+  int return_code)
+{
+  if (multipart->synchronous) {
+    MutexLockGuard guard(&multipart->lock);
+    multipart->failed = multipart->failed || (return_code != 0);
+    multipart->done = true;
+    pthread_cond_broadcast(&multipart->cond);
+    return;
+  }
+
+  Respond(multipart->commit_callback,
+          UploaderResults(UploaderResults::kChunkCommit, return_code));
+  delete multipart;
+}
+
+
+/**
+ * State machine of multipart uploads, run by the results collector thread.
+ * Every multipart request has its own entry in jobs_in_flight_.
+ */
+void S3Uploader::OnMultipartJobComplete(
+  s3fanout::JobInfo *info,
+  int reply_code)
+{
+  S3MultipartUpload *multipart = static_cast<S3MultipartUpload *>(
+    info->callback);
+  const bool ok = (reply_code == 0);
+
+  switch (info->request) {
+    case s3fanout::JobInfo::kReqMultipartInit:
+      if (multipart->copying) {
+        multipart->upload_id = info->upload_id;
+        if (ok)
+          UploadCopyParts(multipart);
+        else
+          RemoveStagedObject(multipart, reply_code);
+        break;
+      }
+      OnMultipartInit(multipart, info, ok);
+      break;
+    case s3fanout::JobInfo::kReqMultipartPart: {
+      bool last = false;
+      {
+        MutexLockGuard guard(&multipart->lock);
+        if (ok)
+          multipart->etags[info->part_number - 1] = info->etag;
+        multipart->failed = multipart->failed || !ok;
+        multipart->parts_in_flight--;
+        last = multipart->committed && (multipart->parts_in_flight == 0);
+      }
+      parts_in_flight_->Decrement();
+      if (last)
+        CompleteMultipart(multipart);
+      break;
+    }
+    case s3fanout::JobInfo::kReqMultipartPartCopy: {
+      bool last = false;
+      {
+        MutexLockGuard guard(&multipart->lock);
+        if (ok)
+          multipart->etags[info->part_number - 1] = info->etag;
+        multipart->failed = multipart->failed || !ok;
+        multipart->parts_in_flight--;
+        last = (multipart->parts_in_flight == 0);
+      }
+      if (last)
+        CompleteMultipart(multipart);
+      break;
+    }
+    case s3fanout::JobInfo::kReqMultipartAbort:
+      if (multipart->copying)
+        RemoveStagedObject(multipart, 99);
+      else
+        FinishMultipart(multipart, 99);
+      break;
+    case s3fanout::JobInfo::kReqMultipartComplete:
+      if (!ok) {
+        // Release the uploaded parts and, if copying, the staged object
+        multipart->failed = true;
+        CompleteMultipart(multipart);
+        break;
+      }
+      if (multipart->final_key.empty()) {
+        FinishMultipart(multipart, 0);
+        break;
+      }
+      if (multipart->copying) {
+        // The copy is in place, only the staged object is left
+        RemoveStagedObject(multipart, 0);
+        break;
+      }
+      if (multipart->size > max_single_copy_size_) {
+        StartMultipartCopy(multipart);
+        break;
+      }
+      {
+        // Move the staged object to its content-addressed location
+        s3fanout::JobInfo *copy_info = CreateJobInfo(multipart->final_key);
+        copy_info->origin->Commit();
+        copy_info->request = s3fanout::JobInfo::kReqCopy;
+        copy_info->copy_source = multipart->object_key;
+        copy_info->callback = multipart;
+        IncJobsInFlight();
+        UploadJobInfo(copy_info);
+      }
+      break;
+    case s3fanout::JobInfo::kReqCopy:
+      RemoveStagedObject(multipart, reply_code);
+      break;
+    default:
+      PANIC(NULL);
+  }
+
+  Respond(NULL, UploaderResults());
+}
+
+
+/**
+ * Sends the parts that were held back until the upload id was known.  If the
+ * upload could not be started, the parts are dropped instead.
+ */
+void S3Uploader::OnMultipartInit(
+  S3MultipartUpload *multipart,
+  s3fanout::JobInfo *info,
+  bool ok)
+{
+  std::vector<s3fanout::JobInfo *> pending_parts;
+  bool last = false;
+  {
+    MutexLockGuard guard(&multipart->lock);
+    multipart->upload_id = ok ? info->upload_id : "";
+    multipart->failed = multipart->failed || !ok;
+    multipart->init_done = true;
+    pending_parts.swap(multipart->pending_parts);
+    if (!ok)
+      multipart->parts_in_flight -= pending_parts.size();
+    last = multipart->committed && (multipart->parts_in_flight == 0);
+  }
+
+  for (unsigned i = 0; i < pending_parts.size(); ++i) {
+    if (ok) {
+      pending_parts[i]->upload_id = multipart->upload_id;
+      UploadJobInfo(pending_parts[i]);
+    } else {
+      delete pending_parts[i];
+      parts_in_flight_->Decrement();
+      Respond(NULL, UploaderResults());
+    }
+  }
+  if (last)
+    CompleteMultipart(multipart);
+}
+
+
+/**
+ * Either the streamed object is at its final key or it could not be copied
+ * there; in both cases the staged object can go
+ */
+void S3Uploader::RemoveStagedObject(
+  S3MultipartUpload *multipart,
+  int return_code)
+{
+  if (return_code == 0)
+    MarkPresent(GetRemotePath(multipart->final_key));
+  s3fanout::JobInfo *delete_info = CreateJobInfo(multipart->object_key);
+  delete_info->request = s3fanout::JobInfo::kReqDelete;
+  IncJobsInFlight();
+  UploadJobInfo(delete_info);
+  FinishMultipart(multipart, return_code);
+}
+
+
+std::string S3Uploader::MkStagingKey(const UploadStreamHandle *handle) const {
+  return repository_alias_ + "/" + kStagingDirectory + "/" +
+         kStagingFilePrefix + StringifyInt(getpid()) + "." +
+         StringifyInt(handle->tag);
+}
+
+
 void S3Uploader::UploadJobInfo(s3fanout::JobInfo *info) {
   LogCvmfs(kLogUploadS3, kLogDebug,
            "Uploading:\n"
@@ -381,6 +876,24 @@ void S3Uploader::StreamedUpload(
   S3StreamHandle *s3_handle = static_cast<S3StreamHandle*>(handle);
 
   s3_handle->buffer->Append(buffer.data, buffer.size);
+
+  if ((multipart_threshold_ > 0) && (s3_handle->multipart == NULL) &&
+      (s3_handle->buffer->GetSize() >= multipart_threshold_))
+  {
+    s3_handle->multipart = new S3MultipartUpload(MkStagingKey(handle));
+    StartMultipart(s3_handle->multipart);
+  }
+
+  // The first part is the data accumulated until the threshold was reached
+  if ((s3_handle->multipart != NULL) &&
+      ((s3_handle->buffer->GetSize() >= multipart_part_size_) ||
+       (s3_handle->multipart->size == 0)))
+  {
+    UploadPart(s3_handle->multipart, s3_handle->buffer.Release());
+    s3_handle->buffer = FileBackedBuffer::Create(
+      multipart_part_size_, spooler_definition().temporary_path);
+  }
+
   Respond(callback, UploaderResults(UploaderResults::kBufferUpload, 0));
 }
 
@@ -399,6 +912,40 @@ void S3Uploader::FinalizeStreamedUpload(
     final_path = repository_alias_ + "/data/" + content_hash.MakePath();
   }
 
+  if (s3_handle->multipart != NULL) {
+    S3MultipartUpload *multipart = s3_handle->multipart;
+    if (s3_handle->buffer->GetSize() > 0)
+      UploadPart(multipart, s3_handle->buffer.Release());
+    multipart->final_key = final_path;
+    multipart->commit_callback = handle->commit_callback;
+    const uint64_t bytes_uploaded = multipart->size;
+    delete s3_handle;
+
+    if (!content_hash.HasSuffix() ||
+        content_hash.suffix == shash::kSuffixPartial) {
+      CountUploadedChunks();
+      CountUploadedBytes(bytes_uploaded);
+    } else if (content_hash.suffix == shash::kSuffixCatalog) {
+      CountUploadedCatalogs();
+      CountUploadedCatalogBytes(bytes_uploaded);
+    }
+
+    // Must be last: the multipart upload may be deleted when this returns
+    CommitMultipart(multipart);
+    return;
+  }
+
+  // Content-addressed objects that are known to exist need no upload at all
+  const ObjectPresence presence = s3_handle->remote_path.empty() ?
+    LookupPresence(GetRemotePath(final_path)) : kPresenceUnknown;
+  if (presence == kPresent) {
+    const CallbackTN *callback = handle->commit_callback;
+    delete s3_handle;
+    CountDuplicates();
+    Respond(callback, UploaderResults(UploaderResults::kChunkCommit, 0));
+    return;
+  }
+
   s3_handle->buffer->Commit();
 
   size_t bytes_uploaded = s3_handle->buffer->GetSize();
@@ -410,7 +957,7 @@ void S3Uploader::FinalizeStreamedUpload(
                                     handle->commit_callback)),
                             s3_handle->buffer.Release());
 
-  if (peek_before_put_)
+  if (peek_before_put_ && (presence != kAbsent))
       info->request = s3fanout::JobInfo::kReqHeadPut;
   UploadJobInfo(info);
 
@@ -447,6 +994,102 @@ void S3Uploader::DoRemoveAsync(const std::string& file_to_delete) {
 }
 
 
+/**
+ * Removes the files with one DeleteObjects request per batch of keys.  Azure
+ * has no such request; the files are removed one by one.
+ */
+void S3Uploader::DoRemoveManyAsync(const std::vector<std::string> &files) {
+  if (authz_method_ == s3fanout::kAuthzAzure) {
+    AbstractUploader::DoRemoveManyAsync(files);
+    return;
+  }
+
+  for (unsigned i = 0; i < files.size(); i += kMaxKeysPerDelete) {
+    const unsigned end =
+      std::min(static_cast<unsigned>(files.size()), i + kMaxKeysPerDelete);
+    std::string request_content = "<Delete><Quiet>true</Quiet>";
+    for (unsigned j = i; j < end; ++j) {
+      request_content += "<Object><Key>" + repository_alias_ + "/" +
+                         files[j] + "</Key></Object>";
+    }
+    request_content += "</Delete>";
+
+    s3fanout::JobInfo *info = CreateJobInfo("");
+    info->origin->Append(request_content.data(), request_content.length());
+    info->origin->Commit();
+    info->request = s3fanout::JobInfo::kReqDeleteMulti;
+
+    LogCvmfs(kLogUploadS3, kLogDebug, "Asynchronously removing %u objects "
+             "from %s", end - i, bucket_.c_str());
+    IncJobsInFlight();
+    UploadJobInfo(info);
+  }
+}
+
+
+/**
+ * Pages through the ListObjectsV2 replies for the keys under the directory.
+ */
+bool S3Uploader::ListObjects(
+  const std::string &directory,
+  std::vector<ObjectInfo> *objects)
+{
+  // Azure has a different listing API
+  if (authz_method_ == s3fanout::kAuthzAzure)
+    return false;
+
+  objects->clear();
+  const std::string prefix = repository_alias_ + "/" + directory + "/";
+  std::string continuation_token;
+  do {
+    s3fanout::JobInfo *info = CreateJobInfo("");
+    info->origin->Commit();
+    info->request = s3fanout::JobInfo::kReqList;
+    info->list_prefix = prefix;
+    info->list_token = continuation_token;
+
+    ListCtrl list_ctrl;
+    MakePipe(list_ctrl.pipe_wait);
+    info->callback = &list_ctrl;
+
+    IncJobsInFlight();
+    UploadJobInfo(info);
+    list_ctrl.WaitFor();
+    if (list_ctrl.return_code != 0)
+      return false;
+
+    std::vector<s3fanout::ListEntry> entries;
+    if (!s3fanout::S3FanoutManager::ParseListing(
+          list_ctrl.response, &entries, &continuation_token))
+    {
+      LogCvmfs(kLogUploadS3, kLogStderr, "malformed listing of %s/%s",
+               bucket_.c_str(), prefix.c_str());
+      return false;
+    }
+    for (unsigned i = 0; i < entries.size(); ++i) {
+      if (!HasPrefix(entries[i].key, prefix, false /* ignore_case */))
+        continue;
+      ObjectInfo object;
+      object.name = entries[i].key.substr(prefix.length());
+      object.size = entries[i].size;
+      object.mtime = entries[i].mtime;
+      objects->push_back(object);
+    }
+  } while (!continuation_token.empty());
+  return true;
+}
+
+
+void S3Uploader::OnListComplete(s3fanout::JobInfo *info, int reply_code) {
+  ListCtrl *ctrl = static_cast<ListCtrl *>(info->callback);
+  ctrl->return_code = reply_code;
+  ctrl->response.swap(info->response);
+  char c = 'c';
+  WritePipe(ctrl->pipe_wait[1], &c, 1);
+  Respond(NULL, UploaderResults());
+}
+
+
 void S3Uploader::OnReqComplete(
   const upload::UploaderResults &results,
   RequestCtrl *ctrl)
@@ -464,7 +1107,7 @@ void S3Uploader::OnReqComplete(
 }
 
 
-bool S3Uploader::Peek(const std::string& path) {
+ObjectPresence S3Uploader::DoPeek(const std::string& path) {
   const std::string mangled_path = repository_alias_ + "/" + path;
   s3fanout::JobInfo *info = CreateJobInfo(mangled_path);
 
@@ -478,7 +1121,57 @@ bool S3Uploader::Peek(const std::string& path) {
   UploadJobInfo(info);
   req_ctrl.WaitFor();
 
-  return req_ctrl.return_code == 0;
+  switch (req_ctrl.return_code) {
+    case 0:
+      return kPresent;
+    case 1:
+      return kAbsent;
+    default:
+      return kPresenceUnknown;
+  }
+}
+
+
+void S3Uploader::OnPeekComplete(
+  const upload::UploaderResults &results,
+  PeekSlot slot)
+{
+  switch (results.return_code) {
+    case 0:
+      slot.ctrl->presence[slot.idx] = kPresent;
+      break;
+    case 1:
+      slot.ctrl->presence[slot.idx] = kAbsent;
+      break;
+    default:
+      slot.ctrl->presence[slot.idx] = kPresenceUnknown;
+  }
+  slot.ctrl->in_flight.Decrement();
+}
+
+
+/**
+ * Pipelines the HEAD requests through the fanout manager, keeping as many of
+ * them in flight as there are parallel connections.
+ */
+void S3Uploader::DoPeekMany(
+  const std::vector<std::string> &paths,
+  std::vector<ObjectPresence> *presence)
+{
+  PeekManyCtrl ctrl(paths.size(), num_parallel_uploads_);
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    s3fanout::JobInfo *info =
+      CreateJobInfo(repository_alias_ + "/" + paths[i]);
+    info->request = s3fanout::JobInfo::kReqHeadOnly;
+    info->callback = const_cast<void*>(static_cast<void const*>(MakeClosure(
+      &S3Uploader::OnPeekComplete, this, PeekSlot(&ctrl, i))));
+
+    ctrl.in_flight.Increment();
+    IncJobsInFlight();
+    UploadJobInfo(info);
+  }
+  ctrl.in_flight.WaitForZero();
+  *presence = ctrl.presence;
 }
 
 
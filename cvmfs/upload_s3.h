@@ -20,18 +20,68 @@
 
 namespace upload {
 
+/**
+ * State of an S3 multipart upload.  The parts are sent in parallel through the
+ * S3 fanout while the object is still being produced.  Parts that are ready
+ * before the upload is initiated wait until its upload id is known.  Completion
+ * and abortion are driven by the results collector thread once the last part
+ * is in.
+ *
+ * Streamed objects are content-addressed, so their final key is only known on
+ * commit.  Their parts go to a staging key from where the completed object is
+ * copied into place.  Objects too large for a single copy request are copied
+ * by a second multipart upload whose parts are ranges of the staged object.
+ * The staged object is removed whether or not it reaches its final key.
+ */
+struct S3MultipartUpload : SingleCopy {
+  typedef AbstractUploader::CallbackTN CallbackTN;
+
+  explicit S3MultipartUpload(const std::string &object_key);
+  ~S3MultipartUpload();
+
+  void WaitForDone();
+
+  const std::string object_key;
+  std::string final_key;  // if set, object_key is a staging key
+  // Set once the staged object is copied in parts to final_key; from then on,
+  // upload_id and etags belong to the multipart upload of the copy
+  bool copying;
+  std::string upload_id;
+  std::vector<std::string> etags;  // of the parts, in order of part number
+  uint64_t size;
+  // The producer waits for the result instead of getting a callback
+  bool synchronous;
+  const CallbackTN *commit_callback;
+
+  // Protected by lock
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  unsigned parts_in_flight;
+  // Parts queued until the initiation of the upload returns
+  std::vector<s3fanout::JobInfo *> pending_parts;
+  bool init_done;
+  bool committed;
+  bool done;
+  bool failed;
+};
+
+
 struct S3StreamHandle : public UploadStreamHandle {
   S3StreamHandle(
     const CallbackTN *commit_callback,
     uint64_t in_memory_threshold,
     const std::string &tmp_dir = "/tmp/")
     : UploadStreamHandle(commit_callback)
+    , multipart(NULL)
   {
     buffer = FileBackedBuffer::Create(in_memory_threshold, tmp_dir);
   }
 
-  // Ownership is later transferred to the S3 fanout
+  // Ownership is later transferred to the S3 fanout.  For multipart uploads,
+  // the buffer contains the part that is currently filled.
   UniquePtr<FileBackedBuffer> buffer;
+  // Set once the object grew larger than the multipart threshold
+  S3MultipartUpload *multipart;
 };
 
 /**
@@ -69,7 +119,12 @@ class S3Uploader : public AbstractUploader {
                                       const shash::Any &content_hash);
 
   virtual void DoRemoveAsync(const std::string &file_to_delete);
-  virtual bool Peek(const std::string &path);
+  virtual void DoRemoveManyAsync(const std::vector<std::string> &files);
+  virtual ObjectPresence DoPeek(const std::string &path);
+  virtual void DoPeekMany(const std::vector<std::string> &paths,
+                          std::vector<ObjectPresence> *presence);
+  virtual bool ListObjects(const std::string &directory,
+                           std::vector<ObjectInfo> *objects);
   virtual bool Mkdir(const std::string &path);
   virtual bool PlaceBootstrappingShortcut(const shash::Any &object);
 
@@ -80,6 +135,10 @@ class S3Uploader : public AbstractUploader {
   s3fanout::S3FanoutManager *GetS3FanoutManager() {
     return s3fanout_mgr_.weak_ref();
   }
+  void SetCopyLimits(uint64_t max_single_copy_size, uint64_t copy_part_size) {
+    max_single_copy_size_ = max_single_copy_size;
+    copy_part_size_ = copy_part_size;
+  }
 
  private:
   static const unsigned kDefaultPort = 80;
@@ -90,6 +149,18 @@ class S3Uploader : public AbstractUploader {
   static const unsigned kDefaultBackoffInitMs = 100;
   static const unsigned kDefaultBackoffMaxMs = 2000;
   static const unsigned kInMemoryObjectThreshold = 500*1024;  // 500KiB
+  // Objects from this size on are uploaded in parts; S3 requires parts of at
+  // least 5MiB, except for the last one
+  static const uint64_t kDefaultMultipartThreshold = 64*1024*1024;  // 64MiB
+  static const uint64_t kDefaultMultipartPartSize = 16*1024*1024;  // 16MiB
+  // S3 parts must be at least 5MiB, except for the last one
+  static const uint64_t kMinMultipartPartSize = 5*1024*1024;  // 5MiB
+  // Larger objects cannot be copied by a single request
+  static const uint64_t kMaxSingleCopySize =
+    static_cast<uint64_t>(5)*1024*1024*1024;  // 5GiB
+  static const uint64_t kDefaultCopyPartSize = 1024*1024*1024;  // 1GiB
+  // Limit of the S3 DeleteObjects request
+  static const unsigned kMaxKeysPerDelete = 1000;
 
   // Used to make the async HTTP requests synchronous in Peek() Create(),
   // and Upload() of single bits
@@ -108,6 +179,54 @@ class S3Uploader : public AbstractUploader {
 
   void OnReqComplete(const upload::UploaderResults &results, RequestCtrl *ctrl);
 
+  // Carries the reply of a listing request back to ListObjects()
+  struct ListCtrl : public RequestCtrl {
+    std::string response;
+  };
+
+  void OnListComplete(s3fanout::JobInfo *info, int reply_code);
+
+  // Collects the answers of a batch of HEAD requests issued by DoPeekMany()
+  struct PeekManyCtrl : SingleCopy {
+    PeekManyCtrl(unsigned num_paths, unsigned max_in_flight)
+      : presence(num_paths, kPresenceUnknown)
+      , in_flight(max_in_flight)
+    { }
+
+    std::vector<ObjectPresence> presence;
+    SynchronizingCounter<uint32_t> in_flight;
+  };
+
+  struct PeekSlot {
+    PeekSlot(PeekManyCtrl *c, unsigned i) : ctrl(c), idx(i) { }
+    PeekManyCtrl *ctrl;
+    unsigned idx;
+  };
+
+  void OnPeekComplete(const upload::UploaderResults &results, PeekSlot slot);
+
+  void StartMultipart(S3MultipartUpload *multipart);
+  void UploadPart(S3MultipartUpload *multipart, FileBackedBuffer *part);
+  void CommitMultipart(S3MultipartUpload *multipart);
+  void CompleteMultipart(S3MultipartUpload *multipart);
+  void StartMultipartCopy(S3MultipartUpload *multipart);
+  void UploadCopyParts(S3MultipartUpload *multipart);
+  void OnMultipartInit(S3MultipartUpload *multipart, s3fanout::JobInfo *info,
+                       bool ok);
+  void RemoveStagedObject(S3MultipartUpload *multipart, int return_code);
+  void FinishMultipart(S3MultipartUpload *multipart, int return_code);
+  void OnMultipartJobComplete(s3fanout::JobInfo *info, int reply_code);
+  bool DoUploadMultipart(const std::string &object_key,
+                         IngestionSource *source);
+  std::string MkStagingKey(const UploadStreamHandle *handle) const;
+  /**
+   * Inverse of the mangling of paths into object keys, used to keep the
+   * presence cache in terms of backend paths
+   */
+  std::string GetRemotePath(const std::string &object_key) const {
+    return object_key.substr(repository_alias_.length() + 1);
+  }
+
   static void *MainCollectResults(void *data);
 
   bool ParseSpoolerDefinition(const SpoolerDefinition &spooler_definition);
@@ -132,6 +251,15 @@ class S3Uploader : public AbstractUploader {
   bool peek_before_put_;
   bool use_https_;
   std::string proxy_;
+  uint64_t multipart_threshold_;  // 0 disables multipart uploads
+  uint64_t multipart_part_size_;
+  uint64_t max_single_copy_size_;
+  uint64_t copy_part_size_;
+  /**
+   * Bounds the number of parts in memory, blocks the upload task when the
+   * fanout cannot keep up
+   */
+  UniquePtr<SynchronizingCounter<uint32_t> > parts_in_flight_;
 
   const std::string temporary_path_;
   mutable atomic_int32 io_errors_;
@@ -33,6 +33,9 @@ SpoolerDefinition::SpoolerDefinition(
       min_file_chunk_size(min_file_chunk_size),
       avg_file_chunk_size(avg_file_chunk_size),
       max_file_chunk_size(max_file_chunk_size),
+      chunking_alg(kChunkXor32),
+      compression_segment_size(0),
+      compression_level(0),
       number_of_concurrent_uploads(kDefaultMaxConcurrentUploads),
       num_upload_tasks(kDefaultNumUploadTasks),
       session_token_file(session_token_file),
@@ -77,6 +80,7 @@ SpoolerDefinition::SpoolerDefinition(
 SpoolerDefinition SpoolerDefinition::Dup2DefaultCompression() const {
   SpoolerDefinition result(*this);
   result.compression_alg = zlib::kZlibDefault;
+  result.compression_level = 0;
   return result;
 }
 
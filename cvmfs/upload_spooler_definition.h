@@ -9,6 +9,7 @@
 
 #include "compression.h"
 #include "hash.h"
+#include "ingestion/chunk_detector.h"
 
 namespace upload {
 
@@ -75,6 +76,22 @@ struct SpoolerDefinition {
   size_t min_file_chunk_size;
   size_t avg_file_chunk_size;
   size_t max_file_chunk_size;
+  /**
+   * Defines the chunk boundaries; changing it for an existing repository
+   * breaks the deduplication of chunks against previous revisions.
+   */
+  ChunkingAlgorithms chunking_alg;
+  /**
+   * If non-zero, chunks are split into segments of this size that are
+   * compressed in parallel.  Changes the compressed representation of larger
+   * chunks and thereby their content hashes.
+   */
+  size_t compression_segment_size;
+  /**
+   * Algorithm specific compression level, e.g. from "zstd:<level>".  Zero
+   * selects the default level of the algorithm.
+   */
+  int compression_level;
 
   /**
    * This is the number of concurrently open files to be uploaded. It does not,
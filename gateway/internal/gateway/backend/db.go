@@ -72,11 +72,18 @@ func (db *DB) Close() error {
 	return nil
 }
 
-// WithLock runs the given task while holding a commit lock for the repository
+// WithLock runs the given task while holding the repository lock exclusively
 func (db *DB) WithLock(ctx context.Context, repository string, task func() error) error {
 	return db.Locks.WithLock(repository, task)
 }
 
+// WithSharedLock runs the given task while holding the repository lock in
+// shared mode. Commits of different leases of a repository can proceed
+// concurrently, exclusive operations such as GC wait for them to finish.
+func (db *DB) WithSharedLock(ctx context.Context, repository string, task func() error) error {
+	return db.Locks.WithSharedLock(repository, task)
+}
+
 func createSchema(db *sql.DB) error {
 	statement := fmt.Sprintf(`
 create table SchemaVersion (
@@ -274,8 +274,11 @@ func (s *Services) CommitLease(ctx context.Context, token, oldRootHash, newRootH
 		return 0, err
 	}
 
+	// Lease paths don't overlap, so commits of different leases are merged
+	// concurrently. The receiver serializes the publication of the new
+	// root catalog.
 	var finalRev uint64
-	if err := s.DB.WithLock(ctx, lease.Repository, func() error {
+	if err := s.DB.WithSharedLock(ctx, lease.Repository, func() error {
 		var err error
 		leasePath := lease.CombinedLeasePath()
 		finalRev, err = s.Pool.CommitLease(ctx, leasePath, oldRootHash, newRootHash, tag)
@@ -8,13 +8,28 @@ type NamedLocks struct {
 	locks sync.Map
 }
 
-// WithLock runs the given task, locking the "name" mutex for the
+func (l *NamedLocks) get(name string) *sync.RWMutex {
+	m, _ := l.locks.LoadOrStore(name, &sync.RWMutex{})
+	return m.(*sync.RWMutex)
+}
+
+// WithLock runs the given task, exclusively locking the "name" mutex for the
 // duration of the task
 func (l *NamedLocks) WithLock(name string, task func() error) error {
-	m, _ := l.locks.LoadOrStore(name, &sync.Mutex{})
-	mtx := m.(*sync.Mutex)
+	mtx := l.get(name)
 	mtx.Lock()
 	defer mtx.Unlock()
 
 	return task()
 }
+
+// WithSharedLock runs the given task, holding the "name" mutex in shared mode
+// for the duration of the task. Tasks holding the shared lock can run
+// concurrently but not at the same time as a task holding the exclusive lock.
+func (l *NamedLocks) WithSharedLock(name string, task func() error) error {
+	mtx := l.get(name)
+	mtx.RLock()
+	defer mtx.RUnlock()
+
+	return task()
+}
@@ -0,0 +1,78 @@
+package backend
+
+import (
+	"sync"
+	"testing"
+	"time"
+)
+
+func TestNamedLocksShared(t *testing.T) {
+	var locks NamedLocks
+
+	// Both tasks need to be inside of the lock at the same time to finish
+	var inside sync.WaitGroup
+	inside.Add(2)
+	var wg sync.WaitGroup
+	for i := 0; i < 2; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			locks.WithSharedLock("test.repo.org", func() error {
+				inside.Done()
+				inside.Wait()
+				return nil
+			})
+		}()
+	}
+
+	done := make(chan struct{})
+	go func() {
+		wg.Wait()
+		close(done)
+	}()
+
+	select {
+	case <-done:
+	case <-time.After(5 * time.Second):
+		t.Fatalf("shared lock holders did not run concurrently")
+	}
+}
+
+func TestNamedLocksExclusive(t *testing.T) {
+	var locks NamedLocks
+
+	started := make(chan struct{})
+	release := make(chan struct{})
+	go locks.WithLock("test.repo.org", func() error {
+		close(started)
+		<-release
+		return nil
+	})
+	<-started
+
+	acquired := make(chan struct{})
+	go locks.WithSharedLock("test.repo.org", func() error {
+		close(acquired)
+		return nil
+	})
+
+	// Other repositories are not blocked
+	if err := locks.WithSharedLock("other.repo.org", func() error {
+		return nil
+	}); err != nil {
+		t.Fatalf("could not lock other repository: %v", err)
+	}
+
+	select {
+	case <-acquired:
+		t.Fatalf("shared lock acquired while the exclusive lock is held")
+	case <-time.After(100 * time.Millisecond):
+	}
+
+	close(release)
+	select {
+	case <-acquired:
+	case <-time.After(5 * time.Second):
+		t.Fatalf("shared lock not acquired after the exclusive lock got released")
+	}
+}
@@ -73,8 +73,9 @@ func (p testCrashTask) Context() context.Context {
 
 // Pool maintains a number of parallel receiver workers to service
 // payload submission and commit requests. Payload submissions are done in
-// parallel, using Config.NumReceivers workers, while only a single commit
-// request can be treated per repository at a time.
+// parallel, using Config.NumReceivers workers. Commit requests of different
+// leases of a repository are also treated in parallel; the receivers merge them
+// concurrently and only serialize the publication of the new root catalog.
 type Pool struct {
 	tasks      chan<- task
 	wg         sync.WaitGroup
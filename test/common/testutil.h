@@ -175,8 +175,9 @@ class AbstractMockUploader : public upload::AbstractUploader {
     assert(AbstractMockUploader::not_implemented);
   }
 
-  virtual bool Peek(const std::string &path) {
+  virtual upload::ObjectPresence DoPeek(const std::string &path) {
     assert(AbstractMockUploader::not_implemented);
+    return upload::kPresenceUnknown;
   }
 
   virtual bool Mkdir(const std::string &path) {
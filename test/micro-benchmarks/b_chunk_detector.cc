@@ -0,0 +1,184 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "ingestion/chunk_detector.h"
+#include "ingestion/item.h"
+#include "ingestion/item_mem.h"
+#include "prng.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+/**
+ * Compares the content-defined chunking algorithms for throughput and for the
+ * fraction of data that deduplicates against a previous version after a few
+ * small insertions.  By default, the input is pseudo-random data; set
+ * CVMFS_UBENCH_CHUNK_DATA to a file in order to benchmark with real data.
+ */
+class BM_ChunkDetector : public benchmark::Fixture {
+ protected:
+  static const unsigned kDataSize = 64 * 1024 * 1024;
+  static const unsigned kBlockSize = 16 * 4096;  // as in TaskRead
+  static const unsigned kNumEdits = 16;
+
+  virtual void SetUp(const benchmark::State &st) {
+    std::string data;
+    const char *path = getenv("CVMFS_UBENCH_CHUNK_DATA");
+    int fd = (path == NULL) ? -1 : open(path, O_RDONLY);
+    if (fd >= 0) {
+      bool retval = SafeReadToString(fd, &data);
+      assert(retval);
+      close(fd);
+    }
+    if (data.empty()) {
+      Prng prng;
+      prng.InitSeed(42);
+      data.resize(kDataSize);
+      for (unsigned i = 0; i < kDataSize; ++i)
+        data[i] = static_cast<char>(prng.Next(256));
+    }
+    MakeBlocks(data, &blocks_);
+
+    // A few short insertions at random positions
+    Prng prng;
+    prng.InitSeed(137);
+    for (unsigned i = 0; i < kNumEdits; ++i) {
+      unsigned pos = prng.Next(data.size());
+      data.insert(pos, "cvmfs");
+    }
+    MakeBlocks(data, &blocks_edited_);
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    FreeBlocks(&blocks_);
+    FreeBlocks(&blocks_edited_);
+  }
+
+  void MakeBlocks(const std::string &data, std::vector<BlockItem *> *blocks) {
+    for (unsigned i = 0; i < data.size(); i += kBlockSize) {
+      BlockItem *b = new BlockItem(&allocator_);
+      b->MakeDataCopy(reinterpret_cast<const unsigned char *>(data.data()) + i,
+                      std::min(kBlockSize, unsigned(data.size() - i)));
+      blocks->push_back(b);
+    }
+  }
+
+  void FreeBlocks(std::vector<BlockItem *> *blocks) {
+    for (unsigned i = 0; i < blocks->size(); ++i)
+      delete (*blocks)[i];
+    blocks->clear();
+  }
+
+  uint64_t Size(const std::vector<BlockItem *> &blocks) {
+    uint64_t size = 0;
+    for (unsigned i = 0; i < blocks.size(); ++i)
+      size += blocks[i]->size();
+    return size;
+  }
+
+  /**
+   * Returns the end offsets of the chunks
+   */
+  std::vector<uint64_t> Chunk(ChunkingAlgorithms algorithm,
+                              uint64_t avg_chunk_size,
+                              const std::vector<BlockItem *> &blocks)
+  {
+    UniquePtr<ChunkDetector> detector(ChunkDetector::Construct(
+      algorithm, avg_chunk_size / 2, avg_chunk_size, avg_chunk_size * 2));
+    std::vector<uint64_t> cuts;
+    uint64_t cut;
+    for (unsigned i = 0; i < blocks.size(); ++i) {
+      while ((cut = detector->FindNextCutMark(blocks[i])) != 0)
+        cuts.push_back(cut);
+    }
+    cuts.push_back(Size(blocks));
+    return cuts;
+  }
+
+  /**
+   * Content hashes of the chunks mapped to their sizes
+   */
+  void HashChunks(const std::vector<BlockItem *> &blocks,
+                  const std::vector<uint64_t> &cuts,
+                  std::vector<std::pair<shash::Md5, uint64_t> > *chunks)
+  {
+    std::string content;
+    unsigned idx_cut = 0;
+    uint64_t offset = 0;
+    for (unsigned i = 0; i < blocks.size(); ++i) {
+      unsigned pos = 0;
+      while (pos < blocks[i]->size()) {
+        uint64_t nbytes = std::min(uint64_t(blocks[i]->size() - pos),
+                                   cuts[idx_cut] - offset);
+        content.append(reinterpret_cast<char *>(blocks[i]->data()) + pos,
+                       nbytes);
+        pos += nbytes;
+        offset += nbytes;
+        if (offset == cuts[idx_cut]) {
+          chunks->push_back(std::make_pair(
+            shash::Md5(content.data(), content.size()), content.size()));
+          content.clear();
+          idx_cut++;
+        }
+      }
+    }
+  }
+
+  void Run(benchmark::State &st, ChunkingAlgorithms algorithm) {  // NOLINT
+    const uint64_t avg_chunk_size = st.range(0);
+    std::vector<uint64_t> cuts;
+    while (st.KeepRunning()) {
+      cuts = Chunk(algorithm, avg_chunk_size, blocks_);
+    }
+    st.SetBytesProcessed(st.iterations() * Size(blocks_));
+
+    std::vector<std::pair<shash::Md5, uint64_t> > chunks;
+    std::vector<std::pair<shash::Md5, uint64_t> > chunks_edited;
+    HashChunks(blocks_, cuts, &chunks);
+    HashChunks(blocks_edited_,
+               Chunk(algorithm, avg_chunk_size, blocks_edited_),
+               &chunks_edited);
+    std::set<shash::Md5> known;
+    for (unsigned i = 0; i < chunks.size(); ++i)
+      known.insert(chunks[i].first);
+    uint64_t dedup_bytes = 0;
+    for (unsigned i = 0; i < chunks_edited.size(); ++i) {
+      if (known.count(chunks_edited[i].first) > 0)
+        dedup_bytes += chunks_edited[i].second;
+    }
+    st.counters["chunks"] = chunks.size();
+    st.counters["dedup"] =
+      static_cast<double>(dedup_bytes) / Size(blocks_edited_);
+  }
+
+  ItemAllocator allocator_;
+  std::vector<BlockItem *> blocks_;
+  std::vector<BlockItem *> blocks_edited_;
+};
+
+
+BENCHMARK_DEFINE_F(BM_ChunkDetector, Xor32)(benchmark::State &st) {
+  Run(st, kChunkXor32);
+}
+BENCHMARK_REGISTER_F(BM_ChunkDetector, Xor32)->Repetitions(3)->
+  Arg(32 * 1024)->Arg(1024 * 1024);
+
+
+BENCHMARK_DEFINE_F(BM_ChunkDetector, Gear)(benchmark::State &st) {
+  Run(st, kChunkGear);
+}
+BENCHMARK_REGISTER_F(BM_ChunkDetector, Gear)->Repetitions(3)->
+  Arg(32 * 1024)->Arg(1024 * 1024);
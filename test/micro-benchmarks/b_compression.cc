@@ -4,10 +4,15 @@
 #include <benchmark/benchmark.h>
 
 #include <inttypes.h>
+#include <pthread.h>
 
+#include <algorithm>
+#include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
+#include "atomic.h"
 #include "bm_util.h"
 #include "compression.h"
 
@@ -34,3 +39,192 @@ BENCHMARK_DEFINE_F(BM_Compression, Zlib)(benchmark::State &st) {
 }
 BENCHMARK_REGISTER_F(BM_Compression, Zlib)->Repetitions(3)->
   Arg(100)->Arg(4096)->Arg(100*1024);
+
+
+/**
+ * Compresses a buffer in one go through the polymorphic Compressor interface.
+ */
+static void CompressAlgorithm(benchmark::State &st, zlib::Algorithms alg) {
+  unsigned size = st.range(0);
+  unsigned char buffer[size];
+  memset(buffer, 0, size);
+  for (unsigned i = 0; i < size; i += 3)
+    buffer[i] = i;
+  while (st.KeepRunning()) {
+    zlib::Compressor *compressor = zlib::Compressor::Construct(alg);
+    size_t out_size = compressor->DeflateBound(size);
+    unsigned char *out_buf = static_cast<unsigned char *>(malloc(out_size));
+    unsigned char *in_buf = buffer;
+    size_t in_size = size;
+    unsigned char *out_ptr = out_buf;
+    compressor->Deflate(true, &in_buf, &in_size, &out_ptr, &out_size);
+    free(out_buf);
+    delete compressor;
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * size);
+}
+
+
+/**
+ * Decompresses a buffer that was compressed with the given algorithm.
+ */
+static void DecompressAlgorithm(benchmark::State &st, zlib::Algorithms alg) {
+  unsigned size = st.range(0);
+  unsigned char buffer[size];
+  memset(buffer, 0, size);
+  for (unsigned i = 0; i < size; i += 3)
+    buffer[i] = i;
+  zlib::Compressor *compressor = zlib::Compressor::Construct(alg);
+  size_t compressed_size = compressor->DeflateBound(size);
+  unsigned char *compressed =
+    static_cast<unsigned char *>(malloc(compressed_size));
+  unsigned char *in_buf = buffer;
+  size_t in_size = size;
+  unsigned char *out_ptr = compressed;
+  compressor->Deflate(true, &in_buf, &in_size, &out_ptr, &compressed_size);
+  delete compressor;
+
+  while (st.KeepRunning()) {
+    void *out_buf;
+    uint64_t out_size;
+    zlib::DecompressMem2Mem(compressed, compressed_size,
+                            &out_buf, &out_size, alg);
+    free(out_buf);
+  }
+  free(compressed);
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * size);
+}
+
+
+BENCHMARK_DEFINE_F(BM_Compression, ZlibStream)(benchmark::State &st) {
+  CompressAlgorithm(st, zlib::kZlibDefault);
+}
+BENCHMARK_REGISTER_F(BM_Compression, ZlibStream)->Repetitions(3)->
+  Arg(4096)->Arg(100*1024)->Arg(1024*1024);
+
+#ifdef HAS_ZSTD
+BENCHMARK_DEFINE_F(BM_Compression, Zstd)(benchmark::State &st) {
+  CompressAlgorithm(st, zlib::kZstd);
+}
+BENCHMARK_REGISTER_F(BM_Compression, Zstd)->Repetitions(3)->
+  Arg(4096)->Arg(100*1024)->Arg(1024*1024);
+#endif
+
+#ifdef HAS_LZ4
+BENCHMARK_DEFINE_F(BM_Compression, Lz4)(benchmark::State &st) {
+  CompressAlgorithm(st, zlib::kLz4);
+}
+BENCHMARK_REGISTER_F(BM_Compression, Lz4)->Repetitions(3)->
+  Arg(4096)->Arg(100*1024)->Arg(1024*1024);
+#endif
+
+BENCHMARK_DEFINE_F(BM_Compression, ZlibInflate)(benchmark::State &st) {
+  DecompressAlgorithm(st, zlib::kZlibDefault);
+}
+BENCHMARK_REGISTER_F(BM_Compression, ZlibInflate)->Repetitions(3)->
+  Arg(4096)->Arg(100*1024)->Arg(1024*1024);
+
+#ifdef HAS_ZSTD
+BENCHMARK_DEFINE_F(BM_Compression, ZstdInflate)(benchmark::State &st) {
+  DecompressAlgorithm(st, zlib::kZstd);
+}
+BENCHMARK_REGISTER_F(BM_Compression, ZstdInflate)->Repetitions(3)->
+  Arg(4096)->Arg(100*1024)->Arg(1024*1024);
+#endif
+
+#ifdef HAS_LZ4
+BENCHMARK_DEFINE_F(BM_Compression, Lz4Inflate)(benchmark::State &st) {
+  DecompressAlgorithm(st, zlib::kLz4);
+}
+BENCHMARK_REGISTER_F(BM_Compression, Lz4Inflate)->Repetitions(3)->
+  Arg(4096)->Arg(100*1024)->Arg(1024*1024);
+#endif
+
+
+namespace {
+
+/**
+ * A large chunk that is compressed segment by segment by a number of threads
+ */
+struct SegmentedChunk {
+  unsigned char *data;
+  size_t size;
+  size_t segment_size;
+  int32_t nsegments;
+  atomic_int32 next_segment;
+  zlib::Algorithms alg;
+};
+
+void *MainCompressSegments(void *data) {
+  SegmentedChunk *chunk = reinterpret_cast<SegmentedChunk *>(data);
+  unsigned char out[64 * 1024];
+  int32_t segment;
+  while ((segment = atomic_xadd32(&chunk->next_segment, 1)) <
+         chunk->nsegments)
+  {
+    const size_t offset = segment * chunk->segment_size;
+    unsigned char *in_buf = chunk->data + offset;
+    size_t in_size = std::min(chunk->segment_size, chunk->size - offset);
+    zlib::SegmentCompressor compressor(chunk->alg, 0, segment == 0);
+    bool done = false;
+    while (!done) {
+      unsigned char *out_ptr = out;
+      size_t out_size = sizeof(out);
+      done = compressor.Deflate(true, segment == chunk->nsegments - 1,
+                                &in_buf, &in_size, &out_ptr, &out_size);
+    }
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+
+/**
+ * Compresses a 64 MB chunk in segments of 1 MB with st.range(0) threads, like
+ * the compression tasks of the publish pipeline do with
+ * CVMFS_COMPRESSION_SEGMENT_SIZE=1048576.  With zero threads, the chunk is
+ * compressed as a single stream for comparison.
+ */
+static void CompressSegments(benchmark::State &st, zlib::Algorithms alg) {
+  const unsigned nthreads = st.range(0);
+  SegmentedChunk chunk;
+  chunk.size = 64 * 1024 * 1024;
+  chunk.segment_size = 1024 * 1024;
+  chunk.nsegments = nthreads == 0 ? 1 : chunk.size / chunk.segment_size;
+  if (nthreads == 0) chunk.segment_size = chunk.size;
+  chunk.alg = alg;
+  chunk.data = static_cast<unsigned char *>(malloc(chunk.size));
+  for (unsigned i = 0; i < chunk.size; ++i)
+    chunk.data[i] = (i % 4096) < 2048 ? (i % 251) : (i * 7919) >> 5;
+
+  std::vector<pthread_t> threads(std::max(nthreads, 1U));
+  while (st.KeepRunning()) {
+    atomic_init32(&chunk.next_segment);
+    for (unsigned i = 0; i < threads.size(); ++i) {
+      int retval = pthread_create(&threads[i], NULL, MainCompressSegments,
+                                  &chunk);
+      assert(retval == 0);
+    }
+    for (unsigned i = 0; i < threads.size(); ++i)
+      pthread_join(threads[i], NULL);
+  }
+  free(chunk.data);
+  st.SetBytesProcessed(int64_t(st.iterations()) * chunk.size);
+}
+
+BENCHMARK_DEFINE_F(BM_Compression, ZlibSegments)(benchmark::State &st) {
+  CompressSegments(st, zlib::kZlibDefault);
+}
+BENCHMARK_REGISTER_F(BM_Compression, ZlibSegments)->Repetitions(3)->
+  UseRealTime()->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+#ifdef HAS_ZSTD
+BENCHMARK_DEFINE_F(BM_Compression, ZstdSegments)(benchmark::State &st) {
+  CompressSegments(st, zlib::kZstd);
+}
+BENCHMARK_REGISTER_F(BM_Compression, ZstdSegments)->Repetitions(3)->
+  UseRealTime()->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+#endif
@@ -2,9 +2,11 @@
  * This file is part of the CernVM File System.
  */
 #include <benchmark/benchmark.h>
+#include <openssl/sha.h>
 
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "bm_util.h"
 #include "hash.h"
@@ -63,3 +65,67 @@ BENCHMARK_DEFINE_F(BM_Hash, Sha1)(benchmark::State &st) {
 }
 BENCHMARK_REGISTER_F(BM_Hash, Sha1)->Repetitions(3)->Arg(100)->Arg(4096)->
   Arg(100*1024);
+
+
+/**
+ * Throughput of the content hashes on large buffers.  Sha1 uses the SHA
+ * instructions of the CPU if available, Sha1OpenSsl is the plain library
+ * code for comparison.  Run with CVMFS_HASH_NO_ACCEL=1 to disable all
+ * accelerated code paths.
+ */
+class BM_ContentHash : public benchmark::Fixture {
+ protected:
+  virtual void SetUp(const benchmark::State &st) {
+    buffer_.resize(st.range(0));
+    for (unsigned i = 0; i < buffer_.size(); ++i)
+      buffer_[i] = static_cast<unsigned char>(i * 7 + 1);
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    buffer_.clear();
+  }
+
+  void Run(benchmark::State &st, shash::Algorithms algorithm) {  // NOLINT
+    shash::Any content_hash(algorithm);
+    while (st.KeepRunning()) {
+      HashMem(&buffer_[0], buffer_.size(), &content_hash);
+      Escape(&content_hash);
+    }
+    st.SetBytesProcessed(st.iterations() * buffer_.size());
+  }
+
+  std::vector<unsigned char> buffer_;
+};
+
+
+BENCHMARK_DEFINE_F(BM_ContentHash, Sha1)(benchmark::State &st) {
+  Run(st, shash::kSha1);
+}
+BENCHMARK_REGISTER_F(BM_ContentHash, Sha1)->Repetitions(3)->Arg(4096)->
+  Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
+
+
+BENCHMARK_DEFINE_F(BM_ContentHash, Sha1OpenSsl)(benchmark::State &st) {
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  while (st.KeepRunning()) {
+    SHA1(&buffer_[0], buffer_.size(), digest);
+    Escape(digest);
+  }
+  st.SetBytesProcessed(st.iterations() * buffer_.size());
+}
+BENCHMARK_REGISTER_F(BM_ContentHash, Sha1OpenSsl)->Repetitions(3)->Arg(4096)->
+  Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
+
+
+BENCHMARK_DEFINE_F(BM_ContentHash, Shake128)(benchmark::State &st) {
+  Run(st, shash::kShake128);
+}
+BENCHMARK_REGISTER_F(BM_ContentHash, Shake128)->Repetitions(3)->Arg(4096)->
+  Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
+
+
+BENCHMARK_DEFINE_F(BM_ContentHash, Shake128Tree)(benchmark::State &st) {
+  Run(st, shash::kShake128Tree);
+}
+BENCHMARK_REGISTER_F(BM_ContentHash, Shake128Tree)->Repetitions(3)->
+  Arg(4096)->Arg(1024 * 1024)->Arg(16 * 1024 * 1024);
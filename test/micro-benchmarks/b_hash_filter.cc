@@ -0,0 +1,168 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#define __STDC_FORMAT_MACROS
+#include <benchmark/benchmark.h>
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bm_util.h"
+#include "garbage_collection/hash_filter.h"
+#include "hash.h"
+#include "prng.h"
+#include "util/posix.h"
+
+/**
+ * Compares the preserved objects filters of the garbage collection on sets of
+ * random hashes.  The label shows the memory used per hash.
+ */
+class BM_HashFilter : public benchmark::Fixture {
+ protected:
+  virtual void SetUp(const benchmark::State &st) {
+    prng_.InitSeed(42);
+    hashes_.resize(st.range(0));
+    for (unsigned i = 0; i < hashes_.size(); ++i) {
+      hashes_[i] = shash::Any(shash::kSha1);
+      hashes_[i].Randomize(&prng_);
+    }
+    // Every other query is for a hash that is not in the set
+    queries_.resize(kNumQueries);
+    for (unsigned i = 0; i < kNumQueries; ++i) {
+      if (i % 2 == 0) {
+        queries_[i] = hashes_[prng_.Next(hashes_.size())];
+      } else {
+        queries_[i] = shash::Any(shash::kSha1);
+        queries_[i].Randomize(&prng_);
+      }
+    }
+    tmp_path_ = CreateTempDir("/tmp/cvmfs_bm_hash_filter");
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    RemoveTree(tmp_path_);
+  }
+
+  template <class HashFilterT>
+  void Fill(HashFilterT *filter) {
+    for (unsigned i = 0; i < hashes_.size(); ++i)
+      filter->Fill(hashes_[i]);
+    filter->Freeze();
+  }
+
+  void SetMemoryLabel(const uint64_t bytes, benchmark::State *st) {
+    char label[64];
+    snprintf(label, sizeof(label), "%.1f bytes per hash",
+             static_cast<double>(bytes) / static_cast<double>(hashes_.size()));
+    st->SetLabel(label);
+  }
+
+  static const unsigned kNumQueries = 100000;
+
+  Prng prng_;
+  std::vector<shash::Any> hashes_;
+  std::vector<shash::Any> queries_;
+  std::string tmp_path_;
+};
+
+
+BENCHMARK_DEFINE_F(BM_HashFilter, FillSmallhash)(benchmark::State &st) {
+  uint64_t bytes = 0;
+  while (st.KeepRunning()) {
+    SmallhashFilter filter;
+    Fill(&filter);
+    bytes = filter.bytes_allocated();
+    Escape(&filter);
+  }
+  st.SetItemsProcessed(st.iterations() * hashes_.size());
+  SetMemoryLabel(bytes, &st);
+}
+BENCHMARK_REGISTER_F(BM_HashFilter, FillSmallhash)
+  ->Repetitions(3)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+
+BENCHMARK_DEFINE_F(BM_HashFilter, FillCompact)(benchmark::State &st) {
+  uint64_t bytes = 0;
+  while (st.KeepRunning()) {
+    CompactHashFilter filter;
+    Fill(&filter);
+    bytes = filter.bytes_allocated();
+    Escape(&filter);
+  }
+  st.SetItemsProcessed(st.iterations() * hashes_.size());
+  SetMemoryLabel(bytes, &st);
+}
+BENCHMARK_REGISTER_F(BM_HashFilter, FillCompact)
+  ->Repetitions(3)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+
+BENCHMARK_DEFINE_F(BM_HashFilter, FillSpilled)(benchmark::State &st) {
+  uint64_t bytes = 0;
+  while (st.KeepRunning()) {
+    CompactHashFilter filter;
+    // An eighth of the keys fit into memory
+    filter.LimitMemory(hashes_.size() / 8 * sizeof(CompactHashFilter::Key),
+                       tmp_path_);
+    Fill(&filter);
+    bytes = filter.bytes_allocated();
+    Escape(&filter);
+  }
+  st.SetItemsProcessed(st.iterations() * hashes_.size());
+  SetMemoryLabel(bytes, &st);
+}
+BENCHMARK_REGISTER_F(BM_HashFilter, FillSpilled)
+  ->Repetitions(3)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+
+BENCHMARK_DEFINE_F(BM_HashFilter, ContainsSmallhash)(benchmark::State &st) {
+  SmallhashFilter filter;
+  Fill(&filter);
+  unsigned i = 0;
+  while (st.KeepRunning()) {
+    bool found = filter.Contains(queries_[i % kNumQueries]);
+    Escape(&found);
+    ++i;
+  }
+  st.SetItemsProcessed(st.iterations());
+  SetMemoryLabel(filter.bytes_allocated(), &st);
+}
+BENCHMARK_REGISTER_F(BM_HashFilter, ContainsSmallhash)
+  ->Repetitions(3)->Arg(1000000);
+
+
+BENCHMARK_DEFINE_F(BM_HashFilter, ContainsCompact)(benchmark::State &st) {
+  CompactHashFilter filter;
+  Fill(&filter);
+  unsigned i = 0;
+  while (st.KeepRunning()) {
+    bool found = filter.Contains(queries_[i % kNumQueries]);
+    Escape(&found);
+    ++i;
+  }
+  st.SetItemsProcessed(st.iterations());
+  SetMemoryLabel(filter.bytes_allocated(), &st);
+}
+BENCHMARK_REGISTER_F(BM_HashFilter, ContainsCompact)
+  ->Repetitions(3)->Arg(1000000);
+
+
+BENCHMARK_DEFINE_F(BM_HashFilter, ContainsSpilled)(benchmark::State &st) {
+  CompactHashFilter filter;
+  filter.LimitMemory(hashes_.size() / 8 * sizeof(CompactHashFilter::Key),
+                     tmp_path_);
+  Fill(&filter);
+  unsigned i = 0;
+  while (st.KeepRunning()) {
+    bool found = filter.Contains(queries_[i % kNumQueries]);
+    Escape(&found);
+    ++i;
+  }
+  st.SetItemsProcessed(st.iterations());
+  SetMemoryLabel(filter.bytes_allocated(), &st);
+}
+BENCHMARK_REGISTER_F(BM_HashFilter, ContainsSpilled)
+  ->Repetitions(3)->Arg(1000000);
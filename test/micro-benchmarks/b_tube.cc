@@ -0,0 +1,132 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <pthread.h>
+
+#include <cassert>
+#include <vector>
+
+#include "bm_util.h"
+#include "ingestion/tube.h"
+
+namespace {
+
+struct TubeItem {
+  TubeItem() : quit(false) { }
+  bool quit;
+};
+
+template <class TubeT>
+struct TubeWorker {
+  TubeT *tube;
+  TubeItem *items;
+  unsigned num_items;
+  unsigned batch_size;
+};
+
+template <class TubeT>
+void *MainProducer(void *data) {
+  TubeWorker<TubeT> *worker = reinterpret_cast<TubeWorker<TubeT> *>(data);
+  for (unsigned i = 0; i < worker->num_items; ++i)
+    worker->tube->EnqueueBack(&worker->items[i]);
+  return NULL;
+}
+
+template <class TubeT>
+void *MainConsumer(void *data) {
+  TubeWorker<TubeT> *worker = reinterpret_cast<TubeWorker<TubeT> *>(data);
+  TubeItem *batch[64];
+  while (true) {
+    unsigned n = worker->tube->PopFrontMany(batch, worker->batch_size);
+    for (unsigned i = 0; i < n; ++i) {
+      if (batch[i]->quit) {
+        // Leave the remaining quit items for the other consumers
+        for (unsigned j = i + 1; j < n; ++j)
+          worker->tube->EnqueueBack(batch[j]);
+        return NULL;
+      }
+    }
+  }
+}
+
+/**
+ * Moves kNumItems through a tube with st.range(0) producers and as many
+ * consumers.  Consumers take batch_size items at once.
+ */
+template <class TubeT>
+void RunTube(benchmark::State &st,  // NOLINT(runtime/references)
+             unsigned batch_size)
+{
+  const unsigned kNumItems = 200000;
+  const unsigned num_threads = st.range(0);
+  const unsigned num_items = kNumItems / num_threads;
+  std::vector<TubeItem> items(num_items);
+  std::vector<TubeItem> quit_items(num_threads);
+  for (unsigned i = 0; i < num_threads; ++i)
+    quit_items[i].quit = true;
+
+  while (st.KeepRunning()) {
+    TubeT tube(1024);
+    std::vector<TubeWorker<TubeT> > workers(num_threads);
+    std::vector<pthread_t> producers(num_threads);
+    std::vector<pthread_t> consumers(num_threads);
+    for (unsigned i = 0; i < num_threads; ++i) {
+      workers[i].tube = &tube;
+      workers[i].items = &items[0];
+      workers[i].num_items = num_items;
+      workers[i].batch_size = batch_size;
+      int retval = pthread_create(&consumers[i], NULL, MainConsumer<TubeT>,
+                                  &workers[i]);
+      assert(retval == 0);
+      retval = pthread_create(&producers[i], NULL, MainProducer<TubeT>,
+                              &workers[i]);
+      assert(retval == 0);
+    }
+    for (unsigned i = 0; i < num_threads; ++i)
+      pthread_join(producers[i], NULL);
+    for (unsigned i = 0; i < num_threads; ++i)
+      tube.EnqueueBack(&quit_items[i]);
+    for (unsigned i = 0; i < num_threads; ++i)
+      pthread_join(consumers[i], NULL);
+  }
+  st.SetItemsProcessed(st.iterations() * num_items * num_threads);
+}
+
+}  // anonymous namespace
+
+
+class BM_Tube : public benchmark::Fixture {
+ protected:
+  virtual void SetUp(const benchmark::State &st) {
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+  }
+};
+
+
+BENCHMARK_DEFINE_F(BM_Tube, LinkedList)(benchmark::State &st) {
+  RunTube<Tube<TubeItem> >(st, 1);
+}
+BENCHMARK_REGISTER_F(BM_Tube, LinkedList)->Repetitions(3)->UseRealTime()->
+  Arg(1)->Arg(4)->Arg(8);
+
+BENCHMARK_DEFINE_F(BM_Tube, LinkedListBatch)(benchmark::State &st) {
+  RunTube<Tube<TubeItem> >(st, 16);
+}
+BENCHMARK_REGISTER_F(BM_Tube, LinkedListBatch)->Repetitions(3)->
+  UseRealTime()->Arg(1)->Arg(4)->Arg(8);
+
+BENCHMARK_DEFINE_F(BM_Tube, Ring)(benchmark::State &st) {
+  RunTube<RingTube<TubeItem> >(st, 1);
+}
+BENCHMARK_REGISTER_F(BM_Tube, Ring)->Repetitions(3)->UseRealTime()->
+  Arg(1)->Arg(4)->Arg(8);
+
+BENCHMARK_DEFINE_F(BM_Tube, RingBatch)(benchmark::State &st) {
+  RunTube<RingTube<TubeItem> >(st, 16);
+}
+BENCHMARK_REGISTER_F(BM_Tube, RingBatch)->Repetitions(3)->UseRealTime()->
+  Arg(1)->Arg(4)->Arg(8);
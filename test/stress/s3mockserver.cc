@@ -64,6 +64,7 @@ int GetValue(std::string body, std::string param,
 
 int main() {
   set<string> existing_files;
+  int upload_id = 0;
 
   int listen_sockfd, accept_sockfd;
   socklen_t clilen;
@@ -95,27 +96,75 @@ int main() {
     std::string req_header = "";
     char buf[10001];
     int nread = read(accept_sockfd, buf, 10000);
+    assert(nread >= 0);
     buf[nread] = 0;
     char *occ = strstr(buf, "\r\n\r\n");
-    if (!occ) occ = strstr(buf, "\n\n");
+    unsigned header_end = 4;
+    if (!occ) {
+      occ = strstr(buf, "\n\n");
+      header_end = 2;
+    }
     assert(occ);
     req_header += std::string(buf, occ-buf);
 
     // Parse header
     std::string req_type = "";
     std::string req_file = "";  // target name without bucket prefix
+    std::string req_query = "";  // multipart sub-resources
     int content_length = 0;
     req_type = GetField(req_header, ' ', 0);
     req_file = GetField(req_header, ' ', 1);
     req_file = req_file.substr(req_file.find("/", 1) + 1);  // no bucket
-    if (req_type == "PUT") {
+    if (req_file.find('?') != std::string::npos) {
+      req_query = req_file.substr(req_file.find('?') + 1);
+      req_file = req_file.substr(0, req_file.find('?'));
+    }
+    if ((req_type == "PUT") || (req_type == "POST")) {
       content_length = GetValue(req_header, "Content-Length");
-      assert(content_length >= 0);
+      if (content_length < 0)
+        content_length = 0;
+    }
+    std::string copy_source = "";
+    const char *copy_header = strstr(buf, "X-Amz-Copy-Source: ");
+    if ((copy_header != NULL) && (copy_header < occ)) {
+      copy_source = std::string(copy_header + 19);
+      copy_source = copy_source.substr(0, copy_source.find_first_of("\r\n"));
+      copy_source = copy_source.substr(copy_source.find("/", 1) + 1);
     }
 
-    string reply = "HTTP/1.1 200 OK\r\n";
+    // Drain the request body so that the client does not see a reset
+    int body_read = nread - static_cast<int>(occ - buf) - header_end;
+    while (body_read < content_length) {
+      int n = read(accept_sockfd, buf, std::min(10000,
+                                                content_length - body_read));
+      if (n <= 0)
+        break;
+      body_read += n;
+    }
 
-    if (req_type == "PUT") {
+    string reply = "HTTP/1.1 200 OK\r\n";
+    string reply_body = "";
+
+    if ((req_type == "POST") && (req_query == "uploads")) {
+      reply_body = "<InitiateMultipartUploadResult><UploadId>" +
+                   StringifyInt(++upload_id) +
+                   "</UploadId></InitiateMultipartUploadResult>";
+    } else if (req_type == "POST") {
+      // Completion of a multipart upload
+      existing_files.insert(req_file);
+      reply_body = "<CompleteMultipartUploadResult>"
+                   "</CompleteMultipartUploadResult>";
+    } else if ((req_type == "PUT") &&
+               (req_query.find("uploadId=") != std::string::npos)) {
+      reply += "ETag: \"" + StringifyInt(++upload_id) + "\"\r\n";
+    } else if ((req_type == "PUT") && !copy_source.empty()) {
+      if (existing_files.find(copy_source) == existing_files.end()) {
+        reply = "HTTP/1.1 404 Not Found\r\n";
+      } else {
+        existing_files.insert(req_file);
+        reply_body = "<CopyObjectResult></CopyObjectResult>";
+      }
+    } else if (req_type == "PUT") {
       existing_files.insert(req_file);
     } else if (req_type == "HEAD") {
       if (existing_files.find(req_file) == existing_files.end()) {
@@ -124,12 +173,14 @@ int main() {
         reply = "HTTP/1.1 200 OK\r\n";
       }
     } else if (req_type == "DELETE") {
-      existing_files.erase(req_file);
+      if (req_query.empty())
+        existing_files.erase(req_file);
       // "No Content"-reply even if file did not exist
       reply = "HTTP/1.1 204 No Content\r\n";
     }
-    reply += "Content-Length: 0\r\n";
+    reply += "Content-Length: " + StringifyInt(reply_body.length()) + "\r\n";
     reply += "Connection: close\r\n\r\n";
+    reply += reply_body;
 
     int n = write(accept_sockfd, reply.c_str(), reply.length());
     assert(n >= 0);
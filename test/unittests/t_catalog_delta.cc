@@ -0,0 +1,240 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <string>
+
+#include "cache_posix.h"
+#include "catalog_delta.h"
+#include "compression.h"
+#include "hash.h"
+#include "sink.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+namespace {
+
+class StringSink : public cvmfs::Sink {
+ public:
+  virtual int64_t Write(const void *buf, uint64_t sz) {
+    data.append(static_cast<const char *>(buf), sz);
+    return sz;
+  }
+  virtual int Reset() { data.clear(); return 0; }
+  std::string data;
+};
+
+}  // anonymous namespace
+
+
+class T_CatalogDelta : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir(GetCurrentWorkingDirectory() + "/cvmfs_ut_delta");
+    ASSERT_FALSE(tmp_path_.empty());
+    cache_mgr_ = PosixCacheManager::Create(tmp_path_ + "/cache", false);
+    ASSERT_TRUE(cache_mgr_.IsValid());
+
+    // Ten and a half blocks of pseudo-random data
+    base_.resize(10 * kDeltaBlockSize + kDeltaBlockSize / 2);
+    for (unsigned i = 0; i < base_.size(); ++i)
+      base_[i] = static_cast<char>((i * 7919) >> 5);
+    base_hash_ = shash::Any(shash::kSha1, shash::kSuffixCatalog);
+    HashString(base_, &base_hash_);
+    ASSERT_TRUE(cache_mgr_->CommitFromMem(
+      base_hash_, reinterpret_cast<const unsigned char *>(base_.data()),
+      base_.size(), "base"));
+    ASSERT_TRUE(SafeWriteToFile(base_, tmp_path_ + "/base", 0600));
+  }
+
+  virtual void TearDown() {
+    cache_mgr_.Destroy();
+    RemoveTree(tmp_path_);
+  }
+
+  void HashString(const string &data, shash::Any *hash) {
+    shash::HashMem(reinterpret_cast<const unsigned char *>(data.data()),
+                   data.size(), hash);
+  }
+
+  /**
+   * Returns the uncompressed delta from the base to new_data
+   */
+  bool MakeDelta(const string &new_data, uint64_t max_size, string *delta) {
+    EXPECT_TRUE(SafeWriteToFile(new_data, tmp_path_ + "/new", 0600));
+    shash::Any delta_hash(shash::kSha1, shash::kSuffixCatalogDelta);
+    if (!CreateCatalogDelta(tmp_path_ + "/base", base_hash_,
+                            tmp_path_ + "/new", max_size,
+                            tmp_path_ + "/delta", &delta_hash))
+    {
+      return false;
+    }
+    string compressed;
+    int fd = open((tmp_path_ + "/delta").c_str(), O_RDONLY);
+    EXPECT_GE(fd, 0);
+    EXPECT_TRUE(SafeReadToString(fd, &compressed));
+    close(fd);
+    // Clients verify the download against this hash
+    shash::Any expected_hash(shash::kSha1, shash::kSuffixCatalogDelta);
+    HashString(compressed, &expected_hash);
+    EXPECT_EQ(expected_hash, delta_hash);
+    void *buf;
+    uint64_t size;
+    EXPECT_TRUE(zlib::DecompressMem2Mem(compressed.data(), compressed.size(),
+                                        &buf, &size));
+    delta->assign(static_cast<char *>(buf), size);
+    free(buf);
+    return true;
+  }
+
+  bool ApplyDelta(const string &delta, string *result) {
+    const int fd_base = cache_mgr_->Open(CacheManager::Bless(base_hash_));
+    EXPECT_GE(fd_base, 0);
+    StringSink sink;
+    const bool retval = ApplyCatalogDelta(
+      reinterpret_cast<const unsigned char *>(delta.data()), delta.size(),
+      base_hash_, cache_mgr_.weak_ref(), fd_base, &sink);
+    cache_mgr_->Close(fd_base);
+    *result = sink.data;
+    return retval;
+  }
+
+  void ExpectRoundtrip(const string &new_data) {
+    string delta;
+    ASSERT_TRUE(MakeDelta(new_data, new_data.size() + 1024, &delta));
+    string result;
+    ASSERT_TRUE(ApplyDelta(delta, &result));
+    EXPECT_EQ(new_data, result);
+  }
+
+  string tmp_path_;
+  UniquePtr<PosixCacheManager> cache_mgr_;
+  string base_;
+  shash::Any base_hash_;
+};
+
+
+TEST_F(T_CatalogDelta, Id) {
+  shash::Any catalog_hash(shash::kSha1, shash::kSuffixCatalog);
+  HashString("catalog", &catalog_hash);
+  shash::Any other_base(shash::kSha1, shash::kSuffixCatalog);
+  HashString("other base", &other_base);
+  shash::Any delta_id = MakeCatalogDeltaId(base_hash_, catalog_hash);
+  EXPECT_EQ(shash::kSuffixCatalogDelta, delta_id.suffix);
+  EXPECT_EQ('D', delta_id.MakePath()[delta_id.MakePath().length() - 1]);
+  EXPECT_NE(catalog_hash, delta_id);
+  EXPECT_NE(base_hash_, delta_id);
+  EXPECT_EQ(delta_id, MakeCatalogDeltaId(base_hash_, catalog_hash));
+  // Only the delta for the cached base is fetched
+  EXPECT_NE(delta_id, MakeCatalogDeltaId(other_base, catalog_hash));
+  EXPECT_NE(delta_id, MakeCatalogDeltaId(catalog_hash, base_hash_));
+}
+
+
+TEST_F(T_CatalogDelta, Ref) {
+  CatalogDeltaRef ref;
+  ref.base_hash = base_hash_;
+  ref.catalog_hash = shash::Any(shash::kSha1, shash::kSuffixCatalog);
+  HashString("catalog", &ref.catalog_hash);
+  ref.delta_hash = shash::Any(shash::kShake128, shash::kSuffixCatalogDelta);
+  HashString("delta", &ref.delta_hash);
+
+  CatalogDeltaRef parsed;
+  ASSERT_TRUE(parsed.Parse(ref.ToString()));
+  EXPECT_EQ(ref.base_hash, parsed.base_hash);
+  EXPECT_EQ(ref.catalog_hash, parsed.catalog_hash);
+  EXPECT_EQ(ref.delta_hash, parsed.delta_hash);
+  EXPECT_EQ(shash::kSuffixCatalog, parsed.catalog_hash.suffix);
+  EXPECT_EQ(shash::kSuffixCatalogDelta, parsed.delta_hash.suffix);
+  EXPECT_EQ(ref.ToString(), parsed.ToString());
+
+  EXPECT_FALSE(parsed.Parse(""));
+  EXPECT_FALSE(parsed.Parse(ref.base_hash.ToString()));
+  EXPECT_FALSE(parsed.Parse(ref.ToString() + " " + ref.base_hash.ToString()));
+  EXPECT_FALSE(parsed.Parse("xyz " + ref.catalog_hash.ToString() + " " +
+                            ref.delta_hash.ToString()));
+}
+
+
+TEST_F(T_CatalogDelta, Unchanged) {
+  string delta;
+  ASSERT_TRUE(MakeDelta(base_, base_.size(), &delta));
+  // Only the header
+  EXPECT_LT(delta.size(), 100U);
+  ExpectRoundtrip(base_);
+}
+
+
+TEST_F(T_CatalogDelta, ChangedBlocks) {
+  string new_data = base_;
+  new_data[0] = 'x';
+  new_data[5 * kDeltaBlockSize + 17] = 'y';
+  new_data[new_data.size() - 1] = 'z';
+  string delta;
+  ASSERT_TRUE(MakeDelta(new_data, new_data.size(), &delta));
+  EXPECT_GT(delta.size(), 2 * kDeltaBlockSize + kDeltaBlockSize / 2);
+  EXPECT_LT(delta.size(), 3 * kDeltaBlockSize);
+  ExpectRoundtrip(new_data);
+}
+
+
+TEST_F(T_CatalogDelta, SizeChanges) {
+  string grown = base_ + string(3 * kDeltaBlockSize, 'g');
+  ExpectRoundtrip(grown);
+
+  string shrunk = base_.substr(0, 4 * kDeltaBlockSize + 10);
+  ExpectRoundtrip(shrunk);
+
+  string aligned = base_.substr(0, 4 * kDeltaBlockSize);
+  ExpectRoundtrip(aligned);
+
+  ExpectRoundtrip("");
+}
+
+
+TEST_F(T_CatalogDelta, MaxSize) {
+  string new_data(base_.size(), 'n');
+  string delta;
+  EXPECT_FALSE(MakeDelta(new_data, new_data.size() / 4, &delta));
+  EXPECT_TRUE(MakeDelta(new_data, 2 * new_data.size(), &delta));
+}
+
+
+TEST_F(T_CatalogDelta, Mismatch) {
+  string new_data = base_;
+  new_data[3 * kDeltaBlockSize] = 'x';
+  string delta;
+  ASSERT_TRUE(MakeDelta(new_data, new_data.size(), &delta));
+
+  string result;
+  EXPECT_TRUE(ApplyDelta(delta, &result));
+
+  // Delta for another base
+  shash::Any other_base(base_hash_);
+  other_base.digest[0] ^= 0xFF;
+  const int fd_base = cache_mgr_->Open(CacheManager::Bless(base_hash_));
+  ASSERT_GE(fd_base, 0);
+  StringSink sink;
+  EXPECT_FALSE(ApplyCatalogDelta(
+    reinterpret_cast<const unsigned char *>(delta.data()), delta.size(),
+    other_base, cache_mgr_.weak_ref(), fd_base, &sink));
+  cache_mgr_->Close(fd_base);
+
+  // Truncated, trailing garbage, corrupted header
+  EXPECT_FALSE(ApplyDelta(delta.substr(0, delta.size() - 1), &result));
+  EXPECT_FALSE(ApplyDelta(delta + "x", &result));
+  EXPECT_FALSE(ApplyDelta(delta.substr(0, 10), &result));
+  string corrupted = delta;
+  corrupted[0] = 'X';
+  EXPECT_FALSE(ApplyDelta(corrupted, &result));
+}
+
+}  // namespace catalog
@@ -0,0 +1,190 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "catalog_diff_tool.h"
+#include "catalog_mgr_ro.h"
+#include "catalog_test_tools.h"
+#include "server_tool.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+namespace {
+
+const char *hashes[] = {"b026324c6904b2a9cb4b88d6d61c81d100000000",
+                        "26ab0db90d72e28ad0ba1e22ee51051000000000",
+                        "6d7fce9fee471194aa8b5b6e47267f0300000000",
+                        "48a24b70a0b376535542b996af51739800000000"};
+
+DirSpec MakeBaseSpec() {
+  DirSpec spec;
+  const size_t file_size = 4096;
+
+  EXPECT_TRUE(spec.AddDirectory("dir", "", file_size));
+  EXPECT_TRUE(spec.AddFile("file1", "dir", hashes[0], file_size));
+  EXPECT_TRUE(spec.AddDirectory("nested", "dir", file_size));
+  EXPECT_TRUE(spec.AddFile("file2", "dir/nested", hashes[1], file_size));
+  EXPECT_TRUE(spec.AddNestedCatalog("dir/nested"));
+
+  return spec;
+}
+
+/**
+ * Records the reported differences as "+path", "-path", and "~path"
+ */
+class RecordingDiffTool
+  : public CatalogDiffTool<catalog::SimpleCatalogManager>
+{
+ public:
+  RecordingDiffTool(const std::string &repo_path,
+                    const shash::Any &old_root_hash,
+                    const shash::Any &new_root_hash,
+                    const std::string &temp_dir_prefix,
+                    download::DownloadManager *download_manager)
+    : CatalogDiffTool<catalog::SimpleCatalogManager>(
+        repo_path, old_root_hash, new_root_hash, temp_dir_prefix,
+        download_manager)
+  { }
+
+  bool Reported(const std::string &change) const {
+    return std::find(changes.begin(), changes.end(), change) != changes.end();
+  }
+
+  int GetNumNewCatalogs() { return GetNewCatalogMgr()->GetNumCatalogs(); }
+
+  std::vector<std::string> changes;
+
+ protected:
+  virtual void ReportAddition(const PathString &path,
+                              const catalog::DirectoryEntry & /* entry */,
+                              const XattrList & /* xattrs */,
+                              const FileChunkList & /* chunks */)
+  {
+    changes.push_back("+" + path.ToString());
+  }
+
+  virtual void ReportRemoval(const PathString &path,
+                             const catalog::DirectoryEntry & /* entry */)
+  {
+    changes.push_back("-" + path.ToString());
+  }
+
+  virtual bool ReportModification(const PathString &path,
+                                  const catalog::DirectoryEntry & /* old */,
+                                  const catalog::DirectoryEntry & /* new */,
+                                  const XattrList & /* xattrs */,
+                                  const FileChunkList & /* chunks */)
+  {
+    changes.push_back("~" + path.ToString());
+    return true;
+  }
+};
+
+}  // anonymous namespace
+
+class T_CatalogDiffTool : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tester_ = new CatalogTestTool("test_diff");
+    ASSERT_TRUE(tester_->Init());
+    ASSERT_TRUE(tester_->Apply("base", MakeBaseSpec()));
+    base_hash_ = tester_->manifest()->catalog_hash();
+
+    server_tool_ = new ServerTool();
+    ASSERT_TRUE(server_tool_->InitDownloadManager(true, ""));
+    repo_path_ = "file://" + GetCurrentWorkingDirectory() + "/test_diff";
+    temp_prefix_ = GetCurrentWorkingDirectory() + "/diff_tool";
+  }
+
+  virtual void TearDown() {
+    server_tool_.Destroy();
+    tester_.Destroy();
+    RemoveTree(GetCurrentWorkingDirectory() + "/test_diff");
+  }
+
+  RecordingDiffTool *CreateDiffTool(const shash::Any &new_root_hash) {
+    RecordingDiffTool *diff_tool = new RecordingDiffTool(
+      repo_path_, base_hash_, new_root_hash, temp_prefix_,
+      server_tool_->download_manager());
+    EXPECT_TRUE(diff_tool->Init());
+    return diff_tool;
+  }
+
+  std::string repo_path_;
+  std::string temp_prefix_;
+  shash::Any base_hash_;
+  UniquePtr<CatalogTestTool> tester_;
+  UniquePtr<ServerTool> server_tool_;
+};
+
+
+TEST_F(T_CatalogDiffTool, IdenticalRoots) {
+  UniquePtr<RecordingDiffTool> diff_tool(CreateDiffTool(base_hash_));
+  EXPECT_TRUE(diff_tool->Run(PathString("")));
+  EXPECT_TRUE(diff_tool->changes.empty());
+  EXPECT_EQ(1, diff_tool->GetNumNewCatalogs());
+}
+
+
+TEST_F(T_CatalogDiffTool, UnchangedNestedCatalog) {
+  DirSpec spec;
+  EXPECT_TRUE(spec.AddFile("file3", "", hashes[2], 1024));
+  EXPECT_TRUE(tester_->ApplyAtRootHash(base_hash_, spec));
+
+  UniquePtr<RecordingDiffTool> diff_tool(
+    CreateDiffTool(tester_->manifest()->catalog_hash()));
+  EXPECT_TRUE(diff_tool->Run(PathString("")));
+  ASSERT_EQ(1U, diff_tool->changes.size());
+  EXPECT_EQ("+/file3", diff_tool->changes[0]);
+  // The unchanged nested catalog is not loaded
+  EXPECT_EQ(1, diff_tool->GetNumNewCatalogs());
+}
+
+
+TEST_F(T_CatalogDiffTool, ChangedNestedCatalog) {
+  DirSpec spec = MakeBaseSpec();
+  EXPECT_TRUE(spec.AddFile("file4", "dir/nested", hashes[3], 1024));
+  EXPECT_TRUE(tester_->Apply("changed", spec));
+
+  UniquePtr<RecordingDiffTool> diff_tool(
+    CreateDiffTool(tester_->manifest()->catalog_hash()));
+  EXPECT_TRUE(diff_tool->Run(PathString("")));
+  EXPECT_TRUE(diff_tool->Reported("~/dir/nested"));
+  EXPECT_TRUE(diff_tool->Reported("+/dir/nested/file4"));
+  EXPECT_FALSE(diff_tool->Reported("~/dir/nested/file2"));
+  EXPECT_EQ(2, diff_tool->GetNumNewCatalogs());
+}
+
+
+TEST_F(T_CatalogDiffTool, NameOrder) {
+  // Names of different length, prefixes, and non-ASCII names
+  const char *names[] = {"b", "a0", "\xc3\xa9", "a", "Z", "ab", "\x7f"};
+  DirSpec spec = MakeBaseSpec();
+  for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    EXPECT_TRUE(spec.AddFile(names[i], "dir", hashes[2], 1024));
+  EXPECT_TRUE(tester_->Apply("names", spec));
+  base_hash_ = tester_->manifest()->catalog_hash();
+  EXPECT_TRUE(spec.AddFile("aa", "dir", hashes[3], 1024));
+  EXPECT_TRUE(spec.AddFile("\xc3\xa8", "dir", hashes[3], 1024));
+  EXPECT_TRUE(tester_->Apply("more names", spec));
+
+  UniquePtr<RecordingDiffTool> diff_tool(
+    CreateDiffTool(tester_->manifest()->catalog_hash()));
+  EXPECT_TRUE(diff_tool->Run(PathString("")));
+  EXPECT_TRUE(diff_tool->Reported("+/dir/aa"));
+  EXPECT_TRUE(diff_tool->Reported("+/dir/\xc3\xa8"));
+  unsigned num_additions = 0;
+  for (unsigned i = 0; i < diff_tool->changes.size(); ++i) {
+    EXPECT_NE('-', diff_tool->changes[i][0]) << diff_tool->changes[i];
+    if (diff_tool->changes[i][0] == '+')
+      num_additions++;
+  }
+  EXPECT_EQ(2U, num_additions);
+}
@@ -4,11 +4,16 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdlib>
+#include <set>
+#include <string>
+
 #include "catalog_mgr_rw.h"
 #include "catalog_test_tools.h"
 #include "download.h"
 #include "statistics.h"
 #include "upload.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -226,4 +231,163 @@ TEST_F(T_CatalogMgrRw, SwapNestedCatalogFailSlow) {
                "failed to load");
 }
 
+
+
+TEST_F(T_CatalogMgrRw, CommitManyNestedCatalogs) {
+  CatalogTestTool tester("commit_many_nested_catalogs");
+  EXPECT_TRUE(tester.Init());
+
+  // Two levels of nested catalogs, finalized by several threads
+  DirSpec spec;
+  for (unsigned i = 0; i < 8; ++i) {
+    const string dir = "dir" + StringifyInt(i);
+    EXPECT_TRUE(spec.AddDirectory(dir, "", g_file_size));
+    EXPECT_TRUE(spec.AddNestedCatalog(dir));
+    for (unsigned j = 0; j < 4; ++j) {
+      const string sub = "sub" + StringifyInt(j);
+      EXPECT_TRUE(spec.AddDirectory(sub, dir, g_file_size));
+      EXPECT_TRUE(spec.AddFile("file", dir + "/" + sub,
+                               g_hashes[(i + j) % 8], g_file_size));
+      EXPECT_TRUE(spec.AddNestedCatalog(dir + "/" + sub));
+    }
+  }
+  setenv("_CVMFS_SERVER_CATALOG_FINALIZE_THREADS", "4", 1);
+  EXPECT_TRUE(tester.ApplyAtRootHash(tester.manifest()->catalog_hash(), spec));
+  unsetenv("_CVMFS_SERVER_CATALOG_FINALIZE_THREADS");
+
+  const shash::Any root_hash = tester.manifest()->catalog_hash();
+  set<string> nested_hashes;
+  for (unsigned i = 0; i < 8; ++i) {
+    for (unsigned j = 0; j < 4; ++j) {
+      const string path =
+        "/dir" + StringifyInt(i) + "/sub" + StringifyInt(j);
+      DirectoryEntry dirent;
+      EXPECT_TRUE(tester.FindEntry(root_hash, path + "/file", &dirent));
+      EXPECT_STREQ(g_hashes[(i + j) % 8], dirent.checksum().ToString().c_str());
+
+      char *nc_hash = NULL;
+      EXPECT_TRUE(tester.LookupNestedCatalogHash(root_hash, path, &nc_hash));
+      ASSERT_TRUE(nc_hash != NULL);
+      nested_hashes.insert(nc_hash);
+      free(nc_hash);
+    }
+  }
+  // The catalogs differ in their mount points and content
+  EXPECT_EQ(32U, nested_hashes.size());
+}
+
+
+TEST_F(T_CatalogMgrRw, BulkInsert) {
+  CatalogTestTool tester("bulk_insert");
+  EXPECT_TRUE(tester.Init());
+
+  // Enough entries to switch the root catalog and the new nested catalog into
+  // bulk insert mode
+  const unsigned kNumDirs = 16;
+  const unsigned kNumFiles = 100;
+  DirSpec spec;
+  EXPECT_TRUE(spec.AddDirectory("bulk", "", g_file_size));
+  for (unsigned i = 0; i < kNumDirs; ++i) {
+    const string dir = "bulk/dir" + StringifyInt(i);
+    EXPECT_TRUE(spec.AddDirectory("dir" + StringifyInt(i), "bulk",
+                                  g_file_size));
+    for (unsigned j = 0; j < kNumFiles; ++j) {
+      EXPECT_TRUE(spec.AddFile("file" + StringifyInt(j), dir,
+                               g_hashes[(i + j) % 8], g_file_size));
+    }
+  }
+  EXPECT_TRUE(spec.AddNestedCatalog("bulk"));
+  EXPECT_TRUE(spec.AddNestedCatalog("bulk/dir3"));
+  EXPECT_TRUE(tester.ApplyAtRootHash(tester.manifest()->catalog_hash(), spec));
+
+  shash::Any root_hash = tester.manifest()->catalog_hash();
+  DirectoryEntry dirent;
+  for (unsigned i = 0; i < kNumDirs; i += 3) {
+    const string dir = "/bulk/dir" + StringifyInt(i);
+    EXPECT_TRUE(tester.FindEntry(root_hash, dir, &dirent));
+    EXPECT_EQ(2U, dirent.linkcount());
+    for (unsigned j = 0; j < kNumFiles; j += 7) {
+      EXPECT_TRUE(tester.FindEntry(root_hash, dir + "/file" + StringifyInt(j),
+                                   &dirent));
+      EXPECT_STREQ(g_hashes[(i + j) % 8],
+                   dirent.checksum().ToString().c_str());
+    }
+  }
+  EXPECT_TRUE(tester.FindEntry(root_hash, "/bulk", &dirent));
+  EXPECT_EQ(kNumDirs + 2, dirent.linkcount());
+  char *nc_hash = NULL;
+  EXPECT_TRUE(tester.LookupNestedCatalogHash(root_hash, "/bulk/dir3",
+                                             &nc_hash));
+  EXPECT_TRUE(nc_hash != NULL);
+  free(nc_hash);
+
+  // Buffered entries, chunks and hardlinks in a new nested catalog
+  catalog::WritableCatalogManager *catalog_mgr = tester.catalog_mgr();
+  DirSpec more;
+  EXPECT_TRUE(more.AddDirectory("more", "", g_file_size));
+  for (unsigned j = 0; j < 1100; ++j) {
+    EXPECT_TRUE(more.AddFile("file" + StringifyInt(j), "more",
+                             g_hashes[j % 8], g_file_size));
+  }
+  // Added below as chunked file and hardlink group
+  EXPECT_TRUE(more.AddFile("chunked", "more", g_hashes[0], g_file_size));
+  EXPECT_TRUE(more.AddFile("link1", "more", g_hashes[0], g_file_size));
+  EXPECT_TRUE(more.AddFile("link2", "more", g_hashes[0], g_file_size));
+  for (DirSpec::ItemList::const_iterator i = more.items().begin();
+       i != more.items().end(); ++i)
+  {
+    if ((i->first == "more/chunked") || (i->first == "more/link1") ||
+        (i->first == "more/link2"))
+    {
+      continue;
+    }
+    if (i->second.entry_.IsDirectory()) {
+      catalog_mgr->AddDirectory(i->second.entry_base(), i->second.xattrs(),
+                                i->second.parent());
+    } else {
+      catalog_mgr->AddFile(i->second.entry_base(), i->second.xattrs(),
+                           i->second.parent());
+    }
+  }
+  catalog_mgr->CreateNestedCatalog("more");
+  catalog::WritableCatalog *catalog = catalog_mgr->GetHostingCatalog("more");
+  ASSERT_TRUE(catalog != NULL);
+  EXPECT_TRUE(catalog->IsBulkInsert());
+
+  FileChunkList chunks;
+  chunks.PushBack(FileChunk(shash::MkFromHexPtr(shash::HexPtr(g_hashes[1])),
+                            0, g_file_size / 2));
+  chunks.PushBack(FileChunk(shash::MkFromHexPtr(shash::HexPtr(g_hashes[2])),
+                            g_file_size / 2, g_file_size / 2));
+  catalog_mgr->AddChunkedFile(more.Item("more/chunked")->entry_base(),
+                              XattrList(), "more", chunks);
+
+  DirectoryEntryBaseList hardlinks;
+  hardlinks.push_back(more.Item("more/link1")->entry_base());
+  hardlinks.push_back(more.Item("more/link2")->entry_base());
+  catalog_mgr->AddHardlinkGroup(hardlinks, XattrList(), "more",
+                                FileChunkList());
+
+  EXPECT_TRUE(catalog_mgr->LookupPath("/more/chunked", kLookupSole, &dirent));
+  EXPECT_TRUE(dirent.IsChunkedFile());
+  EXPECT_TRUE(catalog_mgr->LookupPath("/more/link2", kLookupSole, &dirent));
+  EXPECT_EQ(2U, dirent.linkcount());
+  DirectoryEntryList listing;
+  EXPECT_TRUE(catalog_mgr->Listing("/more", &listing));
+  EXPECT_EQ(1100U + 3U, listing.size());
+
+  EXPECT_TRUE(catalog_mgr->Commit(false, 0, tester.manifest()));
+  root_hash = tester.manifest()->catalog_hash();
+  EXPECT_TRUE(tester.FindEntry(root_hash, "/more/file1099", &dirent));
+  EXPECT_STREQ(g_hashes[1099 % 8], dirent.checksum().ToString().c_str());
+  EXPECT_TRUE(tester.FindEntry(root_hash, "/more/chunked", &dirent));
+  EXPECT_TRUE(dirent.IsChunkedFile());
+  EXPECT_TRUE(tester.FindEntry(root_hash, "/more/link1", &dirent));
+  EXPECT_EQ(2U, dirent.linkcount());
+  nc_hash = NULL;
+  EXPECT_TRUE(tester.LookupNestedCatalogHash(root_hash, "/more", &nc_hash));
+  EXPECT_TRUE(nc_hash != NULL);
+  free(nc_hash);
+}
+
 }  // namespace catalog
@@ -0,0 +1,234 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+
+#include <string>
+
+#include "catalog_mgr_ro.h"
+#include "catalog_test_tools.h"
+#include "receiver/catalog_rebase.h"
+#include "receiver/params.h"
+#include "server_tool.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/raii_temp_dir.h"
+
+namespace {
+
+const char *hashes[] = {"b026324c6904b2a9cb4b88d6d61c81d100000000",
+                        "26ab0db90d72e28ad0ba1e22ee51051000000000",
+                        "6d7fce9fee471194aa8b5b6e47267f0300000000",
+                        "48a24b70a0b376535542b996af51739800000000"};
+
+// /a and /b are nested catalogs, /c is in the root catalog
+DirSpec MakeBaseSpec() {
+  DirSpec spec;
+  const size_t file_size = 4096;
+
+  EXPECT_TRUE(spec.AddDirectory("a", "", file_size));
+  EXPECT_TRUE(spec.AddFile("file1", "a", hashes[0], file_size));
+  EXPECT_TRUE(spec.AddNestedCatalog("a"));
+  EXPECT_TRUE(spec.AddDirectory("b", "", file_size));
+  EXPECT_TRUE(spec.AddFile("file2", "b", hashes[1], file_size));
+  EXPECT_TRUE(spec.AddNestedCatalog("b"));
+  EXPECT_TRUE(spec.AddDirectory("c", "", file_size));
+  EXPECT_TRUE(spec.AddFile("file3", "c", hashes[2], file_size));
+
+  return spec;
+}
+
+receiver::Params MakeParams(const std::string &name) {
+  receiver::Params params;
+
+  const std::string stratum0 = GetCurrentWorkingDirectory() + "/" + name;
+  const std::string temp_dir = stratum0 + "/data/txn";
+
+  params.stratum0 = "file://" + stratum0;
+  params.spooler_configuration = "local," + temp_dir + "," + stratum0;
+  params.hash_alg = shash::kSha1;
+  params.compression_alg = zlib::kZlibDefault;
+  params.generate_legacy_bulk_chunks = false;
+  params.use_file_chunking = true;
+  params.min_chunk_size = 4194304;
+  params.avg_chunk_size = 8388608;
+  params.max_chunk_size = 16777216;
+  params.enforce_limits = false;
+  params.nested_kcatalog_limit = 0;
+  params.root_kcatalog_limit = 0;
+  params.file_mbyte_limit = 0;
+  params.use_autocatalogs = false;
+  params.max_weight = 0;
+  params.min_weight = 0;
+
+  return params;
+}
+
+}  // anonymous namespace
+
+class T_CatalogRebase : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tester_ = new CatalogTestTool("test_rebase");
+    ASSERT_TRUE(tester_->Init());
+    ASSERT_TRUE(tester_->Apply("base", MakeBaseSpec()));
+    base_hash_ = tester_->manifest()->catalog_hash();
+
+    server_tool_ = new ServerTool();
+    ASSERT_TRUE(server_tool_->InitDownloadManager(true, ""));
+    params_ = MakeParams("test_rebase");
+    temp_prefix_ = GetCurrentWorkingDirectory() + "/rebase";
+  }
+
+  virtual void TearDown() {
+    server_tool_.Destroy();
+    tester_.Destroy();
+    RemoveTree(GetCurrentWorkingDirectory() + "/test_rebase");
+  }
+
+  /**
+   * Adds a file to the revision given by the base hash, returns the new
+   * manifest
+   */
+  manifest::Manifest AddFile(const std::string &parent,
+                             const std::string &name,
+                             const char *digest)
+  {
+    EXPECT_TRUE(tester_->ApplyAtRootHash(base_hash_, DirSpec()));
+    const catalog::DirectoryEntry entry =
+      catalog::DirectoryEntryTestFactory::RegularFile(
+        name.c_str(), 1024, shash::MkFromHexPtr(shash::HexPtr(digest)));
+    tester_->catalog_mgr()->AddFile(
+      static_cast<const catalog::DirectoryEntryBase &>(entry), XattrList(),
+      parent);
+    EXPECT_TRUE(tester_->catalog_mgr()->Commit(false, 0, tester_->manifest()));
+    return *tester_->manifest();
+  }
+
+  /**
+   * Looks up path in the root catalog of the given revision, i.e. nested
+   * catalog mountpoints instead of nested catalog roots.
+   */
+  bool LookupInRootCatalog(const shash::Any &root_hash,
+                           const std::string &path,
+                           catalog::DirectoryEntry *dirent,
+                           catalog::Counters *counters)
+  {
+    UniquePtr<RaiiTempDir> temp_dir(RaiiTempDir::Create(temp_prefix_));
+    perf::Statistics statistics;
+    catalog::SimpleCatalogManager catalog_mgr(
+      root_hash, params_.stratum0, temp_dir->dir(),
+      server_tool_->download_manager(), &statistics, true);
+    if (!catalog_mgr.Init())
+      return false;
+    *counters = catalog_mgr.GetRootCatalog()->GetCounters();
+    return catalog_mgr.GetRootCatalog()->LookupPath(PathString(path), dirent);
+  }
+
+  bool Rebase(const std::string &lease_path,
+              const manifest::Manifest &merged,
+              manifest::Manifest *head)
+  {
+    return receiver::RebaseLease(params_, PathString(lease_path), base_hash_,
+                                 merged.catalog_hash(), temp_prefix_,
+                                 server_tool_->download_manager(), head);
+  }
+
+  UniquePtr<CatalogTestTool> tester_;
+  UniquePtr<ServerTool> server_tool_;
+  receiver::Params params_;
+  std::string temp_prefix_;
+  shash::Any base_hash_;
+};
+
+
+TEST_F(T_CatalogRebase, SwapNestedCatalog) {
+  manifest::Manifest merged = AddFile("a", "new_a", hashes[3]);
+  manifest::Manifest head = AddFile("b", "new_b", hashes[3]);
+  const shash::Any head_hash = head.catalog_hash();
+  const uint64_t head_revision = head.revision();
+
+  EXPECT_TRUE(Rebase("a", merged, &head));
+  EXPECT_NE(head_hash, head.catalog_hash());
+  EXPECT_EQ(head_revision + 1, head.revision());
+
+  DirSpec spec;
+  EXPECT_TRUE(tester_->DirSpecAtRootHash(head.catalog_hash(), &spec));
+  EXPECT_TRUE(spec.Item("a/new_a") != NULL);
+  EXPECT_TRUE(spec.Item("a/file1") != NULL);
+  EXPECT_TRUE(spec.Item("b/new_b") != NULL);
+  EXPECT_TRUE(spec.Item("c/file3") != NULL);
+
+  // The lease path can be below the nested catalog mountpoint
+  manifest::Manifest head2 = AddFile("b", "new_b2", hashes[3]);
+  EXPECT_TRUE(Rebase("/a/some/path", merged, &head2));
+  EXPECT_TRUE(tester_->DirSpecAtRootHash(head2.catalog_hash(), &spec));
+  EXPECT_TRUE(spec.Item("a/new_a") != NULL);
+  EXPECT_TRUE(spec.Item("b/new_b2") != NULL);
+}
+
+
+TEST_F(T_CatalogRebase, MountpointAndCounters) {
+  // The lease adds a file and touches the nested catalog root
+  EXPECT_TRUE(tester_->ApplyAtRootHash(base_hash_, DirSpec()));
+  const catalog::DirectoryEntry file =
+    catalog::DirectoryEntryTestFactory::RegularFile(
+      "new_a", 1024, shash::MkFromHexPtr(shash::HexPtr(hashes[3])));
+  tester_->catalog_mgr()->AddFile(
+    static_cast<const catalog::DirectoryEntryBase &>(file), XattrList(), "a");
+  catalog::DirectoryEntryTestFactory::Metadata metadata;
+  metadata.name = "a";
+  metadata.mode = S_IFDIR | 0755;
+  metadata.uid = 0;
+  metadata.gid = 0;
+  metadata.size = 4096;
+  metadata.mtime = 424242;
+  metadata.linkcount = 1;
+  metadata.has_xattrs = false;
+  metadata.is_hidden = false;
+  tester_->catalog_mgr()->TouchDirectory(
+    catalog::DirectoryEntryTestFactory::Make(metadata), XattrList(), "a");
+  EXPECT_TRUE(tester_->catalog_mgr()->Commit(false, 0, tester_->manifest()));
+  manifest::Manifest merged = *tester_->manifest();
+
+  manifest::Manifest head = AddFile("b", "new_b", hashes[3]);
+  EXPECT_TRUE(Rebase("a", merged, &head));
+
+  // The mountpoint in the root catalog follows the root of the nested catalog
+  catalog::DirectoryEntry mountpoint;
+  catalog::Counters counters;
+  ASSERT_TRUE(LookupInRootCatalog(head.catalog_hash(), "/a", &mountpoint,
+                                  &counters));
+  EXPECT_TRUE(mountpoint.IsNestedCatalogMountpoint());
+  EXPECT_EQ(424242, mountpoint.mtime());
+  // c/file3 in the root catalog; a/file1, a/new_a, b/file2, b/new_b and the
+  // two .cvmfscatalog files below
+  EXPECT_EQ(1U, counters.Get("self_regular"));
+  EXPECT_EQ(6U, counters.Get("subtree_regular"));
+  EXPECT_EQ(2U, counters.Get("self_nested"));
+}
+
+
+TEST_F(T_CatalogRebase, ConcurrentChangeInNestedCatalog) {
+  manifest::Manifest merged = AddFile("a", "new_a", hashes[3]);
+  manifest::Manifest head = AddFile("a", "other_a", hashes[3]);
+  const shash::Any head_hash = head.catalog_hash();
+
+  EXPECT_FALSE(Rebase("a", merged, &head));
+  EXPECT_EQ(head_hash, head.catalog_hash());
+}
+
+
+TEST_F(T_CatalogRebase, RootCatalog) {
+  manifest::Manifest merged = AddFile("c", "new_c", hashes[3]);
+  manifest::Manifest head = AddFile("b", "new_b", hashes[3]);
+  const shash::Any head_hash = head.catalog_hash();
+
+  EXPECT_FALSE(Rebase("c", merged, &head));
+  EXPECT_FALSE(Rebase("", merged, &head));
+  EXPECT_EQ(head_hash, head.catalog_hash());
+}
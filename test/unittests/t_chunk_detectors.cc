@@ -5,12 +5,15 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <cstring>
+#include <iterator>
 #include <vector>
 
 #include "ingestion/chunk_detector.h"
 #include "ingestion/item.h"
 #include "ingestion/item_mem.h"
 #include "prng.h"
+#include "util/pointer.h"
 
 
 class T_ChunkDetectors : public ::testing::Test {
@@ -309,3 +312,124 @@ TEST_F(T_ChunkDetectors, Xor32ChunkDetectorZerosBufferPowerOfTwo) {
     }
   }
 }
+
+
+TEST_F(T_ChunkDetectors, ParseChunkingAlgorithm) {
+  EXPECT_EQ(kChunkXor32, ParseChunkingAlgorithm("default"));
+  EXPECT_EQ(kChunkXor32, ParseChunkingAlgorithm("xor32"));
+  EXPECT_EQ(kChunkGear, ParseChunkingAlgorithm("gear"));
+  EXPECT_EQ(kChunkUnknown, ParseChunkingAlgorithm("fastcdc"));
+  EXPECT_EQ("xor32", ChunkingAlgorithmName(kChunkXor32));
+  EXPECT_EQ("gear", ChunkingAlgorithmName(kChunkGear));
+
+  UniquePtr<ChunkDetector> detector(
+    ChunkDetector::Construct(kChunkGear, 1024, 2048, 4096));
+  EXPECT_TRUE(dynamic_cast<GearDetector *>(detector.weak_ref()) != NULL);
+  detector = ChunkDetector::Construct(kChunkXor32, 1024, 2048, 4096);
+  EXPECT_TRUE(dynamic_cast<Xor32Detector *>(detector.weak_ref()) != NULL);
+}
+
+
+TEST_F(T_ChunkDetectors, Gear) {
+  // Different history, then the same window of input
+  uint64_t hash1 = 0;
+  uint64_t hash2 = 0;
+  for (unsigned i = 0; i < 100; ++i)
+    hash1 = GearDetector::Roll(hash1, static_cast<unsigned char>(i));
+  hash2 = GearDetector::Roll(hash2, 42);
+  EXPECT_NE(hash1, hash2);
+  for (unsigned i = 0; i < GearDetector::kGearWindow; ++i) {
+    hash1 = GearDetector::Roll(hash1, static_cast<unsigned char>(i * 7));
+    hash2 = GearDetector::Roll(hash2, static_cast<unsigned char>(i * 7));
+  }
+  EXPECT_EQ(hash1, hash2);
+
+  EXPECT_EQ(0xffc0000000000000ULL, GearDetector::MakeMask(256, true));
+  EXPECT_EQ(0xfc00000000000000ULL, GearDetector::MakeMask(256, false));
+  EXPECT_EQ(0xfc00000000000000ULL, GearDetector::MakeMask(511, false));
+}
+
+
+TEST_F(T_ChunkDetectors, GearChunkDetectorSlow) {
+  const size_t base = 512000;
+  const size_t min_chk_size = base;
+  const size_t avg_chk_size = base * 2;
+  const size_t max_chk_size = base * 4;
+
+  std::vector<size_t> buffer_sizes;
+  buffer_sizes.push_back(102400);    // 100kB
+  buffer_sizes.push_back(base);      // same as minimal chunk size
+  buffer_sizes.push_back(base * 2);  // same as average chunk size
+  buffer_sizes.push_back(10485760);  // 10MB
+
+  // The cut marks must not depend on the buffer size
+  std::vector<uint64_t> reference_cuts;
+  for (unsigned i = 0; i < buffer_sizes.size(); ++i) {
+    CreateBuffers(buffer_sizes[i]);
+
+    GearDetector detector(min_chk_size, avg_chk_size, max_chk_size);
+    EXPECT_FALSE(detector.MightFindChunks(base));
+    EXPECT_TRUE(detector.MightFindChunks(base + 1));
+
+    std::vector<uint64_t> cuts;
+    uint64_t next_cut = 0;
+    uint64_t last_cut = 0;
+    for (unsigned j = 0; j < buffers_.size(); ++j) {
+      while ((next_cut = detector.FindNextCutMark(buffers_[j])) != 0) {
+        ASSERT_LE(min_chk_size, next_cut - last_cut);
+        ASSERT_GE(max_chk_size, next_cut - last_cut);
+        cuts.push_back(next_cut);
+        last_cut = next_cut;
+      }
+    }
+
+    if (i == 0) {
+      reference_cuts = cuts;
+      // Normalized chunking keeps the chunk sizes close to the average
+      const uint64_t avg = cuts.back() / cuts.size();
+      EXPECT_LT(avg_chk_size * 3 / 4, avg);
+      EXPECT_GT(avg_chk_size * 5 / 4, avg);
+    } else {
+      EXPECT_EQ(reference_cuts, cuts) << "buffer size " << buffer_sizes[i];
+    }
+  }
+}
+
+
+TEST_F(T_ChunkDetectors, GearChunkDetectorShift) {
+  // Inserting data in front of the stream must only move the first few cut
+  // marks; afterwards, the chunks are the same (deduplicated)
+  const size_t min_chk_size = 16 * 1024;
+  const size_t avg_chk_size = 32 * 1024;
+  const size_t max_chk_size = 64 * 1024;
+  const unsigned kShift = 1000;
+
+  CreateBuffers(1048576);
+  std::vector<uint64_t> cuts;
+  GearDetector detector(min_chk_size, avg_chk_size, max_chk_size);
+  uint64_t next_cut = 0;
+  for (unsigned j = 0; j < buffers_.size(); ++j) {
+    while ((next_cut = detector.FindNextCutMark(buffers_[j])) != 0)
+      cuts.push_back(next_cut);
+  }
+
+  ItemAllocator allocator;
+  BlockItem prefix(&allocator);
+  prefix.MakeData(kShift);
+  memset(prefix.data(), 'x', kShift);
+  prefix.set_size(kShift);
+  std::vector<uint64_t> cuts_shifted;
+  GearDetector detector_shifted(min_chk_size, avg_chk_size, max_chk_size);
+  while ((next_cut = detector_shifted.FindNextCutMark(&prefix)) != 0)
+    cuts_shifted.push_back(next_cut - kShift);
+  for (unsigned j = 0; j < buffers_.size(); ++j) {
+    while ((next_cut = detector_shifted.FindNextCutMark(buffers_[j])) != 0)
+      cuts_shifted.push_back(next_cut - kShift);
+  }
+
+  std::vector<uint64_t> common;
+  std::set_intersection(cuts.begin(), cuts.end(),
+                        cuts_shifted.begin(), cuts_shifted.end(),
+                        std::back_inserter(common));
+  EXPECT_GT(common.size(), cuts.size() - 5);
+}
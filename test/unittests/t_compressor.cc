@@ -4,6 +4,9 @@
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #include "compression.h"
 #include "smalloc.h"
@@ -49,6 +52,47 @@ class T_Compressor : public ::testing::Test {
 };
 
 
+namespace {
+
+class StringSink : public cvmfs::Sink {
+ public:
+  virtual int64_t Write(const void *buf, uint64_t sz) {
+    data.append(static_cast<const char *>(buf), sz);
+    return sz;
+  }
+  virtual int Reset() { data.clear(); return 0; }
+  std::string data;
+};
+
+
+/**
+ * Compresses input with a small, fixed size output buffer in order to exercise
+ * partial output of the compressor.
+ */
+std::string CompressInRounds(Compressor *compressor,
+                             unsigned char *input, size_t size,
+                             unsigned *rounds)
+{
+  std::string result;
+  unsigned char out[100];
+  bool deflate_finished = false;
+  *rounds = 0;
+  while (!deflate_finished) {
+    unsigned char *outbuf = out;
+    size_t outbuf_size = sizeof(out);
+    deflate_finished =
+      compressor->Deflate(true, &input, &size, &outbuf, &outbuf_size);
+    EXPECT_LE(outbuf_size, sizeof(out));
+    result.append(reinterpret_cast<char *>(out), outbuf_size);
+    (*rounds)++;
+  }
+  EXPECT_EQ(0U, size);
+  return result;
+}
+
+}  // anonymous namespace
+
+
 TEST_F(T_Compressor, Compression) {
   compressor = zlib::Compressor::Construct(zlib::kZlibDefault);
 
@@ -155,4 +199,226 @@ TEST_F(T_Compressor, EchoCompressionLong) {
   EXPECT_EQ(0, memcmp(compress_buf.weak_ref(), long_string, long_size));
 }
 
+
+TEST_F(T_Compressor, ParseAlgorithm) {
+  EXPECT_EQ(kZlibDefault, ParseCompressionAlgorithm("default"));
+  EXPECT_EQ(kNoCompression, ParseCompressionAlgorithm("none"));
+  EXPECT_EQ("zstd", AlgorithmName(kZstd));
+  EXPECT_EQ("lz4", AlgorithmName(kLz4));
+
+  int level = -1;
+  EXPECT_EQ(kZlibDefault, ParseCompressionAlgorithm("default", &level));
+  EXPECT_EQ(0, level);
+#ifdef HAS_ZSTD
+  EXPECT_EQ(kZstd, ParseCompressionAlgorithm("zstd", &level));
+  EXPECT_EQ(0, level);
+  EXPECT_EQ(kZstd, ParseCompressionAlgorithm("zstd:19", &level));
+  EXPECT_EQ(19, level);
+#else
+  EXPECT_FALSE(IsAlgorithmAvailable(kZstd));
+  EXPECT_EQ(kZlibDefault, ParseCompressionAlgorithm("zstd:19", &level));
+  EXPECT_EQ(0, level);
+#endif
+#ifdef HAS_LZ4
+  EXPECT_EQ(kLz4, ParseCompressionAlgorithm("lz4"));
+#else
+  EXPECT_FALSE(IsAlgorithmAvailable(kLz4));
+  EXPECT_EQ(kZlibDefault, ParseCompressionAlgorithm("lz4"));
+#endif
+}
+
+
+#if defined(HAS_ZSTD) && defined(HAS_LZ4)
+TEST_F(T_Compressor, ZstdLevel) {
+  for (unsigned i = 0; i < long_size; ++i)
+    long_string[i] = (i % 4096) < 2048 ? (i % 251) : (i * 7919) >> 5;
+
+  // Levels are per instance, clones inherit them
+  ZstdCompressor fast(kZstd);
+  ZstdCompressor strong(kZstd);
+  strong.SetLevel(19);
+  const int default_level = ZstdCompressor::kDefaultLevel;
+  EXPECT_EQ(default_level, fast.level());
+  EXPECT_EQ(19, strong.level());
+  UniquePtr<Compressor> clone(strong.Clone());
+  EXPECT_EQ(19, static_cast<ZstdCompressor *>(clone.weak_ref())->level());
+  strong.SetLevel(0);
+  EXPECT_EQ(default_level, strong.level());
+  strong.SetLevel(19);
+
+  unsigned rounds;
+  const std::string fast_compressed =
+    CompressInRounds(&fast, long_string, long_size, &rounds);
+  const std::string strong_compressed =
+    CompressInRounds(&strong, long_string, long_size, &rounds);
+  EXPECT_LE(strong_compressed.size(), fast_compressed.size());
+
+  void *decompress_buf;
+  uint64_t decompress_size;
+  ASSERT_TRUE(DecompressMem2Mem(strong_compressed.data(),
+    strong_compressed.size(), &decompress_buf, &decompress_size, kZstd));
+  EXPECT_EQ(static_cast<uint64_t>(long_size), decompress_size);
+  EXPECT_EQ(0, memcmp(decompress_buf, long_string, long_size));
+  free(decompress_buf);
+}
+
+
+TEST_F(T_Compressor, ZstdLz4RoundTrip) {
+  for (unsigned i = 0; i < long_size; ++i)
+    long_string[i] = (i % 4096) < 2048 ? (i % 251) : (i * 7919) >> 5;
+
+  Algorithms algorithms[] = { kZstd, kLz4 };
+  for (unsigned a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); ++a) {
+    compressor = Compressor::Construct(algorithms[a]);
+    ASSERT_TRUE(compressor.IsValid());
+    unsigned rounds;
+    const std::string compressed =
+      CompressInRounds(compressor.weak_ref(), long_string, long_size, &rounds);
+    EXPECT_GT(rounds, 1U);
+    EXPECT_LT(compressed.size(), long_size);
+    EXPECT_LE(compressed.size(), compressor->DeflateBound(long_size));
+
+    // In one go
+    void *decompress_buf;
+    uint64_t decompress_size;
+    ASSERT_TRUE(DecompressMem2Mem(compressed.data(), compressed.size(),
+      &decompress_buf, &decompress_size, algorithms[a]));
+    EXPECT_EQ(static_cast<uint64_t>(long_size), decompress_size);
+    EXPECT_EQ(0, memcmp(decompress_buf, long_string, long_size));
+    free(decompress_buf);
+
+    // In pieces, as done by the download manager
+    UniquePtr<Decompressor> decompressor(
+      Decompressor::Construct(algorithms[a]));
+    ASSERT_TRUE(decompressor.IsValid());
+    StringSink sink;
+    const size_t kPieceSize = 1000;
+    StreamStates state = kStreamContinue;
+    for (size_t pos = 0; pos < compressed.size(); pos += kPieceSize) {
+      const size_t nbytes = std::min(kPieceSize, compressed.size() - pos);
+      state = decompressor->Inflate(compressed.data() + pos, nbytes, &sink);
+      ASSERT_NE(kStreamDataError, state);
+    }
+    EXPECT_EQ(kStreamEnd, state);
+    EXPECT_EQ(long_size, sink.data.size());
+    EXPECT_EQ(0, memcmp(sink.data.data(), long_string, long_size));
+
+    // Truncated or corrupted streams
+    decompressor->Reset();
+    sink.Reset();
+    EXPECT_EQ(kStreamContinue, decompressor->Inflate(
+      compressed.data(), compressed.size() / 2, &sink));
+    decompressor->Reset();
+    std::string corrupted(compressed);
+    corrupted[1] = ~corrupted[1];
+    EXPECT_EQ(kStreamDataError, decompressor->Inflate(
+      corrupted.data(), corrupted.size(), &sink));
+  }
+}
+
+
+TEST_F(T_Compressor, ZstdLz4Empty) {
+  Algorithms algorithms[] = { kZstd, kLz4 };
+  for (unsigned a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); ++a) {
+    compressor = Compressor::Construct(algorithms[a]);
+    unsigned rounds;
+    const std::string compressed =
+      CompressInRounds(compressor.weak_ref(), long_string, 0, &rounds);
+    EXPECT_GT(compressed.size(), 0U);
+
+    void *decompress_buf;
+    uint64_t decompress_size;
+    ASSERT_TRUE(DecompressMem2Mem(compressed.data(), compressed.size(),
+      &decompress_buf, &decompress_size, algorithms[a]));
+    EXPECT_EQ(0U, decompress_size);
+    free(decompress_buf);
+  }
+}
+#endif  // HAS_ZSTD && HAS_LZ4
+
+
+TEST_F(T_Compressor, SegmentCompressor) {
+  for (unsigned i = 0; i < long_size; ++i)
+    long_string[i] = (i % 4096) < 2048 ? (i % 251) : (i * 7919) >> 5;
+  const unsigned kNumSegments = 7;
+  const size_t segment_size = long_size / kNumSegments + 1;
+
+  std::vector<Algorithms> algorithms;
+  algorithms.push_back(kZlibDefault);
+#ifdef HAS_ZSTD
+  algorithms.push_back(kZstd);
+#endif
+#ifdef HAS_LZ4
+  algorithms.push_back(kLz4);
+#endif
+  for (unsigned a = 0; a < algorithms.size(); ++a) {
+    // Compress the segments in reverse order, they are independent
+    std::vector<std::string> segments(kNumSegments);
+    std::vector<uint32_t> checksums(kNumSegments);
+    for (int s = kNumSegments - 1; s >= 0; --s) {
+      const size_t offset = s * segment_size;
+      unsigned char *input = long_string + offset;
+      size_t size = std::min(segment_size, long_size - offset);
+      SegmentCompressor segment_compressor(algorithms[a], 0, s == 0);
+      bool finished = false;
+      while (!finished) {
+        unsigned char out[1000];
+        unsigned char *outbuf = out;
+        size_t outbuf_size = sizeof(out);
+        finished = segment_compressor.Deflate(true, s == kNumSegments - 1,
+          &input, &size, &outbuf, &outbuf_size);
+        segments[s].append(reinterpret_cast<char *>(out), outbuf_size);
+      }
+      EXPECT_EQ(0U, size);
+      EXPECT_EQ(std::min(segment_size, long_size - offset),
+                segment_compressor.size());
+      checksums[s] = segment_compressor.checksum();
+    }
+
+    std::string compressed;
+    uint32_t checksum = checksums[0];
+    for (unsigned s = 0; s < kNumSegments; ++s) {
+      compressed += segments[s];
+      if (s > 0) {
+        checksum = SegmentCompressor::CombineChecksums(algorithms[a],
+          checksum, checksums[s],
+          std::min(segment_size, long_size - s * segment_size));
+      }
+    }
+    unsigned char trailer[SegmentCompressor::kMaxTrailerSize];
+    compressed.append(reinterpret_cast<char *>(trailer),
+      SegmentCompressor::WriteTrailer(algorithms[a], checksum, trailer));
+
+    void *decompress_buf;
+    uint64_t decompress_size;
+    ASSERT_TRUE(DecompressMem2Mem(compressed.data(), compressed.size(),
+      &decompress_buf, &decompress_size, algorithms[a]));
+    EXPECT_EQ(static_cast<uint64_t>(long_size), decompress_size);
+    EXPECT_EQ(0, memcmp(decompress_buf, long_string, long_size));
+    free(decompress_buf);
+  }
+
+  // A single zlib segment is a regular zlib stream
+  unsigned char *input = long_string;
+  size_t size = long_size;
+  SegmentCompressor segment_compressor(kZlibDefault, 0, true);
+  std::string compressed(compressBound(long_size), '\0');
+  unsigned char *outbuf =
+    reinterpret_cast<unsigned char *>(const_cast<char *>(compressed.data()));
+  size_t outbuf_size = compressed.size();
+  EXPECT_TRUE(segment_compressor.Deflate(true, true,
+    &input, &size, &outbuf, &outbuf_size));
+  compressed.resize(outbuf_size);
+  unsigned char trailer[SegmentCompressor::kMaxTrailerSize];
+  compressed.append(reinterpret_cast<char *>(trailer),
+    SegmentCompressor::WriteTrailer(kZlibDefault,
+                                    segment_compressor.checksum(), trailer));
+  void *zlib_buf;
+  uint64_t zlib_size;
+  ASSERT_TRUE(CompressMem2Mem(long_string, long_size, &zlib_buf, &zlib_size));
+  EXPECT_EQ(std::string(reinterpret_cast<char *>(zlib_buf), zlib_size),
+            compressed);
+  free(zlib_buf);
+}
+
 }  // end namespace zlib
@@ -7,7 +7,10 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <cstdlib>
 #include <cstdio>
+#include <string>
+#include <vector>
 
 #include "c_file_sandbox.h"
 #include "c_http_server.h"
@@ -18,6 +21,7 @@
 #include "sink.h"
 #include "statistics.h"
 #include "util/file_guard.h"
+#include "util/pointer.h"
 #include "util/posix.h"
 
 using namespace std;  // NOLINT
@@ -106,6 +110,102 @@ TEST_F(T_Download, LocalFile) {
   fclose(fdest);
 }
 
+TEST_F(T_Download, PriorityClasses) {
+  download_mgr.Spawn();
+  EXPECT_EQ(8, statistics.Lookup("test.n_concurrency_limit")->Get());
+
+  string src_path = GetAbsolutePath(GetSmallFile());
+  string src_content = GetFileContents(src_path);
+  string src_url = "file://" + src_path;
+  for (unsigned p = 0; p < kNumPriorities; ++p) {
+    JobInfo info(&src_url, false /* compressed */, false /* probe hosts */,
+                 NULL);
+    info.priority = static_cast<JobPriority>(p);
+    download_mgr.Fetch(&info);
+    EXPECT_EQ(kFailOk, info.error_code);
+    EXPECT_EQ(src_content.length(), info.destination_mem.pos);
+    free(info.destination_mem.data);
+  }
+  EXPECT_TRUE(statistics.Lookup("test.sz_wait_time_interactive") != NULL);
+  EXPECT_TRUE(statistics.Lookup("test.sz_wait_time_bulk") != NULL);
+}
+
+TEST_F(T_Download, ReservedInteractiveSlots) {
+  string url = "file:///dev/null";
+  vector<JobInfo *> jobs;
+  for (unsigned i = 0; i < 12; ++i) {
+    jobs.push_back(new JobInfo(&url, false, false, NULL));
+    jobs[i]->priority = (i < 10) ? kPriorityBulk : kPriorityInteractive;
+  }
+
+  // Bulk jobs saturate the pool of 8 connections except for the reserve of 2
+  for (unsigned i = 0; i < 10; ++i)
+    download_mgr.pending_jobs_[kPriorityBulk].push_back(jobs[i]);
+  JobInfo *info;
+  while ((info = download_mgr.PopNextJob()) != NULL) {
+    EXPECT_EQ(kPriorityBulk, info->priority);
+    download_mgr.num_active_jobs_++;
+  }
+  EXPECT_EQ(6U, download_mgr.num_active_jobs_);
+
+  // Interactive jobs still get a connection
+  download_mgr.pending_jobs_[kPriorityInteractive].push_back(jobs[10]);
+  download_mgr.pending_jobs_[kPriorityInteractive].push_back(jobs[11]);
+  EXPECT_EQ(jobs[10], download_mgr.PopNextJob());
+  download_mgr.num_active_jobs_++;
+  EXPECT_EQ(jobs[11], download_mgr.PopNextJob());
+  download_mgr.num_active_jobs_++;
+  EXPECT_EQ(static_cast<JobInfo *>(NULL), download_mgr.PopNextJob());
+
+  // Freed connections go to bulk jobs only outside the reserve
+  download_mgr.num_active_jobs_ = 7;
+  EXPECT_EQ(static_cast<JobInfo *>(NULL), download_mgr.PopNextJob());
+  download_mgr.num_active_jobs_ = 5;
+  EXPECT_EQ(jobs[6], download_mgr.PopNextJob());
+
+  download_mgr.pending_jobs_[kPriorityBulk].clear();
+  for (unsigned i = 0; i < jobs.size(); ++i)
+    delete jobs[i];
+}
+
+TEST_F(T_Download, AdaptConcurrency) {
+  const uint64_t kWindow = DownloadManager::kConcurrencyWindowNs;
+  string url = "file:///dev/null";
+  JobInfo waiting(&url, false, false, NULL);
+  download_mgr.window_start_ns_ = 0;
+  EXPECT_EQ(8U, download_mgr.concurrency_limit_);
+
+  // Without waiting jobs, the throughput does not tell anything
+  download_mgr.AdjustConcurrency(1000, kWindow);
+  download_mgr.AdjustConcurrency(10, 2 * kWindow);
+  EXPECT_EQ(8U, download_mgr.concurrency_limit_);
+
+  // The limit starts at the pool size and stays there at constant throughput
+  download_mgr.pending_jobs_[kPriorityBulk].push_back(&waiting);
+  download_mgr.AdjustConcurrency(1000, 3 * kWindow);
+  download_mgr.AdjustConcurrency(1000, 4 * kWindow);
+  EXPECT_EQ(8U, download_mgr.concurrency_limit_);
+
+  // A throughput drop reverses the direction, the limit then keeps on going
+  // down while the throughput does not drop further
+  download_mgr.AdjustConcurrency(500, 5 * kWindow);
+  EXPECT_EQ(7U, download_mgr.concurrency_limit_);
+  download_mgr.AdjustConcurrency(500, 6 * kWindow);
+  EXPECT_EQ(6U, download_mgr.concurrency_limit_);
+  download_mgr.AdjustConcurrency(400, 7 * kWindow);
+  EXPECT_EQ(7U, download_mgr.concurrency_limit_);
+  EXPECT_EQ(7, statistics.Lookup("test.n_concurrency_limit")->Get());
+
+  // Not below a quarter of the pool
+  download_mgr.AdjustConcurrency(300, 8 * kWindow);
+  EXPECT_EQ(6U, download_mgr.concurrency_limit_);
+  for (unsigned i = 9; i < 20; ++i)
+    download_mgr.AdjustConcurrency(300, i * kWindow);
+  EXPECT_EQ(2U, download_mgr.concurrency_limit_);
+
+  download_mgr.pending_jobs_[kPriorityBulk].clear();
+}
+
 TEST_F(T_Download, RemoteFile) {
   string dest_path;
   FILE *fdest = CreateTemporaryFile(&dest_path);
@@ -385,6 +485,68 @@ TEST_F(T_Download, LocalFile2Sink) {
 }
 
 
+#if defined(HAS_ZSTD) && defined(HAS_LZ4)
+TEST_F(T_Download, LocalFileZstdLz4) {
+  unsigned N = 64*1024;
+  string content;
+  for (unsigned i = 0; i < N; ++i)
+    content.push_back('a' + (i % 7) * (i % 13));
+
+  zlib::Algorithms algorithms[] = { zlib::kZstd, zlib::kLz4 };
+  for (unsigned a = 0; a < 2; ++a) {
+    UniquePtr<zlib::Compressor> compressor(
+      zlib::Compressor::Construct(algorithms[a]));
+    size_t out_size = compressor->DeflateBound(N);
+    string compressed(out_size, '\0');
+    unsigned char *in = reinterpret_cast<unsigned char *>(&content[0]);
+    unsigned char *out = reinterpret_cast<unsigned char *>(&compressed[0]);
+    size_t in_size = N;
+    ASSERT_TRUE(compressor->Deflate(true, &in, &in_size, &out, &out_size));
+    compressed.resize(out_size);
+
+    string src_path;
+    FILE *fsrc = CreateTemporaryFile(&src_path);
+    ASSERT_TRUE(fsrc != NULL);
+    UnlinkGuard unlink_guard(src_path);
+    fwrite(compressed.data(), 1, compressed.size(), fsrc);
+    fclose(fsrc);
+    string url = "file://" + src_path;
+
+    TestSink test_sink;
+    JobInfo info_sink(&url, true /* compressed */, false /* probe hosts */,
+                      &test_sink, NULL /* expected hash */);
+    info_sink.compression_alg = algorithms[a];
+    download_mgr.Fetch(&info_sink);
+    EXPECT_EQ(kFailOk, info_sink.error_code);
+    EXPECT_EQ(N, GetFileSize(test_sink.path));
+
+    JobInfo info_mem(&url, true /* compressed */, false /* probe hosts */,
+                     NULL /* expected hash */);
+    info_mem.compression_alg = algorithms[a];
+    download_mgr.Fetch(&info_mem);
+    ASSERT_EQ(kFailOk, info_mem.error_code);
+    ASSERT_EQ(N, info_mem.destination_mem.pos);
+    EXPECT_EQ(0, memcmp(info_mem.destination_mem.data, content.data(), N));
+    free(info_mem.destination_mem.data);
+
+    // Not a zlib stream
+    JobInfo info_zlib(&url, true /* compressed */, false /* probe hosts */,
+                      NULL /* expected hash */);
+    download_mgr.Fetch(&info_zlib);
+    EXPECT_NE(kFailOk, info_zlib.error_code);
+  }
+}
+#else
+TEST_F(T_Download, LocalFileUnavailableAlgorithm) {
+  string url = "file:///nonexistent";
+  JobInfo info(&url, true /* compressed */, false /* probe hosts */,
+               NULL /* expected hash */);
+  info.compression_alg = zlib::kZstd;
+  EXPECT_EQ(kFailBadData, download_mgr.Fetch(&info));
+  EXPECT_EQ(kFailBadData, info.error_code);
+}
+#endif  // HAS_ZSTD && HAS_LZ4
+
 TEST_F(T_Download, StripDirect) {
   string cleaned = "FALSE";
   EXPECT_FALSE(download_mgr.StripDirect("", &cleaned));
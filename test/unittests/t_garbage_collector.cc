@@ -5,9 +5,13 @@
 #include <gtest/gtest.h>
 
 #include <cassert>
+#include <ctime>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
+#include "catalog_delta.h"
 #include "catalog_traversal.h"
 #include "catalog_traversal_parallel.h"
 #include "garbage_collection/garbage_collector.h"
@@ -16,6 +20,7 @@
 #include "manifest.h"
 #include "prng.h"
 #include "testutil.h"
+#include "util/string.h"
 
 using swissknife::CatalogTraversalParallel;
 using swissknife::CatalogTraversal;
@@ -53,23 +58,76 @@ class GC_MockUploader : public AbstractMockUploader<GC_MockUploader> {
   }
 
   virtual void DoRemoveAsync(const std::string &file_to_delete) {
+    if (HasPrefix(file_to_delete, "data/txn/", false)) {
+      deleted_staged.insert(file_to_delete);
+      Respond(NULL, upload::UploaderResults());
+      return;
+    }
     shash::Any hash_to_delete(shash::MkFromSuffixedHexPtr(shash::HexPtr(
       file_to_delete.substr(5, 2) + file_to_delete.substr(8))));
-    deleted_hashes.insert(hash_to_delete);
+    if (hash_to_delete.suffix == shash::kSuffixCatalogDelta)
+      deleted_deltas.insert(hash_to_delete);
+    else
+      deleted_hashes.insert(hash_to_delete);
     Respond(NULL, upload::UploaderResults());
   }
 
+  virtual upload::ObjectPresence DoPeek(const std::string &path) {
+    std::map<std::string, std::vector<upload::ObjectInfo> >::const_iterator
+      i = stored_objects.find(path.substr(0, 7));
+    if (i == stored_objects.end())
+      return upload::kAbsent;
+    for (unsigned j = 0; j < i->second.size(); ++j) {
+      if (i->second[j].name == path.substr(8))
+        return upload::kPresent;
+    }
+    return upload::kAbsent;
+  }
+
+  virtual bool ListObjects(const std::string &directory,
+                           std::vector<upload::ObjectInfo> *objects)
+  {
+    objects->clear();
+    std::map<std::string, std::vector<upload::ObjectInfo> >::const_iterator
+      i = stored_objects.find(directory);
+    if (i != stored_objects.end())
+      *objects = i->second;
+    return true;
+  }
+
+  void StoreObject(const shash::Any &hash, const time_t mtime) {
+    const std::string path = "data/" + hash.MakePath();
+    upload::ObjectInfo object;
+    object.name = path.substr(8);
+    object.size = 1024;
+    object.mtime = mtime;
+    stored_objects[path.substr(0, 7)].push_back(object);
+  }
+
+  void StoreStagedObject(const std::string &name, const time_t mtime) {
+    upload::ObjectInfo object;
+    object.name = name;
+    object.size = 1024;
+    object.mtime = mtime;
+    stored_objects["data/txn"].push_back(object);
+  }
+
   virtual unsigned GetNumberOfErrors() const { return 0; }
   virtual int64_t DoGetObjectSize(const std::string &file_name) {
     return -EOPNOTSUPP;
   }
 
   bool HasDeleted(const shash::Any &hash) const {
+    if (hash.suffix == shash::kSuffixCatalogDelta)
+      return deleted_deltas.find(hash) != deleted_deltas.end();
     return deleted_hashes.find(hash) != deleted_hashes.end();
   }
 
  public:
   std::set<shash::Any> deleted_hashes;
+  std::set<shash::Any> deleted_deltas;
+  std::set<std::string> deleted_staged;
+  std::map<std::string, std::vector<upload::ObjectInfo> > stored_objects;
 };
 
 typedef std::map<std::pair<unsigned int, std::string>, MockCatalog *>
@@ -510,6 +568,18 @@ TYPED_TEST(T_GarbageCollector, KeepLastRevision) {
     this->GetStandardGarbageCollectorConfiguration();
   config.keep_history_depth = 0;  // no history preservation
 
+  // Only some of the catalogs come with a delta
+  GC_MockUploader *upl = static_cast<GC_MockUploader *>(config.uploader);
+  RevisionMap &c = this->catalogs_;
+  const MockCatalog *dead = c[this->mp(3, "00")];
+  const MockCatalog *live = c[this->mp(5, "00")];
+  upl->StoreObject(
+    catalog::MakeCatalogDeltaId(dead->GetPreviousRevision(), dead->hash()),
+    1000);
+  upl->StoreObject(
+    catalog::MakeCatalogDeltaId(live->GetPreviousRevision(), live->hash()),
+    1000);
+
   typename TestFixture::MyGarbageCollector gc(config);
   const bool gc1 = gc.Collect();
   EXPECT_TRUE(gc1);
@@ -517,8 +587,6 @@ TYPED_TEST(T_GarbageCollector, KeepLastRevision) {
   EXPECT_EQ(5u, gc.condemned_catalog_count());
   EXPECT_EQ(static_cast<unsigned>(t(26, 12, 2004)), gc.oldest_trunk_catalog());
 
-  GC_MockUploader *upl = static_cast<GC_MockUploader *>(config.uploader);
-  RevisionMap &c = this->catalogs_;
   EXPECT_FALSE(upl->HasDeleted(h("b52945d780f8cc16711d4e670d82499dad99032d")));
   EXPECT_FALSE(upl->HasDeleted(h("d650d325d59ea9ca754f9b37293cd08d0b12584c")));
   EXPECT_FALSE(upl->HasDeleted(h("4083d30ba1f72e1dfad4cdbfc60ea3c38bfa600d")));
@@ -574,13 +642,95 @@ TYPED_TEST(T_GarbageCollector, KeepLastRevision) {
   EXPECT_TRUE(upl->HasDeleted(c[this->mp(3, "00")]->hash()));
   EXPECT_TRUE(upl->HasDeleted(c[this->mp(3, "10")]->hash()));
   EXPECT_TRUE(upl->HasDeleted(c[this->mp(3, "11")]->hash()));
+  // Catalog deltas go together with the catalog they produce
+  EXPECT_TRUE(upl->HasDeleted(
+    catalog::MakeCatalogDeltaId(dead->GetPreviousRevision(), dead->hash())));
+  EXPECT_FALSE(upl->HasDeleted(
+    catalog::MakeCatalogDeltaId(live->GetPreviousRevision(), live->hash())));
+  EXPECT_EQ(1u, upl->deleted_deltas.size());
 
   EXPECT_EQ(11u, upl->deleted_hashes.size());
+  EXPECT_EQ(12u, gc.condemned_objects_count());
 
   // TODO(rmeusel): Once history handling is complete, one could delete a named
   // snapshot and check if it is gone after another collection run...
 }
 
+TYPED_TEST(T_GarbageCollector, SweepStorage) {
+  typename TestFixture::GcConfiguration config =
+    this->GetStandardGarbageCollectorConfiguration();
+  config.keep_history_depth = 0;  // no history preservation
+  config.sweep_storage = true;
+
+  // The storage contains every object referenced by any of the catalogs
+  GC_MockUploader *upl = static_cast<GC_MockUploader *>(config.uploader);
+  RevisionMap &c = this->catalogs_;
+  const time_t kOld = 1000;
+  std::set<shash::Any> stored;
+  for (RevisionMap::const_iterator i = c.begin(); i != c.end(); ++i) {
+    stored.insert(i->second->hash());
+    const MockCatalog::HashVector &referenced =
+      i->second->GetReferencedObjects();
+    for (unsigned j = 0; j < referenced.size(); ++j) {
+      if (!referenced[j].IsNull())
+        stored.insert(referenced[j]);
+    }
+  }
+  for (std::set<shash::Any>::const_iterator i = stored.begin();
+       i != stored.end(); ++i)
+  {
+    upl->StoreObject(*i, kOld);
+  }
+  const shash::Any orphan = h("f1a2d0b0e0c1a2b3c4d5e6f708192a3b4c5d6e7f");
+  const shash::Any recent = h("f2a2d0b0e0c1a2b3c4d5e6f708192a3b4c5d6e7f");
+  const shash::Any history = h("f3a2d0b0e0c1a2b3c4d5e6f708192a3b4c5d6e7f",
+                               shash::kSuffixHistory);
+  const shash::Any dead_delta = catalog::MakeCatalogDeltaId(
+    c[this->mp(3, "00")]->GetPreviousRevision(), c[this->mp(3, "00")]->hash());
+  const shash::Any live_delta = catalog::MakeCatalogDeltaId(
+    c[this->mp(5, "00")]->GetPreviousRevision(), c[this->mp(5, "00")]->hash());
+  upl->StoreObject(orphan, kOld);
+  upl->StoreObject(recent, time(NULL));
+  upl->StoreObject(history, kOld);
+  upl->StoreObject(dead_delta, kOld);
+  upl->StoreObject(live_delta, kOld);
+  upl->StoreStagedObject("multipart.1234.1", kOld);
+  upl->StoreStagedObject("multipart.1234.2", time(NULL));
+  upl->StoreStagedObject("receiver.XXXXXX", kOld);
+
+  typename TestFixture::MyGarbageCollector gc(config);
+  EXPECT_TRUE(gc.Collect());
+  EXPECT_EQ(11u, gc.preserved_catalog_count());
+
+  // Same as in the reflog based sweep...
+  EXPECT_TRUE(upl->HasDeleted(h("2e87adef242bc67cb66fcd61238ad808a7b44aab")));
+  EXPECT_TRUE(upl->HasDeleted(h("3bf4854891899670727fc8e9c6e454f7e4058454")));
+  EXPECT_TRUE(upl->HasDeleted(h("12ea064b069d98cb9da09219568ff2f8dd7d0a7e")));
+  EXPECT_TRUE(upl->HasDeleted(h("20c2e6328f943003254693a66434ff01ebba26f0")));
+  EXPECT_TRUE(upl->HasDeleted(h("219d1ca4c958bd615822f8c125701e73ce379428")));
+  EXPECT_TRUE(upl->HasDeleted(c[this->mp(1, "00")]->hash()));
+  EXPECT_TRUE(upl->HasDeleted(c[this->mp(1, "10")]->hash()));
+  EXPECT_TRUE(upl->HasDeleted(c[this->mp(3, "00")]->hash()));
+  EXPECT_TRUE(upl->HasDeleted(c[this->mp(3, "10")]->hash()));
+  EXPECT_TRUE(upl->HasDeleted(c[this->mp(3, "11")]->hash()));
+  EXPECT_FALSE(upl->HasDeleted(c[this->mp(5, "00")]->hash()));
+  EXPECT_FALSE(upl->HasDeleted(c[this->mp(2, "10")]->hash()));
+  EXPECT_FALSE(upl->HasDeleted(h("b52945d780f8cc16711d4e670d82499dad99032d")));
+  EXPECT_FALSE(
+      upl->HasDeleted(h("defae1853b929bbbdbc7c6d4e75531273f1ae4cb", 'P')));
+
+  // ... plus the objects that no catalog knows about
+  EXPECT_TRUE(upl->HasDeleted(orphan));
+  EXPECT_TRUE(upl->HasDeleted(dead_delta));
+  EXPECT_FALSE(upl->HasDeleted(recent));
+  EXPECT_FALSE(upl->HasDeleted(history));
+  EXPECT_FALSE(upl->HasDeleted(live_delta));
+
+  // Staged objects of aborted streamed uploads
+  EXPECT_EQ(1U, upl->deleted_staged.size());
+  EXPECT_EQ(1U, upl->deleted_staged.count("data/txn/multipart.1234.1"));
+}
+
 TYPED_TEST(T_GarbageCollector, KeepLastThreeRevisions) {
   typename TestFixture::GcConfiguration config =
     this->GetStandardGarbageCollectorConfiguration();
@@ -5,8 +5,12 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <string>
+#include <vector>
 
 #include "garbage_collection/hash_filter.h"
+#include "testutil.h"
+#include "util/posix.h"
 
 static shash::Any sha(const std::string &hash,
                       const char suffix = shash::kSuffixNone) {
@@ -67,7 +71,18 @@ class T_HashFilter : public ::testing::Test {
   };
 };
 
-typedef ::testing::Types<SimpleHashFilter, SmallhashFilter> HashFilterTypes;
+/**
+ * Spills every 4096 hashes
+ */
+class SpillingHashFilter : public CompactHashFilter {
+ public:
+  SpillingHashFilter() {
+    LimitMemory(4096 * sizeof(Key), GetCurrentWorkingDirectory());
+  }
+};
+
+typedef ::testing::Types<SimpleHashFilter, SmallhashFilter, CompactHashFilter,
+                         SpillingHashFilter> HashFilterTypes;
 TYPED_TEST_CASE(T_HashFilter, HashFilterTypes);
 
 
@@ -424,3 +439,48 @@ TYPED_TEST(T_HashFilter, FillManyRandomHashesSlow) {
 
   std::for_each(random_hashes.begin(), random_hashes.end(), check_contains);
 }
+
+
+TEST(T_CompactHashFilter, Spill) {
+  const std::string tmp_path =
+    CreateTempDir(GetCurrentWorkingDirectory() + "/cvmfs_ut_hash_filter");
+  ASSERT_FALSE(tmp_path.empty());
+
+  Prng rng;
+  rng.InitSeed(4711);
+  RandomHashGenerator random_hash_generator(rng);
+  std::vector<shash::Any> hashes(100000, shash::Any());
+  std::generate(hashes.begin(), hashes.end(), random_hash_generator);
+  std::vector<shash::Any> others(10000, shash::Any());
+  std::generate(others.begin(), others.end(), random_hash_generator);
+
+  {
+    CompactHashFilter filter;
+    // 64 runs are compacted into one along the way
+    filter.LimitMemory(1000 * sizeof(CompactHashFilter::Key), tmp_path);
+    for (unsigned i = 0; i < hashes.size(); ++i) {
+      filter.Fill(hashes[i]);
+      // Duplicates in different runs
+      if (i % 10 == 0)
+        filter.Fill(hashes[i / 2]);
+    }
+    EXPECT_TRUE(filter.has_spilled());
+    EXPECT_EQ(hashes.size(), filter.Count());
+    EXPECT_FALSE(FindFilesByPrefix(tmp_path, "hashfilter").empty());
+    filter.Freeze();
+    EXPECT_EQ(hashes.size(), filter.Count());
+    EXPECT_EQ(1U, FindFilesByPrefix(tmp_path, "hashfilter").size());
+    EXPECT_LE(filter.bytes_allocated(), 1000 * sizeof(CompactHashFilter::Key));
+
+    for (unsigned i = 0; i < hashes.size(); ++i)
+      EXPECT_TRUE(filter.Contains(hashes[i]));
+    unsigned false_positives = 0;
+    for (unsigned i = 0; i < others.size(); ++i) {
+      if (filter.Contains(others[i]))
+        false_positives++;
+    }
+    EXPECT_EQ(0U, false_positives);
+  }
+  EXPECT_TRUE(FindFilesByPrefix(tmp_path, "hashfilter").empty());
+  RemoveTree(tmp_path);
+}
@@ -5,10 +5,13 @@
 #include "gtest/gtest.h"
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "atomic.h"
 #include "c_mock_uploader.h"
@@ -24,6 +27,7 @@
 #include "ingestion/task_read.h"
 #include "ingestion/task_write.h"
 #include "smalloc.h"
+#include "statistics.h"
 #include "testutil.h"
 #include "upload_facility.h"
 #include "util/pointer.h"
@@ -32,6 +36,9 @@
 using namespace std;  // NOLINT
 
 namespace {
+// The tests fill the input tube completely before they drain the output tube
+const uint64_t kTubeLimit = 64 * 1024;
+
 class DummyItem {
  public:
   static DummyItem *CreateQuitBeacon() { return new DummyItem(-1); }
@@ -170,10 +177,131 @@ TEST_F(T_Ingestion, TaskStress) {
 }
 
 
+namespace {
+
+struct FreeArgs {
+  ItemAllocator *allocator;
+  std::vector<void *> buffers;
+};
+
+void *MainFree(void *data) {
+  FreeArgs *args = reinterpret_cast<FreeArgs *>(data);
+  SafeSleepMs(50);
+  for (unsigned i = 0; i < args->buffers.size(); ++i)
+    args->allocator->Free(args->buffers[i]);
+  return NULL;
+}
+
+void *MainEndFile(void *data) {
+  ItemAllocator *allocator = reinterpret_cast<ItemAllocator *>(data);
+  SafeSleepMs(50);
+  allocator->EndFile();
+  return NULL;
+}
+
+}  // anonymous namespace
+
+
+TEST_F(T_Ingestion, ItemAllocator) {
+  // Small and large allocations are not pooled
+  void *small = allocator_.Malloc(100);
+  EXPECT_LE(100U, allocator_.in_use());
+  void *large = allocator_.Malloc(1024 * 1024);
+  memset(large, 0, 1024 * 1024);
+  allocator_.Free(small);
+  allocator_.Free(large);
+  EXPECT_EQ(0U, allocator_.in_use());
+
+  // Pooled buffers are rounded up to the size class and recycled
+  void *block = allocator_.Malloc(TaskRead::kBlockSize - 1);
+  EXPECT_EQ(uint64_t(TaskRead::kBlockSize), allocator_.in_use());
+  memset(block, 0, TaskRead::kBlockSize);
+  allocator_.Free(block);
+  EXPECT_EQ(0U, allocator_.in_use());
+  EXPECT_EQ(block, allocator_.Malloc(TaskRead::kBlockSize));
+  allocator_.Free(block);
+
+  // Buffers that go through the node pool are recycled, too
+  std::vector<void *> buffers;
+  for (unsigned i = 0; i < 1000; ++i)
+    buffers.push_back(allocator_.Malloc(2 * kPageSize));
+  EXPECT_EQ(1000U * 2 * kPageSize, allocator_.in_use());
+  for (unsigned i = 0; i < buffers.size(); ++i)
+    allocator_.Free(buffers[i]);
+  EXPECT_EQ(0U, allocator_.in_use());
+  int64_t total_allocated = ItemAllocator::total_allocated();
+  for (unsigned i = 0; i < buffers.size(); ++i)
+    buffers[i] = allocator_.Malloc(2 * kPageSize);
+  for (unsigned i = 0; i < buffers.size(); ++i)
+    allocator_.Free(buffers[i]);
+  EXPECT_EQ(total_allocated, ItemAllocator::total_allocated());
+  EXPECT_EQ(0U, allocator_.in_use());
+}
+
+
+TEST_F(T_Ingestion, ItemAllocatorWaitForMemory) {
+  FreeArgs args;
+  args.allocator = &allocator_;
+  for (unsigned i = 0; i < 100; ++i)
+    args.buffers.push_back(allocator_.Malloc(TaskRead::kBlockSize));
+  const uint64_t in_use = allocator_.in_use();
+
+  EXPECT_FALSE(allocator_.WaitForMemory(in_use, in_use));
+
+  // Buffers freed in another thread wake up the waiting thread
+  pthread_t thread_free;
+  int retval = pthread_create(&thread_free, NULL, MainFree, &args);
+  ASSERT_EQ(0, retval);
+  EXPECT_TRUE(allocator_.WaitForMemory(0, in_use - 1));
+  EXPECT_EQ(0U, allocator_.in_use());
+  pthread_join(thread_free, NULL);
+
+  // The buffers of the terminated thread are back in the pool
+  void *block = allocator_.Malloc(TaskRead::kBlockSize);
+  EXPECT_TRUE(std::find(args.buffers.begin(), args.buffers.end(), block) !=
+              args.buffers.end());
+  allocator_.Free(block);
+}
+
+
+TEST_F(T_Ingestion, ItemAllocatorWaitForMemoryInFile) {
+  FreeArgs args;
+  args.allocator = &allocator_;
+  for (unsigned i = 0; i < 100; ++i)
+    args.buffers.push_back(allocator_.Malloc(TaskRead::kBlockSize));
+  const uint64_t in_use = allocator_.in_use();
+
+  // The only reader in the middle of a file does not wait
+  allocator_.BeginFile();
+  EXPECT_FALSE(allocator_.WaitForMemoryInFile(in_use));
+  EXPECT_FALSE(allocator_.WaitForMemoryInFile(in_use - 1));
+
+  // Another reader finishes its file while this one waits
+  allocator_.BeginFile();
+  pthread_t thread_end;
+  int retval = pthread_create(&thread_end, NULL, MainEndFile, &allocator_);
+  ASSERT_EQ(0, retval);
+  EXPECT_TRUE(allocator_.WaitForMemoryInFile(in_use - 1));
+  EXPECT_EQ(in_use, allocator_.in_use());
+  pthread_join(thread_end, NULL);
+
+  // Buffers freed in another thread wake up the waiting reader
+  allocator_.BeginFile();
+  pthread_t thread_free;
+  retval = pthread_create(&thread_free, NULL, MainFree, &args);
+  ASSERT_EQ(0, retval);
+  EXPECT_TRUE(allocator_.WaitForMemoryInFile(in_use - 1));
+  pthread_join(thread_free, NULL);
+  EXPECT_EQ(0U, allocator_.in_use());
+  allocator_.EndFile();
+  allocator_.EndFile();
+}
+
+
 TEST_F(T_Ingestion, TaskRead) {
   Tube<FileItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
@@ -201,6 +329,8 @@ TEST_F(T_Ingestion, TaskRead) {
   EXPECT_EQ(BlockItem::kBlockData, item_data->type());
   EXPECT_EQ(str_abc, string(reinterpret_cast<char *>(item_data->data()),
                             item_data->size()));
+  // Read in place, the buffer is sized by the file size
+  EXPECT_EQ(3U, item_data->capacity());
   delete item_data;
   item_stop = tube_out->PopFront();
   EXPECT_EQ(BlockItem::kBlockStop, item_stop->type());
@@ -237,6 +367,7 @@ TEST_F(T_Ingestion, TaskRead) {
   item_stop = tube_out->PopFront();
   EXPECT_EQ(BlockItem::kBlockStop, item_stop->type());
   delete item_stop;
+  EXPECT_EQ(0U, BlockItem::managed_bytes());
   unlink("./large");
 
   task_group.Terminate();
@@ -245,8 +376,8 @@ TEST_F(T_Ingestion, TaskRead) {
 
 TEST_F(T_Ingestion, TaskReadThrottle) {
   Tube<FileItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
@@ -271,9 +402,8 @@ TEST_F(T_Ingestion, TaskReadThrottle) {
   BlockItem *item_stop = tube_out->PopFront();
   EXPECT_EQ(BlockItem::kBlockStop, item_stop->type());
 
-  if (task_read->n_block() == 0) {
-    SafeSleepMs(2 * TaskRead::kThrottleMaxMs);
-  }
+  for (unsigned i = 0; (i < 100) && (task_read->n_block() == 0); ++i)
+    SafeSleepMs(10);
   EXPECT_EQ(1U, task_read->n_block());
 
   delete item_data;
@@ -289,13 +419,13 @@ TEST_F(T_Ingestion, TaskReadThrottle) {
 
 
 TEST_F(T_Ingestion, TaskChunkDispatch) {
-  Tube<BlockItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube tube_in(kTubeLimit);
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(
     new TaskChunk(&tube_in, &tube_group_out, &allocator_));
   task_group.Spawn();
@@ -362,13 +492,13 @@ TEST_F(T_Ingestion, TaskChunkDispatch) {
 
 
 TEST_F(T_Ingestion, TaskChunk) {
-  Tube<BlockItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube tube_in(kTubeLimit);
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(
     new TaskChunk(&tube_in, &tube_group_out, &allocator_));
   task_group.Spawn();
@@ -444,13 +574,13 @@ TEST_F(T_Ingestion, TaskChunk) {
 
 
 TEST_F(T_Ingestion, TaskChunkCornerCases) {
-  Tube<BlockItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube tube_in(kTubeLimit);
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(
     new TaskChunk(&tube_in, &tube_group_out, &allocator_));
   task_group.Spawn();
@@ -505,13 +635,13 @@ TEST_F(T_Ingestion, TaskChunkCornerCases) {
 
 
 TEST_F(T_Ingestion, TaskCompressNull) {
-  Tube<BlockItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube tube_in(kTubeLimit);
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(
     new TaskCompress(&tube_in, &tube_group_out, &allocator_));
   task_group.Spawn();
@@ -550,13 +680,13 @@ TEST_F(T_Ingestion, TaskCompressNull) {
 
 
 TEST_F(T_Ingestion, TaskCompress) {
-  Tube<BlockItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube tube_in(kTubeLimit);
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(
     new TaskCompress(&tube_in, &tube_group_out, &allocator_));
   task_group.Spawn();
@@ -629,14 +759,100 @@ TEST_F(T_Ingestion, TaskCompress) {
 }
 
 
+TEST_F(T_Ingestion, TaskCompressSegments) {
+  const unsigned segment_size = 1024 * 1024;
+  unsigned size = 5 * segment_size + 1000;
+  string content(size, '\0');
+  for (unsigned i = 0; i < size; ++i)
+    content[i] = (i % 4096) < 2048 ? (i % 251) : (i * 7919) >> 5;
+
+  std::vector<zlib::Algorithms> algorithms;
+  algorithms.push_back(zlib::kZlibDefault);
+#ifdef HAS_ZSTD
+  algorithms.push_back(zlib::kZstd);
+#endif
+  for (unsigned a = 0; a < algorithms.size(); ++a) {
+    // The segments of the bulk chunk are spread over two compression tasks
+    BlockTube tube_in(kTubeLimit);
+    BlockTube *tube_chunked[2];
+    BlockTubeGroup tube_group_chunked;
+    BlockTube *tube_out = new BlockTube(kTubeLimit);
+    BlockTubeGroup tube_group_out;
+    tube_group_out.TakeTube(tube_out);
+    tube_group_out.Activate();
+    TubeConsumerGroup<BlockItem, BlockTube> task_group;
+    task_group.TakeConsumer(
+      new TaskChunk(&tube_in, &tube_group_chunked, &allocator_));
+    for (unsigned i = 0; i < 2; ++i) {
+      tube_chunked[i] = new BlockTube(kTubeLimit);
+      tube_group_chunked.TakeTube(tube_chunked[i]);
+      task_group.TakeConsumer(
+        new TaskCompress(tube_chunked[i], &tube_group_out, &allocator_));
+    }
+    tube_group_chunked.Activate();
+    task_group.Spawn();
+
+    FileItem file_large(new FileIngestionSource(std::string("./large")),
+                        4 * 1024 * 1024, 8 * 1024 * 1024, 16 * 1024 * 1024,
+                        algorithms[a], shash::kSha1, shash::kSuffixNone,
+                        false /* may_have_chunks */,
+                        false /* has_legacy_bulk_chunk */,
+                        kChunkXor32, segment_size);
+    file_large.set_size(size);
+    const unsigned block_size = TaskRead::kBlockSize;
+    for (unsigned i = 0; i < size; i += block_size) {
+      BlockItem *b = new BlockItem(1, &allocator_);
+      b->SetFileItem(&file_large);
+      b->MakeDataCopy(
+        reinterpret_cast<const unsigned char *>(content.data()) + i,
+        std::min(block_size, size - i));
+      tube_in.EnqueueBack(b);
+    }
+    BlockItem *b_stop = new BlockItem(1, &allocator_);
+    b_stop->SetFileItem(&file_large);
+    b_stop->MakeStop();
+    tube_in.EnqueueBack(b_stop);
+
+    string compressed;
+    ChunkItem *chunk_item = NULL;
+    BlockItem *b = tube_out->PopFront();
+    int64_t tag = b->tag();
+    while (b->type() == BlockItem::kBlockData) {
+      EXPECT_EQ(tag, b->tag());
+      chunk_item = b->chunk_item();
+      compressed.append(reinterpret_cast<char *>(b->data()), b->size());
+      delete b;
+      b = tube_out->PopFront();
+    }
+    EXPECT_EQ(BlockItem::kBlockStop, b->type());
+    EXPECT_EQ(tag, b->tag());
+    EXPECT_EQ(chunk_item, b->chunk_item());
+    EXPECT_TRUE(chunk_item->is_bulk_chunk());
+    EXPECT_EQ(size, chunk_item->size());
+    delete b;
+    delete chunk_item;
+    EXPECT_EQ(0U, tube_out->size());
+    task_group.Terminate();
+
+    void *decompressed;
+    uint64_t sz_decompressed;
+    ASSERT_TRUE(zlib::DecompressMem2Mem(compressed.data(), compressed.size(),
+      &decompressed, &sz_decompressed, algorithms[a]));
+    EXPECT_EQ(size, sz_decompressed);
+    EXPECT_EQ(0, memcmp(content.data(), decompressed, size));
+    free(decompressed);
+  }
+}
+
+
 TEST_F(T_Ingestion, TaskHash) {
-  Tube<BlockItem> tube_in;
-  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
-  TubeGroup<BlockItem> tube_group_out;
+  BlockTube tube_in(kTubeLimit);
+  BlockTube *tube_out = new BlockTube(kTubeLimit);
+  BlockTubeGroup tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(new TaskHash(&tube_in, &tube_group_out));
   task_group.Spawn();
 
@@ -686,13 +902,13 @@ TEST_F(T_Ingestion, TaskHash) {
 
 
 TEST_F(T_Ingestion, TaskWriteNull) {
-  Tube<BlockItem> tube_in;
+  BlockTube tube_in(kTubeLimit);
   Tube<FileItem> *tube_out = new Tube<FileItem>();
   TubeGroup<FileItem> tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(new TaskWrite(&tube_in, &tube_group_out, uploader_));
   task_group.Spawn();
 
@@ -721,13 +937,13 @@ TEST_F(T_Ingestion, TaskWriteNull) {
 
 
 TEST_F(T_Ingestion, TaskWriteLarge) {
-  Tube<BlockItem> tube_in;
+  BlockTube tube_in(kTubeLimit);
   Tube<FileItem> *tube_out = new Tube<FileItem>();
   TubeGroup<FileItem> tube_group_out;
   tube_group_out.TakeTube(tube_out);
   tube_group_out.Activate();
 
-  TubeConsumerGroup<BlockItem> task_group;
+  TubeConsumerGroup<BlockItem, BlockTube> task_group;
   task_group.TakeConsumer(new TaskWrite(&tube_in, &tube_group_out, uploader_));
   task_group.Spawn();
 
@@ -826,6 +1042,55 @@ TEST_F(T_Ingestion, PipelineNull) {
 }
 
 
+TEST_F(T_Ingestion, PipelineStatistics) {
+  upload::SpoolerDefinition spooler_definition = MockSpoolerDefinition();
+  spooler_definition.compression_alg = zlib::kNoCompression;
+  perf::Statistics statistics;
+  perf::StatisticsTemplate publish_statistics("publish", &statistics);
+  const unsigned size = 100000;
+
+  {
+    IngestionPipeline pipeline(uploader_, spooler_definition,
+                               &publish_statistics);
+    pipeline.Spawn();
+    pipeline.Process(new StringIngestionSource(std::string(size, 'x')), false);
+    pipeline.WaitFor();
+    // Stops the threads so that the counters are final
+  }
+
+  EXPECT_EQ(1, statistics.Lookup("publish.pipeline.read.n_items")->Get());
+  EXPECT_EQ(0, statistics.Lookup("publish.pipeline.read.sz_in_bytes")->Get());
+  EXPECT_EQ(size,
+            statistics.Lookup("publish.pipeline.read.sz_out_bytes")->Get());
+  EXPECT_EQ(size,
+            statistics.Lookup("publish.pipeline.chunk.sz_in_bytes")->Get());
+  EXPECT_EQ(size,
+            statistics.Lookup("publish.pipeline.hash.sz_in_bytes")->Get());
+  EXPECT_EQ(size,
+            statistics.Lookup("publish.pipeline.register.sz_in_bytes")->Get());
+  EXPECT_EQ(1, statistics.Lookup("publish.pipeline.register.n_items")->Get());
+  EXPECT_LE(1, statistics.Lookup("publish.pipeline.chunk.n_pops")->Get());
+  EXPECT_LE(1,
+    statistics.Lookup("publish.pipeline.chunk.max_queue_depth")->Get());
+
+  int64_t nfiles = 0;
+  int64_t nitems = 0;
+  const char *bins[] = {"lt_10us", "lt_100us", "lt_1ms", "lt_10ms",
+                        "lt_100ms", "ge_100ms"};
+  for (unsigned i = 0; i < DurationHistogram::kNumBins; ++i) {
+    nfiles += statistics.Lookup(
+      std::string("publish.pipeline.n_file_latency_") + bins[i])->Get();
+    nitems += statistics.Lookup(
+      std::string("publish.pipeline.hash.n_service_") + bins[i])->Get();
+  }
+  EXPECT_EQ(1, nfiles);
+  EXPECT_EQ(statistics.Lookup("publish.pipeline.hash.n_items")->Get(), nitems);
+
+  EXPECT_NE(std::string::npos,
+            statistics.PrintJSON().find("\"pipeline.write.n_items\":"));
+}
+
+
 TEST_F(T_Ingestion, Scrubbing) {
   UniquePtr<ScrubbingPipeline> pipeline_scrubbing(new ScrubbingPipeline());
   FnFileHashed fn_hashed;
@@ -4,8 +4,17 @@
 
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
 #include "pack.h"
 #include "receiver/payload_processor.h"
+#include "statistics.h"
+#include "testutil.h"
+#include "util/posix.h"
 #include "util/string.h"
 #include "util_concurrency.h"
 
@@ -111,3 +120,117 @@ TEST_F(T_PayloadProcessor, Basic) {
                          serializer_->GetHeaderSize()));
   ASSERT_EQ(1, proc.num_files_received_);
 }
+
+
+/**
+ * Stores the objects with a local uploader instead of the one configured for
+ * the repository
+ */
+class LocalPayloadProcessor : public PayloadProcessor {
+ public:
+  explicit LocalPayloadProcessor(const std::string &storage)
+    : PayloadProcessor(), storage_(storage) {}
+
+  virtual Result Initialize() {
+    upload::SpoolerDefinition definition(
+        "local," + storage_ + "/txn," + storage_, shash::kSha1);
+    uploader_ = upload::AbstractUploader::Construct(definition);
+    return uploader_.IsValid() ? kSuccess : kUploaderError;
+  }
+
+ private:
+  std::string storage_;
+};
+
+class T_PayloadProcessorStore : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    storage_ = CreateTempDir(GetCurrentWorkingDirectory() + "/payload");
+    ASSERT_FALSE(storage_.empty());
+    ASSERT_TRUE(MkdirDeep(storage_ + "/txn", 0700));
+    ASSERT_TRUE(MakeCacheDirectories(storage_ + "/data", 0700));
+  }
+
+  virtual void TearDown() {
+    RemoveTree(storage_);
+  }
+
+  shash::Any AddObject(const std::string &content) {
+    ObjectPack::BucketHandle hd = pack_.NewBucket();
+    ObjectPack::AddToBucket(content.data(), content.size(), hd);
+    shash::Any id(shash::kSha1);
+    shash::HashString(content, &id);
+    EXPECT_TRUE(pack_.CommitBucket(ObjectPack::kCas, id, hd));
+    return id;
+  }
+
+  /**
+   * Serializes the object pack into a file and processes it
+   */
+  PayloadProcessor::Result Process(perf::Statistics *statistics,
+                                   uint64_t *payload_size)
+  {
+    ObjectPackProducer serializer(&pack_);
+    shash::Any digest(shash::kSha1);
+    serializer.GetDigest(&digest);
+    std::string payload;
+    std::vector<unsigned char> buffer(4096);
+    unsigned nbytes;
+    while ((nbytes = serializer.ProduceNext(buffer.size(), &buffer[0])) > 0)
+      payload.append(reinterpret_cast<char *>(&buffer[0]), nbytes);
+    *payload_size = payload.size();
+
+    const std::string path = storage_ + "/payload";
+    EXPECT_TRUE(SafeWriteToFile(payload, path, 0600));
+    const int fd = open(path.c_str(), O_RDONLY);
+    EXPECT_GE(fd, 0);
+
+    LocalPayloadProcessor proc(storage_);
+    proc.SetStatistics(statistics);
+    PayloadProcessor::Result result = proc.Process(
+        fd, digest.ToString(false), "some_path", serializer.GetHeaderSize());
+    close(fd);
+    return result;
+  }
+
+  std::string storage_;
+  ObjectPack pack_;
+};
+
+TEST_F(T_PayloadProcessorStore, StoreObjects) {
+  // Objects larger than the pack consumer's accumulator can arrive in
+  // several pieces
+  const unsigned sizes[] = {0, 1, 4096, 300 * 1024, 2 * 1024 * 1024};
+  const unsigned num_objects = sizeof(sizes) / sizeof(sizes[0]);
+  std::vector<shash::Any> ids;
+  uint64_t object_bytes = 0;
+  for (unsigned i = 0; i < num_objects; ++i) {
+    ids.push_back(AddObject(std::string(sizes[i], 'a' + i)));
+    object_bytes += sizes[i];
+  }
+
+  perf::Statistics statistics;
+  uint64_t payload_size;
+  EXPECT_EQ(PayloadProcessor::kSuccess, Process(&statistics, &payload_size));
+
+  for (unsigned i = 0; i < num_objects; ++i) {
+    EXPECT_TRUE(FileExists(storage_ + "/data/" + ids[i].MakePath()));
+  }
+  EXPECT_EQ(static_cast<int64_t>(object_bytes),
+            statistics.Lookup("publish.payload.sz_in_bytes")->Get());
+  EXPECT_EQ(static_cast<int64_t>(payload_size),
+            statistics.Lookup("publish.payload.sz_payload_bytes")->Get());
+}
+
+TEST_F(T_PayloadProcessorStore, HashMismatch) {
+  ObjectPack::BucketHandle hd = pack_.NewBucket();
+  ObjectPack::AddToBucket("content", 7, hd);
+  shash::Any id(shash::kSha1);
+  shash::HashString("other content", &id);
+  EXPECT_TRUE(pack_.CommitBucket(ObjectPack::kCas, id, hd));
+
+  perf::Statistics statistics;
+  uint64_t payload_size;
+  EXPECT_EQ(PayloadProcessor::kOtherError, Process(&statistics, &payload_size));
+  EXPECT_FALSE(FileExists(storage_ + "/data/" + id.MakePath()));
+}
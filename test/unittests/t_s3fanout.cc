@@ -5,6 +5,10 @@
 #include <gtest/gtest.h>
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
 
 #include "duplex_ssl.h"
 #include "s3fanout.h"
@@ -60,3 +64,155 @@ TEST(T_S3Fanout, DetectThrottleIndicator) {
   EXPECT_EQ(12U, info.throttle_ms);
 }
 
+
+TEST(T_S3Fanout, ClassifyJob) {
+  const uint64_t threshold = s3fanout::S3FanoutManager::kLargeObjectThreshold;
+  FileBackedBuffer *small_buf = FileBackedBuffer::Create(2 * threshold);
+  unsigned char *data = static_cast<unsigned char *>(malloc(threshold));
+  memset(data, 0, threshold);
+  small_buf->Append(data, threshold - 1);
+  small_buf->Commit();
+  FileBackedBuffer *large_buf = FileBackedBuffer::Create(2 * threshold);
+  large_buf->Append(data, threshold);
+  large_buf->Commit();
+  free(data);
+
+  s3fanout::JobInfo small_info("small", NULL, small_buf);
+  s3fanout::JobInfo large_info("large", NULL, large_buf);
+  EXPECT_EQ(s3fanout::kLaneSmall,
+            s3fanout::S3FanoutManager::ClassifyJob(small_info));
+  EXPECT_EQ(s3fanout::kLaneLarge,
+            s3fanout::S3FanoutManager::ClassifyJob(large_info));
+
+  // Requests without a body always use the small object lane
+  large_info.request = s3fanout::JobInfo::kReqHeadPut;
+  EXPECT_EQ(s3fanout::kLaneSmall,
+            s3fanout::S3FanoutManager::ClassifyJob(large_info));
+  large_info.request = s3fanout::JobInfo::kReqMultipartPart;
+  EXPECT_EQ(s3fanout::kLaneLarge,
+            s3fanout::S3FanoutManager::ClassifyJob(large_info));
+}
+
+
+TEST(T_S3Fanout, ParseListing) {
+  vector<s3fanout::ListEntry> entries;
+  string token = "stale";
+  EXPECT_FALSE(s3fanout::S3FanoutManager::ParseListing("", &entries, &token));
+  EXPECT_FALSE(s3fanout::S3FanoutManager::ParseListing(
+    "<Error><Code>NoSuchBucket</Code></Error>", &entries, &token));
+
+  const string complete =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+    "<ListBucketResult xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\">"
+    "<Name>bucket</Name><Prefix>test/data/ab/</Prefix><KeyCount>2</KeyCount>"
+    "<MaxKeys>1000</MaxKeys><IsTruncated>false</IsTruncated>"
+    "<Contents><Key>test/data/ab/cdefC</Key>"
+    "<LastModified>2009-10-12T17:50:30.000Z</LastModified>"
+    "<ETag>&quot;fba9dede5f27731c9771645a39863328&quot;</ETag>"
+    "<Size>434234</Size><StorageClass>STANDARD</StorageClass></Contents>"
+    "<Contents><Key>test/data/ab/0123</Key>"
+    "<LastModified>2021-01-01T00:00:00Z</LastModified>"
+    "<Size>0</Size></Contents>"
+    "</ListBucketResult>";
+  EXPECT_TRUE(
+    s3fanout::S3FanoutManager::ParseListing(complete, &entries, &token));
+  EXPECT_TRUE(token.empty());
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_EQ("test/data/ab/cdefC", entries[0].key);
+  EXPECT_EQ(434234U, entries[0].size);
+  EXPECT_EQ(1255369830, entries[0].mtime);
+  EXPECT_EQ("test/data/ab/0123", entries[1].key);
+  EXPECT_EQ(0U, entries[1].size);
+  EXPECT_EQ(1609459200, entries[1].mtime);
+
+  const string truncated =
+    "<ListBucketResult><IsTruncated>true</IsTruncated>"
+    "<NextContinuationToken>1ueGcxLPRx1Tr/XYExHnhbYLgveDs2J/wm36Hy4vbOwM="
+    "</NextContinuationToken>"
+    "<Contents><Key>test/data/ab/cdef</Key>"
+    "<LastModified>2009-10-12T17:50:30.000Z</LastModified></Contents>"
+    "</ListBucketResult>";
+  EXPECT_TRUE(
+    s3fanout::S3FanoutManager::ParseListing(truncated, &entries, &token));
+  EXPECT_EQ("1ueGcxLPRx1Tr/XYExHnhbYLgveDs2J/wm36Hy4vbOwM=", token);
+  EXPECT_EQ(1U, entries.size());
+
+  const string empty =
+    "<ListBucketResult><IsTruncated>false</IsTruncated></ListBucketResult>";
+  EXPECT_TRUE(s3fanout::S3FanoutManager::ParseListing(empty, &entries, &token));
+  EXPECT_TRUE(entries.empty());
+  EXPECT_TRUE(token.empty());
+
+  // Without timestamps, the age of the objects would be unknown
+  const string no_timestamp =
+    "<ListBucketResult><IsTruncated>false</IsTruncated>"
+    "<Contents><Key>test/data/ab/cdef</Key></Contents></ListBucketResult>";
+  EXPECT_FALSE(
+    s3fanout::S3FanoutManager::ParseListing(no_timestamp, &entries, &token));
+  const string no_token =
+    "<ListBucketResult><IsTruncated>true</IsTruncated></ListBucketResult>";
+  EXPECT_FALSE(
+    s3fanout::S3FanoutManager::ParseListing(no_token, &entries, &token));
+}
+
+
+TEST(T_S3Fanout, ParseCopyPartEtag) {
+  EXPECT_EQ("", s3fanout::S3FanoutManager::ParseCopyPartEtag(""));
+  EXPECT_EQ("", s3fanout::S3FanoutManager::ParseCopyPartEtag(
+    "<Error><Code>InternalError</Code></Error>"));
+  EXPECT_EQ("\"b54357faf0632cce46e942fa68356b38\"",
+    s3fanout::S3FanoutManager::ParseCopyPartEtag(
+      "<CopyPartResult><LastModified>2011-04-11T20:34:56.000Z</LastModified>"
+      "<ETag>\"b54357faf0632cce46e942fa68356b38\"</ETag></CopyPartResult>"));
+  EXPECT_EQ("\"1\"", s3fanout::S3FanoutManager::ParseCopyPartEtag(
+    "<CopyPartResult><ETag>&quot;1&quot;</ETag></CopyPartResult>"));
+}
+
+
+namespace s3fanout {
+
+TEST(T_S3Fanout, AdjustConcurrency) {
+  S3FanoutManager::S3Config config;
+  config.pool_max_handles = 16;
+  S3FanoutManager s3fanout_mgr(config);
+  EXPECT_EQ(16U, s3fanout_mgr.concurrency_limit_);
+
+  // Additive increase: one step per window of concurrency_limit_ replies
+  s3fanout_mgr.concurrency_limit_ = 4;
+  for (unsigned i = 0; i < 3; ++i)
+    s3fanout_mgr.AdjustConcurrency(false, 0.01);
+  EXPECT_EQ(4U, s3fanout_mgr.concurrency_limit_);
+  s3fanout_mgr.AdjustConcurrency(false, 0.01);
+  EXPECT_EQ(5U, s3fanout_mgr.concurrency_limit_);
+  for (unsigned i = 0; i < 5; ++i)
+    s3fanout_mgr.AdjustConcurrency(false, -1.0);
+  EXPECT_EQ(6U, s3fanout_mgr.concurrency_limit_);
+
+  // A throttle reply early in the window halves the limit when it closes
+  s3fanout_mgr.AdjustConcurrency(true, -1.0);
+  for (unsigned i = 0; i < 4; ++i)
+    s3fanout_mgr.AdjustConcurrency(false, 0.01);
+  EXPECT_EQ(6U, s3fanout_mgr.concurrency_limit_);
+  s3fanout_mgr.AdjustConcurrency(false, 0.01);
+  EXPECT_EQ(3U, s3fanout_mgr.concurrency_limit_);
+  EXPECT_EQ(1U, s3fanout_mgr.GetStatistics().num_congestion_events);
+
+  // The next window starts clean
+  for (unsigned i = 0; i < 3; ++i)
+    s3fanout_mgr.AdjustConcurrency(false, 0.01);
+  EXPECT_EQ(4U, s3fanout_mgr.concurrency_limit_);
+
+  // Throttling can go down to a single request
+  for (unsigned i = 0; i < 10; ++i)
+    s3fanout_mgr.AdjustConcurrency(true, -1.0);
+  EXPECT_EQ(1U, s3fanout_mgr.concurrency_limit_);
+  EXPECT_EQ(1U, s3fanout_mgr.GetStatistics().min_concurrency_limit);
+
+  // Growing latencies reduce the limit, but not below a quarter of the pool
+  s3fanout_mgr.concurrency_limit_ = 16;
+  for (unsigned i = 0; i < 64; ++i)
+    s3fanout_mgr.AdjustConcurrency(false, 1.0);
+  EXPECT_EQ(4U, s3fanout_mgr.concurrency_limit_);
+}
+
+}  // namespace s3fanout
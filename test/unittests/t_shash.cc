@@ -7,14 +7,20 @@
 
 #include <gtest/gtest.h>
 
+#include <alloca.h>
+#include <openssl/sha.h>
+
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <set>
 #include <string>
 
 #include "duplex_ssl.h"
 #include "hash.h"
+#include "hash_accel.h"
+#include "hash_tree.h"
 #include "prng.h"
 #include "smalloc.h"
 #include "util/string.h"
@@ -24,10 +30,14 @@ using namespace std;  // NOLINT
 TEST(T_Shash, ContextSize) {
   unsigned max_size = 0;
   for (int i = 0; i < shash::kAny; ++i) {
+    if (i == shash::kShake128Tree)
+      continue;
     max_size = std::max(max_size,
       shash::GetContextSize(static_cast<shash::Algorithms>(i)));
   }
   EXPECT_EQ(max_size, shash::kMaxContextSize);
+  EXPECT_GT(shash::GetContextSize(shash::kShake128Tree),
+            shash::kMaxContextSize);
 }
 
 TEST(T_Shash, TestVectors) {
@@ -281,11 +291,15 @@ TEST(T_Shash, MkFromHexPtr) {
   sha1.Randomize();
   rmd160.Randomize();
   shake128.Randomize();
+  shash::Any shake128tree(shash::kShake128Tree);
+  shake128tree.Randomize();
 
   EXPECT_EQ(md5, shash::MkFromHexPtr(shash::HexPtr(md5.ToString())));
   EXPECT_EQ(sha1, shash::MkFromHexPtr(shash::HexPtr(sha1.ToString())));
   EXPECT_EQ(rmd160, shash::MkFromHexPtr(shash::HexPtr(rmd160.ToString())));
   EXPECT_EQ(shake128, shash::MkFromHexPtr(shash::HexPtr(shake128.ToString())));
+  EXPECT_EQ(shake128tree,
+            shash::MkFromHexPtr(shash::HexPtr(shake128tree.ToString())));
 
   shash::Any constructed = shash::MkFromHexPtr(shash::HexPtr(sha1.ToString()));
   EXPECT_EQ(shash::kSuffixNone, constructed.suffix);
@@ -341,6 +355,15 @@ TEST(T_Shash, MkFromSuffixedHexPtr) {
     shash::MkFromSuffixedHexPtr(shash::HexPtr(shake128S.ToString(true)));
   EXPECT_EQ(shake128S, constructed);
   EXPECT_EQ(shake128S.suffix, constructed.suffix);
+
+  shash::Any shake128tree(shash::kShake128Tree);
+  shake128tree.Randomize();
+  shake128tree.suffix = shash::kSuffixCatalog;
+  constructed =
+    shash::MkFromSuffixedHexPtr(shash::HexPtr(shake128tree.ToString(true)));
+  EXPECT_EQ(shake128tree, constructed);
+  EXPECT_EQ(shake128tree.suffix, constructed.suffix);
+  EXPECT_TRUE(shash::HexPtr(shake128tree.ToString()).IsValid());
 }
 
 
@@ -1134,3 +1157,121 @@ TEST(T_Shash, Sha256) {
     hash.c_str());
 #endif
 }
+
+
+TEST(T_Shash, Sha1Accelerated) {
+  printf("CPU features: %u\n", shash::GetCpuFeatures());
+  const unsigned kMaxSize = 64 * 1024 + 7;
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(kMaxSize));
+  Prng prng;
+  prng.InitSeed(42);
+  for (unsigned i = 0; i < kMaxSize; ++i)
+    buffer[i] = prng.Next(256);
+
+  const unsigned sizes[] = {0, 1, 55, 56, 63, 64, 65, 119, 120, 127, 128, 1000,
+                            kMaxSize};
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    SHA1(buffer, sizes[i], expected);
+
+    // Different splits exercise the partial blocks kept in the context
+    const unsigned splits[] = {1, 13, 64, 100, 4096, kMaxSize};
+    for (unsigned j = 0; j < sizeof(splits) / sizeof(splits[0]); ++j) {
+      shash::Any sha1(shash::kSha1);
+      shash::ContextPtr context(shash::kSha1);
+      context.buffer = alloca(context.size);
+      shash::Init(context);
+      for (unsigned pos = 0; pos < sizes[i]; pos += splits[j]) {
+        shash::Update(buffer + pos, std::min(splits[j], sizes[i] - pos),
+                      context);
+      }
+      shash::Final(context, &sha1);
+      EXPECT_EQ(shash::Any(shash::kSha1, expected), sha1)
+        << "size " << sizes[i] << ", split " << splits[j];
+    }
+  }
+  free(buffer);
+}
+
+
+TEST(T_Shash, TreeHashLeavesN) {
+  unsigned char leaves[shash::kKeccakLanes * shash::kTreeLeafSize];
+  Prng prng;
+  prng.InitSeed(42);
+  for (unsigned i = 0; i < sizeof(leaves); ++i)
+    leaves[i] = prng.Next(256);
+
+  unsigned char cvs[shash::kKeccakLanes * shash::kTreeCvSize];
+  shash::TreeHashLeavesN(leaves, cvs);
+  for (unsigned i = 0; i < shash::kKeccakLanes; ++i) {
+    unsigned char cv[shash::kTreeCvSize];
+    shash::TreeHashLeaf(leaves + i * shash::kTreeLeafSize,
+                        shash::kTreeLeafSize, cv);
+    EXPECT_EQ(0, memcmp(cv, cvs + i * shash::kTreeCvSize, sizeof(cv)));
+  }
+}
+
+
+TEST(T_Shash, TreeHash) {
+  shash::Any tree(shash::kShake128Tree);
+  HashString("", &tree);
+  EXPECT_EQ("a20e5ba58f374d2e53e19b0fac5d569fea8607f6-shake128tree",
+            tree.ToString());
+  HashString("abc", &tree);
+  EXPECT_EQ("9dda7670f09f5545f832045afbdbbf455e66073d-shake128tree",
+            tree.ToString());
+  // Five leaves, i.e. a multi-buffer batch and a single leaf
+  HashString(string(5000, 'a'), &tree);
+  EXPECT_EQ("80d6c5cc95d07fd8ff564f880c9a21dce50a3469-shake128tree",
+            tree.ToString());
+  EXPECT_EQ(shash::kShake128Tree, shash::ParseHashAlgorithm("shake128tree"));
+
+  const unsigned kMaxSize = 64 * 1024 + 7;
+  unsigned char *buffer = static_cast<unsigned char *>(smalloc(kMaxSize));
+  Prng prng;
+  prng.InitSeed(42);
+  for (unsigned i = 0; i < kMaxSize; ++i)
+    buffer[i] = prng.Next(256);
+
+  // The hash depends only on the content, not on the way it is fed in, and
+  // every length has its own tree
+  const unsigned sizes[] = {1, 1023, 1024, 1025, 2048, 3 * 1024 + 1,
+                            4 * 1024, 9 * 1024 - 1, kMaxSize};
+  std::set<shash::Any> distinct;
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    shash::Any expected(shash::kShake128Tree);
+    shash::HashMem(buffer, sizes[i], &expected);
+    distinct.insert(expected);
+
+    const unsigned splits[] = {1, 100, 1024, 5000};
+    for (unsigned j = 0; j < sizeof(splits) / sizeof(splits[0]); ++j) {
+      shash::Any result(shash::kShake128Tree);
+      shash::ContextPtr context(shash::kShake128Tree);
+      context.buffer = alloca(context.size);
+      shash::Init(context);
+      for (unsigned pos = 0; pos < sizes[i]; pos += splits[j]) {
+        shash::Update(buffer + pos, std::min(splits[j], sizes[i] - pos),
+                      context);
+      }
+      shash::Final(context, &result);
+      EXPECT_EQ(expected, result)
+        << "size " << sizes[i] << ", split " << splits[j];
+    }
+  }
+  EXPECT_EQ(sizeof(sizes) / sizeof(sizes[0]), distinct.size());
+
+  // Complete subtrees are merged right away
+  shash::TreeHashContext ctx;
+  shash::TreeHashInit(&ctx);
+  shash::TreeHashUpdate(&ctx, buffer, 2 * shash::kTreeLeafSize);
+  EXPECT_EQ(2U, ctx.nleaves);
+  EXPECT_EQ(1U, ctx.stack_size);
+  shash::TreeHashUpdate(&ctx, buffer, shash::kTreeLeafSize + 1);
+  EXPECT_EQ(3U, ctx.nleaves);
+  EXPECT_EQ(2U, ctx.stack_size);
+  EXPECT_EQ(1U, ctx.leaf_size);
+  shash::TreeHashUpdate(&ctx, buffer, shash::kTreeLeafSize - 1);
+  EXPECT_EQ(4U, ctx.nleaves);
+  EXPECT_EQ(1U, ctx.stack_size);
+  free(buffer);
+}
@@ -203,4 +203,22 @@ TEST(T_Statistics, GenerateJSONStatisticsTemplates) {
   EXPECT_EQ(json_expected, json_observed);
 }
 
+TEST(T_Statistics, GenerateJSONNestedStatisticsTemplates) {
+  Statistics stats;
+  StatisticsTemplate stat_template("template", &stats);
+  StatisticsTemplate stat_template_sub("sub", stat_template);
+
+  Counter *cnt1 = stat_template.RegisterTemplated("valueA", "test counter A");
+  Counter *cnt2 =
+    stat_template_sub.RegisterTemplated("valueB", "test counter B");
+  cnt1->Set(1);
+  cnt2->Set(2);
+
+  std::string json_observed = stats.PrintJSON();
+  std::string json_expected =
+    "{\"template\":{\"sub.valueB\":2,\"valueA\":1}}";
+
+  EXPECT_EQ(json_expected, json_observed);
+}
+
 }  // namespace perf
@@ -0,0 +1,160 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "catalog_test_tools.h"
+#include "hash.h"
+#include "swissknife_check.h"
+#include "testutil.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+namespace {
+
+// The last one is the content hash of the .cvmfscatalog marker file of DirSpec
+const char *hashes[] = {"b026324c6904b2a9cb4b88d6d61c81d100000000",
+                        "26ab0db90d72e28ad0ba1e22ee51051000000000",
+                        "6d7fce9fee471194aa8b5b6e47267f0300000000",
+                        "0000000000000000000000000000000000000001"};
+
+DirSpec MakeSpec() {
+  DirSpec spec;
+  const size_t file_size = 4096;
+
+  EXPECT_TRUE(spec.AddDirectory("dir", "", file_size));
+  EXPECT_TRUE(spec.AddFile("file1", "dir", hashes[0], file_size));
+  EXPECT_TRUE(spec.AddDirectory("nested", "dir", file_size));
+  EXPECT_TRUE(spec.AddFile("file2", "dir/nested", hashes[1], file_size));
+  EXPECT_TRUE(spec.AddFile("file3", "", hashes[2], file_size));
+  EXPECT_TRUE(spec.AddNestedCatalog("dir/nested"));
+
+  return spec;
+}
+
+}  // anonymous namespace
+
+class T_SwissknifeCheck : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    cwd_ = GetCurrentWorkingDirectory();
+    tester_ = new CatalogTestTool("check");
+    ASSERT_TRUE(tester_->Init());
+    ASSERT_TRUE(tester_->Apply("revision", MakeSpec()));
+    stratum0_ = cwd_ + "/check";
+    ASSERT_TRUE(tester_->manifest()->Export(stratum0_ + "/.cvmfspublished"));
+  }
+
+  virtual void TearDown() {
+    EXPECT_EQ(0, chdir(cwd_.c_str()));
+    tester_.Destroy();
+    RemoveTree(stratum0_);
+  }
+
+  int Check(const std::string &flags,
+            const std::string &checkpoint = "",
+            const std::string &subtree = "")
+  {
+    swissknife::ArgumentList args;
+    args['r'].Reset(new std::string(stratum0_));
+    args['t'].Reset(new std::string(stratum0_ + "/data/txn"));
+    args['j'].Reset(new std::string("4"));
+    for (unsigned i = 0; i < flags.length(); ++i)
+      args[flags[i]].Reset(new std::string());
+    if (!checkpoint.empty())
+      args['C'].Reset(new std::string(checkpoint));
+    if (!subtree.empty())
+      args['s'].Reset(new std::string(subtree));
+
+    swissknife::CommandCheck command;
+    const int retval = command.Main(args);
+    EXPECT_EQ(0, chdir(cwd_.c_str()));
+    return retval;
+  }
+
+  /**
+   * Stores fake, uncompressed data chunks
+   */
+  void CreateObjects() {
+    for (unsigned i = 0; i < sizeof(hashes) / sizeof(hashes[0]); ++i) {
+      const shash::Any hash(shash::MkFromHexPtr(shash::HexPtr(hashes[i])));
+      ASSERT_TRUE(SafeWriteToFile("fake", stratum0_ + "/data/" +
+                                  hash.MakePath(), 0644));
+    }
+  }
+
+  std::string cwd_;
+  std::string stratum0_;
+  UniquePtr<CatalogTestTool> tester_;
+};
+
+
+TEST_F(T_SwissknifeCheck, Catalogs) {
+  EXPECT_EQ(0, Check(""));
+}
+
+
+TEST_F(T_SwissknifeCheck, Subtree) {
+  EXPECT_EQ(0, Check("", "", "/dir/nested"));
+  EXPECT_NE(0, Check("c", "", "/dir/nested"));
+  CreateObjects();
+  EXPECT_EQ(0, Check("c", "", "/dir/nested"));
+  EXPECT_NE(0, Check("", "", "/dir/missing"));
+}
+
+
+TEST_F(T_SwissknifeCheck, MissingChunks) {
+  EXPECT_NE(0, Check("c"));
+  CreateObjects();
+  EXPECT_EQ(0, Check("c"));
+}
+
+
+TEST_F(T_SwissknifeCheck, VerifyContent) {
+  CreateObjects();
+  // The objects exist but do not match their content hashes
+  EXPECT_EQ(0, Check("c"));
+  EXPECT_NE(0, Check("V"));
+}
+
+
+TEST_F(T_SwissknifeCheck, Checkpoint) {
+  const std::string checkpoint = cwd_ + "/check_checkpoint";
+  EXPECT_NE(0, Check("c", checkpoint));
+  EXPECT_FALSE(FileExists(checkpoint));
+
+  CreateObjects();
+  EXPECT_EQ(0, Check("c", checkpoint));
+  EXPECT_TRUE(FileExists(checkpoint));
+
+  // Missing chunks are not noticed for the verified catalogs
+  const shash::Any hash(shash::MkFromHexPtr(shash::HexPtr(hashes[1])));
+  EXPECT_EQ(0, unlink((stratum0_ + "/data/" + hash.MakePath()).c_str()));
+  EXPECT_EQ(0, Check("c", checkpoint));
+
+  // A more thorough check ignores the checkpoint
+  EXPECT_NE(0, Check("V", checkpoint));
+  EXPECT_EQ(0, unlink(checkpoint.c_str()));
+  EXPECT_NE(0, Check("c", checkpoint));
+}
+
+
+TEST_F(T_SwissknifeCheck, CheckpointSubtree) {
+  const std::string checkpoint = cwd_ + "/check_checkpoint";
+  CreateObjects();
+  EXPECT_EQ(0, Check("c", checkpoint));
+  EXPECT_EQ(0, Check("c", checkpoint, "/dir/nested"));
+
+  // The subtree check keeps the root catalog in the checkpoint
+  const shash::Any hash(shash::MkFromHexPtr(shash::HexPtr(hashes[2])));
+  EXPECT_EQ(0, unlink((stratum0_ + "/data/" + hash.MakePath()).c_str()));
+  EXPECT_EQ(0, Check("c", checkpoint));
+
+  // A checkpoint of the subtree alone does not cover the root catalog
+  EXPECT_EQ(0, unlink(checkpoint.c_str()));
+  EXPECT_EQ(0, Check("c", checkpoint, "/dir/nested"));
+  EXPECT_NE(0, Check("c", checkpoint));
+}
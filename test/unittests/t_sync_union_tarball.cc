@@ -7,10 +7,15 @@
 #include <gtest/gtest.h>
 
 #include <unistd.h>
+#include <zlib.h>
+
 #include <cassert>
+#include <map>
 #include <string>
 
 #include "aux/tar_files.h"
+#include "duplex_libarchive.h"
+#include "ingestion/ingestion_source.h"
 #include "mock/m_sync_mediator.h"
 #include "sync_item.h"
 #include "sync_union_tarball.h"
@@ -19,6 +24,7 @@
 
 using ::testing::_;
 using ::testing::DefaultValue;
+using ::testing::Invoke;
 using ::testing::Return;
 using ::testing::Property;
 
@@ -54,14 +60,58 @@ class T_SyncUnionTarball : public ::testing::Test {
     return tmp_tar_filename_;
   }
 
+  std::string CreateTarGzFile(const std::string& base64_data) {
+    std::string data_binary;
+    Debase64(base64_data, &data_binary);
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    // window bits + 16 produces the gzip format
+    int retval = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY);
+    assert(retval == Z_OK);
+    std::string compressed(deflateBound(&strm, data_binary.size()), '\0');
+    strm.next_in = reinterpret_cast<Bytef *>(
+        const_cast<char *>(data_binary.data()));
+    strm.avail_in = data_binary.size();
+    strm.next_out = reinterpret_cast<Bytef *>(&compressed[0]);
+    strm.avail_out = compressed.size();
+    retval = deflate(&strm, Z_FINISH);
+    assert(retval == Z_STREAM_END);
+    compressed.resize(strm.total_out);
+    deflateEnd(&strm);
+
+    return CreateTarFile("tar.tar.gz", Base64(compressed));
+  }
+
   virtual void TearDown() {
     unlink(tmp_tar_filename_.c_str());
     delete m_sync_mediator_;
     DefaultValue<zlib::Algorithms>::Clear();
   }
 
+ public:
+  // Acts as the ingestion pipeline for the files passed to the mediator
+  void ReadContent(SharedPtr<SyncItem> entry) {
+    if (!entry->IsRegularFile())
+      return;
+    IngestionSource *source = entry->CreateIngestionSource();
+    EXPECT_TRUE(source->Open());
+    std::string content;
+    char buffer[4];
+    ssize_t nbytes;
+    while ((nbytes = source->Read(buffer, sizeof(buffer))) > 0)
+      content.append(buffer, nbytes);
+    EXPECT_EQ(0, nbytes);
+    EXPECT_TRUE(source->Close());
+    delete source;
+    contents_[entry->GetRelativePath()] = content;
+  }
+
+ protected:
   publish::MockSyncMediator* m_sync_mediator_;
   std::string tmp_tar_filename_;
+  std::map<std::string, std::string> contents_;
 };
 
 TEST_F(T_SyncUnionTarball, Init) {
@@ -73,4 +123,87 @@ TEST_F(T_SyncUnionTarball, Init) {
   EXPECT_TRUE(sync_union.Initialize());
 }
 
+TEST_F(T_SyncUnionTarball, ReadContent) {
+  std::string tar_filename = CreateTarFile("tar.tar", simple_tar);
+  publish::SyncUnionTarball sync_union(m_sync_mediator_, "", tar_filename,
+                                       "/tmp/lala", "", false);
+
+  EXPECT_CALL(*m_sync_mediator_, RegisterUnionEngine(_)).Times(1);
+  EXPECT_CALL(*m_sync_mediator_, AddUnmaterializedDirectory(_))
+      .Times(::testing::AnyNumber());
+  EXPECT_CALL(*m_sync_mediator_, Add(_)).Times(2).WillRepeatedly(
+      Invoke(this, &T_SyncUnionTarball::ReadContent));
+  EXPECT_TRUE(sync_union.Initialize());
+  sync_union.Traverse();
+
+  ASSERT_EQ(2U, contents_.size());
+  EXPECT_EQ("batman\n", contents_["/tmp/lala/tar/aaa/joker"]);
+  EXPECT_EQ("foobar\n", contents_["/tmp/lala/tar/hero"]);
+}
+
+TEST_F(T_SyncUnionTarball, ReadCompressedContent) {
+  if (FindExecutable("gzip").empty() && FindExecutable("pigz").empty()) {
+    printf("Skipping, gzip not available\n");
+    return;
+  }
+  std::string tar_filename = CreateTarGzFile(simple_tar);
+  publish::SyncUnionTarball sync_union(m_sync_mediator_, "", tar_filename,
+                                       "/tmp/lala", "", false);
+
+  EXPECT_CALL(*m_sync_mediator_, RegisterUnionEngine(_)).Times(1);
+  EXPECT_CALL(*m_sync_mediator_, AddUnmaterializedDirectory(_))
+      .Times(::testing::AnyNumber());
+  EXPECT_CALL(*m_sync_mediator_, Add(_)).Times(2).WillRepeatedly(
+      Invoke(this, &T_SyncUnionTarball::ReadContent));
+  EXPECT_TRUE(sync_union.Initialize());
+  sync_union.Traverse();
+
+  ASSERT_EQ(2U, contents_.size());
+  EXPECT_EQ("batman\n", contents_["/tmp/lala/tar/aaa/joker"]);
+  EXPECT_EQ("foobar\n", contents_["/tmp/lala/tar/hero"]);
+}
+
+TEST_F(T_SyncUnionTarball, ReadLargeAndSmallContent) {
+  // Larger than the read-ahead limit, streamed from the archive
+  std::string large(3 * 1024 * 1024 + 17, 'L');
+  std::string small("small");
+
+  std::string tmp_dir = CreateTempDir("test_sync_union");
+  ASSERT_FALSE(tmp_dir.empty());
+  tmp_tar_filename_ = tmp_dir + "/large.tar";
+  struct archive *writer = archive_write_new();
+  ASSERT_EQ(ARCHIVE_OK, archive_write_set_format_pax_restricted(writer));
+  ASSERT_EQ(ARCHIVE_OK,
+            archive_write_open_filename(writer, tmp_tar_filename_.c_str()));
+  const char *names[] = {"large", "small"};
+  const std::string *data[] = {&large, &small};
+  for (unsigned i = 0; i < 2; ++i) {
+    struct archive_entry *entry = archive_entry_new();
+    archive_entry_set_pathname(entry, names[i]);
+    archive_entry_set_size(entry, data[i]->size());
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    ASSERT_EQ(ARCHIVE_OK, archive_write_header(writer, entry));
+    ASSERT_EQ(static_cast<ssize_t>(data[i]->size()),
+              archive_write_data(writer, data[i]->data(), data[i]->size()));
+    archive_entry_free(entry);
+  }
+  archive_write_close(writer);
+  archive_write_free(writer);
+
+  publish::SyncUnionTarball sync_union(m_sync_mediator_, "",
+                                       tmp_tar_filename_, "/", "", false);
+  EXPECT_CALL(*m_sync_mediator_, RegisterUnionEngine(_)).Times(1);
+  EXPECT_CALL(*m_sync_mediator_, AddUnmaterializedDirectory(_))
+      .Times(::testing::AnyNumber());
+  EXPECT_CALL(*m_sync_mediator_, Add(_)).Times(2).WillRepeatedly(
+      Invoke(this, &T_SyncUnionTarball::ReadContent));
+  EXPECT_TRUE(sync_union.Initialize());
+  sync_union.Traverse();
+
+  ASSERT_EQ(2U, contents_.size());
+  EXPECT_EQ(large, contents_["large"]);
+  EXPECT_EQ(small, contents_["small"]);
+}
+
 }  // namespace
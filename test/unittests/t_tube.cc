@@ -4,6 +4,10 @@
 
 #include "gtest/gtest.h"
 
+#include <pthread.h>
+
+#include <vector>
+
 #include "ingestion/tube.h"
 
 using namespace std;  // NOLINT
@@ -89,3 +93,137 @@ TEST_F(T_Tube, Group) {
   x = t2->PopFront();  EXPECT_EQ(&c, x);
   x = t3->PopFront();  EXPECT_EQ(&b, x);
 }
+
+
+TEST_F(T_Tube, PopFrontMany) {
+  DummyItem a, b, c;
+  DummyItem *items[2];
+  tube_.EnqueueBack(&a);
+  tube_.EnqueueBack(&b);
+  tube_.EnqueueBack(&c);
+  EXPECT_EQ(2U, tube_.PopFrontMany(items, 2));
+  EXPECT_EQ(&a, items[0]);
+  EXPECT_EQ(&b, items[1]);
+  EXPECT_EQ(1U, tube_.PopFrontMany(items, 2));
+  EXPECT_EQ(&c, items[0]);
+  EXPECT_TRUE(tube_.IsEmpty());
+}
+
+
+TEST_F(T_Tube, RingFifo) {
+  RingTube<DummyItem> ring(3);
+  EXPECT_EQ(4U, ring.capacity());
+  EXPECT_TRUE(ring.IsEmpty());
+
+  // Several laps around the ring
+  std::vector<DummyItem> items(10);
+  for (unsigned i = 0; i < items.size(); ++i) {
+    ring.EnqueueBack(&items[i]);
+    if (i % 3 == 2) {
+      EXPECT_EQ(3U, ring.size());
+      EXPECT_EQ(&items[i - 2], ring.PopFront());
+      DummyItem *batch[4];
+      EXPECT_EQ(2U, ring.PopFrontMany(batch, 4));
+      EXPECT_EQ(&items[i - 1], batch[0]);
+      EXPECT_EQ(&items[i], batch[1]);
+    }
+  }
+  EXPECT_EQ(1U, ring.size());
+  EXPECT_EQ(&items[9], ring.PopFront());
+  EXPECT_TRUE(ring.IsEmpty());
+  ring.Wait();
+
+  TubeGroup<DummyItem, RingTube<DummyItem> > grp;
+  RingTube<DummyItem> *t1 = new RingTube<DummyItem>();
+  RingTube<DummyItem> *t2 = new RingTube<DummyItem>();
+  grp.TakeTube(t1);
+  grp.TakeTube(t2);
+  grp.Activate();
+  items[0].tag_ = 0;
+  items[1].tag_ = 1;
+  grp.Dispatch(&items[0]);
+  grp.Dispatch(&items[1]);
+  EXPECT_EQ(&items[0], t1->PopFront());
+  EXPECT_EQ(&items[1], t2->PopFront());
+}
+
+
+namespace {
+
+const unsigned kNumRingItems = 100000;
+const unsigned kNumRingThreads = 4;
+
+struct RingWorker {
+  RingTube<DummyItem> *ring;
+  DummyItem *items;
+  unsigned offset;
+  std::vector<unsigned> seen;
+};
+
+void *MainRingProducer(void *data) {
+  RingWorker *worker = reinterpret_cast<RingWorker *>(data);
+  for (unsigned i = worker->offset; i < kNumRingItems; i += kNumRingThreads)
+    worker->ring->EnqueueBack(&worker->items[i]);
+  return NULL;
+}
+
+void *MainRingConsumer(void *data) {
+  RingWorker *worker = reinterpret_cast<RingWorker *>(data);
+  DummyItem *batch[8];
+  while (true) {
+    unsigned n = worker->ring->PopFrontMany(batch, 8);
+    for (unsigned i = 0; i < n; ++i) {
+      if (batch[i]->tag_ < 0) {
+        // Hand the other quit items back to the other consumers
+        for (unsigned j = i + 1; j < n; ++j)
+          worker->ring->EnqueueBack(batch[j]);
+        return NULL;
+      }
+      worker->seen.push_back(batch[i]->tag_);
+    }
+  }
+}
+
+}  // anonymous namespace
+
+TEST_F(T_Tube, RingConcurrent) {
+  // Small ring so that producers and consumers block frequently
+  RingTube<DummyItem> ring(16);
+  std::vector<DummyItem> items(kNumRingItems);
+  for (unsigned i = 0; i < kNumRingItems; ++i)
+    items[i].tag_ = i;
+
+  RingWorker producers[kNumRingThreads];
+  RingWorker consumers[kNumRingThreads];
+  pthread_t threads_producer[kNumRingThreads];
+  pthread_t threads_consumer[kNumRingThreads];
+  for (unsigned i = 0; i < kNumRingThreads; ++i) {
+    producers[i].ring = consumers[i].ring = &ring;
+    producers[i].items = &items[0];
+    producers[i].offset = i;
+    ASSERT_EQ(0, pthread_create(&threads_consumer[i], NULL, MainRingConsumer,
+                                &consumers[i]));
+    ASSERT_EQ(0, pthread_create(&threads_producer[i], NULL, MainRingProducer,
+                                &producers[i]));
+  }
+  for (unsigned i = 0; i < kNumRingThreads; ++i)
+    pthread_join(threads_producer[i], NULL);
+  ring.Wait();
+
+  // Every consumer stops at its quit item
+  DummyItem quit[kNumRingThreads];
+  for (unsigned i = 0; i < kNumRingThreads; ++i)
+    ring.EnqueueBack(&quit[i]);
+  for (unsigned i = 0; i < kNumRingThreads; ++i)
+    pthread_join(threads_consumer[i], NULL);
+
+  std::vector<bool> found(kNumRingItems, false);
+  for (unsigned i = 0; i < kNumRingThreads; ++i) {
+    for (unsigned j = 0; j < consumers[i].seen.size(); ++j) {
+      EXPECT_FALSE(found[consumers[i].seen[j]]);
+      found[consumers[i].seen[j]] = true;
+    }
+  }
+  for (unsigned i = 0; i < kNumRingItems; ++i)
+    EXPECT_TRUE(found[i]);
+}
@@ -8,7 +8,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "atomic.h"
 #include "c_file_sandbox.h"
@@ -83,6 +86,11 @@ class T_Uploaders : public FileSandbox {
 
  public:
   static const unsigned kTotal429Replies;
+  static const unsigned kMultipartThreshold;
+  static const unsigned kMultipartPartSize;
+  static atomic_int32 gUploadId;
+  // Lets the mockup server refuse to copy objects
+  static bool gFailCopies;
   static const unsigned k429ThrottleSec;
   static atomic_int64 gSeed;
   struct StreamHandle {
@@ -110,6 +118,7 @@ class T_Uploaders : public FileSandbox {
     const bool success = MkdirDeep(T_Uploaders::dest_dir, 0700);
     ASSERT_TRUE(success) << "Failed to create uploader destination dir";
     repo_alias = "";
+    gFailCopies = false;
 
     SetUp(type<UploadersT>());
 
@@ -371,8 +380,16 @@ class T_Uploaders : public FileSandbox {
     int *n429 = static_cast<int *>(data);
 
     HTTPResponse response;
-    // strip bucket name
+    // strip bucket name and split off the query string of multipart requests
     std::string req_file = req.path.substr(req.path.find("/", 1) + 1);
+    std::string query;
+    const size_t pos_query = req_file.find('?');
+    if (pos_query != std::string::npos) {
+      query = req_file.substr(pos_query + 1);
+      req_file = req_file.substr(0, pos_query);
+    }
+    const std::string upload_id = GetQueryParam(query, "uploadId");
+    const std::string copy_source = GetHeader(req, "X-Amz-Copy-Source");
 
     if ((*n429 > 0) &&
         (req.path.size() >= 5) &&
@@ -381,6 +398,110 @@ class T_Uploaders : public FileSandbox {
       response.code = 429;
       response.reason = "Too Many Requests";
       response.AddHeader("Retry-After", "1");
+    } else if ((req.method == "GET") &&
+               (GetQueryParam(query, "list-type") == "2"))
+    {
+      response.body = ListMockupFiles(
+        ReplaceAll(GetQueryParam(query, "prefix"), "%2F", "/"),
+        GetQueryParam(query, "continuation-token"));
+    } else if ((req.method == "POST") && (query == "delete")) {
+      std::string keys = req.body;
+      size_t pos_key;
+      while ((pos_key = keys.find("<Key>")) != std::string::npos) {
+        keys = keys.substr(pos_key + 5);
+        const std::string path =
+          T_Uploaders::dest_dir + "/" + keys.substr(0, keys.find('<'));
+        if (FileExists(path)) {
+          int retval = remove(path.c_str());
+          assert(retval == 0);
+        }
+      }
+      response.body = "<DeleteResult></DeleteResult>";
+    } else if ((req.method == "POST") && (query == "uploads")) {
+      response.body =
+        "<InitiateMultipartUploadResult><Key>" + req_file + "</Key>"
+        "<UploadId>" + StringifyInt(atomic_xadd32(&gUploadId, 1)) +
+        "</UploadId></InitiateMultipartUploadResult>";
+    } else if ((req.method == "POST") && !upload_id.empty()) {
+      // Concatenate the parts in the order given by the completion request
+      std::string content;
+      std::string parts = req.body;
+      size_t pos_part;
+      while ((pos_part = parts.find("<PartNumber>")) != std::string::npos) {
+        parts = parts.substr(pos_part + 12);
+        const std::string part_number = parts.substr(0, parts.find('<'));
+        const std::string etag = "<ETag>\"" + part_number + "\"</ETag>";
+        if (parts.find(etag) == std::string::npos) {
+          response.code = 400;
+          response.reason = "Bad Request";
+          return response;
+        }
+        const std::string part_path =
+          MkPartPath(req_file, upload_id, part_number);
+        int fd = open(part_path.c_str(), O_RDONLY);
+        assert(fd >= 0);
+        std::string part;
+        assert(SafeReadToString(fd, &part));
+        close(fd);
+        unlink(part_path.c_str());
+        content += part;
+      }
+      WriteMockupFile(T_Uploaders::dest_dir + "/" + req_file, content);
+      response.body = "<CompleteMultipartUploadResult><Key>" + req_file +
+                      "</Key></CompleteMultipartUploadResult>";
+    } else if ((req.method == "PUT") && !upload_id.empty() &&
+               !copy_source.empty())
+    {
+      // Copies a byte range of the source object into a part
+      const std::string part_number = GetQueryParam(query, "partNumber");
+      const std::string range =
+        GetHeader(req, "X-Amz-Copy-Source-Range").substr(6);  // "bytes="
+      const uint64_t first = String2Uint64(range.substr(0, range.find('-')));
+      const uint64_t last = String2Uint64(range.substr(range.find('-') + 1));
+      const std::string src_path = T_Uploaders::dest_dir + "/" +
+        copy_source.substr(copy_source.find("/", 1) + 1);
+      int fd = open(src_path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        response.code = 404;
+        response.reason = "Not Found";
+        return response;
+      }
+      std::string content;
+      assert(SafeReadToString(fd, &content));
+      close(fd);
+      assert(last < content.size());
+      WriteMockupFile(MkPartPath(req_file, upload_id, part_number),
+                      content.substr(first, last - first + 1));
+      response.body = "<CopyPartResult><ETag>&quot;" + part_number +
+                      "&quot;</ETag></CopyPartResult>";
+    } else if ((req.method == "PUT") && !upload_id.empty()) {
+      const std::string part_number = GetQueryParam(query, "partNumber");
+      WriteMockupFile(MkPartPath(req_file, upload_id, part_number),
+                      req.body.substr(0, req.content_length));
+      response.AddHeader("ETag", "\"" + part_number + "\"");
+    } else if ((req.method == "PUT") && !copy_source.empty() &&
+               T_Uploaders::gFailCopies)
+    {
+      response.code = 403;
+      response.reason = "Forbidden";
+    } else if ((req.method == "PUT") && !copy_source.empty()) {
+      // strip bucket name
+      const std::string src_path = T_Uploaders::dest_dir + "/" +
+        copy_source.substr(copy_source.find("/", 1) + 1);
+      int fd = open(src_path.c_str(), O_RDONLY);
+      if (fd < 0) {
+        response.code = 404;
+        response.reason = "Not Found";
+        return response;
+      }
+      std::string content;
+      assert(SafeReadToString(fd, &content));
+      close(fd);
+      WriteMockupFile(T_Uploaders::dest_dir + "/" + req_file, content);
+      response.body = "<CopyObjectResult></CopyObjectResult>";
+    } else if ((req.method == "DELETE") && !upload_id.empty()) {
+      response.code = 204;
+      response.reason = "No Content";
     } else if (req.method == "PUT") {
       std::string path = T_Uploaders::dest_dir + "/" + req_file;
       FILE* file = fopen(path.c_str(), "w");
@@ -413,6 +534,80 @@ class T_Uploaders : public FileSandbox {
   }
 
 
+  /**
+   * Returns pages of two objects to exercise the continuation of listings
+   */
+  static std::string ListMockupFiles(const std::string &prefix,
+                                     const std::string &token)
+  {
+    std::vector<std::string> names;
+    std::vector<mode_t> modes;
+    ListDirectory(T_Uploaders::dest_dir + "/" + prefix, &names, &modes);
+    const unsigned begin = token.empty() ? 0 : String2Uint64(token);
+    const unsigned end = std::min(begin + 2, unsigned(names.size()));
+    const bool truncated = end < names.size();
+    std::string result = "<ListBucketResult><IsTruncated>" +
+                         std::string(truncated ? "true" : "false") +
+                         "</IsTruncated>";
+    if (truncated) {
+      result += "<NextContinuationToken>" + StringifyInt(end) +
+                "</NextContinuationToken>";
+    }
+    for (unsigned i = begin; i < end; ++i) {
+      result += "<Contents><Key>" + prefix + names[i] + "</Key>"
+        "<LastModified>2021-01-01T00:00:00.000Z</LastModified><Size>" +
+        StringifyInt(GetFileSize(T_Uploaders::dest_dir + "/" + prefix +
+                                 names[i])) +
+        "</Size></Contents>";
+    }
+    return result + "</ListBucketResult>";
+  }
+
+
+  static std::string GetQueryParam(const std::string &query,
+                                   const std::string &key)
+  {
+    std::vector<std::string> params = SplitString(query, '&');
+    for (unsigned i = 0; i < params.size(); ++i) {
+      if (HasPrefix(params[i], key + "=", false))
+        return params[i].substr(key.length() + 1);
+    }
+    return "";
+  }
+
+  static std::string GetHeader(const HTTPRequest &req, const std::string &key)
+  {
+    for (unsigned i = 0; i < req.headers.size(); ++i) {
+      if (req.headers[i].first == key)
+        return req.headers[i].second;
+    }
+    return "";
+  }
+
+  static std::string MkPartPath(const std::string &req_file,
+                                const std::string &upload_id,
+                                const std::string &part_number)
+  {
+    return T_Uploaders::dest_dir + "/" + req_file + ".part." + upload_id +
+           "." + part_number;
+  }
+
+  static void WriteMockupFile(const std::string &path,
+                              const std::string &content)
+  {
+    FILE* file = fopen(path.c_str(), "w");
+    assert(file != NULL);
+    FileGuard file_guard(file);
+    int fid = fileno(file);
+    assert(fid >= 0);
+    ssize_t bytes_written = write(fid, content.data(), content.length());
+    assert(bytes_written >= 0);
+    assert(content.length() == static_cast<size_t>(bytes_written));
+    int retval = fsync(fid);
+    assert(retval == 0);
+  }
+
+
   void CreateTempS3ConfigFile(int accounts, int parallel_connections) {
     ASSERT_GE(accounts, 1);
     ASSERT_GE(parallel_connections, 1);
@@ -438,6 +633,10 @@ class T_Uploaders : public FileSandbox {
         StringifyInt(parallel_connections) + "\n"
         "CVMFS_S3_HOST=127.0.0.1\n"
         "CVMFS_S3_DNS_BUCKETS=false\n"
+        "CVMFS_S3_MULTIPART_THRESHOLD=" + StringifyInt(kMultipartThreshold) +
+        "\n"
+        "CVMFS_S3_MULTIPART_PART_SIZE=" + StringifyInt(kMultipartPartSize) +
+        "\n"
         "CVMFS_S3_PORT=" + StringifyInt(CVMFS_S3_TEST_MOCKUP_SERVER_PORT);
 
     fprintf(s3_conf, "%s\n", conf_str.c_str());
@@ -505,6 +704,18 @@ atomic_int64 T_Uploaders<UploadersT>::gSeed = 0;
 template <class UploadersT>
 const unsigned T_Uploaders<UploadersT>::kTotal429Replies = 4;
 
+template <class UploadersT>
+const unsigned T_Uploaders<UploadersT>::kMultipartThreshold = 6 * 1024 * 1024;
+
+template <class UploadersT>
+const unsigned T_Uploaders<UploadersT>::kMultipartPartSize = 5 * 1024 * 1024;
+
+template <class UploadersT>
+atomic_int32 T_Uploaders<UploadersT>::gUploadId = 1;
+
+template <class UploadersT>
+bool T_Uploaders<UploadersT>::gFailCopies = false;
+
 template <class UploadersT>
 const unsigned T_Uploaders<UploadersT>::k429ThrottleSec = 1;
 
@@ -653,6 +864,58 @@ TYPED_TEST(T_Uploaders, PeekIntoStorage) {
 //------------------------------------------------------------------------------
 
 
+TYPED_TEST(T_Uploaders, PeekManyIntoStorage) {
+  const std::string small_file_path = TestFixture::GetSmallFile();
+  std::vector<std::string> dest_names;
+  dest_names.push_back("peek_many_1");
+  dest_names.push_back("peek_many_alien");
+  dest_names.push_back("peek_many_2");
+
+  for (unsigned i = 0; i < dest_names.size(); i += 2) {
+    this->uploader_->UploadFile(small_file_path, dest_names[i],
+                                AbstractUploader::MakeClosure(
+                                &UploadCallbacks::SimpleUploadClosure,
+                                &this->delegate_,
+                                UploaderResults(0, small_file_path)));
+  }
+  this->uploader_->WaitForUpload();
+  EXPECT_EQ(2, atomic_read32(&(this->delegate_.simple_upload_invocations)));
+
+  std::vector<bool> found;
+  this->uploader_->PeekMany(dest_names, &found);
+  ASSERT_EQ(3U, found.size());
+  EXPECT_TRUE(found[0]);
+  EXPECT_FALSE(found[1]);
+  EXPECT_TRUE(found[2]);
+
+  // The negative answer must not survive an upload of the missing object
+  this->uploader_->UploadFile(small_file_path, dest_names[1],
+                              AbstractUploader::MakeClosure(
+                              &UploadCallbacks::SimpleUploadClosure,
+                              &this->delegate_,
+                              UploaderResults(0, small_file_path)));
+  this->uploader_->WaitForUpload();
+  EXPECT_TRUE(TestFixture::CheckFile(dest_names[1]));
+  EXPECT_TRUE(this->uploader_->Peek(dest_names[1]));
+  this->uploader_->PeekMany(dest_names, &found);
+  EXPECT_TRUE(found[0]);
+  EXPECT_TRUE(found[1]);
+  EXPECT_TRUE(found[2]);
+
+  // Neither must the positive answer survive a removal
+  this->uploader_->RemoveAsync(dest_names[2]);
+  this->uploader_->WaitForUpload();
+  this->uploader_->PeekMany(dest_names, &found);
+  EXPECT_TRUE(found[0]);
+  EXPECT_TRUE(found[1]);
+  EXPECT_FALSE(found[2]);
+  EXPECT_EQ(0U, this->uploader_->GetNumberOfErrors());
+}
+
+
+//------------------------------------------------------------------------------
+
+
 TYPED_TEST(T_Uploaders, RemoveFromStorage) {
   const std::string small_file_path = TestFixture::GetSmallFile();
   const std::string dest_name       = "also_small_file";
@@ -688,6 +951,59 @@ TYPED_TEST(T_Uploaders, RemoveFromStorage) {
 //
 
 
+TYPED_TEST(T_Uploaders, ListAndRemoveManyFromStorage) {
+  const std::string small_file_path = TestFixture::GetSmallFile();
+  ASSERT_TRUE(
+    MkdirDeep(TestFixture::AbsoluteDestinationPath("data/ab"), 0755));
+
+  const unsigned kNumFiles = 5;
+  std::set<std::string> names;
+  for (unsigned i = 0; i < kNumFiles; ++i) {
+    const std::string name = "file" + StringifyInt(i);
+    names.insert(name);
+    this->uploader_->UploadFile(small_file_path, "data/ab/" + name);
+  }
+  this->uploader_->WaitForUpload();
+  EXPECT_EQ(0U, this->uploader_->GetNumberOfErrors());
+
+  std::vector<upload::ObjectInfo> objects;
+  EXPECT_TRUE(this->uploader_->ListObjects("data/ab", &objects));
+  ASSERT_EQ(kNumFiles, objects.size());
+  std::set<std::string> listed_names;
+  for (unsigned i = 0; i < objects.size(); ++i) {
+    listed_names.insert(objects[i].name);
+    EXPECT_EQ(static_cast<uint64_t>(GetFileSize(small_file_path)),
+              objects[i].size);
+    EXPECT_GT(objects[i].mtime, 0);
+  }
+  EXPECT_EQ(names, listed_names);
+
+  EXPECT_TRUE(this->uploader_->ListObjects("data/cd", &objects));
+  EXPECT_TRUE(objects.empty());
+
+  std::vector<std::string> to_delete;
+  to_delete.push_back("data/ab/file0");
+  to_delete.push_back("data/ab/file3");
+  to_delete.push_back("data/ab/file4");
+  this->uploader_->RemoveManyAsync(to_delete);
+  this->uploader_->WaitForUpload();
+  EXPECT_EQ(0U, this->uploader_->GetNumberOfErrors());
+
+  EXPECT_FALSE(TestFixture::CheckFile("data/ab/file0"));
+  EXPECT_TRUE(TestFixture::CheckFile("data/ab/file1"));
+  EXPECT_TRUE(TestFixture::CheckFile("data/ab/file2"));
+  EXPECT_FALSE(TestFixture::CheckFile("data/ab/file3"));
+  EXPECT_FALSE(TestFixture::CheckFile("data/ab/file4"));
+  EXPECT_TRUE(this->uploader_->ListObjects("data/ab", &objects));
+  EXPECT_EQ(2U, objects.size());
+}
+
+
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+//
+
+
 TYPED_TEST(T_Uploaders, UploadEmptyFile) {
   const std::string empty_file_path = TestFixture::GetEmptyFile();
   const std::string dest_name       = "empty_file";
@@ -846,6 +1162,188 @@ TYPED_TEST(T_Uploaders, SingleStreamedUpload) {
 //------------------------------------------------------------------------------
 
 
+TYPED_TEST(T_Uploaders, MultipartStreamedUpload) {
+  if (!TestFixture::IsS3()) {
+    SUCCEED();  // Only the S3 uploader splits large objects into parts
+    return;
+  }
+
+  // Well beyond the multipart threshold, spread over several parts
+  const int number_of_buffers = 80;
+  typename TestFixture::Buffers buffers =
+      TestFixture::MakeRandomizedBuffers(number_of_buffers, 4711);
+  uint64_t total_size = 0;
+  for (unsigned i = 0; i < buffers.size(); ++i)
+    total_size += buffers[i]->length();
+  ASSERT_GT(total_size, 2 * this->kMultipartThreshold);
+
+  UploadStreamHandle *handle = this->uploader_->InitStreamedUpload(
+      AbstractUploader::MakeClosure(&UploadCallbacks::StreamedUploadComplete,
+                                    &this->delegate_,
+                                    0));
+  ASSERT_NE(static_cast<UploadStreamHandle*>(NULL), handle);
+
+  typename TestFixture::Buffers::const_iterator i    = buffers.begin();
+  typename TestFixture::Buffers::const_iterator iend = buffers.end();
+  for (; i != iend; ++i) {
+    this->uploader_->ScheduleUpload(
+      handle,
+      AbstractUploader::UploadBuffer((*i)->length(),
+                                     const_cast<char *>((*i)->data())),
+      AbstractUploader::MakeClosure(
+        &UploadCallbacks::BufferUploadComplete,
+        &this->delegate_,
+        UploaderResults(UploaderResults::kBufferUpload, 0)));
+  }
+
+  shash::Any content_hash(shash::kSha1, 'A');
+  content_hash.Randomize(4711);
+  this->uploader_->ScheduleCommit(handle, content_hash);
+  this->uploader_->WaitForUpload();
+
+  EXPECT_EQ(number_of_buffers,
+    atomic_read32(&(this->delegate_.buffer_upload_complete_invocations)));
+  EXPECT_EQ(1,
+    atomic_read32(&(this->delegate_.streamed_upload_complete_invocations)));
+  EXPECT_EQ(0U, this->uploader_->GetNumberOfErrors());
+
+  const std::string dest = "data/" + content_hash.MakePath();
+  EXPECT_TRUE(TestFixture::CheckFile(dest));
+  TestFixture::CompareBuffersAndFileContents(
+      buffers,
+      TestFixture::AbsoluteDestinationPath(dest));
+
+  // The staging object and its parts must be cleaned up after the commit
+  std::vector<std::string> txn_files;
+  std::vector<mode_t> txn_modes;
+  ListDirectory(TestFixture::AbsoluteDestinationPath("data/txn"),
+                &txn_files, &txn_modes);
+  EXPECT_TRUE(txn_files.empty());
+
+  TestFixture::FreeBuffers(&buffers);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+TYPED_TEST(T_Uploaders, MultipartCopy) {
+  if (!TestFixture::IsS3()) {
+    SUCCEED();  // Only the S3 uploader stages streamed objects
+    return;
+  }
+
+  // Pretend that the staged object is too large for a single copy request
+  upload::S3Uploader *s3uploader =
+    static_cast<upload::S3Uploader *>(this->uploader_);
+  s3uploader->SetCopyLimits(this->kMultipartThreshold,
+                            this->kMultipartPartSize);
+
+  const int number_of_buffers = 80;
+  typename TestFixture::Buffers buffers =
+      TestFixture::MakeRandomizedBuffers(number_of_buffers, 1337);
+  uint64_t total_size = 0;
+  for (unsigned i = 0; i < buffers.size(); ++i)
+    total_size += buffers[i]->length();
+  // Several part copies, the last one is shorter
+  ASSERT_GT(total_size, 2 * this->kMultipartPartSize);
+  ASSERT_NE(0U, total_size % this->kMultipartPartSize);
+
+  UploadStreamHandle *handle = this->uploader_->InitStreamedUpload(
+      AbstractUploader::MakeClosure(&UploadCallbacks::StreamedUploadComplete,
+                                    &this->delegate_,
+                                    0));
+  ASSERT_NE(static_cast<UploadStreamHandle*>(NULL), handle);
+  for (unsigned i = 0; i < buffers.size(); ++i) {
+    this->uploader_->ScheduleUpload(
+      handle,
+      AbstractUploader::UploadBuffer(buffers[i]->length(),
+                                     const_cast<char *>(buffers[i]->data())),
+      AbstractUploader::MakeClosure(
+        &UploadCallbacks::BufferUploadComplete,
+        &this->delegate_,
+        UploaderResults(UploaderResults::kBufferUpload, 0)));
+  }
+
+  shash::Any content_hash(shash::kSha1, 'A');
+  content_hash.Randomize(1337);
+  this->uploader_->ScheduleCommit(handle, content_hash);
+  this->uploader_->WaitForUpload();
+
+  EXPECT_EQ(1,
+    atomic_read32(&(this->delegate_.streamed_upload_complete_invocations)));
+  EXPECT_EQ(0U, this->uploader_->GetNumberOfErrors());
+
+  const std::string dest = "data/" + content_hash.MakePath();
+  EXPECT_TRUE(TestFixture::CheckFile(dest));
+  TestFixture::CompareBuffersAndFileContents(
+      buffers,
+      TestFixture::AbsoluteDestinationPath(dest));
+
+  std::vector<std::string> txn_files;
+  std::vector<mode_t> txn_modes;
+  ListDirectory(TestFixture::AbsoluteDestinationPath("data/txn"),
+                &txn_files, &txn_modes);
+  EXPECT_TRUE(txn_files.empty());
+
+  TestFixture::FreeBuffers(&buffers);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+TYPED_TEST(T_Uploaders, MultipartCopyFailure) {
+  if (!TestFixture::IsS3()) {
+    SUCCEED();  // Only the S3 uploader stages streamed objects
+    return;
+  }
+
+  this->gFailCopies = true;
+  const int number_of_buffers = 80;
+  typename TestFixture::Buffers buffers =
+      TestFixture::MakeRandomizedBuffers(number_of_buffers, 42);
+
+  UploadStreamHandle *handle = this->uploader_->InitStreamedUpload(
+      AbstractUploader::MakeClosure(&UploadCallbacks::StreamedUploadComplete,
+                                    &this->delegate_,
+                                    99));
+  ASSERT_NE(static_cast<UploadStreamHandle*>(NULL), handle);
+  for (unsigned i = 0; i < buffers.size(); ++i) {
+    this->uploader_->ScheduleUpload(
+      handle,
+      AbstractUploader::UploadBuffer(buffers[i]->length(),
+                                     const_cast<char *>(buffers[i]->data())),
+      AbstractUploader::MakeClosure(
+        &UploadCallbacks::BufferUploadComplete,
+        &this->delegate_,
+        UploaderResults(UploaderResults::kBufferUpload, 0)));
+  }
+
+  shash::Any content_hash(shash::kSha1, 'A');
+  content_hash.Randomize(42);
+  this->uploader_->ScheduleCommit(handle, content_hash);
+  this->uploader_->WaitForUpload();
+
+  EXPECT_EQ(1,
+    atomic_read32(&(this->delegate_.streamed_upload_complete_invocations)));
+  EXPECT_GT(this->uploader_->GetNumberOfErrors(), 0U);
+  EXPECT_FALSE(TestFixture::CheckFile("data/" + content_hash.MakePath()));
+
+  // The staged object is removed although it never reached its final key
+  std::vector<std::string> txn_files;
+  std::vector<mode_t> txn_modes;
+  ListDirectory(TestFixture::AbsoluteDestinationPath("data/txn"),
+                &txn_files, &txn_modes);
+  EXPECT_TRUE(txn_files.empty());
+
+  TestFixture::FreeBuffers(&buffers);
+}
+
+
+//------------------------------------------------------------------------------
+
+
 TYPED_TEST(T_Uploaders, MultipleStreamedUploadSlow) {
   const int  number_of_files        = 100;
   const int  max_buffers_per_stream = 15;
@@ -964,4 +1462,22 @@ TYPED_TEST(T_Uploaders, PlaceBootstrappingShortcut) {
                                        digest.MakeAlternativePath()));
 }
 
+
+TEST(T_ObjectPresenceCache, RemovalOvertakesAnswer) {
+  ObjectPresenceCache cache;
+  const std::string path = "data/ab/cdef";
+
+  // The object is removed while the backend answers the existence check
+  uint64_t generation = cache.generation();
+  cache.Forget(path);
+  cache.InsertAnswer(path, kPresent, generation);
+  EXPECT_EQ(kPresenceUnknown, cache.Lookup(path));
+
+  generation = cache.generation();
+  cache.InsertAnswer(path, kPresent, generation);
+  EXPECT_EQ(kPresent, cache.Lookup(path));
+  cache.Forget(path);
+  EXPECT_EQ(kPresenceUnknown, cache.Lookup(path));
+}
+
 }  // namespace upload